@@ -0,0 +1,232 @@
+/**
+ * NeuroPipe payload allocator benchmark
+ *
+ * Compares std::string with Payload (slab_alloc.hpp) on message-body
+ * workloads with mixed sizes: short metric=value strings, 100-300 byte log
+ * lines and a few large stack traces.
+ *
+ *   ingest    - one thread keeps a window of live bodies and replaces the
+ *               oldest with a new one (the topic and session queues)
+ *   handoff   - a producer thread allocates, a consumer thread frees (the
+ *               publishing thread and the writing thread differ)
+ *   footprint - a large working set churned while its size mix drifts;
+ *               reports resident memory per live byte, measured in a forked
+ *               child per allocator so neither sees the other's heap
+ *
+ * Usage: np_alloc_bench [operations] [repetitions]
+ */
+
+#include "bench_harness.hpp"
+#include "../include/slab_alloc.hpp"
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// Body sizes in the proportions a broker sees; `drift` shifts the mix
+// towards log lines and traces as the footprint run goes on
+std::vector<size_t> mixed_sizes(size_t count, uint32_t seed, double drift = 0.0) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> band(0.0, 1.0);
+    std::vector<size_t> sizes(count);
+    for (size_t i = 0; i < count; ++i) {
+        double shift = drift * i / count;
+        double pick = band(rng);
+        if (pick < 0.40 - 0.3 * shift) {
+            sizes[i] = std::uniform_int_distribution<size_t>(8, 24)(rng);       // metric=value
+        } else if (pick < 0.95 - 0.1 * shift) {
+            sizes[i] = std::uniform_int_distribution<size_t>(100, 300)(rng);    // DebugLogger line
+        } else {
+            sizes[i] = std::uniform_int_distribution<size_t>(400, 2000)(rng);   // Stack trace
+        }
+    }
+    return sizes;
+}
+
+template <typename Body>
+void bench_ingest(BenchHarness& harness, const char* name, uint64_t operations,
+                  const std::vector<size_t>& sizes, const std::string& text) {
+    const size_t window = 4096;
+    std::vector<Body> live(window);
+    harness.run(name, operations, [&] {
+        for (uint64_t i = 0; i < operations; ++i) {
+            size_t size = sizes[i % sizes.size()];
+            live[i % window] = Body(std::string_view(text.data(), size));
+        }
+        do_not_optimize(live[0]);
+    });
+}
+
+// Single-producer single-consumer ring of bodies
+template <typename Body>
+class Handoff {
+public:
+    static constexpr size_t SLOTS = 1024;
+
+    void push(Body body) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        while (tail - head_.load(std::memory_order_acquire) == SLOTS) {
+            std::this_thread::yield();
+        }
+        slots_[tail % SLOTS] = std::move(body);
+        tail_.store(tail + 1, std::memory_order_release);
+    }
+
+    Body pop() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        while (tail_.load(std::memory_order_acquire) == head) {
+            std::this_thread::yield();
+        }
+        Body body = std::move(slots_[head % SLOTS]);
+        head_.store(head + 1, std::memory_order_release);
+        return body;
+    }
+
+private:
+    Body slots_[SLOTS];
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+template <typename Body>
+void bench_handoff(BenchHarness& harness, const char* name, uint64_t operations,
+                   const std::vector<size_t>& sizes, const std::string& text) {
+    auto ring = std::make_unique<Handoff<Body>>();
+    harness.run(name, operations, [&] {
+        std::thread consumer([&] {
+            size_t bytes = 0;
+            for (uint64_t i = 0; i < operations; ++i) {
+                bytes += ring->pop().size();
+            }
+            do_not_optimize(bytes);
+        });
+        for (uint64_t i = 0; i < operations; ++i) {
+            ring->push(Body(std::string_view(text.data(), sizes[i % sizes.size()])));
+        }
+        consumer.join();
+    });
+}
+
+size_t resident_bytes() {
+    long pages = 0;
+    long resident = 0;
+    if (FILE* statm = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        std::fclose(statm);
+    }
+    return static_cast<size_t>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+struct Footprint {
+    double seconds = 0.0;
+    size_t live_bytes = 0;       // Body bytes held at the end
+    size_t resident_growth = 0;  // RSS added by the run
+};
+
+template <typename Body>
+Footprint churn(size_t working_set, uint64_t operations, const std::string& text) {
+    std::vector<size_t> fill = mixed_sizes(working_set, 11);
+    std::vector<size_t> replacements = mixed_sizes(operations, 12, 1.0);
+    std::mt19937 rng(13);
+    std::uniform_int_distribution<size_t> victim(0, working_set - 1);
+
+    size_t resident_before = resident_bytes();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Body> live;
+    live.reserve(working_set);
+    for (size_t size : fill) {
+        live.emplace_back(std::string_view(text.data(), size));
+    }
+    for (size_t size : replacements) {
+        live[victim(rng)] = Body(std::string_view(text.data(), size));
+    }
+    Footprint result;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (const Body& body : live) {
+        result.live_bytes += body.size();
+    }
+    size_t resident_after = resident_bytes();
+    result.resident_growth = resident_after > resident_before ? resident_after - resident_before : 0;
+    return result;
+}
+
+// Run churn<Body> in a child process so each allocator starts from a fresh heap
+template <typename Body>
+bool measure_footprint(const char* name, size_t working_set, uint64_t operations, const std::string& text) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    pid_t child = fork();
+    if (child < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (child == 0) {
+        close(fds[0]);
+        Footprint result = churn<Body>(working_set, operations, text);
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? 0 : 1);
+    }
+    close(fds[1]);
+    Footprint result;
+    bool ok = read(fds[0], &result, sizeof(result)) == sizeof(result);
+    close(fds[0]);
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!ok) {
+        return false;
+    }
+    std::printf("%-36s %8.1f MB live %8.1f MB resident %6.2fx overhead %10.0f ops/s\n", name,
+                result.live_bytes / 1e6, result.resident_growth / 1e6,
+                result.live_bytes ? static_cast<double>(result.resident_growth) / result.live_bytes : 0.0,
+                (working_set + operations) / result.seconds);
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    uint64_t operations = 1000000;
+    int repetitions = 5;
+    if (argc >= 2) {
+        operations = std::stoull(argv[1]);
+    }
+    if (argc >= 3) {
+        repetitions = std::stoi(argv[2]);
+    }
+
+    const std::string text(slab::MAX_BLOCK, 'x');
+    const std::vector<size_t> sizes = mixed_sizes(1 << 16, 7);
+
+    std::cout << "=== NeuroPipe Payload Allocator Benchmark (" << operations << " operations x "
+              << repetitions << " repetitions) ===" << std::endl;
+    BenchHarness harness(repetitions);
+    bench_ingest<std::string>(harness, "ingest/std_string", operations, sizes, text);
+    bench_ingest<Payload>(harness, "ingest/slab_payload", operations, sizes, text);
+    bench_handoff<std::string>(harness, "handoff/std_string", operations, sizes, text);
+    bench_handoff<Payload>(harness, "handoff/slab_payload", operations, sizes, text);
+
+    slab::Stats stats = slab::stats();
+    std::cout << "slab: " << stats.slabs << " slabs, " << stats.remote_frees << " remote frees in "
+              << stats.remote_batches << " hand-overs" << std::endl;
+
+    const size_t working_set = 200000;
+    bool ok = measure_footprint<std::string>("footprint/std_string", working_set, operations * 2, text) &&
+              measure_footprint<Payload>("footprint/slab_payload", working_set, operations * 2, text);
+    if (!ok) {
+        std::cerr << "[bench] footprint run failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
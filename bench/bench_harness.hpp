@@ -0,0 +1,195 @@
+#pragma once
+#include "perf_counters.hpp"
+#include "../src/alloc_accounting.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Keep a value alive so the optimizer cannot drop the work producing it
+template <typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Result of one benchmark scenario: wall-clock time plus perf counters
+struct ScenarioResult {
+    std::string name;
+    uint64_t operations = 0;
+    double seconds = 0.0;
+    PerfCounters::Sample counters;
+    alloc_accounting::Snapshot allocations;  // Zero unless built with NEUROPIPE_ALLOC_ACCOUNTING
+    std::vector<double> samples_ns_per_op;    // One entry per timed repetition
+
+    double ops_per_second() const { return seconds > 0 ? operations / seconds : 0.0; }
+    double ns_per_op() const { return operations ? seconds * 1e9 / operations : 0.0; }
+
+    double median_ns_per_op() const {
+        if (samples_ns_per_op.empty()) {
+            return ns_per_op();
+        }
+        std::vector<double> sorted = samples_ns_per_op;
+        std::sort(sorted.begin(), sorted.end());
+        size_t mid = sorted.size() / 2;
+        return sorted.size() % 2 ? sorted[mid] : (sorted[mid - 1] + sorted[mid]) / 2;
+    }
+
+    // Fastest repetition: the least noise-sensitive estimate on a busy machine
+    double min_ns_per_op() const {
+        if (samples_ns_per_op.empty()) {
+            return ns_per_op();
+        }
+        return *std::min_element(samples_ns_per_op.begin(), samples_ns_per_op.end());
+    }
+
+    // Half-width of the 95% confidence interval of the mean ns/op across
+    // repetitions (Student's t); zero with fewer than two repetitions
+    double ci95_ns_per_op() const {
+        size_t n = samples_ns_per_op.size();
+        if (n < 2) {
+            return 0.0;
+        }
+        double mean = 0.0;
+        for (double sample : samples_ns_per_op) {
+            mean += sample;
+        }
+        mean /= n;
+        double variance = 0.0;
+        for (double sample : samples_ns_per_op) {
+            variance += (sample - mean) * (sample - mean);
+        }
+        variance /= (n - 1);
+        return student_t95(n - 1) * std::sqrt(variance / n);
+    }
+
+    static double student_t95(size_t degrees_of_freedom) {
+        static const double TABLE[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                       2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086};
+        if (degrees_of_freedom == 0) {
+            return 0.0;
+        }
+        return degrees_of_freedom <= 20 ? TABLE[degrees_of_freedom - 1] : 1.96;
+    }
+
+    // Counter value per operation (negative when the counter is unavailable)
+    double per_op(PerfCounters::Counter counter) const {
+        if (!counters.has(counter) || operations == 0) {
+            return -1.0;
+        }
+        return static_cast<double>(counters.get(counter)) / operations;
+    }
+
+    double allocations_per_op() const {
+        return operations ? static_cast<double>(allocations.total().allocations) / operations : 0.0;
+    }
+
+    // Instructions per cycle (negative when unavailable)
+    double ipc() const {
+        if (!counters.has(PerfCounters::CYCLES) || !counters.has(PerfCounters::INSTRUCTIONS) ||
+            counters.get(PerfCounters::CYCLES) == 0) {
+            return -1.0;
+        }
+        return static_cast<double>(counters.get(PerfCounters::INSTRUCTIONS)) /
+               counters.get(PerfCounters::CYCLES);
+    }
+};
+
+/**
+ * Runs benchmark scenarios with perf counters around each one.
+ *
+ * With more than one repetition the body runs once untimed to warm caches
+ * and allocators, then `repetitions` timed times; ns/op is reported as the
+ * mean with a 95% confidence interval.
+ *
+ * Usage:
+ *   BenchHarness harness(5);
+ *   harness.run("publish", 100000, [&] { for (...) topics.publish(...); });
+ */
+class BenchHarness {
+public:
+    explicit BenchHarness(int repetitions = 1) : repetitions_(std::max(1, repetitions)) {
+        if (!counters_.available()) {
+            std::cerr << "[bench] perf counters " << counters_.unavailable_reason()
+                      << " - reporting wall-clock only" << std::endl;
+        } else if (!counters_.unavailable_reason().empty()) {
+            std::cerr << "[bench] perf counters partially " << counters_.unavailable_reason() << std::endl;
+        }
+        if (counters_.available() && !counters_.counts_kernel()) {
+            std::cerr << "[bench] perf counters exclude kernel time (perf_event_paranoid)" << std::endl;
+        }
+    }
+
+    // Run body once per repetition; each call must perform `operations` operations
+    ScenarioResult run(const std::string& name, uint64_t operations, const std::function<void()>& body) {
+        ScenarioResult result;
+        result.name = name;
+        result.operations = operations * repetitions_;
+
+        if (repetitions_ > 1) {
+            body();
+        }
+
+        alloc_accounting::Snapshot allocs_before = alloc_accounting::snapshot();
+        counters_.start();
+        for (int i = 0; i < repetitions_; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            body();
+            auto end = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(end - start).count();
+            result.seconds += seconds;
+            if (operations) {
+                result.samples_ns_per_op.push_back(seconds * 1e9 / operations);
+            }
+        }
+        result.counters = counters_.stop();
+        result.allocations = alloc_accounting::snapshot() - allocs_before;
+
+        print(result);
+        results_.push_back(result);
+        return result;
+    }
+
+    const std::vector<ScenarioResult>& results() const { return results_; }
+    PerfCounters& counters() { return counters_; }
+    int repetitions() const { return repetitions_; }
+
+    static void print(const ScenarioResult& result) {
+        char line[512];
+        int n = std::snprintf(line, sizeof(line), "%-36s %10llu ops %8.3fs %12.0f ops/s %10.1f ns/op",
+                              result.name.c_str(), static_cast<unsigned long long>(result.operations),
+                              result.seconds, result.ops_per_second(), result.ns_per_op());
+        if (result.samples_ns_per_op.size() > 1 && n >= 0 && static_cast<size_t>(n) < sizeof(line)) {
+            n += std::snprintf(line + n, sizeof(line) - n, " +/- %.1f (95%% CI, n=%zu)",
+                               result.ci95_ns_per_op(), result.samples_ns_per_op.size());
+        }
+        if (result.ipc() >= 0 || result.per_op(PerfCounters::CONTEXT_SWITCHES) >= 0) {
+            n += std::snprintf(line + n, sizeof(line) - n, " |");
+            append_counter(line, n, sizeof(line), " cyc/op %.0f", result.per_op(PerfCounters::CYCLES));
+            append_counter(line, n, sizeof(line), " ins/op %.0f", result.per_op(PerfCounters::INSTRUCTIONS));
+            append_counter(line, n, sizeof(line), " IPC %.2f", result.ipc());
+            append_counter(line, n, sizeof(line), " LLC-miss/op %.3f", result.per_op(PerfCounters::CACHE_MISSES));
+            append_counter(line, n, sizeof(line), " br-miss/op %.3f", result.per_op(PerfCounters::BRANCH_MISSES));
+            append_counter(line, n, sizeof(line), " cs/op %.4f", result.per_op(PerfCounters::CONTEXT_SWITCHES));
+            append_counter(line, n, sizeof(line), " sys/op %.3f", result.per_op(PerfCounters::SYSCALLS));
+        }
+        if (alloc_accounting::ENABLED && n >= 0 && static_cast<size_t>(n) < sizeof(line)) {
+            std::snprintf(line + n, sizeof(line) - n, " | alloc/op %.2f", result.allocations_per_op());
+        }
+        std::cout << line << std::endl;
+    }
+
+private:
+    static void append_counter(char* line, int& n, size_t size, const char* format, double value) {
+        if (value >= 0 && n >= 0 && static_cast<size_t>(n) < size) {
+            n += std::snprintf(line + n, size - n, format, value);
+        }
+    }
+
+    PerfCounters counters_;
+    int repetitions_;
+    std::vector<ScenarioResult> results_;
+};
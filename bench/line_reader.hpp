@@ -0,0 +1,48 @@
+#pragma once
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Buffered line reader over a blocking stream socket (TCP or Unix domain)
+template <typename Socket>
+class LineReader {
+public:
+    explicit LineReader(Socket& socket) : socket_(socket), buffer_(65536) {}
+
+    bool next(std::string_view& line) {
+        while (true) {
+            const char* newline = static_cast<const char*>(
+                std::memchr(buffer_.data() + begin_, '\n', end_ - begin_));
+            if (newline) {
+                size_t length = newline - (buffer_.data() + begin_);
+                line = std::string_view(buffer_.data() + begin_, length);
+                begin_ += length + 1;
+                return true;
+            }
+            // Compact, grow if one line fills the buffer, then read more
+            if (begin_ > 0) {
+                std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+                end_ -= begin_;
+                begin_ = 0;
+            }
+            if (end_ == buffer_.size()) {
+                buffer_.resize(buffer_.size() * 2);
+            }
+            std::error_code ec;
+            size_t n = socket_.read_some(asio::buffer(buffer_.data() + end_, buffer_.size() - end_), ec);
+            if (ec) {
+                return false;
+            }
+            end_ += n;
+        }
+    }
+
+private:
+    Socket& socket_;
+    std::vector<char> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include "../src/asio_server.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Sessions backed by loopback TCP pairs. The broker is never started; an
+// io_context thread completes Session writes and one thread per client end
+// reads and discards everything the broker sends.
+class LoopbackSessions {
+public:
+    LoopbackSessions()
+        : broker_(broker_io_, 0),
+          work_(asio::make_work_guard(io_)),
+          runner_([this] { io_.run(); }) {}
+
+    ~LoopbackSessions() {
+        for (auto& client : clients_) {
+            ::shutdown(client->native_handle(), SHUT_RDWR);
+        }
+        for (auto& drain : drains_) {
+            drain.join();
+        }
+        work_.reset();
+        io_.stop();
+        runner_.join();
+        sessions_.clear();
+    }
+
+    std::shared_ptr<Session> create() {
+        asio::ip::tcp::acceptor acceptor(io_, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+        auto client = std::make_unique<asio::ip::tcp::socket>(io_);
+        client->connect(acceptor.local_endpoint());
+        asio::ip::tcp::socket server(io_);
+        acceptor.accept(server);
+
+        auto session = std::make_shared<Session>(std::move(server), broker_);
+        int fd = client->native_handle();
+        drains_.emplace_back([this, fd] {
+            char buffer[65536];
+            ssize_t n;
+            while ((n = ::read(fd, buffer, sizeof(buffer))) > 0) {
+                drained_bytes_.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+            }
+        });
+        clients_.push_back(std::move(client));
+        sessions_.push_back(session);
+        return session;
+    }
+
+    // Wait until queued writes have reached the client ends, so one
+    // scenario's backlog does not run during the next one
+    void settle() {
+        uint64_t last = drained_bytes_.load();
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            uint64_t now = drained_bytes_.load();
+            if (now == last) {
+                return;
+            }
+            last = now;
+        }
+    }
+
+    BrokerServer& broker() { return broker_; }
+
+private:
+    asio::io_context broker_io_;
+    BrokerServer broker_;
+    asio::io_context io_;
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    std::thread runner_;
+    std::vector<std::unique_ptr<asio::ip::tcp::socket>> clients_;
+    std::vector<std::thread> drains_;
+    std::vector<std::shared_ptr<Session>> sessions_;
+    std::atomic<uint64_t> drained_bytes_{0};
+};
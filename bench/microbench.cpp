@@ -0,0 +1,238 @@
+/**
+ * NeuroPipe in-process microbenchmarks
+ *
+ * Drives broker components directly (no client protocol round trips) and
+ * reports wall-clock throughput plus perf counters per operation, so
+ * cache-layout and parser changes can be judged on IPC and misses. Each
+ * scenario is repeated and ns/op is reported with a 95% confidence interval.
+ *
+ * Sessions run on loopback socket pairs whose client ends are drained and
+ * discarded, so Session::process_message and the write path execute
+ * unmodified without a real client.
+ */
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include "bench_harness.hpp"
+#include "loopback_sessions.hpp"
+#include "../src/asio_server.hpp"
+#include "../src/utils.hpp"
+#include "../include/lz_codec.hpp"
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int CONTENDING_THREADS = 4;
+
+// Run body(thread_index, operations_per_thread) on `threads` threads at once
+template <typename Body>
+void run_contended(int threads, uint64_t operations, Body body) {
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            body(t, operations / threads);
+        });
+    }
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void bench_session(BenchHarness& harness, uint64_t iterations) {
+    LoopbackSessions network;
+    auto session = network.create();
+    const std::string publish_line = "PUBLISH:bench_topic:" + std::string(200, 'x');
+
+    harness.run("session/process_message_publish", iterations, [&] {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            session->process_message(publish_line);
+        }
+    });
+    network.settle();
+
+    harness.run("session/process_message_invalid", iterations, [&] {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            session->process_message("BOGUS:command");
+        }
+    });
+    network.settle();
+
+    // One operation = SUBSCRIBE plus UNSUBSCRIBE
+    harness.run("session/process_message_sub_unsub", iterations, [&] {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            session->process_message("SUBSCRIBE:bench_topic");
+            session->process_message("UNSUBSCRIBE:bench_topic");
+        }
+    });
+    network.settle();
+}
+
+void bench_topic_manager(BenchHarness& harness, uint64_t iterations) {
+    const std::string payload(200, 'x');
+
+    {
+        TopicManager topics;
+        harness.run("topic_manager/publish_no_subscribers", iterations, [&] {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                topics.publish("bench_topic", payload);
+            }
+        });
+    }
+
+    {
+        TopicManager topics;
+        harness.run("topic_manager/get_subscribers_miss", iterations, [&] {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                do_not_optimize(topics.get_subscribers("missing_topic"));
+            }
+        });
+    }
+
+    {
+        LoopbackSessions network;
+        TopicManager topics;
+        for (int i = 0; i < 4; ++i) {
+            topics.subscribe("bench_topic", network.create());
+        }
+        const std::string small_payload(64, 'x');
+        uint64_t fanout_iterations = iterations / 4;
+        harness.run("topic_manager/publish_fanout_4", fanout_iterations, [&] {
+            for (uint64_t i = 0; i < fanout_iterations; ++i) {
+                topics.publish("bench_topic", small_payload);
+            }
+        });
+        network.settle();
+    }
+
+    {
+        // unsubscribe_all walks every topic, so give it some to walk
+        LoopbackSessions network;
+        TopicManager topics;
+        auto bystander = network.create();
+        for (int i = 0; i < 64; ++i) {
+            topics.subscribe("topic_" + std::to_string(i), bystander);
+        }
+        auto session = network.create();
+        harness.run("topic_manager/unsubscribe_all_64", iterations, [&] {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                topics.subscribe("topic_7", session);
+                topics.unsubscribe_all(session);
+            }
+        });
+    }
+
+    {
+        TopicManager topics;
+        harness.run("topic_manager/publish_contended_4t", iterations, [&] {
+            run_contended(CONTENDING_THREADS, iterations, [&](int t, uint64_t operations) {
+                const std::string topic = "bench_topic_" + std::to_string(t);
+                for (uint64_t i = 0; i < operations; ++i) {
+                    topics.publish(topic, payload);
+                }
+            });
+        });
+    }
+}
+
+void bench_thread_safe_queue(BenchHarness& harness, uint64_t iterations) {
+    const std::string item(128, 'q');
+
+    {
+        ThreadSafeQueue<std::string> queue;
+        harness.run("thread_safe_queue/push_pop", iterations, [&] {
+            std::string out;
+            for (uint64_t i = 0; i < iterations; ++i) {
+                queue.push(item);
+                queue.try_pop(out);
+            }
+            do_not_optimize(out);
+        });
+    }
+
+    {
+        // Producers push while one consumer blocks in wait_and_pop
+        ThreadSafeQueue<std::string> queue;
+        uint64_t per_producer = iterations / CONTENDING_THREADS;
+        harness.run("thread_safe_queue/mpsc_contended_4p", per_producer * CONTENDING_THREADS, [&] {
+            std::thread consumer([&] {
+                std::string out;
+                for (uint64_t i = 0; i < per_producer * CONTENDING_THREADS; ++i) {
+                    queue.wait_and_pop(out);
+                }
+                do_not_optimize(out);
+            });
+            run_contended(CONTENDING_THREADS, per_producer * CONTENDING_THREADS, [&](int, uint64_t operations) {
+                for (uint64_t i = 0; i < operations; ++i) {
+                    queue.push(item);
+                }
+            });
+            consumer.join();
+        });
+    }
+}
+
+void bench_lz_codec(BenchHarness& harness, uint64_t iterations) {
+    // One DebugLogger-style batch (~16KB) per operation
+    std::string batch;
+    for (int i = 0; batch.size() < 16 * 1024; ++i) {
+        batch += "PUBLISH:debug:[12:00:" + std::to_string(10 + i % 50) + ".123] [INFO] order_service: "
+                 "Processed order " + std::to_string(100000 + i * 7) + " for user " +
+                 std::to_string(i * 31 % 1000) + "\n";
+    }
+    uint64_t batches = std::max<uint64_t>(1, iterations / 100);
+
+    std::string frame;
+    harness.run("lz_codec/encode_batch_16k", batches, [&] {
+        for (uint64_t i = 0; i < batches; ++i) {
+            lz_codec::encode_batch(batch, frame);
+        }
+        do_not_optimize(frame);
+    });
+
+    std::string block;
+    lz_codec::compress(batch, block);
+    std::string out;
+    harness.run("lz_codec/decompress_16k", batches, [&] {
+        for (uint64_t i = 0; i < batches; ++i) {
+            out.clear();
+            lz_codec::decompress(block, batch.size(), out);
+        }
+        do_not_optimize(out);
+    });
+    std::cout << "  lz_codec ratio: " << batch.size() << " -> " << frame.size() << " bytes ("
+              << (100.0 * frame.size() / batch.size()) << "%)" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    uint64_t iterations = 200000;
+    int repetitions = 5;
+    if (argc >= 2) {
+        iterations = std::stoull(argv[1]);
+    }
+    if (argc >= 3) {
+        repetitions = std::stoi(argv[2]);
+    }
+
+    // Per-message logging would dominate every scenario
+    set_log_level(LogLevel::Warn);
+
+    std::cout << "=== NeuroPipe Microbenchmarks (" << iterations << " iterations x "
+              << repetitions << " repetitions) ===" << std::endl;
+    BenchHarness harness(repetitions);
+    bench_session(harness, iterations);
+    bench_topic_manager(harness, iterations);
+    bench_thread_safe_queue(harness, iterations);
+    bench_lz_codec(harness, iterations);
+    return 0;
+}
@@ -0,0 +1,525 @@
+/**
+ * np_bench - NeuroPipe load generator
+ *
+ * Spawns publisher and subscriber connections over loopback against a
+ * running broker (Asio `broker` or `broker_legacy`) and sweeps transport
+ * (TCP or the broker's Unix domain socket), topic count, payload size,
+ * fan-out and ack mode. Publishers run closed-loop (as fast as
+ * the connection allows) or open-loop at a fixed aggregate rate; open-loop
+ * latency is measured from the scheduled send time so stalls are not hidden
+ * (no coordinated omission).
+ *
+ * Reports msgs/s, MB/s and p50/p99/p99.9/max end-to-end latency as text and,
+ * with --json, as machine-readable JSON.
+ */
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include "bench_harness.hpp"
+#include "line_reader.hpp"
+#include "../include/latency_trace.hpp"
+#include "../src/latency_histogram.hpp"
+#include "../src/stream_transport.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+
+namespace {
+
+struct BenchConfig {
+    std::string host = "127.0.0.1";
+    std::string port = "9092";
+    std::string unix_path = transport::DEFAULT_UNIX_PATH;
+    bool legacy = false;                 // broker_legacy: no SUBSCRIBE/acks, broadcast to all
+    std::vector<int> transports = {0};   // 0 = TCP, 1 = Unix domain socket
+    int publishers = 1;
+    std::vector<int> topic_counts = {1};
+    std::vector<int> payload_sizes = {128};
+    std::vector<int> fanouts = {1};      // Subscriber connections, each subscribed to every topic
+    std::vector<int> ack_modes = {0};    // 0 = fire-and-forget, 1 = wait for OK:PUBLISHED
+    double rate = 0.0;                   // Aggregate msgs/s; 0 = closed loop
+    double duration_s = 5.0;
+    double warmup_s = 1.0;
+    std::string json_path;
+    int broker_pid = 0;                  // Attach perf counters to the broker process
+};
+
+struct Scenario {
+    bool unix_socket;
+    int topics;
+    int payload;
+    int fanout;
+    bool ack;
+};
+
+struct ScenarioStats {
+    Scenario scenario;
+    uint64_t published = 0;        // Sent inside the measurement window
+    uint64_t delivered = 0;        // Received inside the measurement window
+    uint64_t delivered_bytes = 0;
+    uint64_t lost = 0;             // Expected deliveries never received
+    double window_s = 0.0;
+    LatencyHistogram latency;
+    PerfCounters::Sample broker_counters;
+
+    double msgs_per_second() const { return window_s > 0 ? delivered / window_s : 0.0; }
+    double mb_per_second() const { return window_s > 0 ? delivered_bytes / window_s / 1e6 : 0.0; }
+};
+
+std::vector<int> parse_list(const std::string& text) {
+    std::vector<int> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        values.push_back(std::stoi(item));
+    }
+    return values;
+}
+
+std::vector<int> parse_transport_list(const std::string& text) {
+    std::vector<int> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item == "tcp") {
+            values.push_back(0);
+        } else if (item == "unix") {
+            values.push_back(1);
+        } else {
+            throw std::invalid_argument("transport must be 'tcp' or 'unix': " + item);
+        }
+    }
+    return values;
+}
+
+std::vector<int> parse_ack_list(const std::string& text) {
+    std::vector<int> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item == "none") {
+            values.push_back(0);
+        } else if (item == "ack") {
+            values.push_back(1);
+        } else {
+            throw std::invalid_argument("ack mode must be 'none' or 'ack': " + item);
+        }
+    }
+    return values;
+}
+
+std::string topic_name(int index) {
+    return "bench_t" + std::to_string(index);
+}
+
+class LoadRun {
+public:
+    LoadRun(const BenchConfig& config, const Scenario& scenario)
+        : config_(config), scenario_(scenario), io_context_() {}
+
+    ScenarioStats run() {
+        ScenarioStats stats;
+        stats.scenario = scenario_;
+
+        // Subscribers first, so nothing published in the window is missed
+        std::vector<std::unique_ptr<StreamSocket>> subscriber_sockets;
+        for (int i = 0; i < scenario_.fanout; ++i) {
+            subscriber_sockets.push_back(connect());
+            subscribe_all(*subscriber_sockets.back());
+        }
+
+        uint64_t now = latency_trace::now_ns();
+        warmup_end_ns_ = now + static_cast<uint64_t>(config_.warmup_s * 1e9);
+        end_ns_ = warmup_end_ns_ + static_cast<uint64_t>(config_.duration_s * 1e9);
+
+        std::vector<std::thread> threads;
+        std::vector<LatencyHistogram> histograms(scenario_.fanout);
+        for (int i = 0; i < scenario_.fanout; ++i) {
+            threads.emplace_back([this, &histograms, &subscriber_sockets, i] {
+                run_subscriber(*subscriber_sockets[i], histograms[i]);
+            });
+        }
+
+        PerfCounters broker_counters(config_.broker_pid);
+        if (config_.broker_pid) {
+            broker_counters.start();
+        }
+
+        std::vector<std::thread> publishers;
+        for (int i = 0; i < config_.publishers; ++i) {
+            publishers.emplace_back([this, i] { run_publisher(i); });
+        }
+        for (auto& thread : publishers) {
+            thread.join();
+        }
+
+        // Drain: wait until everything sent has arrived; a saturated broker
+        // may still be flushing its write queues, so allow a full duration
+        uint64_t expected = total_sent_.load() * static_cast<uint64_t>(scenario_.fanout);
+        auto drain_deadline = std::chrono::steady_clock::now() +
+            std::chrono::milliseconds(static_cast<int64_t>(std::max(2.0, config_.duration_s) * 1000));
+        while (total_received_.load() < expected && std::chrono::steady_clock::now() < drain_deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        if (config_.broker_pid) {
+            stats.broker_counters = broker_counters.stop();
+        }
+
+        stopping_ = true;
+        for (auto& socket : subscriber_sockets) {
+            ::shutdown(socket->native_handle(), SHUT_RDWR);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        for (auto& histogram : histograms) {
+            stats.latency.merge(histogram);
+        }
+        stats.published = window_sent_.load();
+        stats.delivered = window_received_.load();
+        stats.delivered_bytes = window_bytes_.load();
+        uint64_t received = total_received_.load();
+        stats.lost = expected > received ? expected - received : 0;
+        stats.window_s = config_.duration_s;
+        return stats;
+    }
+
+private:
+    std::unique_ptr<StreamSocket> connect() {
+        auto socket = std::make_unique<StreamSocket>(io_context_);
+        connect_stream(*socket, scenario_.unix_socket ? std::string(transport::UNIX_PREFIX) + config_.unix_path
+                                                      : config_.host,
+                       config_.port);
+        return socket;
+    }
+
+    void subscribe_all(StreamSocket& socket) {
+        if (config_.legacy) {
+            return;  // Legacy broker broadcasts everything to every client
+        }
+        LineReader reader(socket);
+        for (int t = 0; t < scenario_.topics; ++t) {
+            asio::write(socket, asio::buffer("SUBSCRIBE:" + topic_name(t) + "\n"));
+            std::string_view line;
+            if (!reader.next(line) || line.find("OK:SUBSCRIBED") != 0) {
+                throw std::runtime_error("subscribe failed: " + std::string(line));
+            }
+        }
+    }
+
+    void run_subscriber(StreamSocket& socket, LatencyHistogram& histogram) {
+        LineReader reader(socket);
+        std::string_view line;
+        while (reader.next(line)) {
+            // Asio broker: MESSAGE:topic:payload, legacy: PUBLISH:topic:payload
+            if (line.find("MESSAGE:") != 0 && line.find("PUBLISH:") != 0) {
+                continue;
+            }
+            size_t topic_end = line.find(':', 8);
+            if (topic_end == std::string_view::npos) {
+                continue;
+            }
+            std::string_view payload = line.substr(topic_end + 1);
+            uint64_t sent_ns;
+            if (payload.size() < latency_trace::STAMP_WIDTH ||
+                !latency_trace::parse_stamp(payload.substr(0, latency_trace::STAMP_WIDTH), sent_ns)) {
+                continue;
+            }
+            uint64_t received_ns = latency_trace::now_ns();
+            total_received_.fetch_add(1, std::memory_order_relaxed);
+            if (sent_ns >= warmup_end_ns_ && sent_ns < end_ns_) {
+                histogram.record(received_ns - sent_ns);
+                window_received_.fetch_add(1, std::memory_order_relaxed);
+                window_bytes_.fetch_add(payload.size(), std::memory_order_relaxed);
+            }
+        }
+        if (!stopping_) {
+            std::cerr << "[np_bench] subscriber connection closed by broker" << std::endl;
+        }
+    }
+
+    void run_publisher(int index) {
+        auto socket = connect();
+
+        // Fire-and-forget still gets acks (or legacy broadcasts); drain them
+        // on a side thread so the broker never blocks writing to us
+        std::thread drain;
+        if (!scenario_.ack) {
+            drain = std::thread([&socket] {
+                LineReader reader(*socket);
+                std::string_view line;
+                while (reader.next(line)) {
+                }
+            });
+        }
+        LineReader ack_reader(*socket);
+
+        std::vector<std::string> prefixes;
+        for (int t = 0; t < scenario_.topics; ++t) {
+            prefixes.push_back("PUBLISH:" + topic_name(t) + ":");
+        }
+        std::string padding(std::max(0, scenario_.payload - static_cast<int>(latency_trace::STAMP_WIDTH)), 'x');
+
+        double per_publisher_rate = config_.rate / config_.publishers;
+        uint64_t interval_ns = per_publisher_rate > 0 ? static_cast<uint64_t>(1e9 / per_publisher_rate) : 0;
+        uint64_t start_ns = latency_trace::now_ns();
+        std::string line;
+        for (uint64_t seq = 0;; ++seq) {
+            uint64_t stamp = latency_trace::now_ns();
+            if (interval_ns) {
+                // Open loop: stamp the scheduled time, then wait for it
+                uint64_t scheduled = start_ns + seq * interval_ns;
+                while (stamp < scheduled) {
+                    if (scheduled - stamp > 200000) {
+                        std::this_thread::sleep_for(std::chrono::nanoseconds(scheduled - stamp - 100000));
+                    }
+                    stamp = latency_trace::now_ns();
+                }
+                stamp = scheduled;
+            }
+            if (stamp >= end_ns_) {
+                break;
+            }
+
+            line.assign(prefixes[(seq + index) % prefixes.size()]);
+            line.append(latency_trace::format_stamp(stamp));
+            line.append(padding);
+            line.push_back('\n');
+
+            std::error_code ec;
+            asio::write(*socket, asio::buffer(line), ec);
+            if (ec) {
+                std::cerr << "[np_bench] publish failed: " << ec.message() << std::endl;
+                break;
+            }
+            total_sent_.fetch_add(1, std::memory_order_relaxed);
+            if (stamp >= warmup_end_ns_) {
+                window_sent_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            if (scenario_.ack) {
+                std::string_view response;
+                if (!ack_reader.next(response)) {
+                    break;
+                }
+            }
+        }
+
+        ::shutdown(socket->native_handle(), SHUT_RDWR);
+        if (drain.joinable()) {
+            drain.join();
+        }
+    }
+
+    const BenchConfig& config_;
+    Scenario scenario_;
+    asio::io_context io_context_;
+    uint64_t warmup_end_ns_ = 0;
+    uint64_t end_ns_ = 0;
+    std::atomic<bool> stopping_{false};
+    std::atomic<uint64_t> total_sent_{0};
+    std::atomic<uint64_t> total_received_{0};
+    std::atomic<uint64_t> window_sent_{0};
+    std::atomic<uint64_t> window_received_{0};
+    std::atomic<uint64_t> window_bytes_{0};
+};
+
+void print_text(const BenchConfig& config, const ScenarioStats& stats) {
+    const Scenario& s = stats.scenario;
+    std::printf("%-4s topics=%-3d payload=%-6d fanout=%-3d ack=%-4s %10.0f msg/s %8.2f MB/s  "
+                "p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus  lost=%llu\n",
+                s.unix_socket ? "unix" : "tcp", s.topics, s.payload, s.fanout, s.ack ? "ack" : "none",
+                stats.msgs_per_second(), stats.mb_per_second(),
+                stats.latency.percentile(50) / 1e3, stats.latency.percentile(99) / 1e3,
+                stats.latency.percentile(99.9) / 1e3, stats.latency.max() / 1e3,
+                static_cast<unsigned long long>(stats.lost));
+    if (config.broker_pid) {
+        ScenarioResult broker;
+        broker.name = "  broker counters";
+        broker.operations = stats.published ? stats.published : 1;
+        broker.seconds = stats.window_s;
+        broker.counters = stats.broker_counters;
+        BenchHarness::print(broker);
+    }
+    std::fflush(stdout);
+}
+
+std::string to_json(const BenchConfig& config, const std::vector<ScenarioStats>& results) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    out << "{\n  \"target\": \"" << (config.legacy ? "broker_legacy" : "broker") << "\",\n"
+        << "  \"mode\": \"" << (config.rate > 0 ? "open" : "closed") << "\",\n"
+        << "  \"rate\": " << config.rate << ",\n"
+        << "  \"publishers\": " << config.publishers << ",\n"
+        << "  \"duration_s\": " << config.duration_s << ",\n"
+        << "  \"scenarios\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const ScenarioStats& r = results[i];
+        out << (i ? "," : "") << "\n    {\"transport\": \"" << (r.scenario.unix_socket ? "unix" : "tcp") << "\""
+            << ", \"topics\": " << r.scenario.topics
+            << ", \"payload\": " << r.scenario.payload
+            << ", \"fanout\": " << r.scenario.fanout
+            << ", \"ack\": \"" << (r.scenario.ack ? "ack" : "none") << "\""
+            << ", \"published\": " << r.published
+            << ", \"delivered\": " << r.delivered
+            << ", \"lost\": " << r.lost
+            << ", \"msgs_per_s\": " << r.msgs_per_second()
+            << ", \"mb_per_s\": " << r.mb_per_second()
+            << ", \"latency_us\": {\"p50\": " << r.latency.percentile(50) / 1e3
+            << ", \"p99\": " << r.latency.percentile(99) / 1e3
+            << ", \"p999\": " << r.latency.percentile(99.9) / 1e3
+            << ", \"max\": " << r.latency.max() / 1e3 << "}";
+        if (config.broker_pid) {
+            out << ", \"broker_counters\": {";
+            bool first = true;
+            for (size_t c = 0; c < PerfCounters::COUNTER_COUNT; ++c) {
+                auto counter = static_cast<PerfCounters::Counter>(c);
+                if (r.broker_counters.has(counter)) {
+                    out << (first ? "" : ", ") << "\"" << PerfCounters::name(counter) << "\": "
+                        << r.broker_counters.get(counter);
+                    first = false;
+                }
+            }
+            out << "}";
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+void print_usage(const char* program_name) {
+    std::cout << "\nUsage: " << program_name << " [options]\n"
+              << "\nOptions (lists are comma separated and swept as a cartesian product):\n"
+              << "  --host H            Broker host (default 127.0.0.1)\n"
+              << "  --port P            Broker port (default 9092)\n"
+              << "  --unix PATH         Broker Unix socket (default " << transport::DEFAULT_UNIX_PATH << ")\n"
+              << "  --transport LIST    tcp | unix (default tcp)\n"
+              << "  --target T          broker | legacy (default broker)\n"
+              << "  --publishers N      Publisher connections (default 1)\n"
+              << "  --topics LIST       Topic counts to sweep (default 1)\n"
+              << "  --payload LIST      Payload sizes in bytes (default 128)\n"
+              << "  --fanout LIST       Subscriber connections per run (default 1)\n"
+              << "  --ack LIST          none | ack (default none)\n"
+              << "  --rate R            Aggregate open-loop msgs/s, 0 = closed loop (default 0)\n"
+              << "  --duration S        Measured seconds per scenario (default 5)\n"
+              << "  --warmup S          Unmeasured warm-up seconds (default 1)\n"
+              << "  --json FILE         Also write results as JSON\n"
+              << "  --broker-pid PID    Report perf counters of the broker process\n"
+              << "\nExample:\n"
+              << "  " << program_name << " --topics 1,16 --payload 64,1024 --fanout 1,8 --ack none,ack\n"
+              << "  " << program_name << " --transport tcp,unix --payload 64,4096\n"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::invalid_argument("missing value for " + arg);
+                }
+                return argv[++i];
+            };
+            if (arg == "--help" || arg == "-h") {
+                print_usage(argv[0]);
+                return 0;
+            } else if (arg == "--host") {
+                config.host = value();
+            } else if (arg == "--port") {
+                config.port = value();
+            } else if (arg == "--unix") {
+                config.unix_path = value();
+            } else if (arg == "--transport") {
+                config.transports = parse_transport_list(value());
+            } else if (arg == "--target") {
+                std::string target = value();
+                if (target != "broker" && target != "legacy") {
+                    throw std::invalid_argument("--target must be broker or legacy");
+                }
+                config.legacy = (target == "legacy");
+            } else if (arg == "--publishers") {
+                config.publishers = std::max(1, std::stoi(value()));
+            } else if (arg == "--topics") {
+                config.topic_counts = parse_list(value());
+            } else if (arg == "--payload") {
+                config.payload_sizes = parse_list(value());
+            } else if (arg == "--fanout") {
+                config.fanouts = parse_list(value());
+            } else if (arg == "--ack") {
+                config.ack_modes = parse_ack_list(value());
+            } else if (arg == "--rate") {
+                config.rate = std::stod(value());
+            } else if (arg == "--duration") {
+                config.duration_s = std::stod(value());
+            } else if (arg == "--warmup") {
+                config.warmup_s = std::stod(value());
+            } else if (arg == "--json") {
+                config.json_path = value();
+            } else if (arg == "--broker-pid") {
+                config.broker_pid = std::stoi(value());
+            } else {
+                throw std::invalid_argument("unknown option " + arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "np_bench: " << e.what() << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::cout << "=== np_bench: " << (config.legacy ? "broker_legacy" : "broker") << " at "
+              << config.host << ":" << config.port << ", " << config.publishers << " publisher(s), "
+              << (config.rate > 0 ? "open loop @ " + std::to_string(static_cast<long>(config.rate)) + " msg/s"
+                                  : std::string("closed loop"))
+              << " ===" << std::endl;
+
+    std::vector<ScenarioStats> results;
+    try {
+        for (int unix_socket : config.transports) {
+            for (int topics : config.topic_counts) {
+                for (int payload : config.payload_sizes) {
+                    for (int fanout : config.fanouts) {
+                        for (int ack : config.ack_modes) {
+                            if (ack && config.legacy) {
+                                std::cout << "(skipping ack mode: broker_legacy sends no acks)" << std::endl;
+                                continue;
+                            }
+                            Scenario scenario{unix_socket != 0, std::max(1, topics), std::max(0, payload),
+                                              std::max(1, fanout), ack != 0};
+                            LoadRun run(config, scenario);
+                            results.push_back(run.run());
+                            print_text(config, results.back());
+                        }
+                    }
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "np_bench: " << e.what() << "\nIs the broker running?" << std::endl;
+        return 1;
+    }
+
+    if (!config.json_path.empty()) {
+        std::ofstream out(config.json_path);
+        out << to_json(config, results);
+        std::cout << "JSON results written to " << config.json_path << std::endl;
+    }
+    return 0;
+}
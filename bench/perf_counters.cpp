@@ -0,0 +1,173 @@
+#include "perf_counters.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+struct CounterSpec {
+    uint32_t type;
+    uint64_t config;
+    const char* name;
+};
+
+const CounterSpec SPECS[PerfCounters::COUNTER_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"},
+    {PERF_TYPE_TRACEPOINT, 0 /* looked up in tracefs */, "syscalls"},
+};
+
+// Id of a tracepoint such as raw_syscalls/sys_enter, 0 when tracefs is not
+// mounted or readable
+uint64_t tracepoint_id(const char* name) {
+    for (const char* root : {"/sys/kernel/tracing/events/", "/sys/kernel/debug/tracing/events/"}) {
+        std::ifstream file(std::string(root) + name + "/id");
+        uint64_t id = 0;
+        if (file >> id) {
+            return id;
+        }
+    }
+    return 0;
+}
+
+// read() layout for PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING
+struct ReadValue {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+// Threads to attach to: every current task of the process (inherit covers
+// the threads they spawn later). A counter on pid 0 alone would miss the
+// threads that already exist, such as an io thread started before the
+// counters.
+std::vector<int> target_tasks(int pid) {
+    std::vector<int> tasks;
+    std::string path = pid == 0 ? std::string("/proc/self/task") : "/proc/" + std::to_string(pid) + "/task";
+    if (DIR* dir = opendir(path.c_str())) {
+        while (struct dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') {
+                tasks.push_back(std::atoi(entry->d_name));
+            }
+        }
+        closedir(dir);
+    }
+    return tasks;
+}
+
+} // namespace
+
+PerfCounters::PerfCounters(int pid) {
+    std::vector<int> tasks = target_tasks(pid);
+    uint64_t sys_enter = tracepoint_id("raw_syscalls/sys_enter");
+
+    // Prefer user+kernel counts (syscall-heavy scenarios spend real time in
+    // the kernel); fall back to user-only when perf_event_paranoid forbids it
+    int open_errno = tasks.empty() ? ESRCH : 0;
+    for (bool exclude_kernel : {false, true}) {
+        int opened = 0;
+        for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+            uint64_t config = SPECS[i].type == PERF_TYPE_TRACEPOINT ? sys_enter : SPECS[i].config;
+            if (SPECS[i].type == PERF_TYPE_TRACEPOINT && config == 0) {
+                continue;
+            }
+            for (int tid : tasks) {
+                int fd = open_counter(SPECS[i].type, config, exclude_kernel, tid);
+                if (fd >= 0) {
+                    fds_[i].push_back(fd);
+                    opened++;
+                } else if (open_errno == 0) {
+                    open_errno = errno;
+                }
+            }
+        }
+        if (opened > 0) {
+            counts_kernel_ = !exclude_kernel;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        if (fds_[i].empty()) {
+            reason_ += (reason_.empty() ? "" : ", ") + std::string(SPECS[i].name);
+        }
+    }
+    if (!reason_.empty()) {
+        reason_ = "unavailable: " + reason_ + " (" + std::strerror(open_errno) + ")";
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (auto& fds : fds_) {
+        for (int fd : fds) {
+            close(fd);
+        }
+    }
+}
+
+int PerfCounters::open_counter(uint32_t type, uint64_t config, bool exclude_kernel, int tid) {
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;  // Include threads the scenario spawns
+    attr.exclude_kernel = exclude_kernel ? 1 : 0;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    long fd = syscall(SYS_perf_event_open, &attr, tid, -1 /* any cpu */, -1 /* no group */, 0);
+    return static_cast<int>(fd);
+}
+
+bool PerfCounters::available() const {
+    for (const auto& fds : fds_) {
+        if (!fds.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PerfCounters::start() {
+    for (const auto& fds : fds_) {
+        for (int fd : fds) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+PerfCounters::Sample PerfCounters::stop() {
+    Sample sample;
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        for (int fd : fds_[i]) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+            ReadValue value;
+            if (read(fd, &value, sizeof(value)) != static_cast<ssize_t>(sizeof(value)) ||
+                value.time_running == 0) {
+                continue;
+            }
+            // Scale up when the PMU multiplexed this counter with others
+            double scale = static_cast<double>(value.time_enabled) / static_cast<double>(value.time_running);
+            sample.values[i] += static_cast<uint64_t>(static_cast<double>(value.value) * scale);
+            sample.valid[i] = true;
+        }
+    }
+    return sample;
+}
+
+const char* PerfCounters::name(Counter counter) {
+    return SPECS[counter].name;
+}
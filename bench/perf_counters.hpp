@@ -0,0 +1,69 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Hardware/software performance counters via perf_event_open(2).
+ *
+ * Counts cycles, instructions, cache misses, branch misses, context
+ * switches and system calls (the raw_syscalls:sys_enter tracepoint, which
+ * needs tracefs) for the whole process: every thread it has when the
+ * counters are opened, plus the threads those spawn afterwards.
+ * Given another process id (e.g. a running broker) it counts every thread
+ * that process has when the counters are opened.
+ * When the kernel or container forbids perf events (perf_event_paranoid,
+ * seccomp, no PMU in the VM) the affected counters are simply reported as
+ * unavailable and the benchmark carries on with wall-clock numbers.
+ */
+class PerfCounters {
+public:
+    enum Counter : size_t {
+        CYCLES = 0,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        CONTEXT_SWITCHES,
+        SYSCALLS,
+        COUNTER_COUNT
+    };
+
+    struct Sample {
+        std::array<uint64_t, COUNTER_COUNT> values{};
+        std::array<bool, COUNTER_COUNT> valid{};
+
+        bool has(Counter counter) const { return valid[counter]; }
+        uint64_t get(Counter counter) const { return values[counter]; }
+    };
+
+    // pid 0 = this process
+    explicit PerfCounters(int pid = 0);
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // True if at least one counter could be opened
+    bool available() const;
+
+    // Why counters are missing (empty when everything opened)
+    const std::string& unavailable_reason() const { return reason_; }
+
+    // Whether kernel-mode events are included (false under paranoid >= 2)
+    bool counts_kernel() const { return counts_kernel_; }
+
+    void start();
+    Sample stop();
+
+    static const char* name(Counter counter);
+
+private:
+    int open_counter(uint32_t type, uint64_t config, bool exclude_kernel, int tid);
+
+    // One fd per counted thread for each counter
+    std::array<std::vector<int>, COUNTER_COUNT> fds_;
+    bool counts_kernel_ = true;
+    std::string reason_;
+};
@@ -0,0 +1,369 @@
+/**
+ * np_perf_gate - performance regression check against a stored baseline
+ *
+ * Runs a short, stable subset of the benchmarks (fastest of repeated
+ * microbenchmarks and in-process broker pub/sub rounds) and compares
+ * throughput, p99 latency and allocations per message with a checked-in
+ * JSON baseline. Exits non-zero when any metric is worse than the baseline
+ * by more than the tolerance.
+ *
+ * Usage:
+ *   np_perf_gate --baseline bench/perf_baseline.json [--tolerance PCT]
+ *   np_perf_gate --baseline bench/perf_baseline.json --update   # refresh on purpose
+ *
+ * Always built with allocation accounting so allocations per message are
+ * measured regardless of how the rest of the tree is configured.
+ */
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include "bench_harness.hpp"
+#include "line_reader.hpp"
+#include "loopback_sessions.hpp"
+#include "../include/latency_trace.hpp"
+#include "../src/asio_server.hpp"
+#include "../src/latency_histogram.hpp"
+#include "../src/utils.hpp"
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace {
+
+const double DEFAULT_TOLERANCE_PERCENT = 25.0;
+const uint64_t MICRO_ITERATIONS = 100000;
+const int MICRO_REPETITIONS = 9;
+const int PUBSUB_ROUNDS = 6;                 // First round is warm-up
+const uint64_t PUBSUB_ROUND_MESSAGES = 5000;
+
+struct Metric {
+    std::string name;
+    double value;
+    bool higher_is_better;
+};
+
+// Throughput of the fastest repetition; interference from other processes
+// only ever slows a run down, so this is far more stable than the mean
+Metric throughput_metric(const ScenarioResult& result) {
+    double fastest = result.min_ns_per_op();
+    return {result.name + "/ops_per_s", fastest > 0 ? 1e9 / fastest : 0.0, true};
+}
+
+void run_microbenchmarks(std::vector<Metric>& metrics) {
+    BenchHarness harness(MICRO_REPETITIONS);
+    const std::string payload(200, 'x');
+
+    {
+        TopicManager topics;
+        metrics.push_back(throughput_metric(harness.run("topic_manager/publish_no_subscribers", MICRO_ITERATIONS, [&] {
+            for (uint64_t i = 0; i < MICRO_ITERATIONS; ++i) {
+                topics.publish("bench_topic", payload);
+            }
+        })));
+    }
+
+    {
+        LoopbackSessions network;
+        auto session = network.create();
+        const std::string line = "PUBLISH:bench_topic:" + payload;
+        metrics.push_back(throughput_metric(harness.run("session/process_message_publish", MICRO_ITERATIONS, [&] {
+            for (uint64_t i = 0; i < MICRO_ITERATIONS; ++i) {
+                session->process_message(line);
+            }
+        })));
+        network.settle();
+    }
+
+    {
+        ThreadSafeQueue<std::string> queue;
+        metrics.push_back(throughput_metric(harness.run("thread_safe_queue/push_pop", MICRO_ITERATIONS, [&] {
+            std::string out;
+            for (uint64_t i = 0; i < MICRO_ITERATIONS; ++i) {
+                queue.push(payload);
+                queue.try_pop(out);
+            }
+            do_not_optimize(out);
+        })));
+    }
+}
+
+// One publisher waiting for each ack, one subscriber, broker in-process
+void run_pubsub(std::vector<Metric>& metrics) {
+    asio::io_context broker_io;
+    BrokerServer broker(broker_io, 0);
+    broker.start();
+    std::thread broker_thread([&broker_io] { broker_io.run(); });
+
+    asio::io_context client_io;
+    asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(), broker.get_port());
+    asio::ip::tcp::socket subscriber(client_io);
+    asio::ip::tcp::socket publisher(client_io);
+    subscriber.connect(endpoint);
+    publisher.connect(endpoint);
+    subscriber.set_option(asio::ip::tcp::no_delay(true));
+    publisher.set_option(asio::ip::tcp::no_delay(true));
+
+    LineReader subscriber_reader(subscriber);
+    LineReader publisher_reader(publisher);
+    std::string_view line;
+    asio::write(subscriber, asio::buffer(std::string("SUBSCRIBE:perf\n")));
+    if (!subscriber_reader.next(line) || line.find("OK:SUBSCRIBED") != 0) {
+        throw std::runtime_error("subscribe failed");
+    }
+
+    // Deliveries arrive in publish order, so the n-th one belongs to round n / ROUND_MESSAGES
+    std::vector<LatencyHistogram> latency(PUBSUB_ROUNDS);
+    std::atomic<uint64_t> received{0};
+    std::thread receiver([&] {
+        std::string_view message;
+        while (received.load() < PUBSUB_ROUNDS * PUBSUB_ROUND_MESSAGES && subscriber_reader.next(message)) {
+            size_t topic_end = message.find(':', 8);
+            uint64_t sent_ns;
+            if (message.find("MESSAGE:") != 0 || topic_end == std::string_view::npos ||
+                !latency_trace::parse_stamp(message.substr(topic_end + 1, latency_trace::STAMP_WIDTH), sent_ns)) {
+                continue;
+            }
+            latency[received.load() / PUBSUB_ROUND_MESSAGES].record(latency_trace::now_ns() - sent_ns);
+            received.fetch_add(1);
+        }
+    });
+
+    // Best round wins, as for the microbenchmarks; allocation counts are
+    // deterministic and taken over all measured rounds
+    const std::string padding(64, 'x');
+    std::string message;
+    double best_msgs_per_s = 0.0;
+    double best_p99_us = 0.0;
+    alloc_accounting::Snapshot allocs_before;
+    uint64_t published_before = 0;
+    uint64_t delivered_before = 0;
+    for (int round = 0; round < PUBSUB_ROUNDS; ++round) {
+        if (round == 1) {
+            allocs_before = alloc_accounting::snapshot();
+            published_before = broker.get_topic_manager().get_published_count();
+            delivered_before = broker.get_topic_manager().get_delivered_count();
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < PUBSUB_ROUND_MESSAGES; ++i) {
+            message = "PUBLISH:perf:" + latency_trace::format_stamp(latency_trace::now_ns()) + padding + "\n";
+            asio::write(publisher, asio::buffer(message));
+            if (!publisher_reader.next(line)) {
+                throw std::runtime_error("broker closed the publisher connection");
+            }
+        }
+        while (received.load() < (round + 1) * PUBSUB_ROUND_MESSAGES) {
+            std::this_thread::yield();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (round == 0) {
+            continue;
+        }
+        double p99_us = latency[round].percentile(99) / 1e3;
+        best_msgs_per_s = std::max(best_msgs_per_s, PUBSUB_ROUND_MESSAGES / seconds);
+        best_p99_us = round == 1 ? p99_us : std::min(best_p99_us, p99_us);
+    }
+    receiver.join();
+    alloc_accounting::Snapshot allocs = alloc_accounting::snapshot() - allocs_before;
+    uint64_t published = broker.get_topic_manager().get_published_count() - published_before;
+    uint64_t delivered = broker.get_topic_manager().get_delivered_count() - delivered_before;
+
+    subscriber.close();
+    publisher.close();
+    broker.stop();
+    broker_io.stop();
+    broker_thread.join();
+
+    std::printf("%-36s %10llu msgs  best round %.0f msg/s, p99 %.1f us\n", "pubsub/ack_roundtrip",
+                static_cast<unsigned long long>((PUBSUB_ROUNDS - 1) * PUBSUB_ROUND_MESSAGES),
+                best_msgs_per_s, best_p99_us);
+    metrics.push_back({"pubsub/msgs_per_s", best_msgs_per_s, true});
+    metrics.push_back({"pubsub/p99_us", best_p99_us, false});
+    metrics.push_back({"pubsub/allocs_per_published",
+                       alloc_accounting::allocations_per_published(allocs, published), false});
+    metrics.push_back({"pubsub/allocs_per_delivered",
+                       alloc_accounting::allocations_per_delivered(allocs, delivered), false});
+}
+
+struct Baseline {
+    double tolerance_percent = DEFAULT_TOLERANCE_PERCENT;
+    std::map<std::string, double> tolerance_overrides;  // Per metric, e.g. for tail latency
+    std::map<std::string, double> values;
+
+    double tolerance_for(const std::string& metric, double fallback) const {
+        auto it = tolerance_overrides.find(metric);
+        return it != tolerance_overrides.end() ? it->second : fallback;
+    }
+};
+
+// "name": number pairs inside the (flat) object stored under key
+std::map<std::string, double> read_object(const std::string& text, const std::string& key) {
+    std::map<std::string, double> values;
+    size_t key_pos = text.find("\"" + key + "\"");
+    size_t open = key_pos == std::string::npos ? key_pos : text.find('{', key_pos);
+    size_t close = open == std::string::npos ? open : text.find('}', open);
+    if (close == std::string::npos) {
+        return values;
+    }
+    std::string body = text.substr(open + 1, close - open - 1);
+    static const std::regex entry("\"([^\"]+)\"\\s*:\\s*(-?[0-9.]+(?:[eE][-+]?[0-9]+)?)");
+    for (auto it = std::sregex_iterator(body.begin(), body.end(), entry); it != std::sregex_iterator(); ++it) {
+        values[(*it)[1]] = std::stod((*it)[2]);
+    }
+    return values;
+}
+
+// Reads the format written by write_baseline
+bool read_baseline(const std::string& path, Baseline& baseline) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+
+    static const std::regex tolerance("\"tolerance_percent\"\\s*:\\s*([0-9.]+)");
+    std::smatch match;
+    if (std::regex_search(text, match, tolerance)) {
+        baseline.tolerance_percent = std::stod(match[1]);
+    }
+    baseline.tolerance_overrides = read_object(text, "tolerance_overrides");
+    baseline.values = read_object(text, "metrics");
+    return true;
+}
+
+// Per-metric tolerance overrides are kept across refreshes
+bool write_baseline(const std::string& path, double tolerance_percent, const Baseline& previous,
+                    const std::vector<Metric>& metrics) {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    out << std::setprecision(6) << "{\n  \"tolerance_percent\": " << tolerance_percent << ",\n"
+        << "  \"tolerance_overrides\": {";
+    size_t i = 0;
+    for (const auto& [name, value] : previous.tolerance_overrides) {
+        out << (i++ ? "," : "") << "\n    \"" << name << "\": " << value;
+    }
+    out << (i ? "\n  " : "") << "},\n  \"metrics\": {";
+    for (i = 0; i < metrics.size(); ++i) {
+        out << (i ? "," : "") << "\n    \"" << metrics[i].name << "\": " << metrics[i].value;
+    }
+    out << "\n  }\n}\n";
+    return static_cast<bool>(out);
+}
+
+// Returns the number of regressions
+int compare(const Baseline& baseline, double tolerance_percent, const std::vector<Metric>& metrics) {
+    int regressions = 0;
+    std::printf("\n%-48s %14s %14s %9s  %s\n", "metric", "baseline", "current", "change", "status");
+    for (const Metric& metric : metrics) {
+        auto it = baseline.values.find(metric.name);
+        if (it == baseline.values.end()) {
+            std::printf("%-48s %14s %14.3f %9s  %s\n", metric.name.c_str(), "-", metric.value, "-", "NEW");
+            continue;
+        }
+        double base = it->second;
+        // Positive change = better, whichever direction the metric improves in
+        double change_percent = 0.0;
+        if (base != 0) {
+            change_percent = (metric.value - base) / std::fabs(base) * 100.0;
+            if (!metric.higher_is_better) {
+                change_percent = -change_percent;
+            }
+        } else if (metric.value != 0) {
+            change_percent = metric.higher_is_better ? 100.0 : -100.0;
+        }
+        double tolerance = baseline.tolerance_for(metric.name, tolerance_percent);
+        const char* status = "ok";
+        if (change_percent < -tolerance) {
+            status = "REGRESSION";
+            regressions++;
+        } else if (change_percent > tolerance) {
+            status = "improved (consider --update)";
+        }
+        std::printf("%-48s %14.3f %14.3f %+8.1f%%  %s\n", metric.name.c_str(), base, metric.value,
+                    change_percent, status);
+    }
+    return regressions;
+}
+
+void print_usage(const char* program_name) {
+    std::cout << "\nUsage: " << program_name << " --baseline FILE [--tolerance PCT] [--update]\n"
+              << "\n  --baseline FILE   JSON baseline to compare with (or write with --update)\n"
+              << "  --tolerance PCT   Allowed regression in percent for every metric (default: baseline's, else "
+              << DEFAULT_TOLERANCE_PERCENT << ")\n"
+              << "  --update          Record the current results as the new baseline\n"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string baseline_path;
+    double tolerance_override = -1.0;
+    bool update = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--baseline" && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance_override = std::stod(argv[++i]);
+        } else if (arg == "--update") {
+            update = true;
+        } else {
+            print_usage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 2;
+        }
+    }
+    if (baseline_path.empty()) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    set_log_level(LogLevel::Warn);
+
+    Baseline baseline;
+    bool have_baseline = read_baseline(baseline_path, baseline);
+    if (!have_baseline && !update) {
+        std::cerr << "np_perf_gate: cannot read baseline " << baseline_path
+                  << " (create it with --update)" << std::endl;
+        return 2;
+    }
+    double tolerance = tolerance_override >= 0 ? tolerance_override : baseline.tolerance_percent;
+    if (tolerance_override >= 0 && !update) {
+        baseline.tolerance_overrides.clear();  // An explicit tolerance applies to every metric
+    }
+
+    std::vector<Metric> metrics;
+    try {
+        run_microbenchmarks(metrics);
+        run_pubsub(metrics);
+    } catch (const std::exception& e) {
+        std::cerr << "np_perf_gate: " << e.what() << std::endl;
+        return 2;
+    }
+
+    if (update) {
+        if (!write_baseline(baseline_path, tolerance, baseline, metrics)) {
+            std::cerr << "np_perf_gate: cannot write " << baseline_path << std::endl;
+            return 2;
+        }
+        std::cout << "\nBaseline written to " << baseline_path << " (tolerance " << tolerance << "%)" << std::endl;
+        return 0;
+    }
+
+    int regressions = compare(baseline, tolerance, metrics);
+    if (regressions > 0) {
+        std::cout << "\n" << regressions << " metric(s) regressed beyond tolerance" << std::endl;
+        return 1;
+    }
+    std::cout << "\nAll metrics within tolerance of the baseline" << std::endl;
+    return 0;
+}
@@ -0,0 +1,256 @@
+/**
+ * np_replay - re-issue a broker traffic capture
+ *
+ * Reads a capture written by the broker (CAPTURE:START or NEUROPIPE_CAPTURE)
+ * and sends every frame again, either on one connection per captured
+ * connection (opened and closed as in the capture) or spread over a fixed
+ * number of connections. Frames go out at the original pace, a multiple of
+ * it, or as fast as possible. Broker responses are read and discarded.
+ */
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include "../src/capture.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+
+namespace {
+
+struct ReplayConfig {
+    std::string host = "127.0.0.1";
+    std::string port = "9092";
+    std::string path;
+    double speed = 1.0;        // 0 = as fast as possible
+    int connections = 0;       // 0 = mirror the captured connections
+};
+
+class Replayer {
+public:
+    explicit Replayer(const ReplayConfig& config) : config_(config), resolver_(io_context_) {
+        endpoints_ = resolver_.resolve(config_.host, config_.port);
+    }
+
+    int run() {
+        capture::Reader reader(config_.path);
+        if (!reader.ok()) {
+            std::cerr << "np_replay: " << config_.path << " is not a readable capture" << std::endl;
+            return 1;
+        }
+
+        for (int i = 0; i < config_.connections; ++i) {
+            fixed_.push_back(open());
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t first_ns = 0;
+        uint64_t last_ns = 0;
+        capture::Record record;
+        while (reader.next(record)) {
+            if (first_ns == 0) {
+                first_ns = record.timestamp_ns;
+            }
+            last_ns = record.timestamp_ns;
+            if (config_.speed > 0) {
+                auto due = start + std::chrono::nanoseconds(
+                    static_cast<int64_t>((record.timestamp_ns - first_ns) / config_.speed));
+                wait_until(due);
+                auto lateness = std::chrono::steady_clock::now() - due;
+                max_lateness_ns_ = std::max<int64_t>(max_lateness_ns_,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(lateness).count());
+            }
+            apply(record);
+        }
+
+        // Give the broker a moment to answer the tail before hanging up
+        wait_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(200));
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double captured_seconds = (last_ns - first_ns) / 1e9;
+        for (auto& [id, socket] : mirrored_) {
+            close(*socket);
+        }
+        for (auto& socket : fixed_) {
+            close(*socket);
+        }
+
+        std::printf("Replayed %llu frames (%.2f MB) on %llu connections in %.3fs "
+                    "(captured span %.3fs, %.0f frames/s)\n",
+                    static_cast<unsigned long long>(frames_), bytes_ / 1e6,
+                    static_cast<unsigned long long>(opened_), seconds, captured_seconds,
+                    seconds > 0 ? frames_ / seconds : 0.0);
+        if (config_.speed > 0) {
+            std::printf("Max schedule lateness: %.3f ms\n", max_lateness_ns_ / 1e6);
+        }
+        if (skipped_) {
+            std::printf("Skipped %llu capture-control frames\n", static_cast<unsigned long long>(skipped_));
+        }
+        return 0;
+    }
+
+private:
+    using Socket = asio::ip::tcp::socket;
+
+    std::unique_ptr<Socket> open() {
+        auto socket = std::make_unique<Socket>(io_context_);
+        asio::connect(*socket, endpoints_);
+        socket->set_option(asio::ip::tcp::no_delay(true));
+        opened_++;
+        return socket;
+    }
+
+    void close(Socket& socket) {
+        drain(socket);
+        std::error_code ec;
+        socket.close(ec);
+    }
+
+    Socket& socket_for(uint32_t connection) {
+        if (!fixed_.empty()) {
+            return *fixed_[connection % fixed_.size()];
+        }
+        auto it = mirrored_.find(connection);
+        if (it == mirrored_.end()) {
+            it = mirrored_.emplace(connection, open()).first;
+        }
+        return *it->second;
+    }
+
+    void apply(const capture::Record& record) {
+        switch (record.kind) {
+        case capture::Kind::Open:
+            if (fixed_.empty()) {
+                socket_for(record.connection);
+            }
+            break;
+        case capture::Kind::Close:
+            if (fixed_.empty()) {
+                auto it = mirrored_.find(record.connection);
+                if (it != mirrored_.end()) {
+                    close(*it->second);
+                    mirrored_.erase(it);
+                }
+            }
+            break;
+        case capture::Kind::Frame: {
+            // Replaying capture control would start or stop a capture on the target
+            if (record.frame.find("CAPTURE:") == 0) {
+                skipped_++;
+                break;
+            }
+            Socket& socket = socket_for(record.connection);
+            line_.assign(record.frame);
+            line_.push_back('\n');
+            std::error_code ec;
+            asio::write(socket, asio::buffer(line_), ec);
+            if (ec) {
+                throw std::runtime_error("write failed: " + ec.message());
+            }
+            frames_++;
+            bytes_ += line_.size();
+            drain(socket);
+            break;
+        }
+        }
+    }
+
+    // Discard whatever the broker has sent so far, without blocking
+    void drain(Socket& socket) {
+        char buffer[65536];
+        while (::recv(socket.native_handle(), buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+        }
+    }
+
+    void drain_all() {
+        for (auto& [id, socket] : mirrored_) {
+            drain(*socket);
+        }
+        for (auto& socket : fixed_) {
+            drain(*socket);
+        }
+    }
+
+    // Sleep until due, keeping every connection's receive side empty meanwhile
+    void wait_until(std::chrono::steady_clock::time_point due) {
+        while (true) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= due) {
+                return;
+            }
+            drain_all();
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                due - now, std::chrono::milliseconds(1)));
+        }
+    }
+
+    const ReplayConfig& config_;
+    asio::io_context io_context_;
+    asio::ip::tcp::resolver resolver_;
+    asio::ip::tcp::resolver::results_type endpoints_;
+    std::vector<std::unique_ptr<Socket>> fixed_;
+    std::unordered_map<uint32_t, std::unique_ptr<Socket>> mirrored_;
+    std::string line_;
+    uint64_t frames_ = 0;
+    uint64_t bytes_ = 0;
+    uint64_t opened_ = 0;
+    uint64_t skipped_ = 0;
+    int64_t max_lateness_ns_ = 0;
+};
+
+void print_usage(const char* program_name) {
+    std::cout << "\nUsage: " << program_name << " [options] <capture.npcap>\n"
+              << "\nOptions:\n"
+              << "  --host H          Broker host (default 127.0.0.1)\n"
+              << "  --port P          Broker port (default 9092)\n"
+              << "  --speed X         Multiple of the captured pace (default 1)\n"
+              << "  --max             As fast as possible\n"
+              << "  --connections N   Spread frames over N connections\n"
+              << "                    (default: one per captured connection)\n"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    ReplayConfig config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc) {
+            config.host = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            config.port = argv[++i];
+        } else if (arg == "--speed" && i + 1 < argc) {
+            config.speed = std::stod(argv[++i]);
+        } else if (arg == "--max") {
+            config.speed = 0;
+        } else if (arg == "--connections" && i + 1 < argc) {
+            config.connections = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] != '-' && config.path.empty()) {
+            config.path = arg;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.path.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        Replayer replayer(config);
+        return replayer.run();
+    } catch (const std::exception& e) {
+        std::cerr << "np_replay: " << e.what() << std::endl;
+        return 1;
+    }
+}
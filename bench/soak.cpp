@@ -0,0 +1,488 @@
+/**
+ * np_soak - long-running soak test with resource tracking
+ *
+ * Runs the broker in-process under churned load for a configurable time:
+ *   - churn clients connect, subscribe, publish a few messages and disconnect
+ *   - steady publishers send at a fixed rate to a set of topics
+ *   - a subscribe storm subscribes and unsubscribes many topics in bursts
+ *   - slow consumers read a busy topic in bursts with pauses
+ *
+ * Every interval it samples VmRSS and Threads from /proc/self/status, the
+ * number of open fds and the broker's session/topic counts into a CSV time
+ * series. After warm-up, each series gets a least-squares slope; the run
+ * fails when RSS grows faster than --max-rss-slope, or when fds or threads
+ * grow monotonically (a leak rather than noise).
+ */
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include "line_reader.hpp"
+#include "../src/asio_server.hpp"
+#include "../src/utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <sys/socket.h>
+
+namespace {
+
+const int TOPIC_COUNT = 16;
+
+struct SoakConfig {
+    double duration_s = 60.0;
+    double interval_s = 1.0;
+    double warmup_fraction = 0.2;      // Early samples excluded from slopes
+    int churn_clients = 4;
+    int publishers = 2;
+    double publish_rate = 500.0;       // Per publisher, msgs/s
+    int slow_consumers = 1;
+    int storm_topics = 200;
+    double max_rss_slope_kb_per_min = 256.0;
+    std::string csv_path = "soak.csv";
+};
+
+struct Sample {
+    double elapsed_s;
+    long rss_kb;
+    long fds;
+    long threads;
+    size_t sessions;
+    size_t topics;
+    uint64_t published;
+    uint64_t delivered;
+};
+
+long read_status_field(const char* field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    size_t field_length = std::strlen(field);
+    while (std::getline(status, line)) {
+        if (line.compare(0, field_length, field) == 0 && line.size() > field_length && line[field_length] == ':') {
+            return std::stol(line.substr(field_length + 1));
+        }
+    }
+    return -1;
+}
+
+long count_open_fds() {
+    long count = 0;
+    if (DIR* dir = opendir("/proc/self/fd")) {
+        while (struct dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') {
+                count++;
+            }
+        }
+        closedir(dir);
+        count--;  // The directory stream itself
+    }
+    return count;
+}
+
+std::string soak_topic(int index) {
+    return "soak.t" + std::to_string(index % TOPIC_COUNT);
+}
+
+class SoakLoad {
+public:
+    SoakLoad(const SoakConfig& config, uint16_t port)
+        : config_(config), endpoint_(asio::ip::address_v4::loopback(), port) {}
+
+    ~SoakLoad() { stop(); }
+
+    void start() {
+        for (int i = 0; i < config_.churn_clients; ++i) {
+            threads_.emplace_back([this, i] { run_churn(i); });
+        }
+        for (int i = 0; i < config_.publishers; ++i) {
+            threads_.emplace_back([this, i] { run_publisher(i); });
+        }
+        for (int i = 0; i < config_.slow_consumers; ++i) {
+            threads_.emplace_back([this] { run_slow_consumer(); });
+        }
+        if (config_.storm_topics > 0) {
+            threads_.emplace_back([this] { run_subscribe_storm(); });
+        }
+    }
+
+    void stop() {
+        if (stopping_.exchange(true)) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sockets_mutex_);
+            for (auto* socket : sockets_) {
+                ::shutdown(socket->native_handle(), SHUT_RDWR);
+            }
+        }
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    uint64_t churn_cycles() const { return churn_cycles_.load(); }
+
+private:
+    // Long-lived sockets are registered so stop() can unblock their readers
+    class Registered {
+    public:
+        Registered(SoakLoad& load, asio::ip::tcp::socket& socket) : load_(load), socket_(socket) {
+            std::lock_guard<std::mutex> lock(load_.sockets_mutex_);
+            load_.sockets_.push_back(&socket_);
+            if (load_.stopping_) {
+                ::shutdown(socket_.native_handle(), SHUT_RDWR);
+            }
+        }
+        ~Registered() {
+            std::lock_guard<std::mutex> lock(load_.sockets_mutex_);
+            load_.sockets_.erase(std::find(load_.sockets_.begin(), load_.sockets_.end(), &socket_));
+        }
+
+    private:
+        SoakLoad& load_;
+        asio::ip::tcp::socket& socket_;
+    };
+
+    bool connect(asio::ip::tcp::socket& socket) {
+        std::error_code ec;
+        socket.connect(endpoint_, ec);
+        return !ec;
+    }
+
+    // Connect, subscribe to a few topics, publish, read the acks, disconnect
+    void run_churn(int index) {
+        std::mt19937 rng(index);
+        asio::io_context io_context;
+        while (!stopping_) {
+            asio::ip::tcp::socket socket(io_context);
+            if (!connect(socket)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            Registered registered(*this, socket);
+            std::string batch;
+            std::string unsubscribe;
+            for (int i = 0; i < 3; ++i) {
+                std::string topic = soak_topic(rng());
+                batch += "SUBSCRIBE:" + topic + "\n";
+                unsubscribe += "UNSUBSCRIBE:" + topic + "\n";
+            }
+            for (int i = 0; i < 5; ++i) {
+                batch += "PUBLISH:" + soak_topic(rng()) + ":churn " + std::to_string(index) + "\n";
+            }
+            std::error_code ec;
+            asio::write(socket, asio::buffer(batch), ec);
+
+            LineReader reader(socket);
+            std::string_view line;
+            int acks = 0;
+            while (!ec && acks < 8 && reader.next(line)) {
+                if (line.find("OK:") == 0) {
+                    acks++;
+                }
+            }
+            churn_cycles_.fetch_add(1);
+            // Half the clients unsubscribe before leaving, half just drop the connection
+            if (!ec && rng() % 2 == 0) {
+                asio::write(socket, asio::buffer(unsubscribe), ec);
+            }
+        }
+    }
+
+    void run_publisher(int index) {
+        asio::io_context io_context;
+        asio::ip::tcp::socket socket(io_context);
+        if (!connect(socket)) {
+            return;
+        }
+        Registered registered(*this, socket);
+
+        // Acks are drained so they never back up in the broker
+        std::thread drain([&socket] {
+            LineReader reader(socket);
+            std::string_view line;
+            while (reader.next(line)) {
+            }
+        });
+
+        auto interval = std::chrono::nanoseconds(static_cast<int64_t>(1e9 / std::max(1.0, config_.publish_rate)));
+        auto next = std::chrono::steady_clock::now();
+        const std::string payload(128, 'p');
+        for (uint64_t seq = 0; !stopping_; ++seq) {
+            std::string line = "PUBLISH:" + soak_topic(static_cast<int>(seq + index)) + ":" + payload + "\n";
+            std::error_code ec;
+            asio::write(socket, asio::buffer(line), ec);
+            if (ec) {
+                break;
+            }
+            next += interval;
+            std::this_thread::sleep_until(next);
+        }
+        ::shutdown(socket.native_handle(), SHUT_RDWR);
+        drain.join();
+    }
+
+    // Reads the busiest topic in bursts, pausing long enough to build backlog
+    void run_slow_consumer() {
+        asio::io_context io_context;
+        asio::ip::tcp::socket socket(io_context);
+        if (!connect(socket)) {
+            return;
+        }
+        Registered registered(*this, socket);
+        asio::socket_base::receive_buffer_size small_buffer(4096);
+        socket.set_option(small_buffer);
+        std::error_code ec;
+        asio::write(socket, asio::buffer(std::string("SUBSCRIBE:") + soak_topic(0) + "\n"), ec);
+
+        LineReader reader(socket);
+        std::string_view line;
+        while (!stopping_) {
+            auto burst_end = std::chrono::steady_clock::now() + std::chrono::milliseconds(800);
+            while (std::chrono::steady_clock::now() < burst_end && reader.next(line)) {
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+    }
+
+    void run_subscribe_storm() {
+        asio::io_context io_context;
+        asio::ip::tcp::socket socket(io_context);
+        if (!connect(socket)) {
+            return;
+        }
+        Registered registered(*this, socket);
+        std::thread drain([&socket] {
+            LineReader reader(socket);
+            std::string_view line;
+            while (reader.next(line)) {
+            }
+        });
+
+        while (!stopping_) {
+            std::string subscribe;
+            std::string unsubscribe;
+            for (int i = 0; i < config_.storm_topics; ++i) {
+                subscribe += "SUBSCRIBE:storm." + std::to_string(i) + "\n";
+                unsubscribe += "UNSUBSCRIBE:storm." + std::to_string(i) + "\n";
+            }
+            std::error_code ec;
+            asio::write(socket, asio::buffer(subscribe), ec);
+            if (!ec) {
+                asio::write(socket, asio::buffer(unsubscribe), ec);
+            }
+            if (ec) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        ::shutdown(socket.native_handle(), SHUT_RDWR);
+        drain.join();
+    }
+
+    const SoakConfig& config_;
+    asio::ip::tcp::endpoint endpoint_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<uint64_t> churn_cycles_{0};
+    std::vector<std::thread> threads_;
+    std::vector<asio::ip::tcp::socket*> sockets_;
+    std::mutex sockets_mutex_;
+};
+
+struct Trend {
+    double slope_per_min = 0.0;  // Least-squares slope
+    bool monotonic = false;      // Never decreased and ended higher
+};
+
+template <typename Field>
+Trend analyze(const std::vector<Sample>& samples, size_t first, Field field) {
+    Trend trend;
+    size_t n = samples.size() - first;
+    if (n < 3) {
+        return trend;
+    }
+    double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+    for (size_t i = first; i < samples.size(); ++i) {
+        double x = samples[i].elapsed_s / 60.0;
+        double y = static_cast<double>(field(samples[i]));
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+    }
+    double denominator = n * sum_xx - sum_x * sum_x;
+    trend.slope_per_min = denominator != 0 ? (n * sum_xy - sum_x * sum_y) / denominator : 0.0;
+
+    trend.monotonic = field(samples.back()) > field(samples[first]);
+    for (size_t i = first + 1; i < samples.size() && trend.monotonic; ++i) {
+        if (field(samples[i]) < field(samples[i - 1])) {
+            trend.monotonic = false;
+        }
+    }
+    return trend;
+}
+
+void print_usage(const char* program_name) {
+    std::cout << "\nUsage: " << program_name << " [options]\n"
+              << "\nOptions:\n"
+              << "  --duration S          Soak time in seconds (default 60)\n"
+              << "  --interval S          Sampling interval in seconds (default 1)\n"
+              << "  --warmup-fraction F   Leading fraction ignored by the verdict (default 0.2)\n"
+              << "  --churn N             Connect/disconnect clients (default 4)\n"
+              << "  --publishers N        Steady publishers (default 2)\n"
+              << "  --rate R              Msgs/s per publisher (default 500)\n"
+              << "  --slow-consumers N    Bursty slow subscribers (default 1)\n"
+              << "  --storm-topics N      Topics per subscribe storm, 0 = off (default 200)\n"
+              << "  --max-rss-slope KB    Allowed RSS growth in KB/min (default 256)\n"
+              << "  --csv FILE            Time series output (default soak.csv)\n"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    SoakConfig config;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::invalid_argument("missing value for " + arg);
+                }
+                return argv[++i];
+            };
+            if (arg == "--help" || arg == "-h") {
+                print_usage(argv[0]);
+                return 0;
+            } else if (arg == "--duration") {
+                config.duration_s = std::stod(value());
+            } else if (arg == "--interval") {
+                config.interval_s = std::stod(value());
+            } else if (arg == "--warmup-fraction") {
+                config.warmup_fraction = std::stod(value());
+            } else if (arg == "--churn") {
+                config.churn_clients = std::stoi(value());
+            } else if (arg == "--publishers") {
+                config.publishers = std::stoi(value());
+            } else if (arg == "--rate") {
+                config.publish_rate = std::stod(value());
+            } else if (arg == "--slow-consumers") {
+                config.slow_consumers = std::stoi(value());
+            } else if (arg == "--storm-topics") {
+                config.storm_topics = std::stoi(value());
+            } else if (arg == "--max-rss-slope") {
+                config.max_rss_slope_kb_per_min = std::stod(value());
+            } else if (arg == "--csv") {
+                config.csv_path = value();
+            } else {
+                throw std::invalid_argument("unknown option " + arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "np_soak: " << e.what() << std::endl;
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    // Churned clients make broker write errors routine; NEUROPIPE_LOG_LEVEL re-enables logs
+    set_log_level(LogLevel::Off);
+    apply_log_level_from_env();
+
+    std::ofstream csv(config.csv_path);
+    if (!csv) {
+        std::cerr << "np_soak: cannot write " << config.csv_path << std::endl;
+        return 2;
+    }
+    csv << "elapsed_s,rss_kb,fds,threads,sessions,topics,published,delivered\n";
+
+    asio::io_context io_context;
+    BrokerServer broker(io_context, 0);
+    broker.start();
+    std::vector<std::thread> io_threads;
+    for (int i = 0; i < 2; ++i) {
+        io_threads.emplace_back([&io_context] { io_context.run(); });
+    }
+
+    std::cout << "=== np_soak: " << config.duration_s << "s against in-process broker on port "
+              << broker.get_port() << ", CSV -> " << config.csv_path << " ===" << std::endl;
+
+    SoakLoad load(config, broker.get_port());
+    load.start();
+
+    std::vector<Sample> samples;
+    auto start = std::chrono::steady_clock::now();
+    auto next = start;
+    auto interval = std::chrono::milliseconds(static_cast<int64_t>(config.interval_s * 1000));
+    while (true) {
+        next += interval;
+        std::this_thread::sleep_until(next);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        TopicManager& topics = broker.get_topic_manager();
+        Sample sample{elapsed, read_status_field("VmRSS"), count_open_fds(), read_status_field("Threads"),
+                      broker.get_active_sessions(), broker.get_topic_count(),
+                      topics.get_published_count(), topics.get_delivered_count()};
+        samples.push_back(sample);
+        csv << std::fixed << std::setprecision(1) << sample.elapsed_s << "," << sample.rss_kb << ","
+            << sample.fds << "," << sample.threads << "," << sample.sessions << "," << sample.topics << ","
+            << sample.published << "," << sample.delivered << "\n";
+        csv.flush();
+
+        if (elapsed >= config.duration_s) {
+            break;
+        }
+    }
+
+    load.stop();
+    broker.stop();
+    io_context.stop();
+    for (auto& thread : io_threads) {
+        thread.join();
+    }
+
+    size_t first = static_cast<size_t>(samples.size() * std::clamp(config.warmup_fraction, 0.0, 0.9));
+    Trend rss = analyze(samples, first, [](const Sample& s) { return s.rss_kb; });
+    Trend fds = analyze(samples, first, [](const Sample& s) { return s.fds; });
+    Trend threads = analyze(samples, first, [](const Sample& s) { return s.threads; });
+    Trend sessions = analyze(samples, first, [](const Sample& s) { return static_cast<long>(s.sessions); });
+
+    auto report = [](const char* name, const Trend& trend, const char* unit) {
+        std::printf("  %-9s slope %+10.2f %s/min%s\n", name, trend.slope_per_min, unit,
+                    trend.monotonic ? "  (monotonic growth)" : "");
+    };
+    std::cout << "\n" << samples.size() << " samples, " << load.churn_cycles() << " churn connections" << std::endl;
+    report("rss", rss, "KB");
+    report("fds", fds, "");
+    report("threads", threads, "");
+    report("sessions", sessions, "");
+
+    bool failed = false;
+    if (rss.slope_per_min > config.max_rss_slope_kb_per_min) {
+        std::printf("FAIL: RSS grows %.1f KB/min (limit %.1f)\n", rss.slope_per_min, config.max_rss_slope_kb_per_min);
+        failed = true;
+    }
+    if (fds.monotonic) {
+        std::printf("FAIL: open fds grow monotonically (fd leak)\n");
+        failed = true;
+    }
+    if (threads.monotonic) {
+        std::printf("FAIL: threads grow monotonically\n");
+        failed = true;
+    }
+    if (sessions.monotonic) {
+        std::printf("WARN: broker session count grows monotonically (lingering sessions)\n");
+    }
+    std::cout << (failed ? "VERDICT: FAIL" : "VERDICT: PASS") << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <time.h>
+
+/**
+ * Latency trace stamps shared by DebugLogger, the broker and consumer_client.
+ *
+ * Traced messages carry one fixed-width hex stamp per hop so the broker can
+ * patch the enqueue/write stamps in place without re-formatting the line:
+ *
+ *   TPUBLISH:<send>:topic:payload                               (client -> broker)
+ *   TMESSAGE:<send>,<ingress>,<enqueue>,<write>:topic:payload   (broker -> client)
+ *
+ * Stamps are CLOCK_MONOTONIC nanoseconds. That clock is shared by every
+ * process on the host and is served from the vDSO, so it is cheap to read and
+ * stamps taken in different processes on the same host are comparable.
+ */
+namespace latency_trace {
+
+enum Hop : size_t {
+    HOP_SEND = 0,     // DebugLogger handed the line to send()
+    HOP_INGRESS = 1,  // Broker read completion for the line
+    HOP_ENQUEUE = 2,  // Pushed onto the subscriber's write queue
+    HOP_WRITE = 3,    // Handed to async_write on the subscriber socket
+    HOP_COUNT = 4
+};
+
+struct Stamps {
+    uint64_t ns[HOP_COUNT] = {0, 0, 0, 0};
+};
+
+constexpr size_t STAMP_WIDTH = 16;
+constexpr std::string_view PUBLISH_PREFIX = "TPUBLISH:";
+constexpr std::string_view MESSAGE_PREFIX = "TMESSAGE:";
+
+// Offset of a hop's stamp inside a TMESSAGE line
+constexpr size_t stamp_offset(Hop hop) {
+    return MESSAGE_PREFIX.size() + hop * (STAMP_WIDTH + 1);
+}
+
+// Offset of the topic inside a TMESSAGE line
+constexpr size_t MESSAGE_TOPIC_OFFSET = stamp_offset(HOP_COUNT);
+
+inline uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+inline void write_stamp(char* dst, uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = STAMP_WIDTH; i-- > 0;) {
+        dst[i] = digits[value & 0xf];
+        value >>= 4;
+    }
+}
+
+inline std::string format_stamp(uint64_t value) {
+    std::string out(STAMP_WIDTH, '0');
+    write_stamp(out.data(), value);
+    return out;
+}
+
+inline bool parse_stamp(std::string_view text, uint64_t& value) {
+    if (text.empty() || text.size() > STAMP_WIDTH) {
+        return false;
+    }
+    uint64_t result = 0;
+    for (char c : text) {
+        uint64_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        result = (result << 4) | digit;
+    }
+    value = result;
+    return true;
+}
+
+// Build a TMESSAGE line with the enqueue/write slots left zeroed
+inline std::string format_message(const Stamps& stamps, std::string_view topic,
+                                  const std::string& payload) {
+    std::string line;
+    line.reserve(MESSAGE_TOPIC_OFFSET + topic.size() + payload.size() + 2);
+    line.append(MESSAGE_PREFIX);
+    for (size_t hop = 0; hop < HOP_COUNT; ++hop) {
+        line.append(format_stamp(stamps.ns[hop]));
+        line.push_back(hop + 1 < HOP_COUNT ? ',' : ':');
+    }
+    line.append(topic);
+    line.push_back(':');
+    line.append(payload);
+    line.push_back('\n');
+    return line;
+}
+
+// Patch one hop's stamp in a TMESSAGE line in place
+inline void stamp_message(char* line, size_t size, Hop hop, uint64_t value) {
+    if (size > MESSAGE_TOPIC_OFFSET && std::string_view(line, MESSAGE_PREFIX.size()) == MESSAGE_PREFIX) {
+        write_stamp(line + stamp_offset(hop), value);
+    }
+}
+
+inline void stamp_message(std::string& line, Hop hop, uint64_t value) {
+    stamp_message(line.data(), line.size(), hop, value);
+}
+
+// Parse a TMESSAGE line into stamps, topic and payload
+inline bool parse_message(std::string_view line, Stamps& stamps,
+                          std::string_view& topic, std::string_view& payload) {
+    if (line.size() <= MESSAGE_TOPIC_OFFSET || line.substr(0, MESSAGE_PREFIX.size()) != MESSAGE_PREFIX) {
+        return false;
+    }
+    for (size_t hop = 0; hop < HOP_COUNT; ++hop) {
+        if (!parse_stamp(line.substr(stamp_offset(static_cast<Hop>(hop)), STAMP_WIDTH), stamps.ns[hop])) {
+            return false;
+        }
+    }
+    std::string_view rest = line.substr(MESSAGE_TOPIC_OFFSET);
+    size_t colon = rest.find(':');
+    if (colon == std::string_view::npos) {
+        return false;
+    }
+    topic = rest.substr(0, colon);
+    payload = rest.substr(colon + 1);
+    return true;
+}
+
+} // namespace latency_trace
@@ -0,0 +1,308 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+/**
+ * Batch compression shared by DebugLogger, the broker and consumer_client.
+ *
+ * The codec is a small LZ77 variant in the LZ4 block layout: a sequence is a
+ * token byte (literal count in the high nibble, match length - 4 in the low
+ * nibble, 15 meaning "more length bytes follow"), the literals, a 16-bit
+ * little-endian back-reference offset and any extra match length bytes. The
+ * last sequence carries literals only. Matches are found through a single
+ * hash table probe per position, so compression stays in the hundreds of
+ * MB/s and log lines (same timestamp prefix, level and service name on every
+ * line) shrink by several times.
+ *
+ * On the wire a connection opts in with COMPRESS:LZ (answered OK:COMPRESS:LZ,
+ * or ERROR:UNKNOWN_COMMAND by older brokers). After that either side may
+ * replace a run of complete lines with one frame:
+ *
+ *   ZBATCH:<raw_bytes>:<compressed_bytes>\n<compressed block>
+ *
+ * Plain lines stay valid on a compressed connection, so a sender decides per
+ * batch; Adaptive below makes that decision.
+ */
+namespace lz_codec {
+
+constexpr std::string_view BATCH_PREFIX = "ZBATCH:";
+
+// Receivers refuse frames announcing more than this
+constexpr size_t MAX_BATCH_BYTES = 4 << 20;
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 5;   // Blocks end with at least this many literals
+constexpr size_t MAX_OFFSET = 65535;
+constexpr int HASH_BITS = 12;
+
+inline size_t compress_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+namespace detail {
+
+inline uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+inline uint8_t* put_length(uint8_t* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = static_cast<uint8_t>(length);
+    return out;
+}
+
+inline uint8_t* put_literals(uint8_t* out, const uint8_t* literals, size_t count, size_t match_code) {
+    *out++ = static_cast<uint8_t>((std::min<size_t>(count, 15) << 4) | std::min<size_t>(match_code, 15));
+    if (count >= 15) {
+        out = put_length(out, count - 15);
+    }
+    std::memcpy(out, literals, count);
+    return out + count;
+}
+
+} // namespace detail
+
+// Append the compressed form of input to out; returns the compressed size
+inline size_t compress(std::string_view input, std::string& out) {
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(input.data());
+    const size_t size = input.size();
+    const size_t start = out.size();
+    out.resize(start + compress_bound(size));
+    uint8_t* dst = reinterpret_cast<uint8_t*>(out.data()) + start;
+    uint8_t* op = dst;
+
+    size_t anchor = 0;
+    if (size >= MIN_MATCH + LAST_LITERALS) {
+        uint32_t table[1 << HASH_BITS] = {};
+        const size_t match_limit = size - LAST_LITERALS;
+        size_t pos = 0;
+        size_t misses = 0;
+        while (pos + MIN_MATCH <= match_limit) {
+            uint32_t sequence = detail::read32(src + pos);
+            uint32_t& slot = table[detail::hash(sequence)];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(pos);
+            if (candidate >= pos || pos - candidate > MAX_OFFSET ||
+                detail::read32(src + candidate) != sequence) {
+                // Step faster through data that keeps missing (incompressible input)
+                pos += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+            size_t length = MIN_MATCH;
+            while (pos + length < match_limit && src[candidate + length] == src[pos + length]) {
+                ++length;
+            }
+            op = detail::put_literals(op, src + anchor, pos - anchor, length - MIN_MATCH);
+            size_t offset = pos - candidate;
+            *op++ = static_cast<uint8_t>(offset);
+            *op++ = static_cast<uint8_t>(offset >> 8);
+            if (length - MIN_MATCH >= 15) {
+                op = detail::put_length(op, length - MIN_MATCH - 15);
+            }
+            pos += length;
+            anchor = pos;
+        }
+    }
+    op = detail::put_literals(op, src + anchor, size - anchor, 0);
+
+    size_t written = static_cast<size_t>(op - dst);
+    out.resize(start + written);
+    return written;
+}
+
+// Append the raw_size bytes encoded by input to out; false on a corrupt block
+inline bool decompress(std::string_view input, size_t raw_size, std::string& out) {
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(input.data());
+    const uint8_t* const end = ip + input.size();
+    const size_t start = out.size();
+    out.resize(start + raw_size);
+    uint8_t* const base = reinterpret_cast<uint8_t*>(out.data()) + start;
+    uint8_t* op = base;
+    uint8_t* const op_end = base + raw_size;
+
+    auto read_length = [&](size_t& length) {
+        uint8_t byte;
+        do {
+            if (ip == end) {
+                return false;
+            }
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    };
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !read_length(literals)) {
+            break;
+        }
+        if (literals > static_cast<size_t>(end - ip) || literals > static_cast<size_t>(op_end - op)) {
+            break;
+        }
+        std::memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == end) {
+            // Last sequence: literals only
+            if (op == op_end) {
+                return true;
+            }
+            break;
+        }
+
+        if (end - ip < 2) {
+            break;
+        }
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        size_t length = token & 0xf;
+        if (length == 15 && !read_length(length)) {
+            break;
+        }
+        length += MIN_MATCH;
+        if (offset == 0 || offset > static_cast<size_t>(op - base) ||
+            length > static_cast<size_t>(op_end - op)) {
+            break;
+        }
+        const uint8_t* match = op - offset;
+        if (offset >= length) {
+            std::memcpy(op, match, length);
+        } else {
+            // Overlapping match: it repeats the bytes it produces
+            for (size_t i = 0; i < length; ++i) {
+                op[i] = match[i];
+            }
+        }
+        op += length;
+    }
+    out.resize(start);
+    return false;
+}
+
+// Replace frame with the ZBATCH frame (header included) for a run of complete
+// lines. Callers send the lines plain instead when the frame is not smaller.
+inline void encode_batch(std::string_view lines, std::string& frame) {
+    frame.clear();
+    compress(lines, frame);
+    std::string header = std::string(BATCH_PREFIX) + std::to_string(lines.size()) + ":" +
+                         std::to_string(frame.size()) + "\n";
+    frame.insert(0, header);
+}
+
+// Parse a ZBATCH header line (without its newline)
+inline bool parse_batch_header(std::string_view line, size_t& raw_size, size_t& compressed_size) {
+    if (line.substr(0, BATCH_PREFIX.size()) != BATCH_PREFIX) {
+        return false;
+    }
+    line.remove_prefix(BATCH_PREFIX.size());
+    size_t colon = line.find(':');
+    if (colon == 0 || colon == std::string_view::npos || colon + 1 == line.size()) {
+        return false;
+    }
+    auto parse = [](std::string_view digits, size_t& value) {
+        value = 0;
+        for (char c : digits) {
+            if (c < '0' || c > '9' || value > MAX_BATCH_BYTES) {
+                return false;
+            }
+            value = value * 10 + static_cast<size_t>(c - '0');
+        }
+        return value <= MAX_BATCH_BYTES;
+    };
+    return parse(line.substr(0, colon), raw_size) && parse(line.substr(colon + 1), compressed_size);
+}
+
+/**
+ * Per-connection decision whether a batch is worth compressing.
+ *
+ * Batches under min_batch_bytes go out plain. Every compressed batch feeds a
+ * moving average of the compression ratio and of the bytes saved per
+ * microsecond of CPU; when either falls below its threshold the sender stops
+ * compressing for a back-off of batches (doubling while the data stays
+ * incompressible) and then probes again with the next batch.
+ */
+class Adaptive {
+public:
+    size_t min_batch_bytes = 512;
+    double max_ratio = 0.8;                 // compressed / raw above this is not worth it
+    double min_saved_bytes_per_us = 32.0;   // below this the CPU costs more than the bytes
+    uint32_t initial_backoff = 16;
+    uint32_t max_backoff = 1024;
+
+    bool should_compress(size_t batch_bytes) {
+        if (batch_bytes < min_batch_bytes) {
+            return false;
+        }
+        if (skip_ > 0) {
+            --skip_;
+            return false;
+        }
+        return true;
+    }
+
+    // Account a batch as sent: wire_bytes is the frame or, if sent plain, raw_bytes
+    void record(size_t raw_bytes, size_t wire_bytes) {
+        batches_++;
+        raw_bytes_ += raw_bytes;
+        wire_bytes_ += wire_bytes;
+        if (wire_bytes < raw_bytes) {
+            compressed_batches_++;
+        }
+    }
+
+    // Feed back a compression attempt: frame size and CPU time spent on it
+    void observe(size_t raw_bytes, size_t frame_bytes, uint64_t cpu_ns) {
+        double ratio = static_cast<double>(frame_bytes) / static_cast<double>(raw_bytes);
+        double saved = raw_bytes > frame_bytes ? static_cast<double>(raw_bytes - frame_bytes) : 0.0;
+        double saved_per_us = saved / (static_cast<double>(cpu_ns) / 1000.0 + 1e-3);
+        ratio_ = ratio_ < 0 ? ratio : ratio_ + (ratio - ratio_) * ALPHA;
+        saved_per_us_ = saved_per_us_ < 0 ? saved_per_us : saved_per_us_ + (saved_per_us - saved_per_us_) * ALPHA;
+
+        if (ratio_ > max_ratio || saved_per_us_ < min_saved_bytes_per_us) {
+            uint32_t backoff = backoff_ ? backoff_ : initial_backoff;
+            skip_ = backoff;
+            backoff_ = std::min(backoff * 2, max_backoff);
+            // Judge the next probe on its own rather than on the history that failed
+            ratio_ = -1;
+            saved_per_us_ = -1;
+        } else {
+            backoff_ = 0;
+        }
+    }
+
+    bool backing_off() const { return skip_ > 0; }
+    uint64_t batches() const { return batches_; }
+    uint64_t compressed_batches() const { return compressed_batches_; }
+    uint64_t raw_bytes() const { return raw_bytes_; }
+    uint64_t wire_bytes() const { return wire_bytes_; }
+
+private:
+    static constexpr double ALPHA = 0.25;
+
+    uint32_t skip_ = 0;
+    uint32_t backoff_ = 0;  // 0: next back-off starts at initial_backoff
+    double ratio_ = -1;
+    double saved_per_us_ = -1;
+    uint64_t batches_ = 0;
+    uint64_t compressed_batches_ = 0;
+    uint64_t raw_bytes_ = 0;
+    uint64_t wire_bytes_ = 0;
+};
+
+} // namespace lz_codec
@@ -1,16 +1,27 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <chrono>
 #include <cstdint>
+#include "slab_alloc.hpp"
+#include "topic_table.hpp"
 
 struct Message {
-    std::string topic;
-    std::string payload;
+    TopicId topic;  // Interned name, see topics::name()
+    Payload payload;  // Inline when short, else a slab block (slab_alloc.hpp)
     uint64_t sequence;
     std::chrono::system_clock::time_point timestamp;
-    
-    // Constructor
-    Message(const std::string& t, const std::string& p)
-        : topic(t), payload(p), sequence(0), 
+
+    // Latency trace stamps (CLOCK_MONOTONIC ns, zero when the publish was untraced)
+    uint64_t send_ns = 0;
+    uint64_t ingress_ns = 0;
+
+    // Constructors
+    Message(TopicId t, std::string_view p)
+        : topic(t), payload(p), sequence(0),
           timestamp(std::chrono::system_clock::now()) {}
-};
\ No newline at end of file
+    Message(std::string_view t, std::string_view p)
+        : Message(topics::intern(t), p) {}
+
+    const std::string& topic_name() const { return topics::name(topic); }
+};
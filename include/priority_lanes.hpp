@@ -0,0 +1,87 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+/**
+ * Outbound queue split by priority class, so a connection saturated by bulk
+ * topics still gets critical messages out promptly.
+ *
+ * Each class has its own FIFO lane; order is kept within a lane only. The
+ * writer asks pick() which lane to take from next:
+ *
+ *   strict    the highest non-empty lane, always; lower lanes wait for it
+ *             to drain
+ *   weighted  lanes take turns, lane i sending up to weights[i] messages per
+ *             turn, so every lane progresses and the higher ones get the
+ *             larger share
+ *
+ * Not synchronized.
+ */
+enum class Priority : uint8_t { High, Normal, Low };
+
+constexpr size_t PRIORITY_COUNT = 3;
+
+struct LaneSchedule {
+    bool strict = false;
+    std::array<uint32_t, PRIORITY_COUNT> weights = {16, 4, 1};  // Messages per turn (weighted)
+};
+
+template <typename T>
+class PriorityLanes {
+public:
+    explicit PriorityLanes(const LaneSchedule& schedule = LaneSchedule()) : schedule_(schedule) {}
+
+    void push(Priority priority, T value) {
+        lanes_[static_cast<size_t>(priority)].push_back(std::move(value));
+        ++size_;
+    }
+    T& back(Priority priority) { return lanes_[static_cast<size_t>(priority)].back(); }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    std::deque<T>& lane(size_t index) { return lanes_[index]; }
+
+    // Lane the next message comes from; the queue must not be empty
+    size_t pick() {
+        if (schedule_.strict) {
+            size_t index = 0;
+            while (lanes_[index].empty()) {
+                ++index;
+            }
+            return index;
+        }
+        // A turn ends when the lane runs out of messages or of its weight
+        while (lanes_[turn_].empty() || used_ >= std::max<uint32_t>(1, schedule_.weights[turn_])) {
+            turn_ = (turn_ + 1) % PRIORITY_COUNT;
+            used_ = 0;
+        }
+        ++used_;
+        return turn_;
+    }
+
+    // Drop the first count messages of a lane (written)
+    void pop(size_t index, size_t count) {
+        std::deque<T>& lane = lanes_[index];
+        lane.erase(lane.begin(), lane.begin() + count);
+        size_ -= count;
+    }
+
+    void clear() {
+        for (std::deque<T>& lane : lanes_) {
+            lane.clear();
+        }
+        size_ = 0;
+    }
+
+private:
+    LaneSchedule schedule_;
+    std::array<std::deque<T>, PRIORITY_COUNT> lanes_;
+    size_t size_ = 0;
+    size_t turn_ = 0;    // Weighted: lane whose turn it is
+    uint32_t used_ = 0;  // and messages it has sent this turn
+};
@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string_view>
+
+/**
+ * Shared-memory message ring between one producer process and the broker.
+ *
+ * A producer (DebugLogger) creates the ring in /dev/shm, maps it, and hands
+ * its name to the broker with SHM:ATTACH:<name> over the broker's Unix
+ * socket. The broker maps the same pages and answers with an eventfd
+ * (SCM_RIGHTS) that the producer rings only when the broker has gone to
+ * sleep, so a busy broker is fed without any syscalls.
+ *
+ * Layout: a Header, then `capacity` data bytes (a power of two). Each record
+ * is a 32-bit state word followed by one protocol line without its newline,
+ * padded to 8 bytes. Producer threads claim space with a CAS on `reserve`,
+ * copy the line, then publish the state word with COMMITTED set. A record
+ * that would straddle the end of the buffer is preceded by a PADDING record
+ * filling the tail. The broker consumes committed records in order, zeroes
+ * them and advances `consumed`.
+ *
+ * A producer that dies mid-write leaves an uncommitted record. The broker
+ * only ever stops at such a record; it sees the producer's death as the
+ * close of its control connection, drains what was committed and unmaps.
+ */
+namespace shm_ring {
+
+constexpr uint64_t MAGIC = 0x31474e4952504e;  // "NPRING1"
+constexpr uint32_t DEFAULT_CAPACITY = 1 << 20;
+constexpr size_t DATA_OFFSET = 256;
+constexpr size_t RECORD_ALIGN = 8;
+
+constexpr uint32_t COMMITTED = 0x80000000u;
+constexpr uint32_t PADDING = 0x40000000u;
+constexpr uint32_t LENGTH_MASK = 0x3fffffffu;
+
+// Prefix of ring names; the broker maps nothing else
+constexpr std::string_view NAME_PREFIX = "/neuropipe_ring_";
+
+struct Header {
+    uint64_t magic;
+    uint32_t capacity;
+    uint32_t reserved;
+    alignas(64) std::atomic<uint64_t> reserve;          // Next byte producers will claim
+    alignas(64) std::atomic<uint64_t> consumed;         // Everything before this is free again
+    alignas(64) std::atomic<uint32_t> consumer_waiting; // Broker is (about to be) asleep on the eventfd
+    std::atomic<uint64_t> dropped;                      // Lines the producer dropped on a full ring
+};
+static_assert(sizeof(Header) <= DATA_OFFSET, "ring header overlaps the data area");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring counters must be lock-free across processes");
+
+inline size_t mapping_size(uint32_t capacity) {
+    return DATA_OFFSET + capacity;
+}
+
+inline size_t record_size(size_t length) {
+    return (sizeof(uint32_t) + length + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+}
+
+// Initialise a freshly created, zero-filled mapping
+inline Header* init(void* base, uint32_t capacity) {
+    auto* header = new (base) Header();
+    header->magic = MAGIC;
+    header->capacity = capacity;
+    return header;
+}
+
+namespace detail {
+
+inline std::atomic_ref<uint32_t> state(uint8_t* data, uint64_t offset) {
+    return std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t*>(data + offset));
+}
+
+} // namespace detail
+
+// Writing side; any number of threads of the producer process may share one
+class Producer {
+public:
+    Producer() = default;
+    explicit Producer(void* base)
+        : header_(static_cast<Header*>(base)),
+          data_(static_cast<uint8_t*>(base) + DATA_OFFSET),
+          mask_(header_->capacity - 1) {}
+
+    // Copy one line into the ring without blocking or system calls. False
+    // (and the line counted as dropped) when the ring is full. wake is set
+    // when the caller must signal the broker's eventfd.
+    bool write(std::string_view line, bool& wake) {
+        wake = false;
+        const uint64_t capacity = mask_ + 1;
+        const size_t need = record_size(line.size());
+        if (line.size() > LENGTH_MASK || need > capacity / 2) {
+            header_->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        uint64_t position = header_->reserve.load(std::memory_order_relaxed);
+        uint64_t padding;
+        do {
+            uint64_t offset = position & mask_;
+            padding = offset + need > capacity ? capacity - offset : 0;
+            if (position + padding + need - header_->consumed.load(std::memory_order_acquire) > capacity) {
+                header_->dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!header_->reserve.compare_exchange_weak(position, position + padding + need,
+                                                         std::memory_order_relaxed,
+                                                         std::memory_order_relaxed));
+
+        if (padding) {
+            detail::state(data_, position & mask_).store(COMMITTED | PADDING | static_cast<uint32_t>(padding),
+                                                         std::memory_order_release);
+            position += padding;
+        }
+        uint64_t offset = position & mask_;
+        std::memcpy(data_ + offset + sizeof(uint32_t), line.data(), line.size());
+        detail::state(data_, offset).store(COMMITTED | static_cast<uint32_t>(line.size()),
+                                           std::memory_order_release);
+
+        // Pairs with the fence in Consumer::prepare_wait: either the broker
+        // sees this record before sleeping or we see it waiting
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (header_->consumer_waiting.load(std::memory_order_relaxed) &&
+            header_->consumer_waiting.exchange(0, std::memory_order_relaxed)) {
+            wake = true;
+        }
+        return true;
+    }
+
+    uint64_t dropped() const { return header_->dropped.load(std::memory_order_relaxed); }
+
+private:
+    Header* header_ = nullptr;
+    uint8_t* data_ = nullptr;
+    uint64_t mask_ = 0;
+};
+
+// Reading side (the broker); single-threaded
+class Consumer {
+public:
+    // False if the mapping is not a ring of a size that fits mapped_size
+    bool attach(void* base, size_t mapped_size) {
+        auto* header = static_cast<Header*>(base);
+        uint32_t capacity = header->capacity;
+        if (mapped_size < DATA_OFFSET || header->magic != MAGIC || capacity < 64 ||
+            (capacity & (capacity - 1)) != 0 || mapping_size(capacity) > mapped_size) {
+            return false;
+        }
+        header_ = header;
+        data_ = static_cast<uint8_t*>(base) + DATA_OFFSET;
+        mask_ = capacity - 1;
+        return true;
+    }
+
+    // Hand up to max committed lines to f in order. Returns the number of
+    // lines, or -1 if the ring is corrupt (the producer broke the format).
+    template <typename F>
+    long drain(F&& f, size_t max) {
+        const uint64_t capacity = mask_ + 1;
+        uint64_t position = header_->consumed.load(std::memory_order_relaxed);
+        long lines = 0;
+        while (static_cast<size_t>(lines) < max) {
+            uint64_t offset = position & mask_;
+            uint32_t state = detail::state(data_, offset).load(std::memory_order_acquire);
+            if (!(state & COMMITTED)) {
+                break;
+            }
+            uint64_t span;
+            if (state & PADDING) {
+                span = state & LENGTH_MASK;
+                if (span != capacity - offset) {
+                    lines = -1;
+                    break;
+                }
+            } else {
+                size_t length = state & LENGTH_MASK;
+                span = record_size(length);
+                if (offset + span > capacity) {
+                    lines = -1;
+                    break;
+                }
+                f(std::string_view(reinterpret_cast<const char*>(data_ + offset + sizeof(uint32_t)), length));
+                lines++;
+            }
+            // Zeroed so the next lap only finds state words producers wrote
+            std::memset(data_ + offset, 0, span);
+            position += span;
+        }
+        header_->consumed.store(position, std::memory_order_release);
+        return lines;
+    }
+
+    // Announce that the broker is going to sleep on the eventfd. False if a
+    // record arrived meanwhile, in which case it must drain instead.
+    bool prepare_wait() {
+        header_->consumer_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t offset = header_->consumed.load(std::memory_order_relaxed) & mask_;
+        if (detail::state(data_, offset).load(std::memory_order_acquire) & COMMITTED) {
+            header_->consumer_waiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t dropped() const { return header_->dropped.load(std::memory_order_relaxed); }
+
+private:
+    Header* header_ = nullptr;
+    uint8_t* data_ = nullptr;
+    uint64_t mask_ = 0;
+};
+
+} // namespace shm_ring
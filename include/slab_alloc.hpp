@@ -0,0 +1,428 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+
+/**
+ * Per-thread slab allocator for message bodies (Message::payload and the
+ * lines queued on sessions).
+ *
+ * Bodies fall into a few size bands (short metric=value strings, 100-300
+ * byte DebugLogger lines), so blocks come in 23 size classes from 32 bytes
+ * to 2 KiB, at most 1.25x apart above 128 bytes. A class is carved from
+ * 64 KiB slabs aligned to their size, so masking a block's address finds its
+ * slab header and with it the class and the owning thread. Slabs are cut
+ * from 2 MiB mappings; pages are only touched as blocks are carved.
+ *
+ * Each thread allocates from its own cache without locks. A block freed on
+ * its owner thread goes straight back on the owner's free list. A block
+ * freed on another thread is added to that thread's outgoing batch for the
+ * owner, and the batch is handed over with one compare-and-swap when it
+ * fills, when a block of another owner comes along, or when the thread
+ * exits. The owner takes every handed-over block of a class at once when its
+ * own free list runs dry.
+ *
+ * Larger bodies go to operator new. The cache of an exited thread is kept
+ * and given to the next new thread, so blocks outliving their thread are
+ * still freed correctly. Slabs are never returned to the system.
+ *
+ * Payload wraps the allocator in a string-like value; bodies up to
+ * INLINE_CAPACITY bytes are stored in the object itself.
+ */
+namespace slab {
+
+constexpr size_t SLAB_SIZE = 64 * 1024;  // Power of two; slabs are aligned to it
+constexpr size_t CLASS_SIZES[] = {32,  48,  64,  80,  96,  112, 128,  160,  192,  224,  256, 320,
+                                  384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048};
+constexpr size_t CLASS_COUNT = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+constexpr size_t MAX_BLOCK = CLASS_SIZES[CLASS_COUNT - 1];
+constexpr size_t REGION_SLABS = 32;    // Slabs per mapping
+constexpr uint32_t REMOTE_BATCH = 32;  // Blocks handed to another thread at once
+
+struct Stats {
+    uint64_t slabs = 0;               // 64 KiB slabs carved so far
+    uint64_t live_blocks = 0;         // Slab blocks allocated and not yet freed
+    uint64_t live_bytes = 0;          // Their capacity
+    uint64_t large_allocations = 0;   // Bodies above MAX_BLOCK (operator new)
+    uint64_t remote_frees = 0;        // Blocks freed on a thread other than their owner
+    uint64_t remote_batches = 0;      // Hand-overs carrying those blocks
+    uint64_t slab_bytes() const { return slabs * SLAB_SIZE; }
+};
+
+namespace detail {
+
+// Class index by (size + 15) / 16; every class size is a multiple of 16
+inline constexpr auto CLASS_BY_16 = [] {
+    std::array<uint8_t, MAX_BLOCK / 16 + 1> table{};
+    size_t cls = 0;
+    for (size_t i = 0; i < table.size(); ++i) {
+        while (CLASS_SIZES[cls] < i * 16) {
+            ++cls;
+        }
+        table[i] = static_cast<uint8_t>(cls);
+    }
+    return table;
+}();
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct ThreadCache;
+
+struct alignas(64) SlabHeader {
+    ThreadCache* owner;
+    size_t size_class;
+};
+
+// Counter written by one thread only and read by stats() from any
+struct OwnedCounter {
+    std::atomic<uint64_t> value{0};
+    void add(uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+struct ThreadCache {
+    struct Class {
+        FreeBlock* free = nullptr;
+        char* bump = nullptr;              // Uncarved rest of the newest slab
+        char* bump_end = nullptr;
+        std::atomic<FreeBlock*> remote{nullptr};  // Handed over by other threads
+    };
+    // Blocks this thread freed for one other owner, not handed over yet
+    struct Batch {
+        ThreadCache* owner = nullptr;
+        FreeBlock* head = nullptr;
+        FreeBlock* tail = nullptr;
+        uint32_t count = 0;
+    };
+
+    Class classes[CLASS_COUNT];
+    Batch outgoing[CLASS_COUNT];
+    char* region = nullptr;              // Unused slabs of the newest mapping
+    char* region_end = nullptr;
+
+    // Live blocks are allocated minus freed, summed over all caches
+    OwnedCounter slabs, allocated_blocks, allocated_bytes, freed_blocks, freed_bytes;
+    OwnedCounter large_allocations, remote_frees, remote_batches;
+
+    ThreadCache* next = nullptr;         // Registry list of every cache
+    ThreadCache* next_orphan = nullptr;
+};
+
+struct Registry {
+    std::mutex mutex;
+    ThreadCache* caches = nullptr;
+    ThreadCache* orphans = nullptr;      // Caches of exited threads
+};
+
+inline Registry& registry() {
+    // Never destroyed: blocks may be freed during static destruction
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+inline thread_local ThreadCache* tl_cache = nullptr;
+inline thread_local bool tl_exited = false;
+
+inline void hand_over(ThreadCache::Batch& batch, size_t cls) {
+    if (!batch.head) {
+        return;
+    }
+    auto& remote = batch.owner->classes[cls].remote;
+    FreeBlock* head = remote.load(std::memory_order_relaxed);
+    do {
+        batch.tail->next = head;
+    } while (!remote.compare_exchange_weak(head, batch.head, std::memory_order_release,
+                                           std::memory_order_relaxed));
+    batch = ThreadCache::Batch{};
+}
+
+inline void flush_outgoing(ThreadCache* cache) {
+    for (size_t cls = 0; cls < CLASS_COUNT; ++cls) {
+        if (cache->outgoing[cls].head) {
+            cache->remote_batches.add(1);
+            hand_over(cache->outgoing[cls], cls);
+        }
+    }
+}
+
+struct ThreadRelease {
+    ~ThreadRelease() {
+        ThreadCache* cache = tl_cache;
+        flush_outgoing(cache);
+        tl_cache = nullptr;
+        tl_exited = true;
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        cache->next_orphan = reg.orphans;
+        reg.orphans = cache;
+    }
+};
+
+[[gnu::noinline]] inline ThreadCache* attach_thread() {
+    ThreadCache* cache;
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        cache = reg.orphans;
+        if (cache) {
+            reg.orphans = cache->next_orphan;
+            cache->next_orphan = nullptr;
+        } else {
+            cache = new ThreadCache();
+            cache->next = reg.caches;
+            reg.caches = cache;
+        }
+    }
+    tl_cache = cache;
+    // A thread still allocating after its release ran (static destructors
+    // of the main thread) keeps this cache for good
+    if (!tl_exited) {
+        static thread_local ThreadRelease release;
+        (void)release;
+    }
+    return cache;
+}
+
+inline ThreadCache* cache() {
+    ThreadCache* cache = tl_cache;
+    return cache ? cache : attach_thread();
+}
+
+// Map REGION_SLABS slabs aligned to SLAB_SIZE (over-map, then trim both ends)
+inline void map_region(ThreadCache* cache) {
+    size_t size = REGION_SLABS * SLAB_SIZE;
+    void* mapping = mmap(nullptr, size + SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    auto start = reinterpret_cast<uintptr_t>(mapping);
+    uintptr_t aligned = (start + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1);
+    if (aligned > start) {
+        munmap(mapping, aligned - start);
+    }
+    if (start + SLAB_SIZE > aligned) {
+        munmap(reinterpret_cast<void*>(aligned + size), start + SLAB_SIZE - aligned);
+    }
+    cache->region = reinterpret_cast<char*>(aligned);
+    cache->region_end = cache->region + size;
+}
+
+[[gnu::noinline]] inline FreeBlock* carve_slab(ThreadCache* cache, size_t cls) {
+    if (cache->region == cache->region_end) {
+        map_region(cache);
+    }
+    void* memory = cache->region;
+    cache->region += SLAB_SIZE;
+    auto header = new (memory) SlabHeader{cache, cls};
+    auto& entry = cache->classes[cls];
+    entry.bump = reinterpret_cast<char*>(header + 1);
+    entry.bump_end = static_cast<char*>(memory) + SLAB_SIZE;
+    cache->slabs.add(1);
+    auto block = reinterpret_cast<FreeBlock*>(entry.bump);
+    entry.bump += CLASS_SIZES[cls];
+    return block;
+}
+
+}  // namespace detail
+
+inline size_t size_class(size_t size) {
+    return detail::CLASS_BY_16[(size + 15) / 16];
+}
+
+// Block of at least size bytes; capacity receives its usable size, which
+// deallocate() needs back
+inline void* allocate(size_t size, size_t& capacity) {
+    detail::ThreadCache* cache = detail::cache();
+    if (size > MAX_BLOCK) {
+        cache->large_allocations.add(1);
+        capacity = size;
+        return ::operator new(size);
+    }
+    size_t cls = size_class(size);
+    capacity = CLASS_SIZES[cls];
+    auto& entry = cache->classes[cls];
+    detail::FreeBlock* block = entry.free;
+    if (!block && entry.remote.load(std::memory_order_relaxed)) {
+        block = entry.remote.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (block) {
+        entry.free = block->next;
+    } else if (entry.bump && entry.bump + capacity <= entry.bump_end) {
+        block = reinterpret_cast<detail::FreeBlock*>(entry.bump);
+        entry.bump += capacity;
+    } else {
+        block = detail::carve_slab(cache, cls);
+    }
+    cache->allocated_blocks.add(1);
+    cache->allocated_bytes.add(capacity);
+    return block;
+}
+
+inline void deallocate(void* pointer, size_t capacity) {
+    if (capacity > MAX_BLOCK) {
+        ::operator delete(pointer);
+        return;
+    }
+    detail::ThreadCache* cache = detail::cache();
+    auto header = reinterpret_cast<detail::SlabHeader*>(reinterpret_cast<uintptr_t>(pointer) & ~(SLAB_SIZE - 1));
+    size_t cls = header->size_class;
+    auto block = static_cast<detail::FreeBlock*>(pointer);
+    cache->freed_blocks.add(1);
+    cache->freed_bytes.add(CLASS_SIZES[cls]);
+    if (header->owner == cache) {
+        auto& entry = cache->classes[cls];
+        block->next = entry.free;
+        entry.free = block;
+        return;
+    }
+    cache->remote_frees.add(1);
+    auto& batch = cache->outgoing[cls];
+    if (batch.owner != header->owner || batch.count == REMOTE_BATCH) {
+        if (batch.head) {
+            cache->remote_batches.add(1);
+            detail::hand_over(batch, cls);
+        }
+        batch.owner = header->owner;
+    }
+    block->next = batch.head;
+    batch.head = block;
+    if (!batch.tail) {
+        batch.tail = block;
+    }
+    ++batch.count;
+}
+
+// Hand this thread's outgoing batches over now (a thread about to idle)
+inline void flush() {
+    if (detail::tl_cache) {
+        detail::flush_outgoing(detail::tl_cache);
+    }
+}
+
+inline Stats stats() {
+    Stats total;
+    uint64_t freed_blocks = 0;
+    uint64_t freed_bytes = 0;
+    detail::Registry& reg = detail::registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (detail::ThreadCache* cache = reg.caches; cache; cache = cache->next) {
+        total.slabs += cache->slabs.get();
+        total.live_blocks += cache->allocated_blocks.get();
+        total.live_bytes += cache->allocated_bytes.get();
+        freed_blocks += cache->freed_blocks.get();
+        freed_bytes += cache->freed_bytes.get();
+        total.large_allocations += cache->large_allocations.get();
+        total.remote_frees += cache->remote_frees.get();
+        total.remote_batches += cache->remote_batches.get();
+    }
+    // Counters of different threads are read at slightly different times
+    total.live_blocks = total.live_blocks > freed_blocks ? total.live_blocks - freed_blocks : 0;
+    total.live_bytes = total.live_bytes > freed_bytes ? total.live_bytes - freed_bytes : 0;
+    return total;
+}
+
+}  // namespace slab
+
+// Message body: inline up to INLINE_CAPACITY bytes, else a slab block
+class Payload {
+public:
+    static constexpr size_t INLINE_CAPACITY = 24;
+
+    Payload() noexcept : data_(inline_), size_(0), capacity_(0) {}
+    Payload(std::string_view text) { init(text); }
+    Payload(const std::string& text) { init(text); }
+    Payload(const char* text) { init(text); }
+    Payload(const Payload& other) { init(other.view()); }
+    Payload(Payload&& other) noexcept { steal(other); }
+    ~Payload() { release(); }
+
+    Payload& operator=(const Payload& other) {
+        if (this != &other) {
+            assign(other.view());
+        }
+        return *this;
+    }
+    Payload& operator=(Payload&& other) noexcept {
+        if (this != &other) {
+            release();
+            steal(other);
+        }
+        return *this;
+    }
+
+    void assign(std::string_view text) {
+        if (text.size() > capacity()) {
+            release();
+            init(text);
+            return;
+        }
+        std::memmove(data_, text.data(), text.size());
+        size_ = static_cast<uint32_t>(text.size());
+    }
+
+    char* data() { return data_; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    bool is_inline() const { return data_ == inline_; }
+
+    std::string_view view() const { return std::string_view(data_, size_); }
+    operator std::string_view() const { return view(); }
+    std::string str() const { return std::string(data_, size_); }
+
+    friend bool operator==(const Payload& payload, std::string_view text) { return payload.view() == text; }
+
+private:
+    size_t capacity() const { return is_inline() ? INLINE_CAPACITY : capacity_; }
+
+    void init(std::string_view text) {
+        size_ = static_cast<uint32_t>(text.size());
+        if (text.size() <= INLINE_CAPACITY) {
+            data_ = inline_;
+            capacity_ = 0;
+        } else {
+            size_t capacity;
+            data_ = static_cast<char*>(slab::allocate(text.size(), capacity));
+            capacity_ = static_cast<uint32_t>(capacity);
+        }
+        std::memcpy(data_, text.data(), text.size());
+    }
+
+    void steal(Payload& other) noexcept {
+        size_ = other.size_;
+        if (other.is_inline()) {
+            data_ = inline_;
+            capacity_ = 0;
+            std::memcpy(inline_, other.inline_, other.size_);
+        } else {
+            data_ = other.data_;
+            capacity_ = other.capacity_;
+        }
+        other.data_ = other.inline_;
+        other.size_ = 0;
+        other.capacity_ = 0;
+    }
+
+    void release() {
+        if (!is_inline()) {
+            slab::deallocate(data_, capacity_);
+            data_ = inline_;
+            capacity_ = 0;
+        }
+    }
+
+    char* data_;
+    uint32_t size_;
+    uint32_t capacity_;  // Block size; 0 while inline
+    char inline_[INLINE_CAPACITY];
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Hierarchical timer wheel: many timeouts behind one clock.
+ *
+ * Time is counted in ticks. Level 0 has a slot per tick for the next 256
+ * ticks; each level above covers 256 times the span of the one below. An
+ * entry goes into the lowest level whose span reaches its tick and moves
+ * down when the wheel turns onto its slot, so scheduling is O(1) and an
+ * entry moves at most LEVELS - 1 times before it fires. Deadlines past
+ * the top level's span fire at its end.
+ *
+ * Entries cannot be cancelled: the owner checks, when one fires, whether
+ * it is still wanted, and schedules it again when its deadline moved. Not
+ * synchronized. Slots keep their capacity, so a wheel that has reached its
+ * working size schedules without allocating.
+ */
+template <typename T>
+class TimerWheel {
+public:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 8;
+    static constexpr size_t SLOTS = size_t{1} << SLOT_BITS;
+    static constexpr uint64_t SPAN = uint64_t{1} << (LEVELS * SLOT_BITS);  // Ticks ahead the wheel reaches
+
+    explicit TimerWheel(uint64_t now = 0) : current_(now) {}
+
+    // Fire value at tick (the next tick when that has passed)
+    void schedule(uint64_t tick, T value) {
+        insert(tick <= current_ ? current_ + 1 : tick, std::move(value));
+        ++size_;
+    }
+
+    // Turn the wheel to now, calling fire(T&&) for every entry that is due;
+    // fire may schedule new entries
+    template <typename Fire>
+    void advance(uint64_t now, Fire&& fire) {
+        while (current_ < now) {
+            if (size_ == 0) {
+                current_ = now;  // Nothing to move or fire on the way
+                return;
+            }
+            ++current_;
+            cascade();
+            std::vector<Entry>& slot = levels_[0][current_ & (SLOTS - 1)];
+            if (slot.empty()) {
+                continue;
+            }
+            // Whatever fire() schedules lands at a later tick, so not here
+            firing_.swap(slot);
+            size_ -= firing_.size();
+            for (Entry& entry : firing_) {
+                fire(std::move(entry.value));
+            }
+            firing_.clear();
+        }
+    }
+
+    uint64_t now() const { return current_; }
+    size_t size() const { return size_; }
+
+private:
+    struct Entry {
+        uint64_t tick;
+        T value;
+    };
+
+    void insert(uint64_t tick, T value) {
+        uint64_t delta = tick - current_;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (uint64_t{1} << ((level + 1) * SLOT_BITS))) {
+            ++level;
+        }
+        if (delta >= SPAN) {
+            tick = current_ + SPAN - 1;
+        }
+        levels_[level][(tick >> (level * SLOT_BITS)) & (SLOTS - 1)].push_back(Entry{tick, std::move(value)});
+    }
+
+    // A level's slot comes due when the digits below it roll over to zero;
+    // its entries are spread over the levels below, highest level first
+    void cascade() {
+        int top = 0;
+        while (top < LEVELS - 1 && (current_ & ((uint64_t{1} << ((top + 1) * SLOT_BITS)) - 1)) == 0) {
+            ++top;
+        }
+        for (int level = top; level > 0; --level) {
+            std::vector<Entry>& slot = levels_[level][(current_ >> (level * SLOT_BITS)) & (SLOTS - 1)];
+            if (slot.empty()) {
+                continue;
+            }
+            moving_.swap(slot);
+            for (Entry& entry : moving_) {
+                insert(entry.tick, std::move(entry.value));
+            }
+            moving_.clear();
+        }
+    }
+
+    uint64_t current_;
+    size_t size_ = 0;
+    std::array<std::array<std::vector<Entry>, SLOTS>, LEVELS> levels_;
+    std::vector<Entry> firing_;
+    std::vector<Entry> moving_;
+};
@@ -0,0 +1,140 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Topic interning: each distinct topic name gets a small integer id, handed
+ * out in order from 0, so per-topic state can live in plain vectors.
+ *
+ * TopicTable is a flat open-addressing hash table (linear probing, power of
+ * two capacity, load factor at most 1/2). A slot holds the name's hash and
+ * its id; the names themselves sit in a deque so references to them stay
+ * valid. Lookups take a std::string_view, so a topic parsed out of a
+ * protocol line is resolved without building a std::string. The table is
+ * not synchronized.
+ *
+ * topics:: below is the process-wide table behind Message. Ids are never
+ * reused and names never freed, so an id stays meaningful for the life of
+ * the process.
+ */
+using TopicId = uint32_t;
+
+class TopicTable {
+public:
+    static constexpr TopicId NONE = UINT32_MAX;
+
+    TopicTable() : slots_(INITIAL_SLOTS) {}
+
+    // Id of name, or NONE when it was never interned
+    TopicId find(std::string_view name) const {
+        return slots_[probe(name, hash(name))].id;
+    }
+
+    TopicId intern(std::string_view name) {
+        size_t h = hash(name);
+        Slot& slot = slots_[probe(name, h)];
+        if (slot.id != NONE) {
+            return slot.id;
+        }
+        TopicId id = static_cast<TopicId>(names_.size());
+        names_.emplace_back(name);
+        hashes_.push_back(h);
+        slot = Slot{h, id};
+        if (names_.size() * 2 > slots_.size()) {
+            grow();
+        }
+        return id;
+    }
+
+    const std::string& name(TopicId id) const { return names_[id]; }
+    size_t size() const { return names_.size(); }
+
+private:
+    static constexpr size_t INITIAL_SLOTS = 64;  // Power of two
+
+    struct Slot {
+        size_t hash = 0;
+        TopicId id = NONE;
+    };
+
+    static size_t hash(std::string_view name) { return std::hash<std::string_view>{}(name); }
+
+    // Slot holding name, or the empty slot where it would go
+    size_t probe(std::string_view name, size_t h) const {
+        size_t mask = slots_.size() - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            const Slot& slot = slots_[i];
+            if (slot.id == NONE || (slot.hash == h && names_[slot.id] == name)) {
+                return i;
+            }
+        }
+    }
+
+    void grow() {
+        std::vector<Slot> slots(slots_.size() * 2);
+        size_t mask = slots.size() - 1;
+        for (TopicId id = 0; id < names_.size(); ++id) {
+            size_t i = hashes_[id] & mask;
+            while (slots[i].id != NONE) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = Slot{hashes_[id], id};
+        }
+        slots_.swap(slots);
+    }
+
+    std::vector<Slot> slots_;
+    std::deque<std::string> names_;  // By id; deque keeps references stable
+    std::vector<size_t> hashes_;     // By id, for rehashing
+};
+
+namespace topics {
+
+namespace detail {
+
+struct Registry {
+    std::shared_mutex mutex;
+    TopicTable table;
+};
+
+inline Registry& registry() {
+    // Never destroyed: messages may be handled during static destruction
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+}  // namespace detail
+
+inline TopicId find(std::string_view name) {
+    auto& registry = detail::registry();
+    std::shared_lock<std::shared_mutex> lock(registry.mutex);
+    return registry.table.find(name);
+}
+
+inline TopicId intern(std::string_view name) {
+    auto& registry = detail::registry();
+    {
+        std::shared_lock<std::shared_mutex> lock(registry.mutex);
+        TopicId id = registry.table.find(name);
+        if (id != TopicTable::NONE) {
+            return id;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(registry.mutex);
+    return registry.table.intern(name);
+}
+
+inline const std::string& name(TopicId id) {
+    auto& registry = detail::registry();
+    std::shared_lock<std::shared_mutex> lock(registry.mutex);
+    return registry.table.name(id);
+}
+
+}  // namespace topics
@@ -0,0 +1,273 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Read-only shared-memory tail of a topic, for local readers.
+ *
+ * With TAIL:START:<topic> (or NEUROPIPE_TAIL_TOPICS) the broker copies every
+ * message published to the topic into a ring of fixed-size slots in
+ * /dev/shm/neuropipe_tail_<topic>. Local processes map it read-only and
+ * follow it at their own pace; the broker does not know they exist, so a
+ * reader costs it nothing.
+ *
+ * Each slot is a seqlock: the broker sets the slot's sequence word to
+ * 2n+1 while it writes message n and to 2n+2 once done, then advances
+ * `head`. A reader copies the slot and checks the word again. A word above
+ * what it expected means the broker has lapped it. The reader then skips
+ * ahead to half a ring behind `head` and reports how many messages it
+ * lost. Payloads longer than a slot are truncated.
+ */
+namespace topic_tail {
+
+constexpr uint64_t MAGIC = 0x314c494154504e;  // "NPTAIL1"
+constexpr uint32_t DEFAULT_SLOT_COUNT = 4096;
+constexpr uint32_t DEFAULT_SLOT_SIZE = 512;
+constexpr size_t DATA_OFFSET = 256;
+constexpr size_t SLOT_HEADER = 16;
+
+constexpr uint32_t FLAG_TRUNCATED = 1;
+
+constexpr std::string_view NAME_PREFIX = "/neuropipe_tail_";
+
+struct Header {
+    uint64_t magic;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    alignas(64) std::atomic<uint64_t> head;    // Messages written so far
+    std::atomic<uint32_t> closed;              // Broker stopped the tail
+};
+static_assert(sizeof(Header) <= DATA_OFFSET, "tail header overlaps the slots");
+
+struct Slot {
+    std::atomic<uint64_t> sequence;  // 2n+1 while message n is written, 2n+2 after
+    uint32_t length;
+    uint32_t flags;
+    // Followed by slot_size - SLOT_HEADER payload bytes
+};
+static_assert(sizeof(Slot) == SLOT_HEADER, "unexpected slot header layout");
+
+inline size_t mapping_size(uint32_t slot_count, uint32_t slot_size) {
+    return DATA_OFFSET + static_cast<size_t>(slot_count) * slot_size;
+}
+
+// Shared-memory object name for topic; empty when the topic has characters
+// that cannot appear in one
+inline std::string shm_name(const std::string& topic) {
+    if (topic.empty() || topic.size() > 200) {
+        return "";
+    }
+    for (char c : topic) {
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '_' || c == '-' || c == '.')) {
+            return "";
+        }
+    }
+    return std::string(NAME_PREFIX) + topic;
+}
+
+// Broker side; one thread at a time
+class Writer {
+public:
+    Writer() = default;
+
+    // Lay out a ring in zero-filled memory of mapping_size(slot_count, slot_size)
+    Writer(void* base, uint32_t slot_count, uint32_t slot_size)
+        : header_(new (base) Header()),
+          slots_(static_cast<uint8_t*>(base) + DATA_OFFSET),
+          slot_count_(slot_count),
+          slot_size_(slot_size) {
+        header_->slot_count = slot_count;
+        header_->slot_size = slot_size;
+        header_->magic = MAGIC;
+    }
+
+    void append(std::string_view payload) {
+        uint64_t n = header_->head.load(std::memory_order_relaxed);
+        uint8_t* slot_base = slots_ + (n % slot_count_) * slot_size_;
+        auto* slot = reinterpret_cast<Slot*>(slot_base);
+        size_t capacity = slot_size_ - SLOT_HEADER;
+        size_t length = std::min(payload.size(), capacity);
+
+        slot->sequence.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->length = static_cast<uint32_t>(length);
+        slot->flags = length < payload.size() ? FLAG_TRUNCATED : 0;
+        std::memcpy(slot_base + SLOT_HEADER, payload.data(), length);
+        slot->sequence.store(2 * n + 2, std::memory_order_release);
+        header_->head.store(n + 1, std::memory_order_release);
+    }
+
+    // Tell readers no more messages will come through this mapping
+    void close() { header_->closed.store(1, std::memory_order_release); }
+
+private:
+    Header* header_ = nullptr;
+    uint8_t* slots_ = nullptr;
+    uint32_t slot_count_ = 0;
+    uint32_t slot_size_ = 0;
+};
+
+// Reader side; any number of processes, each at its own position
+class Reader {
+public:
+    enum class Status {
+        Message,   // payload holds the next message
+        Empty,     // Caught up with the broker
+        Lapped,    // Overrun: skipped() messages were lost, reading resumes
+        Closed     // The broker stopped this tail
+    };
+
+    Reader() = default;
+    ~Reader() { unmap(); }
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // Map the tail of topic read-only. Starts with the next message, or with
+    // the oldest one still in the ring when from_oldest is set.
+    bool open(const std::string& topic, bool from_oldest = false) {
+        unmap();
+        std::string name = shm_name(topic);
+        if (name.empty()) {
+            return false;
+        }
+        int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(DATA_OFFSET)) {
+            ::close(fd);
+            return false;
+        }
+        size_t size = static_cast<size_t>(info.st_size);
+        void* base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+        mapped_ = base;
+        mapped_size_ = size;
+        inode_ = info.st_ino;
+        name_ = name;
+        if (!attach(base, size, from_oldest)) {
+            unmap();
+            return false;
+        }
+        return true;
+    }
+
+    // Follow a ring mapped by the caller
+    bool attach(const void* base, size_t size, bool from_oldest = false) {
+        auto* header = static_cast<const Header*>(base);
+        if (size < DATA_OFFSET || header->magic != MAGIC || header->slot_count == 0 ||
+            header->slot_size <= SLOT_HEADER || header->slot_size % 8 != 0 ||
+            mapping_size(header->slot_count, header->slot_size) > size) {
+            return false;
+        }
+        header_ = header;
+        slots_ = static_cast<const uint8_t*>(base) + DATA_OFFSET;
+        slot_count_ = header->slot_count;
+        slot_size_ = header->slot_size;
+        uint64_t head = header_->head.load(std::memory_order_acquire);
+        if (!from_oldest) {
+            next_ = head;
+        } else {
+            // The oldest slot is the next one the broker overwrites
+            next_ = head >= slot_count_ ? head - slot_count_ + 1 : 0;
+        }
+        return true;
+    }
+
+    Status next(std::string& payload) {
+        const uint8_t* slot_base = slots_ + (next_ % slot_count_) * slot_size_;
+        auto* slot = reinterpret_cast<const Slot*>(slot_base);
+        const uint64_t expected = 2 * next_ + 2;
+
+        uint64_t before = slot->sequence.load(std::memory_order_acquire);
+        if (before < expected) {
+            // Not written yet (or being written right now)
+            if (header_->closed.load(std::memory_order_acquire) &&
+                next_ >= header_->head.load(std::memory_order_acquire)) {
+                return Status::Closed;
+            }
+            return Status::Empty;
+        }
+        if (before == expected) {
+            size_t length = std::min<size_t>(slot->length, slot_size_ - SLOT_HEADER);
+            truncated_ = (slot->flags & FLAG_TRUNCATED) != 0;
+            payload.assign(reinterpret_cast<const char*>(slot_base + SLOT_HEADER), length);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->sequence.load(std::memory_order_relaxed) == before) {
+                next_++;
+                return Status::Message;
+            }
+        }
+
+        // Overwritten before or while we read it: move to half a ring
+        // behind the broker, which leaves room before it laps us again
+        uint64_t head = header_->head.load(std::memory_order_acquire);
+        uint64_t resume = head > slot_count_ / 2 ? head - slot_count_ / 2 : 0;
+        skipped_ = resume > next_ ? resume - next_ : 1;
+        next_ = std::max(resume, next_ + 1);
+        lost_ += skipped_;
+        return Status::Lapped;
+    }
+
+    // True when the broker has since created a new ring under this name
+    // (after a restart); open() again to follow it
+    bool replaced() const {
+        if (name_.empty()) {
+            return false;
+        }
+        int fd = shm_open(name_.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        bool other = fstat(fd, &info) == 0 && info.st_ino != inode_;
+        ::close(fd);
+        return other;
+    }
+
+    bool is_open() const { return header_ != nullptr; }
+    bool truncated() const { return truncated_; }     // Last message was cut to the slot size
+    uint64_t skipped() const { return skipped_; }     // Messages lost by the last Lapped
+    uint64_t lost() const { return lost_; }           // Messages lost in total
+    uint64_t position() const { return next_; }
+
+private:
+    void unmap() {
+        if (mapped_) {
+            munmap(mapped_, mapped_size_);
+            mapped_ = nullptr;
+        }
+        header_ = nullptr;
+        name_.clear();
+    }
+
+    const Header* header_ = nullptr;
+    const uint8_t* slots_ = nullptr;
+    uint32_t slot_count_ = 0;
+    uint32_t slot_size_ = 0;
+    uint64_t next_ = 0;
+    uint64_t skipped_ = 0;
+    uint64_t lost_ = 0;
+    bool truncated_ = false;
+    void* mapped_ = nullptr;
+    size_t mapped_size_ = 0;
+    ino_t inode_ = 0;
+    std::string name_;
+};
+
+} // namespace topic_tail
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+/**
+ * Broker addresses shared by DebugLogger, the broker and the clients.
+ *
+ * A host of the form "unix:/path/to/socket" selects the broker's Unix domain
+ * stream socket instead of TCP (the port is ignored). Same-host clients skip
+ * the TCP loopback stack that way; the line protocol is identical.
+ */
+namespace transport {
+
+constexpr std::string_view UNIX_PREFIX = "unix:";
+
+// Where the broker listens unless NEUROPIPE_UNIX_SOCKET says otherwise
+constexpr const char* DEFAULT_UNIX_PATH = "/tmp/neuropipe.sock";
+
+inline bool is_unix_address(std::string_view host) {
+    return host.substr(0, UNIX_PREFIX.size()) == UNIX_PREFIX;
+}
+
+// Socket path of a unix: address
+inline std::string unix_path(std::string_view host) {
+    return std::string(host.substr(UNIX_PREFIX.size()));
+}
+
+// Human-readable form of a broker address, for connection messages
+inline std::string describe(const std::string& host, const std::string& port) {
+    return is_unix_address(host) ? host : host + ":" + port;
+}
+
+} // namespace transport
@@ -1,5 +1,10 @@
 #include "debug_logger.hpp"
+#include "../include/latency_trace.hpp"
+#include <algorithm>
 #include <iostream>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 DebugLogger::DebugLogger(const std::string& service_name,
                          const std::string& broker_host,
@@ -8,28 +13,54 @@ DebugLogger::DebugLogger(const std::string& service_name,
       broker_host_(broker_host),
       broker_port_(broker_port),
       socket_fd_(-1),
-      connected_(false) {
+      connected_(false),
+      latency_trace_(false) {
     
     connect_to_broker();
 }
 
 DebugLogger::~DebugLogger() {
+    if (flush_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(socket_mutex_);
+            stopping_ = true;
+        }
+        flush_cv_.notify_all();
+        flush_thread_.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(socket_mutex_);
+        flush_batch();
+    }
     if (socket_fd_ >= 0) {
         close(socket_fd_);
     }
 }
 
+DebugLogger::SharedRing::~SharedRing() {
+    if (event_fd >= 0) {
+        close(event_fd);
+    }
+    if (base) {
+        munmap(base, size);
+    }
+}
+
 void DebugLogger::connect_to_broker() {
     std::lock_guard<std::mutex> lock(socket_mutex_);
     
     // Close existing connection if any
+    detach_shared_memory();
     if (socket_fd_ >= 0) {
         close(socket_fd_);
         socket_fd_ = -1;
     }
     
+    // Same-host brokers are reachable over their Unix domain socket
+    bool unix_socket = transport::is_unix_address(broker_host_);
+    
     // Create socket
-    socket_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    socket_fd_ = socket(unix_socket ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
     if (socket_fd_ < 0) {
         std::cerr << "[DebugLogger] Failed to create socket" << std::endl;
         connected_ = false;
@@ -43,23 +74,41 @@ void DebugLogger::connect_to_broker() {
     setsockopt(socket_fd_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
     
     // Setup server address
-    struct sockaddr_in server_addr;
+    struct sockaddr_storage server_addr;
+    socklen_t server_addr_len;
     std::memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(broker_port_);
-    
-    if (inet_pton(AF_INET, broker_host_.c_str(), &server_addr.sin_addr) <= 0) {
-        std::cerr << "[DebugLogger] Invalid broker address: " << broker_host_ << std::endl;
-        close(socket_fd_);
-        socket_fd_ = -1;
-        connected_ = false;
-        return;
+    if (unix_socket) {
+        std::string path = transport::unix_path(broker_host_);
+        auto* unix_addr = reinterpret_cast<struct sockaddr_un*>(&server_addr);
+        if (path.empty() || path.size() >= sizeof(unix_addr->sun_path)) {
+            std::cerr << "[DebugLogger] Invalid broker socket path: " << broker_host_ << std::endl;
+            close(socket_fd_);
+            socket_fd_ = -1;
+            connected_ = false;
+            return;
+        }
+        unix_addr->sun_family = AF_UNIX;
+        std::memcpy(unix_addr->sun_path, path.c_str(), path.size() + 1);
+        server_addr_len = sizeof(struct sockaddr_un);
+    } else {
+        auto* inet_addr = reinterpret_cast<struct sockaddr_in*>(&server_addr);
+        inet_addr->sin_family = AF_INET;
+        inet_addr->sin_port = htons(broker_port_);
+        
+        if (inet_pton(AF_INET, broker_host_.c_str(), &inet_addr->sin_addr) <= 0) {
+            std::cerr << "[DebugLogger] Invalid broker address: " << broker_host_ << std::endl;
+            close(socket_fd_);
+            socket_fd_ = -1;
+            connected_ = false;
+            return;
+        }
+        server_addr_len = sizeof(struct sockaddr_in);
     }
     
     // Connect to broker
-    if (connect(socket_fd_, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+    if (connect(socket_fd_, (struct sockaddr*)&server_addr, server_addr_len) < 0) {
         std::cerr << "[DebugLogger] Failed to connect to broker at " 
-                  << broker_host_ << ":" << broker_port_ << std::endl;
+                  << transport::describe(broker_host_, std::to_string(broker_port_)) << std::endl;
         close(socket_fd_);
         socket_fd_ = -1;
         connected_ = false;
@@ -67,6 +116,273 @@ void DebugLogger::connect_to_broker() {
     }
     
     connected_ = true;
+    
+    if (shm_requested_) {
+        attach_shared_memory();
+    }
+    if (compression_requested_ && !ring_.load()) {
+        negotiate_compression();
+    }
+}
+
+void DebugLogger::negotiate_compression() {
+    compression_ = false;
+    static const char request[] = "COMPRESS:LZ\n";
+    if (!send_all(request, sizeof(request) - 1)) {
+        return;
+    }
+    
+    std::string reply;
+    read_reply(reply, nullptr);
+    compression_ = (reply == "OK:COMPRESS:LZ");
+    if (!compression_) {
+        std::cerr << "[DebugLogger] Broker declined compression (" << reply << "), sending plain" << std::endl;
+    }
+}
+
+bool DebugLogger::read_reply(std::string& reply, int* received_fd) {
+    // Read a byte at a time so nothing after the reply is consumed; the
+    // timeout bounds the wait on a broker that never answers. Acks of
+    // earlier publishes and detaches are skipped.
+    struct timeval timeout;
+    timeout.tv_sec = 2;
+    timeout.tv_usec = 0;
+    setsockopt(socket_fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (true) {
+        reply.clear();
+        bool complete = false;
+        while (reply.size() < 64) {
+            char c;
+            struct iovec iov = {&c, 1};
+            char control[CMSG_SPACE(sizeof(int))];
+            struct msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(socket_fd_, &msg, MSG_CMSG_CLOEXEC) != 1) {
+                return false;
+            }
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+                if (received_fd && *received_fd < 0) {
+                    *received_fd = fd;
+                } else {
+                    close(fd);
+                }
+            }
+            if (c == '\n') {
+                complete = true;
+                break;
+            }
+            reply.push_back(c);
+        }
+        if (!complete || (reply != "OK:PUBLISHED" && reply != "OK:SHM:DETACHED")) {
+            return complete;
+        }
+    }
+}
+
+void DebugLogger::attach_shared_memory() {
+    if (!transport::is_unix_address(broker_host_)) {
+        std::cerr << "[DebugLogger] Shared memory needs a unix: broker address, sending over the socket" << std::endl;
+        return;
+    }
+    
+    release_rings();
+    
+    // The name only lives until the broker has mapped the ring
+    static std::atomic<int> counter{0};
+    std::string name = std::string(shm_ring::NAME_PREFIX) + std::to_string(getpid()) + "_" +
+                       std::to_string(counter.fetch_add(1));
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        std::cerr << "[DebugLogger] Cannot create shared-memory ring: " << std::strerror(errno) << std::endl;
+        return;
+    }
+    auto ring = std::make_unique<SharedRing>();
+    ring->size = shm_ring::mapping_size(shm_ring::DEFAULT_CAPACITY);
+    void* base = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(ring->size)) == 0) {
+        base = mmap(nullptr, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        std::cerr << "[DebugLogger] Cannot map shared-memory ring: " << std::strerror(errno) << std::endl;
+        return;
+    }
+    ring->base = base;
+    shm_ring::init(base, shm_ring::DEFAULT_CAPACITY);
+    ring->producer = shm_ring::Producer(base);
+    
+    std::string request = "SHM:ATTACH:" + name + "\n";
+    std::string reply;
+    bool answered = send_all(request.data(), request.size()) && read_reply(reply, &ring->event_fd);
+    shm_unlink(name.c_str());
+    if (!answered) {
+        return;
+    }
+    if (reply != "OK:SHM:ATTACHED" || ring->event_fd < 0) {
+        std::cerr << "[DebugLogger] Broker declined shared memory (" << reply << "), sending over the socket" << std::endl;
+        return;
+    }
+    ring_.store(ring.get());
+    rings_.push_back(std::move(ring));
+}
+
+void DebugLogger::detach_shared_memory() {
+    ring_.store(nullptr);
+    release_rings();
+}
+
+void DebugLogger::release_rings() {
+    // ring_ changed before this load, so a publisher that counts itself in
+    // after it can only see the current ring
+    if (ring_writers_.load() != 0) {
+        return;  // Next time
+    }
+    SharedRing* current = ring_.load();
+    rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+                                [current](const std::unique_ptr<SharedRing>& ring) { return ring.get() != current; }),
+                 rings_.end());
+}
+
+void DebugLogger::set_shared_memory(bool enabled) {
+    shm_requested_ = enabled;
+    std::lock_guard<std::mutex> lock(socket_mutex_);
+    if (enabled) {
+        if (connected_ && !ring_.load()) {
+            flush_batch();
+            attach_shared_memory();
+        }
+    } else if (ring_.load()) {
+        detach_shared_memory();
+        if (connected_) {
+            // The broker drains the ring before it answers the next command
+            static const char request[] = "SHM:DETACH\n";
+            send_all(request, sizeof(request) - 1);
+        }
+    }
+}
+
+// Lock-free path of send_message; false if no ring is attached. A message
+// that finds the ring full is dropped (true): sending it over the socket
+// instead would put it ahead of lines still in the ring.
+bool DebugLogger::write_shared_memory(const std::string& protocol_msg) {
+    ring_writers_.fetch_add(1);
+    SharedRing* ring = ring_.load();
+    if (!ring) {
+        ring_writers_.fetch_sub(1, std::memory_order_release);
+        return false;
+    }
+    bool wake;
+    std::string_view line(protocol_msg.data(), protocol_msg.size() - 1);  // Records carry no newline
+    bool written = ring->producer.write(line, wake);
+    if (written && wake) {
+        uint64_t one = 1;
+        ssize_t ignored = write(ring->event_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+    ring_writers_.fetch_sub(1, std::memory_order_release);  // ring may be released from here on
+    if (written) {
+        return true;
+    }
+    
+    // Full: a broker that died stops draining, which shows as EOF on the
+    // control connection
+    std::lock_guard<std::mutex> lock(socket_mutex_);
+    if (ring_.load() != ring) {
+        return true;
+    }
+    char buffer[256];
+    ssize_t received;
+    while ((received = recv(socket_fd_, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+    }
+    if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        detach_shared_memory();
+        connected_ = false;
+        std::cerr << "[DebugLogger] Broker gone, shared-memory ring detached" << std::endl;
+    }
+    return true;  // Dropped, like messages sent while disconnected
+}
+
+void DebugLogger::set_compression(bool enabled) {
+    compression_requested_ = enabled;
+    std::lock_guard<std::mutex> lock(socket_mutex_);
+    if (enabled) {
+        if (connected_ && !compression_) {
+            negotiate_compression();
+        }
+        if (!flush_thread_.joinable()) {
+            // Bounds how long a quiet service's last messages sit in the batch
+            flush_thread_ = std::thread([this]() {
+                std::unique_lock<std::mutex> lock(socket_mutex_);
+                while (!stopping_) {
+                    flush_cv_.wait_for(lock, BATCH_LINGER);
+                    flush_batch();
+                }
+            });
+        }
+    } else {
+        flush_batch();
+        if (compression_ && connected_) {
+            static const char request[] = "COMPRESS:OFF\n";
+            send_all(request, sizeof(request) - 1);
+        }
+        compression_ = false;
+    }
+}
+
+void DebugLogger::flush() {
+    std::lock_guard<std::mutex> lock(socket_mutex_);
+    flush_batch();
+}
+
+void DebugLogger::flush_batch() {
+    if (batch_.empty()) {
+        return;
+    }
+    if (!connected_) {
+        batch_.clear();  // Dropped, like unbatched messages while disconnected
+        return;
+    }
+    
+    const std::string* out = &batch_;
+    if (compression_ && compression_policy_.should_compress(batch_.size())) {
+        uint64_t begin_ns = latency_trace::now_ns();
+        lz_codec::encode_batch(batch_, batch_frame_);
+        compression_policy_.observe(batch_.size(), batch_frame_.size(), latency_trace::now_ns() - begin_ns);
+        if (batch_frame_.size() < batch_.size()) {
+            out = &batch_frame_;
+        }
+    }
+    compression_policy_.record(batch_.size(), out->size());
+    
+    if (!send_all(out->data(), out->size())) {
+        connected_ = false;
+        std::cerr << "[DebugLogger] Send failed, connection lost" << std::endl;
+    }
+    batch_.clear();
+}
+
+bool DebugLogger::send_all(const char* data, size_t length) {
+    // A short write would cut a compressed frame, so keep going until done
+    while (length > 0) {
+        ssize_t sent = send(socket_fd_, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        length -= static_cast<size_t>(sent);
+    }
+    return true;
 }
 
 bool DebugLogger::reconnect() {
@@ -120,10 +436,44 @@ void DebugLogger::send_message(const std::string& topic, const std::string& mess
     }
     
     // Format as NeuroPipe protocol: PUBLISH:topic:payload\n
-    std::string protocol_msg = "PUBLISH:" + topic + ":" + message + "\n";
+    // (TPUBLISH:send_stamp:topic:payload\n in latency trace mode)
+    std::string protocol_msg;
+    if (latency_trace_) {
+        protocol_msg.reserve(latency_trace::PUBLISH_PREFIX.size() + latency_trace::STAMP_WIDTH +
+                             topic.size() + message.size() + 3);
+        protocol_msg.append(latency_trace::PUBLISH_PREFIX);
+        protocol_msg.append(latency_trace::STAMP_WIDTH, '0');
+        protocol_msg += ":" + topic + ":" + message + "\n";
+    } else {
+        protocol_msg = "PUBLISH:" + topic + ":" + message + "\n";
+    }
+    
+    if (ring_.load(std::memory_order_relaxed)) {
+        if (latency_trace_) {
+            latency_trace::write_stamp(protocol_msg.data() + latency_trace::PUBLISH_PREFIX.size(),
+                                       latency_trace::now_ns());
+        }
+        if (write_shared_memory(protocol_msg)) {
+            return;
+        }
+    }
     
     std::lock_guard<std::mutex> lock(socket_mutex_);
     
+    if (latency_trace_) {
+        // Stamp once the socket is ours so the send hop excludes lock waits
+        latency_trace::write_stamp(protocol_msg.data() + latency_trace::PUBLISH_PREFIX.size(),
+                                   latency_trace::now_ns());
+    }
+    
+    if (compression_) {
+        batch_ += protocol_msg;
+        if (batch_.size() >= BATCH_BYTES) {
+            flush_batch();
+        }
+        return;
+    }
+    
     ssize_t sent = send(socket_fd_, protocol_msg.c_str(), protocol_msg.length(), MSG_NOSIGNAL);
     if (sent < 0) {
         // Connection lost, mark as disconnected
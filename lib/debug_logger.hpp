@@ -7,10 +7,18 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <cstring>
 #include <atomic>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+#include "../include/lz_codec.hpp"
+#include "../include/shm_ring.hpp"
+#include "../include/transport.hpp"
 
 /**
  * DebugLogger - Simple logging library for NeuroPipe
@@ -29,8 +37,9 @@ public:
     /**
      * Create logger for a service
      * @param service_name Name of your service (e.g., "order_service")
-     * @param broker_host Broker hostname (default: "127.0.0.1")
-     * @param broker_port Broker port (default: 9092)
+     * @param broker_host Broker hostname (default: "127.0.0.1"), or
+     *                    "unix:/path" for the broker's Unix domain socket
+     * @param broker_port Broker port (default: 9092, unused for unix:)
      */
     DebugLogger(const std::string& service_name, 
                 const std::string& broker_host = "127.0.0.1",
@@ -58,8 +67,47 @@ public:
     // Reconnect to broker
     bool reconnect();
     
+    /**
+     * Latency trace mode: stamp each message with its send time (TPUBLISH)
+     * so consumers running with --latency can report per-hop latency.
+     */
+    void set_latency_trace(bool enabled) { latency_trace_ = enabled; }
+    bool latency_trace() const { return latency_trace_; }
+    
+    /**
+     * Batch compression: negotiate COMPRESS:LZ with the broker and send
+     * messages in compressed batches. A batch goes out once it reaches
+     * BATCH_BYTES or has waited BATCH_LINGER; small or incompressible batches
+     * are sent plain. Brokers without compression get plain lines as before.
+     */
+    void set_compression(bool enabled);
+    bool compression() const { return compression_; }  // Negotiated and active
+    
+    // Send any batched messages now
+    void flush();
+    
+    /**
+     * Shared-memory mode (unix: brokers only): messages are copied into a
+     * ring shared with the broker instead of being sent, so publishing
+     * makes no system calls while the broker keeps up. Messages are dropped
+     * while the ring is full. Takes precedence over compression.
+     */
+    void set_shared_memory(bool enabled);
+    bool shared_memory() const { return ring_.load() != nullptr; }  // Attached and active
+    
+    static constexpr size_t BATCH_BYTES = 16 * 1024;
+    static constexpr std::chrono::milliseconds BATCH_LINGER{20};
+    
 private:
     void connect_to_broker();
+    void negotiate_compression();  // Caller holds socket_mutex_
+    void flush_batch();            // Caller holds socket_mutex_
+    bool send_all(const char* data, size_t length);
+    bool read_reply(std::string& reply, int* received_fd);  // Caller holds socket_mutex_
+    void attach_shared_memory();   // Caller holds socket_mutex_
+    void detach_shared_memory();   // Caller holds socket_mutex_
+    void release_rings();          // Caller holds socket_mutex_
+    bool write_shared_memory(const std::string& protocol_msg);
     void send_message(const std::string& topic, const std::string& message);
     std::string get_timestamp();
     std::string format_log_message(const std::string& level, const std::string& message);
@@ -70,7 +118,33 @@ private:
     int broker_port_;
     int socket_fd_;
     std::atomic<bool> connected_;
+    std::atomic<bool> latency_trace_;
     std::mutex socket_mutex_;
+    
+    std::atomic<bool> compression_requested_{false};
+    std::atomic<bool> compression_{false};
+    std::string batch_;
+    std::string batch_frame_;
+    lz_codec::Adaptive compression_policy_;
+    std::thread flush_thread_;
+    std::condition_variable flush_cv_;
+    bool stopping_ = false;
+    
+    // A detached ring stays mapped while another thread may still be writing
+    // into it: publishers count themselves in ring_writers_ around their use
+    // of ring_, and release_rings() frees the detached ones when it sees no
+    // publisher at work, so reconnects do not pile up mappings and eventfds
+    struct SharedRing {
+        void* base = nullptr;
+        size_t size = 0;
+        int event_fd = -1;
+        shm_ring::Producer producer;
+        ~SharedRing();
+    };
+    std::atomic<bool> shm_requested_{false};
+    std::atomic<SharedRing*> ring_{nullptr};
+    std::atomic<int> ring_writers_{0};
+    std::vector<std::unique_ptr<SharedRing>> rings_;  // The attached one and any not yet released
 };
 
 /**
@@ -0,0 +1,200 @@
+#include "alloc_accounting.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <iomanip>
+
+namespace alloc_accounting {
+
+namespace {
+
+// One cache line per tag so threads working in different subsystems
+// do not bounce each other's counters
+struct alignas(64) AtomicCounters {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> frees{0};
+};
+
+AtomicCounters g_counters[TAG_COUNT];
+
+// Trivially initialized so it is safe to touch from inside operator new
+thread_local Tag t_current_tag = Tag::Untagged;
+
+const char* const TAG_NAMES[TAG_COUNT] = {
+    "untagged", "session_setup", "read", "parse", "publish", "fanout", "write"
+};
+
+[[maybe_unused]] void count_allocation(size_t size) {
+    auto& counters = g_counters[static_cast<size_t>(t_current_tag)];
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+[[maybe_unused]] void count_free() {
+    g_counters[static_cast<size_t>(t_current_tag)].frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace
+
+Counters Snapshot::total() const {
+    Counters sum;
+    for (const auto& counters : per_tag) {
+        sum.allocations += counters.allocations;
+        sum.bytes += counters.bytes;
+        sum.frees += counters.frees;
+    }
+    return sum;
+}
+
+uint64_t Snapshot::allocations(std::initializer_list<Tag> tags) const {
+    uint64_t sum = 0;
+    for (Tag tag : tags) {
+        sum += per_tag[static_cast<size_t>(tag)].allocations;
+    }
+    return sum;
+}
+
+Snapshot Snapshot::operator-(const Snapshot& earlier) const {
+    Snapshot delta;
+    for (size_t i = 0; i < TAG_COUNT; ++i) {
+        delta.per_tag[i].allocations = per_tag[i].allocations - earlier.per_tag[i].allocations;
+        delta.per_tag[i].bytes = per_tag[i].bytes - earlier.per_tag[i].bytes;
+        delta.per_tag[i].frees = per_tag[i].frees - earlier.per_tag[i].frees;
+    }
+    return delta;
+}
+
+const char* tag_name(Tag tag) {
+    return TAG_NAMES[static_cast<size_t>(tag)];
+}
+
+Snapshot snapshot() {
+    Snapshot snap;
+    for (size_t i = 0; i < TAG_COUNT; ++i) {
+        snap.per_tag[i].allocations = g_counters[i].allocations.load(std::memory_order_relaxed);
+        snap.per_tag[i].bytes = g_counters[i].bytes.load(std::memory_order_relaxed);
+        snap.per_tag[i].frees = g_counters[i].frees.load(std::memory_order_relaxed);
+    }
+    return snap;
+}
+
+double allocations_per_published(const Snapshot& delta, uint64_t published) {
+    if (published == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(delta.allocations({Tag::Read, Tag::Parse, Tag::Publish})) / published;
+}
+
+double allocations_per_delivered(const Snapshot& delta, uint64_t delivered) {
+    if (delivered == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(delta.allocations({Tag::Fanout, Tag::Write})) / delivered;
+}
+
+std::string report(const Snapshot& delta, uint64_t published, uint64_t delivered) {
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2)
+        << "Allocations - per published: " << allocations_per_published(delta, published)
+        << ", per delivered: " << allocations_per_delivered(delta, delivered);
+    for (size_t i = 0; i < TAG_COUNT; ++i) {
+        const auto& counters = delta.per_tag[i];
+        if (counters.allocations == 0) {
+            continue;
+        }
+        oss << "\n    " << std::left << std::setw(14) << TAG_NAMES[i]
+            << " allocs=" << counters.allocations
+            << " bytes=" << counters.bytes
+            << " frees=" << counters.frees;
+    }
+    return oss.str();
+}
+
+ScopedTag::ScopedTag(Tag tag) : previous_(t_current_tag) {
+    t_current_tag = tag;
+}
+
+ScopedTag::~ScopedTag() {
+    t_current_tag = previous_;
+}
+
+} // namespace alloc_accounting
+
+#ifdef NEUROPIPE_ALLOC_ACCOUNTING
+
+// Replacement global allocation functions. Aligned and nothrow variants
+// funnel into the same counters; sized deletes forward to the plain ones.
+
+void* operator new(std::size_t size) {
+    alloc_accounting::count_allocation(size);
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    alloc_accounting::count_allocation(size);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept {
+    return ::operator new(size, tag);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    alloc_accounting::count_allocation(size);
+    size_t alignment = static_cast<size_t>(align);
+    size_t rounded = (size + alignment - 1) / alignment * alignment;
+    if (void* ptr = std::aligned_alloc(alignment, rounded ? rounded : alignment)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return ::operator new(size, align);
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr) {
+        alloc_accounting::count_free();
+        std::free(ptr);
+    }
+}
+
+void operator delete[](void* ptr) noexcept {
+    ::operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    ::operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    ::operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    ::operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    ::operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    ::operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+    ::operator delete(ptr);
+}
+
+#endif // NEUROPIPE_ALLOC_ACCOUNTING
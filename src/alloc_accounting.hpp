@@ -0,0 +1,90 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <initializer_list>
+#include <string>
+
+/**
+ * Allocation accounting for the message hot path (opt-in build mode).
+ *
+ * Built with -DNEUROPIPE_ALLOC_ACCOUNTING (CMake option of the same name,
+ * or `make ALLOC_ACCOUNTING=1`), global operator new/delete count every
+ * allocation against the subsystem tag active on the calling thread.
+ * Without the flag ALLOC_SCOPE compiles to nothing and snapshots are empty.
+ *
+ * Usage:
+ *   ALLOC_SCOPE(Publish);   // allocations until end of scope count as Publish
+ */
+namespace alloc_accounting {
+
+enum class Tag : uint8_t {
+    Untagged = 0,
+    SessionSetup,   // Session construction / start
+    Read,           // Read completion: line extraction
+    Parse,          // Session::process_message
+    Publish,        // TopicManager::publish bookkeeping
+    Fanout,         // Building and queueing subscriber notifications
+    Write,          // Write completion and queue pops
+    Count
+};
+
+constexpr size_t TAG_COUNT = static_cast<size_t>(Tag::Count);
+
+struct Counters {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    uint64_t frees = 0;
+};
+
+struct Snapshot {
+    std::array<Counters, TAG_COUNT> per_tag{};
+
+    Counters total() const;
+    // Allocations in the given tags, summed
+    uint64_t allocations(std::initializer_list<Tag> tags) const;
+    Snapshot operator-(const Snapshot& earlier) const;
+};
+
+#ifdef NEUROPIPE_ALLOC_ACCOUNTING
+constexpr bool ENABLED = true;
+#else
+constexpr bool ENABLED = false;
+#endif
+
+const char* tag_name(Tag tag);
+
+// Current process-wide counters (all zero when accounting is compiled out)
+Snapshot snapshot();
+
+// Allocations attributed to ingest (read/parse/publish) per published message
+double allocations_per_published(const Snapshot& delta, uint64_t published);
+
+// Allocations attributed to fan-out and writes per delivered message
+double allocations_per_delivered(const Snapshot& delta, uint64_t delivered);
+
+// Multi-line per-subsystem report of an interval
+std::string report(const Snapshot& delta, uint64_t published, uint64_t delivered);
+
+class ScopedTag {
+public:
+    explicit ScopedTag(Tag tag);
+    ~ScopedTag();
+
+    ScopedTag(const ScopedTag&) = delete;
+    ScopedTag& operator=(const ScopedTag&) = delete;
+
+private:
+    Tag previous_;
+};
+
+} // namespace alloc_accounting
+
+#ifdef NEUROPIPE_ALLOC_ACCOUNTING
+#define ALLOC_SCOPE_CONCAT_INNER(a, b) a##b
+#define ALLOC_SCOPE_CONCAT(a, b) ALLOC_SCOPE_CONCAT_INNER(a, b)
+#define ALLOC_SCOPE(tag) \
+    alloc_accounting::ScopedTag ALLOC_SCOPE_CONCAT(alloc_scope_, __LINE__)(alloc_accounting::Tag::tag)
+#else
+#define ALLOC_SCOPE(tag) ((void)0)
+#endif
@@ -1,34 +1,147 @@
 #include "asio_server.hpp"
+#include "tracing.hpp"
+#include "alloc_accounting.hpp"
+#include "capture.hpp"
+#include "shm_transport.hpp"
+#include "handoff.hpp"
+#include "../include/transport.hpp"
 #include <sstream>
 #include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// One listening socket and its tuning (see broker_config.hpp)
+struct BrokerListener {
+    using Acceptor = asio::basic_socket_acceptor<asio::generic::stream_protocol>;
+    
+    BrokerListener(asio::io_context& io_context, const ListenerConfig& listener_config)
+        : config(listener_config), acceptor(io_context), throttle(io_context) {}
+    
+    ListenerConfig config;
+    bool is_unix = false;
+    std::string unix_path;
+    Acceptor acceptor;
+    std::atomic<size_t> connections{0};   // Sessions from this listener still registered
+    bool refusing = false;                // At max_connections (logged once per episode)
+    
+    // accept_rate token bucket; only the accept chain touches it
+    asio::steady_timer throttle;
+    double tokens = 0;
+    std::chrono::steady_clock::time_point refilled;
+};
+
+namespace {
+
+// Amount in SUBSCRIBE:topic:credit=<n> and CREDIT:<n>: messages, or bytes
+// with a B suffix
+bool parse_credit(std::string_view text, uint64_t& amount, bool& bytes) {
+    bytes = !text.empty() && text.back() == 'B';
+    if (bytes) {
+        text.remove_suffix(1);
+    }
+    if (text.empty() || text.size() > 15) {
+        return false;
+    }
+    amount = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        amount = amount * 10 + (c - '0');
+    }
+    return true;
+}
+
+} // namespace
 
 // ============================================================================
 // Session Implementation
 // ============================================================================
 
-Session::Session(asio::ip::tcp::socket socket, BrokerServer& broker)
-    : socket_(std::move(socket)), broker_(broker) {
-    // Generate unique client ID from endpoint
-    std::ostringstream oss;
-    oss << socket_.remote_endpoint();
-    client_id_ = oss.str();
+Session::Session(Socket socket, BrokerServer& broker)
+    : socket_(std::move(socket)), broker_(broker), uring_(broker.get_uring_engine()),
+      capture_id_(capture::next_connection_id()), write_lanes_(broker.get_lane_schedule()) {
+    ALLOC_SCOPE(SessionSetup);
+    // The id is formatted on first use; a connect storm at warn level
+    // never needs most of them
+    std::error_code ignored;
+    peer_ = socket_.remote_endpoint(ignored);
+    producer_key_ = HeavyHitters::client_key(peer_.data(), peer_.size(), capture_id_);
 }
 
 Session::~Session() {
-    log_info("Session destroyed: " + client_id_);
+    if (!log_enabled(LogLevel::Info)) {
+        return;
+    }
+    if (compression_policy_.batches() > 0) {
+        log_info("Compression for " + get_client_id() + ": " +
+                 std::to_string(compression_policy_.compressed_batches()) + "/" +
+                 std::to_string(compression_policy_.batches()) + " batches compressed, " +
+                 std::to_string(compression_policy_.raw_bytes()) + " -> " +
+                 std::to_string(compression_policy_.wire_bytes()) + " bytes");
+    }
+    log_info("Session destroyed: " + get_client_id());
+}
+
+const std::string& Session::get_client_id() const {
+    std::call_once(client_id_once_, [this]() {
+        if (peer_.protocol().family() == AF_UNIX) {
+            // Unix domain peers are unnamed; the connection id keeps ids unique
+            client_id_ = "unix#" + std::to_string(capture_id_);
+            return;
+        }
+        asio::ip::tcp::endpoint endpoint;
+        std::memcpy(endpoint.data(), peer_.data(), peer_.size());
+        endpoint.resize(peer_.size());
+        asio::ip::address address = endpoint.address();
+        client_id_ = address.is_v6() ? "[" + address.to_string() + "]" : address.to_string();
+        client_id_ += ":" + std::to_string(endpoint.port());
+    });
+    return client_id_;
 }
 
 void Session::start() {
-    log_info("New session started: " + client_id_);
-    do_read();
+    if (log_enabled(LogLevel::Info)) {
+        log_info("New session started: " + get_client_id());
+    }
+    uint64_t now = latency_trace::now_ns();
+    if (capture::active()) {
+        capture::record(capture::Kind::Open, capture_id_, now);
+    }
+    heard_ns_.store(now, std::memory_order_relaxed);
+    uint64_t timeout = idle_timeout_ms_.load(std::memory_order_relaxed);
+    uint64_t heartbeat = heartbeat_ms_.load(std::memory_order_relaxed);
+    if (timeout || heartbeat) {
+        uint64_t first = (heartbeat && (!timeout || heartbeat < timeout)) ? heartbeat : timeout;
+        broker_.watch(shared_from_this(), now + first * 1000000);
+    }
+    if (uring_) {
+        uring_->start_receive(socket_.native_handle(), shared_from_this());
+    } else {
+        do_read();
+    }
 }
 
-void Session::deliver(const std::string& message) {
+void Session::deliver(const std::string& message, Priority priority) {
+    TRACE_SCOPE("Session::deliver");
+    if (closed_.load(std::memory_order_relaxed)) {
+        return;  // Nothing will write it; fan-out may still hold this session
+    }
     bool write_in_progress = false;
     {
         std::lock_guard<std::mutex> lock(write_mutex_);
-        write_in_progress = !write_queue_.empty();
-        write_queue_.push(message);
+        write_in_progress = !write_lanes_.empty();
+        write_lanes_.push(priority, Payload(message));
+        if (latency_trace_) {
+            Payload& queued = write_lanes_.back(priority);
+            latency_trace::stamp_message(queued.data(), queued.size(), latency_trace::HOP_ENQUEUE,
+                                         latency_trace::now_ns());
+        }
     }
     
     if (!write_in_progress) {
@@ -42,56 +155,367 @@ void Session::do_read() {
         socket_,
         read_buffer_,
         '\n',
-        [this, self](std::error_code ec, std::size_t /*length*/) {
-            if (!ec) {
-                std::istream is(&read_buffer_);
-                std::string message;
-                std::getline(is, message);
-                
-                log_debug("Received from " + client_id_ + ": " + message);
-                process_message(message);
-                do_read(); // Continue reading
-            } else {
-                log_info("Session disconnected: " + client_id_ + " (" + ec.message() + ")");
-                broker_.on_session_disconnect(self);
+        asio::bind_allocator(
+            HandlerAllocator<char>(read_handler_memory_),
+            [this, self](std::error_code ec, std::size_t /*length*/) {
+                if (!ec) {
+                    TRACE_ROOT_SCOPE("Session::on_read");
+                    ALLOC_SCOPE(Read);
+                    read_ingress_ns_ = latency_trace::now_ns();
+                    heard_ns_.store(read_ingress_ns_, std::memory_order_relaxed);
+                    if (quickack_) {
+                        rearm_quickack();
+                    }
+                    std::istream is(&read_buffer_);
+                    std::getline(is, read_line_);  // Reuses the line's capacity
+                    if (is_batch_header(read_line_)) {
+                        read_batch(read_line_);  // Continues reading once the batch is in
+                        return;
+                    }
+                    handle_line(read_line_);
+                    do_read(); // Continue reading
+                } else {
+                    on_read_error(ec);
+                }
+            }));
+}
+
+void Session::on_receive(const char* data, size_t length) {
+    TRACE_ROOT_SCOPE("Session::on_read");
+    ALLOC_SCOPE(Read);
+    if (read_closed_) {
+        return;
+    }
+    read_ingress_ns_ = latency_trace::now_ns();
+    heard_ns_.store(read_ingress_ns_, std::memory_order_relaxed);
+    if (quickack_) {
+        rearm_quickack();
+    }
+    auto space = read_buffer_.prepare(length);
+    std::memcpy(space.data(), data, length);
+    read_buffer_.commit(length);
+    
+    // Every complete line in the chunk, in order, with the chunk's ingress stamp
+    while (!read_closed_) {
+        if (batch_pending_) {
+            if (read_buffer_.size() < pending_batch_compressed_) {
+                return;
             }
-        });
+            batch_pending_ = false;
+            unpack_batch(pending_batch_raw_, pending_batch_compressed_);
+            continue;
+        }
+        auto buffered = read_buffer_.data();
+        auto begin = static_cast<const char*>(buffered.data());
+        auto end = static_cast<const char*>(std::memchr(begin, '\n', buffered.size()));
+        if (!end) {
+            return;
+        }
+        read_line_.assign(begin, end);
+        read_buffer_.consume(end - begin + 1);
+        if (is_batch_header(read_line_)) {
+            read_batch(read_line_);
+            continue;
+        }
+        handle_line(read_line_);
+    }
 }
 
-void Session::do_write() {
+void Session::on_receive_end(const std::error_code& ec) {
+    if (!read_closed_) {
+        on_read_error(ec);
+    }
+}
+
+void Session::handle_line(const std::string& message) {
+    if (capture::active()) {
+        capture::record(capture::Kind::Frame, capture_id_, read_ingress_ns_, message);
+    }
+    if (log_enabled(LogLevel::Debug)) {
+        log_debug("Received from " + get_client_id() + ": " + message);
+    }
+    process_message(message);
+}
+
+void Session::on_read_error(const std::error_code& ec) {
+    if (log_enabled(LogLevel::Info)) {
+        log_info("Session disconnected: " + get_client_id() + " (" + ec.message() + ")");
+    }
+    if (shm_ring_) {
+        // Whatever the producer committed before it went away still counts;
+        // a record it died in the middle of is never committed and is skipped
+        detach_ring();
+    }
+    if (capture::active()) {
+        capture::record(capture::Kind::Close, capture_id_, latency_trace::now_ns());
+    }
+    broker_.on_session_disconnect(shared_from_this());
+}
+
+// A line announcing a binary block: ZBATCH once compression is on, FBATCH
+// on a bridge link, RBATCH from this broker's replication leader
+bool Session::is_batch_header(const std::string& line) const {
+    return (compression_ && line.compare(0, lz_codec::BATCH_PREFIX.size(), lz_codec::BATCH_PREFIX) == 0) ||
+           (bridge_ && line.compare(0, federation::FRAME_PREFIX.size(), federation::FRAME_PREFIX) == 0) ||
+           (upstream_ && line.compare(0, replication::FRAME_PREFIX.size(), replication::FRAME_PREFIX) == 0);
+}
+
+void Session::read_batch(const std::string& header) {
+    // Bridge and replication frames reuse the batch path: their record
+    // count stands in for the raw size and their block length for the
+    // compressed size
+    size_t raw_size, compressed_size;
+    bool valid;
+    if (bridge_ && header.compare(0, federation::FRAME_PREFIX.size(), federation::FRAME_PREFIX) == 0) {
+        block_kind_ = BlockKind::Bridge;
+        valid = federation::parse_frame_header(header, raw_size, compressed_size);
+    } else if (upstream_ && header.compare(0, replication::FRAME_PREFIX.size(), replication::FRAME_PREFIX) == 0) {
+        block_kind_ = BlockKind::Replication;
+        valid = replication::parse_frame_header(header, raw_size, compressed_size, replication_end_);
+    } else {
+        block_kind_ = BlockKind::Compressed;
+        valid = lz_codec::parse_batch_header(header, raw_size, compressed_size);
+    }
+    if (!valid) {
+        // The stream cannot be resynchronised after a bad frame length
+        log_error(std::string(block_kind_ == BlockKind::Compressed ? "Invalid compressed batch" : "Invalid frame") +
+                  " from " + get_client_id() + ", closing");
+        deliver("ERROR:INVALID_BATCH\n");
+        read_closed_ = true;
+        std::error_code ignored;
+        socket_.shutdown(asio::socket_base::shutdown_receive, ignored);
+        on_read_error(asio::error::invalid_argument);
+        return;
+    }
+    
+    if (uring_) {
+        // on_receive unpacks it once the block is buffered
+        pending_batch_raw_ = raw_size;
+        pending_batch_compressed_ = compressed_size;
+        batch_pending_ = true;
+        return;
+    }
+    
+    // async_read_until usually reads past the header, so part or all of
+    // the block may already be buffered
+    size_t buffered = read_buffer_.size();
+    if (buffered >= compressed_size) {
+        unpack_batch(raw_size, compressed_size);
+        do_read();
+        return;
+    }
     auto self(shared_from_this());
+    asio::async_read(
+        socket_,
+        read_buffer_,
+        asio::transfer_exactly(compressed_size - buffered),
+        asio::bind_allocator(
+            HandlerAllocator<char>(read_handler_memory_),
+            [this, self, raw_size, compressed_size](std::error_code ec, std::size_t /*length*/) {
+                if (!ec) {
+                    TRACE_ROOT_SCOPE("Session::on_read");
+                    ALLOC_SCOPE(Read);
+                    unpack_batch(raw_size, compressed_size);
+                    do_read();
+                } else {
+                    on_read_error(ec);
+                }
+            }));
+}
+
+void Session::unpack_batch(size_t raw_size, size_t compressed_size) {
+    TRACE_SCOPE("Session::process_batch");
+    auto block = static_cast<const char*>(read_buffer_.data().data());
+    if (block_kind_ == BlockKind::Bridge) {
+        bool ok = bridge_->handle_frame(std::string_view(block, compressed_size), raw_size);
+        read_buffer_.consume(compressed_size);
+        if (!ok) {
+            log_error("Corrupt bridge frame from " + get_client_id());
+            deliver("ERROR:INVALID_BATCH\n");
+        }
+        return;
+    }
+    if (block_kind_ == BlockKind::Replication) {
+        bool ok = broker_.get_replication().handle_frame(std::string_view(block, compressed_size), raw_size,
+                                                         replication_end_);
+        read_buffer_.consume(compressed_size);
+        if (!ok) {
+            // Records before the damage are applied; reconnecting resumes after them
+            log_error("Corrupt replication frame from " + get_client_id() + ", reconnecting");
+            close();
+        }
+        return;
+    }
+    read_batch_.clear();
+    bool ok = lz_codec::decompress(std::string_view(block, compressed_size), raw_size, read_batch_);
+    read_buffer_.consume(compressed_size);
+    if (!ok) {
+        log_error("Corrupt compressed batch from " + get_client_id());
+        deliver("ERROR:INVALID_BATCH\n");
+        return;
+    }
     
+    // Every line of the batch shares the batch's ingress stamp
     std::string message;
+    size_t begin = 0;
+    while (begin < read_batch_.size()) {
+        size_t end = read_batch_.find('\n', begin);
+        if (end == std::string::npos) {
+            end = read_batch_.size();
+        }
+        message.assign(read_batch_, begin, end - begin);
+        begin = end + 1;
+        handle_line(message);
+    }
+}
+
+void Session::do_write() {
+    auto self(shared_from_this());
+    
+    // The front element of the picked lane stays queued (and its storage
+    // stays valid) until the write completes, so the buffer can point
+    // straight at it.
+    asio::const_buffer buffer;
+    bool compress = compression_;
+    // io_uring sends copy into registered buffers anyway, so they take the
+    // whole queue per send just like compression does
+    bool batch = compress || uring_;
     {
         std::lock_guard<std::mutex> lock(write_mutex_);
-        if (write_queue_.empty()) {
+        if (write_lanes_.empty()) {
             return;
         }
-        message = write_queue_.front();
+        write_batch_counts_.fill(0);
+        if (batch) {
+            // Everything queued so far goes out in one write, highest lane
+            // first; the copies are taken under the lock, compression
+            // happens outside it
+            write_batch_.clear();
+            for (size_t lane = 0; lane < PRIORITY_COUNT; ++lane) {
+                for (Payload& message : write_lanes_.lane(lane)) {
+                    if (latency_trace_) {
+                        latency_trace::stamp_message(message.data(), message.size(), latency_trace::HOP_WRITE,
+                                                     latency_trace::now_ns());
+                    }
+                    write_batch_ += message.view();
+                }
+                write_batch_counts_[lane] = write_lanes_.lane(lane).size();
+            }
+        } else {
+            size_t lane = write_lanes_.pick();
+            Payload& message = write_lanes_.lane(lane).front();
+            if (latency_trace_) {
+                latency_trace::stamp_message(message.data(), message.size(), latency_trace::HOP_WRITE,
+                                             latency_trace::now_ns());
+            }
+            buffer = asio::buffer(message.data(), message.size());
+            write_batch_counts_[lane] = 1;
+        }
+    }
+    
+    if (batch) {
+        buffer = asio::buffer(write_batch_);
+    }
+    if (compress) {
+        if (compression_policy_.should_compress(write_batch_.size())) {
+            TRACE_SCOPE("Session::compress_batch");
+            uint64_t begin_ns = latency_trace::now_ns();
+            lz_codec::encode_batch(write_batch_, write_frame_);
+            compression_policy_.observe(write_batch_.size(), write_frame_.size(),
+                                        latency_trace::now_ns() - begin_ns);
+            if (write_frame_.size() < write_batch_.size()) {
+                buffer = asio::buffer(write_frame_);
+            }
+        }
+        compression_policy_.record(write_batch_.size(), buffer.size());
     }
     
+    // Time from initiation to completion handler covers the socket write
+    // plus any queueing before the handler runs
+    write_trace_begin_ns_ = (tracing::enabled() && tracing::sample_root()) ? latency_trace::now_ns() : 0;
+    
+    if (uring_) {
+        uring_->send(socket_.native_handle(),
+                     std::string_view(static_cast<const char*>(buffer.data()), buffer.size()), self);
+        return;
+    }
     asio::async_write(
         socket_,
-        asio::buffer(message.data(), message.length()),
-        [this, self](std::error_code ec, std::size_t /*length*/) {
-            if (!ec) {
-                {
-                    std::lock_guard<std::mutex> lock(write_mutex_);
-                    write_queue_.pop();
-                }
-                do_write(); // Write next message
-            } else {
-                log_error("Write failed for " + client_id_ + ": " + ec.message());
-                broker_.on_session_disconnect(self);
+        buffer,
+        asio::bind_allocator(
+            HandlerAllocator<char>(write_handler_memory_),
+            [this, self](std::error_code ec, std::size_t length) {
+                on_write(ec, length);
+            }));
+}
+
+void Session::on_send(const std::error_code& ec, size_t length) {
+    on_write(ec, length);
+}
+
+void Session::on_write(const std::error_code& ec, size_t length) {
+    if (write_trace_begin_ns_) {
+        tracing::record("Session::write_inflight", write_trace_begin_ns_,
+                        latency_trace::now_ns(), "bytes", static_cast<int64_t>(length));
+    }
+    TRACE_ROOT_SCOPE("Session::on_write");
+    ALLOC_SCOPE(Write);
+    if (!ec) {
+        // Pop and check for more under one lock: a deliver() that
+        // lands in between must either see the queue empty (and start
+        // the next write itself) or see it non-empty and leave it to us.
+        // Deciding separately let two writes run at once.
+        bool more = false;
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            for (size_t lane = 0; lane < PRIORITY_COUNT; ++lane) {
+                write_lanes_.pop(lane, write_batch_counts_[lane]);
             }
-        });
+            more = !write_lanes_.empty();
+        }
+        if (more) {
+            do_write(); // Write next message
+        }
+    } else {
+        // Nothing more goes out, so the queue goes now rather than with the
+        // session; an expired session's write fails here too
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            write_lanes_.clear();
+        }
+        if (!closed_) {
+            log_error("Write failed for " + get_client_id() + ": " + ec.message());
+        }
+        broker_.on_session_disconnect(shared_from_this());
+    }
 }
 
 void Session::process_message(const std::string& message) {
+    TRACE_SCOPE("Session::process_message");
+    ALLOC_SCOPE(Parse);
+    
     // Protocol format:
     // PUBLISH:topic:payload
+    // TPUBLISH:send_stamp:topic:payload (latency-traced publish)
     // SUBSCRIBE:topic
+    // SUBSCRIBE:topic:credit=N[B] / CREDIT:N[B] (sent only what the client
+    // granted, in messages or bytes; see pump_credit)
     // UNSUBSCRIBE:topic
+    // TRACE:ON / TRACE:OFF (receive traced messages as TMESSAGE lines)
+    // TRACING:START[:sample_every] / TRACING:STOP / TRACING:DUMP (broker span
+    // tracing, local Unix socket peers only)
+    // TOP[:k] (heaviest topics/clients/services over the last minute, JSON)
+    // CAPTURE:START / CAPTURE:STOP (record inbound traffic for np_replay,
+    // local Unix socket peers only)
+    // COMPRESS:LZ / COMPRESS:OFF (ZBATCH compressed batches, see lz_codec.hpp)
+    // SHM:ATTACH:name / SHM:DETACH (shared-memory ring, Unix socket only)
+    // TAIL:START:topic / TAIL:STOP:topic (read-only shared-memory topic tail,
+    // local Unix socket peers only)
+    // BRIDGE:HELLO:... (another broker opens a federation link, see federation.hpp)
+    // REPLICATE:... (a follower asks for topic data, see replication.hpp)
+    // REPLICATION:STATUS / REPLICATION:PROMOTE / REPLICATION:FOLLOW:leader
+    // HEARTBEAT:ON / HEARTBEAT:OFF (the broker probes a silent session with
+    // HEARTBEAT, which is answered with HEARTBEAT:ACK)
     
     // Handle empty messages
     if (message.empty()) {
@@ -99,6 +523,53 @@ void Session::process_message(const std::string& message) {
         return;
     }
     
+    // Heartbeats go both ways on any session, bridges and replication
+    // streams included
+    if (message.compare(0, 9, "HEARTBEAT") == 0 || message.compare(0, 13, "OK:HEARTBEAT:") == 0) {
+        handle_heartbeat(message);
+        return;
+    }
+    
+    // On a bridge link the remote broker's control lines go to the link
+    if (bridge_ && (message.compare(0, 7, "BRIDGE:") == 0 || message.compare(0, 10, "OK:BRIDGE:") == 0 ||
+                    message.compare(0, 6, "ERROR:") == 0)) {
+        bridge_->handle_line(message);
+        return;
+    }
+    if (message.compare(0, 13, "BRIDGE:HELLO:") == 0) {
+        bridge_ = broker_.get_federation().accept(shared_from_this(), message);
+        return;
+    }
+    
+    // Replication streams: acknowledgements from a follower, control lines
+    // from this broker's leader
+    if (feed_ && message.compare(0, 5, "RACK:") == 0) {
+        uint64_t end = std::strtoull(message.c_str() + 5, nullptr, 10);
+        feed_->acknowledge(end);
+        return;
+    }
+    if (upstream_) {
+        broker_.get_replication().handle_line(message);
+        return;
+    }
+    if (message.compare(0, 10, "REPLICATE:") == 0) {
+        // A follower gets every topic's data, so only where configured
+        if (!listener_ || !listener_->config.replication) {
+            deliver("ERROR:REPLICATION_NOT_ALLOWED\n");
+            return;
+        }
+        if (!feed_) {
+            feed_ = broker_.get_replication().attach(shared_from_this(), message);
+        }
+        return;
+    }
+    
+    if ((message.compare(0, 8, "PUBLISH:") == 0 || message.compare(0, 9, "TPUBLISH:") == 0) &&
+        broker_.get_replication().following()) {
+        deliver("ERROR:FOLLOWER\n");
+        return;
+    }
+    
     if (message.find("PUBLISH:") == 0) {
         // Bounds check: need at least "PUBLISH:t:p" (11 chars minimum)
         if (message.length() < 10) {
@@ -108,7 +579,7 @@ void Session::process_message(const std::string& message) {
         
         size_t first_colon = message.find(':', 8);
         if (first_colon != std::string::npos && first_colon > 8) {
-            std::string topic = message.substr(8, first_colon - 8);
+            std::string_view topic = std::string_view(message).substr(8, first_colon - 8);
             std::string payload = message.substr(first_colon + 1);
             
             // Validate topic is not empty
@@ -117,12 +588,127 @@ void Session::process_message(const std::string& message) {
                 return;
             }
             
-            broker_.publish(topic, payload);
-            deliver("OK:PUBLISHED\n");
+            broker_.get_heavy_hitters().record(producer_key_, topic, payload);
+            acknowledge_publish(broker_.publish(topic, payload));
         } else {
             deliver("ERROR:INVALID_FORMAT\n");
         }
     }
+    else if (message.find("TPUBLISH:") == 0) {
+        size_t stamp_end = message.find(':', 9);
+        latency_trace::Stamps trace;
+        if (stamp_end == std::string::npos ||
+            !latency_trace::parse_stamp(std::string_view(message).substr(9, stamp_end - 9),
+                                        trace.ns[latency_trace::HOP_SEND])) {
+            deliver("ERROR:INVALID_FORMAT\n");
+            return;
+        }
+        trace.ns[latency_trace::HOP_INGRESS] = read_ingress_ns_;
+        
+        size_t topic_end = message.find(':', stamp_end + 1);
+        if (topic_end == std::string::npos) {
+            deliver("ERROR:INVALID_FORMAT\n");
+            return;
+        }
+        if (topic_end == stamp_end + 1) {
+            deliver("ERROR:EMPTY_TOPIC\n");
+            return;
+        }
+        
+        std::string_view topic = std::string_view(message).substr(stamp_end + 1, topic_end - stamp_end - 1);
+        std::string payload = message.substr(topic_end + 1);
+        broker_.get_heavy_hitters().record(producer_key_, topic, payload);
+        acknowledge_publish(broker_.publish(topic, payload, &trace));
+    }
+    else if (message == "TRACE:ON" || message == "TRACE:OFF") {
+        bool enable = (message == "TRACE:ON");
+        latency_trace_ = enable;
+        deliver(enable ? "OK:TRACE:ON\n" : "OK:TRACE:OFF\n");
+    }
+    else if (message.find("TRACING:") == 0) {
+        // Tracing costs every message some CPU, and dumps write files
+        if (!is_local_peer()) {
+            deliver("ERROR:PERMISSION_DENIED\n");
+            return;
+        }
+        handle_tracing_command(message.substr(8));
+    }
+    else if (message.find("REPLICATION:") == 0) {
+        handle_replication_command(message.substr(12));
+    }
+    else if (message.find("CAPTURE:") == 0 && !is_local_peer()) {
+        // A capture holds every client's traffic and fills the broker's disk
+        deliver("ERROR:PERMISSION_DENIED\n");
+    }
+    else if (message == "CAPTURE:START") {
+        // Fixed file name pattern: clients must not choose paths on the broker host
+        static std::atomic<int> capture_counter{0};
+        std::string path = "neuropipe_capture_" + std::to_string(getpid()) + "_" +
+                           std::to_string(capture_counter++) + ".npcap";
+        if (!capture::start(path)) {
+            deliver("ERROR:CAPTURE_START_FAILED\n");
+            return;
+        }
+        log_info("Traffic capture started by " + get_client_id() + " -> " + path);
+        deliver("OK:CAPTURE:STARTED:" + path + "\n");
+    }
+    else if (message == "CAPTURE:STOP") {
+        long records = capture::stop();
+        if (records < 0) {
+            deliver("ERROR:CAPTURE_NOT_ACTIVE\n");
+            return;
+        }
+        log_info("Traffic capture stopped (" + std::to_string(records) + " records)");
+        deliver("OK:CAPTURE:STOPPED:" + std::to_string(records) + "\n");
+    }
+    else if (message.find("TAIL:") == 0 && !is_local_peer()) {
+        // Each tail maps a ring in /dev/shm for readers on this host
+        deliver("ERROR:PERMISSION_DENIED\n");
+    }
+    else if (message.find("TAIL:START:") == 0) {
+        std::string topic = message.substr(11);
+        std::string error;
+        std::string name = broker_.get_topic_manager().start_tail(topic, error);
+        if (name.empty()) {
+            log_warn("Cannot start tail of topic '" + topic + "': " + error);
+            deliver("ERROR:TAIL_START_FAILED\n");
+            return;
+        }
+        log_info("Topic tail of '" + topic + "' started by " + get_client_id() + " -> " + name);
+        deliver("OK:TAIL:STARTED:" + name + "\n");
+    }
+    else if (message.find("TAIL:STOP:") == 0) {
+        std::string topic = message.substr(10);
+        if (!broker_.get_topic_manager().stop_tail(topic)) {
+            deliver("ERROR:TAIL_NOT_ACTIVE\n");
+            return;
+        }
+        log_info("Topic tail of '" + topic + "' stopped");
+        deliver("OK:TAIL:STOPPED:" + topic + "\n");
+    }
+    else if (message.find("COMPRESS:") == 0) {
+        if (message == "COMPRESS:LZ") {
+            // Acknowledge before switching so the reply itself goes out plain
+            deliver("OK:COMPRESS:LZ\n");
+            compression_ = true;
+        } else if (message == "COMPRESS:OFF") {
+            compression_ = false;
+            deliver("OK:COMPRESS:OFF\n");
+        } else {
+            deliver("ERROR:UNSUPPORTED_CODEC\n");
+        }
+    }
+    else if (message.find("SHM:ATTACH:") == 0) {
+        attach_ring(message.substr(11));
+    }
+    else if (message == "SHM:DETACH") {
+        if (!shm_ring_) {
+            deliver("ERROR:SHM_NOT_ATTACHED\n");
+            return;
+        }
+        detach_ring();
+        deliver("OK:SHM:DETACHED\n");
+    }
     else if (message.find("SUBSCRIBE:") == 0) {
         // Bounds check: need at least "SUBSCRIBE:t" (11 chars minimum)
         if (message.length() <= 10) {
@@ -131,6 +717,16 @@ void Session::process_message(const std::string& message) {
         }
         
         std::string topic = message.substr(10);
+        size_t credit_at = topic.rfind(":credit=");
+        uint64_t credit = 0;
+        bool credit_bytes = false;
+        if (credit_at != std::string::npos) {
+            if (!parse_credit(std::string_view(topic).substr(credit_at + 8), credit, credit_bytes)) {
+                deliver("ERROR:INVALID_FORMAT\n");
+                return;
+            }
+            topic.resize(credit_at);
+        }
         
         // Validate topic is not empty
         if (topic.empty()) {
@@ -138,8 +734,42 @@ void Session::process_message(const std::string& message) {
             return;
         }
         
-        broker_.subscribe(topic, shared_from_this());
+        if (credit_at == std::string::npos) {
+            if (!broker_.subscribe(topic, shared_from_this())) {
+                deliver("ERROR:TOO_MANY_TOPICS\n");
+                return;
+            }
+            drop_credit(topic);
+            deliver("OK:SUBSCRIBED:" + topic + "\n");
+            return;
+        }
+        std::string error;
+        if (!subscribe_credit(topic, credit, credit_bytes, error)) {
+            deliver("ERROR:" + error + "\n");
+            return;
+        }
         deliver("OK:SUBSCRIBED:" + topic + "\n");
+        pump_credit();
+    }
+    else if (message.find("CREDIT:") == 0) {
+        // No reply: grants are frequent, and the messages they release
+        // are the answer
+        uint64_t amount;
+        bool bytes;
+        if (!parse_credit(std::string_view(message).substr(7), amount, bytes)) {
+            deliver("ERROR:INVALID_FORMAT\n");
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(credit_mutex_);
+            if (!credit_topics_.empty() && bytes != credit_bytes_) {
+                deliver("ERROR:CREDIT_UNIT\n");
+                return;
+            }
+            credit_bytes_ = bytes;
+            credit_ = std::min<int64_t>(credit_ + static_cast<int64_t>(amount), INT64_MAX / 2);
+        }
+        pump_credit();
     }
     else if (message.find("UNSUBSCRIBE:") == 0) {
         // Bounds check: need at least "UNSUBSCRIBE:t" (13 chars minimum)
@@ -156,9 +786,23 @@ void Session::process_message(const std::string& message) {
             return;
         }
         
+        drop_credit(topic);
         broker_.unsubscribe(topic, shared_from_this());
         deliver("OK:UNSUBSCRIBED:" + topic + "\n");
     }
+    else if (message == "TOP" || message.find("TOP:") == 0) {
+        size_t k = 10;
+        if (message.size() > 4) {
+            try {
+                k = std::stoul(message.substr(4));
+            } catch (const std::exception&) {
+                deliver("ERROR:INVALID_FORMAT\n");
+                return;
+            }
+        }
+        k = std::min(k, broker_.get_heavy_hitters().capacity());
+        deliver("OK:TOP:" + broker_.get_heavy_hitters().top_json(k) + "\n");
+    }
     else if (message.find("PING") == 0) {
         deliver("PONG\n");
     }
@@ -167,115 +811,1405 @@ void Session::process_message(const std::string& message) {
     }
 }
 
-// ============================================================================
-// TopicManager Implementation
-// ============================================================================
-
-void TopicManager::subscribe(const std::string& topic, std::shared_ptr<Session> session) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    subscriptions_[topic].insert(session);
-    log_info("Session " + session->get_client_id() + " subscribed to topic: " + topic);
-}
-
-void TopicManager::unsubscribe(const std::string& topic, std::shared_ptr<Session> session) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = subscriptions_.find(topic);
-    if (it != subscriptions_.end()) {
-        it->second.erase(session);
-        if (it->second.empty()) {
-            subscriptions_.erase(it);
-        }
-        log_info("Session " + session->get_client_id() + " unsubscribed from topic: " + topic);
+bool Session::is_local_peer() {
+    struct ucred peer;
+    socklen_t peer_length = sizeof(peer);
+    if (socket_.local_endpoint().protocol().family() != AF_UNIX ||
+        getsockopt(socket_.native_handle(), SOL_SOCKET, SO_PEERCRED, &peer, &peer_length) != 0) {
+        return false;
     }
+    return peer.uid == geteuid() || peer.uid == 0;
 }
 
-void TopicManager::unsubscribe_all(std::shared_ptr<Session> session) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (auto& [topic, subscribers] : subscriptions_) {
-        subscribers.erase(session);
+void Session::attach_ring(const std::string& name) {
+    // The eventfd goes back over SCM_RIGHTS, and only processes of our own
+    // user may have us map their memory
+    struct ucred peer;
+    socklen_t peer_length = sizeof(peer);
+    if (socket_.local_endpoint().protocol().family() != AF_UNIX ||
+        getsockopt(socket_.native_handle(), SOL_SOCKET, SO_PEERCRED, &peer, &peer_length) != 0) {
+        deliver("ERROR:SHM_REQUIRES_UNIX_SOCKET\n");
+        return;
     }
-    log_info("Session " + session->get_client_id() + " unsubscribed from all topics");
-}
-
-void TopicManager::publish(const std::string& topic, const std::string& payload) {
-    Message msg(topic, payload);
-    
-    std::vector<std::shared_ptr<Session>> subscribers;
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        
-        // Assign sequence number
-        msg.sequence = sequence_counter_++;
-        
-        // Store message in queue
-        topic_queues_[topic].push(msg);
-        
-        // Get subscribers
-        auto it = subscriptions_.find(topic);
-        if (it != subscriptions_.end()) {
-            subscribers.assign(it->second.begin(), it->second.end());
-        }
+    if (peer.uid != geteuid() && peer.uid != 0) {
+        deliver("ERROR:SHM_PERMISSION_DENIED\n");
+        return;
+    }
+    if (shm_ring_) {
+        deliver("ERROR:SHM_ALREADY_ATTACHED\n");
+        return;
     }
     
-    // Broadcast to subscribers (outside lock to avoid deadlock)
-    if (!subscribers.empty()) {
-        std::string notification = "MESSAGE:" + topic + ":" + payload + "\n";
-        for (auto& subscriber : subscribers) {
-            subscriber->deliver(notification);
-        }
-        log_info("Published to topic '" + topic + "' (" + std::to_string(subscribers.size()) + " subscribers)");
-    } else {
-        log_info("Published to topic '" + topic + "' (no subscribers)");
+    std::string error;
+    auto ring = ShmRingSource::open(socket_.get_executor(), name, error);
+    if (!ring) {
+        log_warn("Cannot attach shared-memory ring " + name + " for " + get_client_id() + ": " + error);
+        deliver("ERROR:SHM_ATTACH_FAILED\n");
+        return;
+    }
+    if (!send_with_fd("OK:SHM:ATTACHED\n", ring->event_fd())) {
+        deliver("ERROR:SHM_ATTACH_FAILED\n");
+        return;
     }
+    shm_ring_ = std::move(ring);
+    log_info("Shared-memory ring " + name + " attached for " + get_client_id());
+    wait_ring();
 }
 
-std::vector<std::shared_ptr<Session>> TopicManager::get_subscribers(const std::string& topic) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = subscriptions_.find(topic);
-    if (it != subscriptions_.end()) {
-        return std::vector<std::shared_ptr<Session>>(it->second.begin(), it->second.end());
+void Session::detach_ring() {
+    while (consume_ring(1024) == 1024) {
     }
-    return {};
+    
+    uint64_t dropped = shm_ring_->ring().dropped();
+    log_info("Shared-memory ring detached for " + get_client_id() +
+             (dropped ? " (" + std::to_string(dropped) + " lines dropped on a full ring)" : ""));
+    shm_ring_.reset();  // Cancels the pending wait
 }
 
-void TopicManager::store_message(const Message& msg) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    topic_queues_[msg.topic].push(msg);
+// Reply carrying a file descriptor. Only possible while no write is queued,
+// so the reply cannot overtake or split queued output.
+bool Session::send_with_fd(const std::string& reply, int fd) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (!write_lanes_.empty()) {
+        return false;
+    }
+    struct iovec iov = {const_cast<char*>(reply.data()), reply.size()};
+    char control[CMSG_SPACE(sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(socket_.native_handle(), &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(reply.size());
 }
 
-bool TopicManager::consume_message(const std::string& topic, Message& msg) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = topic_queues_.find(topic);
-    if (it != topic_queues_.end() && !it->second.empty()) {
-        msg = it->second.front();
-        it->second.pop();
-        return true;
+void Session::wait_ring() {
+    auto self(shared_from_this());
+    if (!shm_ring_->ring().prepare_wait()) {
+        // A record landed while we were deciding to sleep
+        asio::post(socket_.get_executor(), [this, self]() {
+            if (shm_ring_) {
+                drain_ring();
+            }
+        });
+        return;
     }
-    return false;
+    shm_ring_->async_wait([this, self](std::error_code ec) {
+        if (ec || !shm_ring_) {
+            return;
+        }
+        shm_ring_->clear_wakeup();
+        drain_ring();
+    });
 }
 
-size_t TopicManager::get_topic_count() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return subscriptions_.size();
+void Session::drain_ring() {
+    TRACE_ROOT_SCOPE("Session::drain_ring");
+    ALLOC_SCOPE(Read);
+    // Bounded so one busy producer cannot starve the other connections
+    const size_t batch = 1024;
+    long lines = consume_ring(batch);
+    
+    if (lines < 0) {
+        log_error("Corrupt shared-memory ring from " + get_client_id() + ", detaching");
+        shm_ring_.reset();
+        return;
+    }
+    if (lines > 0) {
+        heard_ns_.store(read_ingress_ns_, std::memory_order_relaxed);  // The socket itself may be quiet
+    }
+    if (static_cast<size_t>(lines) == batch) {
+        auto self(shared_from_this());
+        asio::post(socket_.get_executor(), [this, self]() {
+            if (shm_ring_) {
+                drain_ring();
+            }
+        });
+        return;
+    }
+    wait_ring();
 }
 
-size_t TopicManager::get_subscriber_count(const std::string& topic) const {
+long Session::consume_ring(size_t max_lines) {
+    std::string message;
+    bool corrupt = false;
+    ring_draining_ = true;
+    long lines = shm_ring_->ring().drain([&](std::string_view line) {
+        // Producers only publish through the ring. Anything else counts as
+        // corrupt: a command has a reply to send, and SHM:DETACH would
+        // drain this ring again from inside this drain.
+        if (corrupt || !(line.compare(0, 8, "PUBLISH:") == 0 || line.compare(0, 9, "TPUBLISH:") == 0)) {
+            corrupt = true;
+            return;
+        }
+        read_ingress_ns_ = latency_trace::now_ns();
+        message.assign(line);
+        if (capture::active()) {
+            capture::record(capture::Kind::Frame, capture_id_, read_ingress_ns_, message);
+        }
+        process_message(message);
+    }, max_lines);
+    ring_draining_ = false;
+    return corrupt ? -1 : lines;
+}
+
+// OK:PUBLISHED at once, or once enough followers have the message when
+// publishes wait for replication
+void Session::acknowledge_publish(uint64_t sequence) {
+    if (ring_draining_) {
+        return;
+    }
+    replication::Replication& replication = broker_.get_replication();
+    if (replication.required_acks() == 0) {
+        deliver("OK:PUBLISHED\n");
+        return;
+    }
+    std::weak_ptr<Session> weak = shared_from_this();
+    replication.when_replicated(sequence, [weak](bool replicated) {
+        if (auto self = weak.lock()) {
+            self->deliver(replicated ? "OK:PUBLISHED\n" : "ERROR:NOT_REPLICATED\n");
+        }
+    });
+}
+
+void Session::handle_replication_command(const std::string& command) {
+    replication::Replication& replication = broker_.get_replication();
+    std::string error;
+    if (command == "STATUS") {
+        replication::Stats stats = replication.stats();
+        std::ostringstream json;
+        json << "{\"role\":\"" << (stats.following ? "follower" : "leader") << "\""
+             << ",\"history\":" << stats.history << ",\"offset\":" << stats.offset;
+        if (stats.following) {
+            json << ",\"leader\":\"" << stats.leader << "\",\"connected\":" << (stats.connected ? "true" : "false")
+                 << ",\"applied\":" << stats.applied << ",\"apply_lag_us\":" << stats.apply_lag_us;
+        }
+        json << ",\"full_copies\":" << stats.full_copies << ",\"acks_timed_out\":" << stats.acks_timed_out
+             << ",\"followers\":[";
+        for (size_t i = 0; i < stats.followers.size(); ++i) {
+            const replication::FollowerStats& follower = stats.followers[i];
+            json << (i ? "," : "") << "{\"name\":\"" << follower.name << "\",\"acked\":" << follower.acked
+                 << ",\"lag\":" << follower.lag << ",\"ack_latency_us\":" << follower.ack_latency_us << "}";
+        }
+        json << "]}";
+        deliver("OK:REPLICATION:" + json.str() + "\n");
+    }
+    else if ((command == "PROMOTE" || command.find("FOLLOW:") == 0) && !is_local_peer()) {
+        // Either one replaces this broker's topic data or hands it out
+        deliver("ERROR:PERMISSION_DENIED\n");
+    }
+    else if (command == "PROMOTE") {
+        if (replication.promote(error)) {
+            deliver("OK:PROMOTED:" + std::to_string(broker_.get_topic_manager().get_next_sequence()) + "\n");
+        } else {
+            deliver("ERROR:" + error + "\n");
+        }
+    }
+    else if (command.find("FOLLOW:") == 0) {
+        if (replication.follow(command.substr(7), error)) {
+            deliver("OK:FOLLOWING\n");
+        } else {
+            deliver("ERROR:" + error + "\n");
+        }
+    }
+    else {
+        deliver("ERROR:UNKNOWN_COMMAND\n");
+    }
+}
+
+void Session::handle_heartbeat(const std::string& message) {
+    if (message == "HEARTBEAT") {
+        deliver("HEARTBEAT:ACK\n");
+    } else if (message == "HEARTBEAT:ACK") {
+        // The read that brought it counts as hearing from the peer
+    } else if (message == "HEARTBEAT:ON") {
+        uint32_t interval = 10000;
+        if (listener_ && listener_->config.heartbeat_ms > 0) {
+            interval = listener_->config.heartbeat_ms;
+        } else if (listener_ && listener_->config.idle_timeout_ms > 0) {
+            interval = std::max(1, listener_->config.idle_timeout_ms / 3);
+        }
+        deliver("OK:HEARTBEAT:" + std::to_string(interval) + "\n");
+        start_heartbeats(interval);
+    } else if (message == "HEARTBEAT:OFF") {
+        if (listener_ && listener_->config.heartbeat_ms > 0) {
+            deliver("ERROR:HEARTBEAT_REQUIRED\n");
+            return;
+        }
+        heartbeat_ms_ = 0;
+        deliver("OK:HEARTBEAT:OFF\n");
+    } else if (message.compare(0, 13, "OK:HEARTBEAT:") == 0) {
+        // The broker this session dialled probes it now; probe back at the
+        // same rate, so a dead peer is noticed from this side as well
+        uint32_t interval = static_cast<uint32_t>(std::strtoul(message.c_str() + 13, nullptr, 10));
+        if (interval > 0) {
+            start_heartbeats(interval);
+        }
+    } else {
+        deliver("ERROR:INVALID_FORMAT\n");
+    }
+}
+
+void Session::start_heartbeats(uint32_t interval_ms) {
+    heartbeat_ms_ = interval_ms;
+    broker_.watch(shared_from_this(), latency_trace::now_ns() + uint64_t{interval_ms} * 1000000);
+}
+
+bool Session::subscribe_credit(const std::string& topic, uint64_t amount, bool bytes, std::string& error) {
+    std::lock_guard<std::mutex> lock(credit_mutex_);
+    if (!credit_topics_.empty() && bytes != credit_bytes_) {
+        error = "CREDIT_UNIT";  // One unit per session
+        return false;
+    }
+    uint64_t next;
+    if (!broker_.get_topic_manager().subscribe_credit(topic, shared_from_this(), next)) {
+        error = "TOO_MANY_TOPICS";
+        return false;
+    }
+    credit_bytes_ = bytes;
+    TopicId id = topics::find(topic);
+    if (std::none_of(credit_topics_.begin(), credit_topics_.end(),
+                     [id](const CreditCursor& cursor) { return cursor.topic == id; })) {
+        credit_topics_.push_back(CreditCursor{id, next});
+    }
+    credit_ = std::min<int64_t>(credit_ + static_cast<int64_t>(amount), INT64_MAX / 2);
+    return true;
+}
+
+void Session::drop_credit(std::string_view topic) {
+    TopicId id = topics::find(topic);
+    std::lock_guard<std::mutex> lock(credit_mutex_);
+    credit_topics_.erase(std::remove_if(credit_topics_.begin(), credit_topics_.end(),
+                                        [id](const CreditCursor& cursor) { return cursor.topic == id; }),
+                         credit_topics_.end());
+}
+
+void Session::credit_ready() {
+    if (credit_open_.load(std::memory_order_relaxed)) {
+        pump_credit();
+    }
+}
+
+void Session::pump_credit() {
+    // Copies are taken in bounded batches while credit lasts; whatever the
+    // credit does not cover stays in the topic queues, not in write_queue_
+    const size_t batch_bytes = 64 * 1024;
+    std::lock_guard<std::mutex> lock(credit_mutex_);
+    while (credit_ > 0 && !closed_ && !credit_topics_.empty()) {
+        credit_batch_.clear();
+        if (broker_.get_topic_manager().fill_credit(credit_topics_, credit_, credit_bytes_, batch_bytes,
+                                                    credit_batch_) == 0) {
+            break;
+        }
+        deliver(credit_batch_);
+    }
+    credit_open_ = credit_ > 0;
+}
+
+void Session::handle_tracing_command(const std::string& command) {
+    if (command == "START" || command.find("START:") == 0) {
+        uint32_t sample_every = 1;
+        if (command.size() > 6) {
+            try {
+                sample_every = static_cast<uint32_t>(std::stoul(command.substr(6)));
+            } catch (const std::exception&) {
+                deliver("ERROR:INVALID_FORMAT\n");
+                return;
+            }
+        }
+        tracing::start(sample_every);
+        log_info("Span tracing started by " + get_client_id() + " (1/" + std::to_string(sample_every) + " sampled)");
+        deliver("OK:TRACING:STARTED\n");
+    }
+    else if (command == "STOP") {
+        tracing::stop();
+        deliver("OK:TRACING:STOPPED\n");
+    }
+    else if (command == "DUMP") {
+        // Fixed file name pattern: clients must not choose paths on the broker host
+        static std::atomic<int> dump_counter{0};
+        std::string path = "neuropipe_trace_" + std::to_string(getpid()) + "_" +
+                           std::to_string(dump_counter++) + ".json";
+        long spans = tracing::dump_chrome_json(path);
+        if (spans < 0) {
+            deliver("ERROR:TRACING_DUMP_FAILED\n");
+            return;
+        }
+        log_info("Span trace written to " + path + " (" + std::to_string(spans) + " spans)");
+        deliver("OK:TRACING:DUMPED:" + path + "\n");
+    }
+    else {
+        deliver("ERROR:UNKNOWN_COMMAND\n");
+    }
+}
+
+// ============================================================================
+// TopicManager Implementation
+// ============================================================================
+
+TopicManager::TopicState& TopicManager::state(TopicId id) {
+    if (id >= topics_.size()) {
+        topics_.resize(id + 1);
+    }
+    if (!topics_[id]) {
+        topics_[id] = std::make_unique<TopicState>();
+        topics_[id]->priority = classify(id);
+        ++state_count_;
+    }
+    return *topics_[id];
+}
+
+bool TopicManager::at_topic_limit(std::string_view topic) const {
+    return state_count_ >= max_topics_ && !find_state(topic);
+}
+
+Priority TopicManager::classify(TopicId id) const {
+    if (high_patterns_.empty() && low_patterns_.empty()) {
+        return Priority::Normal;
+    }
+    const std::string& topic = topics::name(id);
+    if (federation::matches(high_patterns_, topic)) {
+        return Priority::High;
+    }
+    return federation::matches(low_patterns_, topic) ? Priority::Low : Priority::Normal;
+}
+
+void TopicManager::set_priorities(const std::string& high, const std::string& low) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    high_patterns_ = federation::parse_patterns(high);
+    low_patterns_ = federation::parse_patterns(low);
+    for (TopicId id = 0; id < topics_.size(); ++id) {
+        if (topics_[id]) {
+            topics_[id]->priority = classify(id);
+        }
+    }
+}
+
+TopicManager::TopicState* TopicManager::find_state(std::string_view topic) {
+    TopicId id = topics::find(topic);
+    return id < topics_.size() ? topics_[id].get() : nullptr;
+}
+
+const TopicManager::TopicState* TopicManager::find_state(std::string_view topic) const {
+    TopicId id = topics::find(topic);
+    return id < topics_.size() ? topics_[id].get() : nullptr;
+}
+
+bool TopicManager::subscribe(std::string_view topic, std::shared_ptr<Session> session) {
+    TopicId id;
+    bool first = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (at_topic_limit(topic)) {
+            return false;
+        }
+        id = topics::intern(topic);
+        TopicState& entry = state(id);
+        entry.credit_subscribers.erase(session);
+        if (entry.subscribers.insert(session).second && entry.subscribers.size() == 1) {
+            ++subscribed_topics_;
+            first = true;
+        }
+    }
+    if (log_enabled(LogLevel::Info)) {
+        log_info("Session " + session->get_client_id() + " subscribed to topic: " + std::string(topic));
+    }
+    if (first) {
+        notify_interest(id);
+    }
+    return true;
+}
+
+bool TopicManager::subscribe_credit(std::string_view topic, std::shared_ptr<Session> session, uint64_t& next) {
+    TopicId id;
+    bool first = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (at_topic_limit(topic)) {
+            return false;
+        }
+        id = topics::intern(topic);
+        TopicState& entry = state(id);
+        entry.credit_subscribers.insert(session);
+        if (entry.subscribers.insert(session).second && entry.subscribers.size() == 1) {
+            ++subscribed_topics_;
+            first = true;
+        }
+        next = sequence_counter_;
+    }
+    if (log_enabled(LogLevel::Info)) {
+        log_info("Session " + session->get_client_id() + " subscribed to topic with credit: " + std::string(topic));
+    }
+    if (first) {
+        notify_interest(id);
+    }
+    return true;
+}
+
+size_t TopicManager::fill_credit(std::vector<CreditCursor>& cursors, int64_t& credit, bool bytes,
+                                 size_t max_bytes, std::string& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Each cursor's place in its queue; deque iterators stay valid while
+    // the lock is held
+    using Position = std::deque<Message>::const_iterator;
+    std::vector<std::pair<Position, Position>> positions(cursors.size());
+    for (size_t i = 0; i < cursors.size(); ++i) {
+        CreditCursor& cursor = cursors[i];
+        // clear_messages() restarts sequences; carry on from the new ones
+        cursor.next = std::min(cursor.next, sequence_counter_);
+        const TopicState* entry = cursor.topic < topics_.size() ? topics_[cursor.topic].get() : nullptr;
+        if (entry) {
+            positions[i].first = std::lower_bound(entry->queue.begin(), entry->queue.end(), cursor.next,
+                                                  [](const Message& msg, uint64_t value) { return msg.sequence < value; });
+            positions[i].second = entry->queue.end();
+        }
+    }
+    size_t count = 0;
+    while (credit > 0 && out.size() < max_bytes) {
+        size_t from = cursors.size();
+        for (size_t i = 0; i < cursors.size(); ++i) {
+            if (positions[i].first != positions[i].second &&
+                (from == cursors.size() || positions[i].first->sequence < positions[from].first->sequence)) {
+                from = i;
+            }
+        }
+        if (from == cursors.size()) {
+            break;
+        }
+        const Message& msg = *positions[from].first++;
+        size_t before = out.size();
+        out.append("MESSAGE:").append(topics::name(msg.topic)).append(1, ':');
+        out.append(msg.payload.view()).append(1, '\n');
+        cursors[from].next = msg.sequence + 1;
+        credit -= bytes ? static_cast<int64_t>(out.size() - before) : 1;
+        ++count;
+    }
+    delivered_count_.fetch_add(count, std::memory_order_relaxed);
+    return count;
+}
+
+void TopicManager::unsubscribe(std::string_view topic, std::shared_ptr<Session> session) {
+    bool last = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        TopicState* entry = find_state(topic);
+        if (!entry || entry->subscribers.erase(session) == 0) {
+            return;
+        }
+        entry->credit_subscribers.erase(session);
+        if (entry->subscribers.empty()) {
+            --subscribed_topics_;
+            last = true;
+        }
+    }
+    if (log_enabled(LogLevel::Info)) {
+        log_info("Session " + session->get_client_id() + " unsubscribed from topic: " + std::string(topic));
+    }
+    if (last) {
+        notify_interest(topics::find(topic));
+    }
+}
+
+void TopicManager::unsubscribe_all(std::shared_ptr<Session> session) {
+    std::vector<TopicId> emptied;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (TopicId id = 0; id < topics_.size(); ++id) {
+            auto& entry = topics_[id];
+            if (!entry || entry->subscribers.erase(session) == 0) {
+                continue;
+            }
+            entry->credit_subscribers.erase(session);
+            if (entry->subscribers.empty()) {
+                --subscribed_topics_;
+                emptied.push_back(id);
+            }
+        }
+    }
+    if (log_enabled(LogLevel::Info)) {
+        log_info("Session " + session->get_client_id() + " unsubscribed from all topics");
+    }
+    for (TopicId id : emptied) {
+        notify_interest(id);
+    }
+}
+
+uint64_t TopicManager::publish(std::string_view topic, const std::string& payload,
+                               const latency_trace::Stamps* trace, const federation::Origin* origin) {
+    TRACE_SCOPE("TopicManager::publish");
+    ALLOC_SCOPE(Publish);
+    Message msg(topics::intern(topic), payload);
+    if (trace) {
+        msg.send_ns = trace->ns[latency_trace::HOP_SEND];
+        msg.ingress_ns = trace->ns[latency_trace::HOP_INGRESS];
+    }
+    return add_message(std::move(msg), topic, payload, trace, origin, true);
+}
+
+void TopicManager::apply(std::string_view topic, const std::string& payload, uint64_t sequence,
+                         std::chrono::system_clock::time_point timestamp) {
+    TRACE_SCOPE("TopicManager::apply");
+    ALLOC_SCOPE(Publish);
+    Message msg(topics::intern(topic), payload);
+    msg.sequence = sequence;
+    msg.timestamp = timestamp;
+    add_message(std::move(msg), topic, payload, nullptr, nullptr, false);
+}
+
+uint64_t TopicManager::add_message(Message msg, std::string_view topic, const std::string& payload,
+                                   const latency_trace::Stamps* trace, const federation::Origin* origin,
+                                   bool assign_sequence) {
+    std::vector<std::shared_ptr<Session>> subscribers;
+    std::vector<std::shared_ptr<Session>> pulling;  // Credit subscribers; they read the queue
+    std::vector<std::shared_ptr<federation::Link>> links;
+    uint64_t sequence;
+    Priority priority;
+    {
+        std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+        {
+            TRACE_SCOPE("TopicManager::lock_wait");
+            lock.lock();
+        }
+        
+        // Assign sequence number (a replicated message keeps the leader's)
+        if (assign_sequence) {
+            msg.sequence = sequence_counter_++;
+        } else {
+            sequence_counter_ = std::max(sequence_counter_, msg.sequence + 1);
+        }
+        sequence = msg.sequence;
+        
+        TopicState& entry = state(msg.topic);
+        if (entry.tail) {
+            entry.tail->append(payload);
+        }
+        priority = entry.priority;
+        
+        // Get subscribers
+        if (entry.credit_subscribers.empty()) {
+            subscribers.assign(entry.subscribers.begin(), entry.subscribers.end());
+        } else {
+            for (const auto& subscriber : entry.subscribers) {
+                (entry.credit_subscribers.count(subscriber) ? pulling : subscribers).push_back(subscriber);
+            }
+        }
+        if (!entry.links.empty()) {
+            links = entry.links;
+        }
+        
+        // Store message in queue
+        entry.queue.push_back(std::move(msg));
+        if (append_listener_) {
+            append_listener_(entry.queue.back());
+        }
+    }
+    published_count_.fetch_add(1, std::memory_order_relaxed);
+    delivered_count_.fetch_add(subscribers.size(), std::memory_order_relaxed);
+    
+    // Broadcast to subscribers (outside lock to avoid deadlock)
+    if (!subscribers.empty()) {
+        tracing::Scope fanout("TopicManager::fanout");
+        ALLOC_SCOPE(Fanout);
+        fanout.set_arg("subscribers", static_cast<int64_t>(subscribers.size()));
+        std::string notification;
+        notification.reserve(8 + topic.size() + 1 + payload.size() + 1);
+        notification.append("MESSAGE:").append(topic).append(1, ':').append(payload).append(1, '\n');
+        std::string traced_notification;
+        for (auto& subscriber : subscribers) {
+            if (trace && subscriber->latency_trace_enabled()) {
+                if (traced_notification.empty()) {
+                    traced_notification = latency_trace::format_message(*trace, topic, payload);
+                }
+                subscriber->deliver(traced_notification, priority);
+            } else {
+                subscriber->deliver(notification, priority);
+            }
+        }
+        if (log_enabled(LogLevel::Info)) {
+            log_info("Published to topic '" + std::string(topic) + "' (" + std::to_string(subscribers.size()) + " subscribers)");
+        }
+    } else if (log_enabled(LogLevel::Info)) {
+        log_info("Published to topic '" + std::string(topic) + "' (no subscribers)");
+    }
+    
+    // The message is queued, so credit subscribers copy it only once they
+    // have credit for it
+    for (auto& subscriber : pulling) {
+        subscriber->credit_ready();
+    }
+    
+    // Bridged brokers that asked for the topic; each link skips the one
+    // the message came from
+    for (auto& link : links) {
+        link->forward(topic, payload, origin);
+    }
+    return sequence;
+}
+
+std::vector<std::shared_ptr<Session>> TopicManager::get_subscribers(std::string_view topic) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TopicState* entry = find_state(topic);
+    if (entry) {
+        return std::vector<std::shared_ptr<Session>>(entry->subscribers.begin(), entry->subscribers.end());
+    }
+    return {};
+}
+
+void TopicManager::store_message(const Message& msg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    state(msg.topic).queue.push_back(msg);
+}
+
+bool TopicManager::consume_message(std::string_view topic, Message& msg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TopicState* entry = find_state(topic);
+    if (entry && !entry->queue.empty()) {
+        msg = std::move(entry->queue.front());
+        entry->queue.pop_front();
+        return true;
+    }
+    return false;
+}
+
+std::string TopicManager::start_tail(const std::string& topic, std::string& error) {
+    TopicId id = topics::intern(topic);
+    std::lock_guard<std::mutex> lock(mutex_);
+    TopicState& entry = state(id);
+    if (entry.tail) {
+        return entry.tail->name();
+    }
+    if (!open_tail(entry, topic, error)) {
+        return "";
+    }
+    return entry.tail->name();
+}
+
+bool TopicManager::open_tail(TopicState& entry, const std::string& topic, std::string& error) {
+    if (tail_count_ >= MAX_TAILS) {
+        error = "already " + std::to_string(MAX_TAILS) + " topic tails";
+        return false;
+    }
+    entry.tail = TopicTail::create(topic, error);
+    if (!entry.tail) {
+        return false;
+    }
+    ++tail_count_;
+    return true;
+}
+
+bool TopicManager::stop_tail(const std::string& topic) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TopicState* entry = find_state(topic);
+    if (!entry || !entry->tail) {
+        return false;
+    }
+    entry->tail.reset();
+    --tail_count_;
+    return true;
+}
+
+void TopicManager::stop_tails() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : topics_) {
+        if (entry) {
+            entry->tail.reset();
+        }
+    }
+    tail_count_ = 0;
+}
+
+bool TopicManager::save_snapshot(const std::string& path, snapshot::Totals& totals, std::string& error) const {
+    totals = snapshot::Totals();
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshot::Writer writer;
+    if (!writer.open(path, sequence_counter_, error)) {
+        return false;
+    }
+    for (size_t id = 0; id < topics_.size(); ++id) {
+        const TopicState* entry = topics_[id].get();
+        if (!entry || (entry->queue.empty() && !entry->tail)) {
+            continue;
+        }
+        writer.topic(topics::name(static_cast<TopicId>(id)), entry->tail ? snapshot::FLAG_TAIL : 0,
+                     entry->queue.size());
+        for (const Message& msg : entry->queue) {
+            writer.message(msg.sequence,
+                           std::chrono::duration_cast<std::chrono::nanoseconds>(msg.timestamp.time_since_epoch()).count(),
+                           msg.payload.view());
+        }
+        ++totals.topics;
+        totals.messages += entry->queue.size();
+    }
+    return writer.commit(error);
+}
+
+bool TopicManager::load_snapshot(const std::string& path, snapshot::Totals& totals, std::string& error) {
+    totals = snapshot::Totals();
+    snapshot::Reader reader;
+    if (!reader.open(path, error)) {
+        return false;
+    }
+    std::string name;
+    std::string payload;
+    uint64_t flags;
+    uint64_t count;
+    std::lock_guard<std::mutex> lock(mutex_);
+    sequence_counter_ = std::max(sequence_counter_, reader.next_sequence());
+    while (reader.next_topic(name, flags, count)) {
+        TopicId id = topics::intern(name);
+        TopicState& entry = state(id);
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t sequence;
+            int64_t timestamp_ns;
+            if (!reader.next_message(sequence, timestamp_ns, payload)) {
+                error = path + " is damaged after " + std::to_string(totals.messages) + " messages";
+                return false;
+            }
+            Message msg(id, payload);
+            msg.sequence = sequence;
+            msg.timestamp = std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(timestamp_ns)));
+            entry.queue.push_back(std::move(msg));
+            ++totals.messages;
+        }
+        if ((flags & snapshot::FLAG_TAIL) && !entry.tail) {
+            std::string tail_error;
+            if (!open_tail(entry, name, tail_error)) {
+                log_warn("Cannot restore tail of topic '" + name + "': " + tail_error);
+            }
+        }
+        ++totals.topics;
+    }
+    if (!reader.complete()) {
+        error = path + " is damaged after " + std::to_string(totals.messages) + " messages";
+        return false;
+    }
+    return true;
+}
+
+uint64_t TopicManager::get_next_sequence() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sequence_counter_;
+}
+
+void TopicManager::advance_sequence(uint64_t sequence) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sequence_counter_ = std::max(sequence_counter_, sequence);
+}
+
+void TopicManager::clear_messages() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : topics_) {
+        if (entry) {
+            entry->queue.clear();
+        }
+    }
+    sequence_counter_ = 0;
+}
+
+void TopicManager::at_next_sequence(const std::function<void(uint64_t)>& fn) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fn(sequence_counter_);
+}
+
+bool TopicManager::copy_messages(TopicId& topic, uint64_t& sequence, uint64_t below, size_t max_bytes,
+                                 std::vector<Message>& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t bytes = 0;
+    for (; topic < topics_.size(); ++topic, sequence = 0) {
+        const TopicState* entry = topics_[topic].get();
+        if (!entry) {
+            continue;
+        }
+        // Queues are in sequence order
+        auto it = std::lower_bound(entry->queue.begin(), entry->queue.end(), sequence,
+                                   [](const Message& msg, uint64_t value) { return msg.sequence < value; });
+        for (; it != entry->queue.end() && it->sequence < below; ++it) {
+            if (bytes >= max_bytes) {
+                sequence = it->sequence;
+                return true;
+            }
+            out.push_back(*it);
+            bytes += it->payload.view().size() + topics::name(topic).size();
+        }
+    }
+    return false;
+}
+
+void TopicManager::add_link_interest(std::string_view topic, std::shared_ptr<federation::Link> link) {
+    TopicId id = topics::intern(topic);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& links = state(id).links;
+        if (std::find(links.begin(), links.end(), link) != links.end()) {
+            return;
+        }
+        links.push_back(std::move(link));
+    }
+    notify_interest(id);
+}
+
+void TopicManager::remove_link_interest(std::string_view topic, const federation::Link* link) {
+    TopicId id = topics::find(topic);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        TopicState* entry = id < topics_.size() ? topics_[id].get() : nullptr;
+        if (!entry) {
+            return;
+        }
+        auto found = std::find_if(entry->links.begin(), entry->links.end(),
+                                  [link](const auto& candidate) { return candidate.get() == link; });
+        if (found == entry->links.end()) {
+            return;
+        }
+        entry->links.erase(found);
+    }
+    notify_interest(id);
+}
+
+void TopicManager::remove_link(const federation::Link* link) {
+    std::vector<TopicId> changed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (TopicId id = 0; id < topics_.size(); ++id) {
+            auto& entry = topics_[id];
+            if (!entry) {
+                continue;
+            }
+            auto found = std::find_if(entry->links.begin(), entry->links.end(),
+                                      [link](const auto& candidate) { return candidate.get() == link; });
+            if (found != entry->links.end()) {
+                entry->links.erase(found);
+                changed.push_back(id);
+            }
+        }
+    }
+    for (TopicId id : changed) {
+        notify_interest(id);
+    }
+}
+
+bool TopicManager::has_interest(TopicId topic, const federation::Link* except) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const TopicState* entry = topic < topics_.size() ? topics_[topic].get() : nullptr;
+    if (!entry) {
+        return false;
+    }
+    if (!entry->subscribers.empty()) {
+        return true;
+    }
+    for (const auto& link : entry->links) {
+        if (link.get() != except) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<TopicId> TopicManager::interested_topics(const federation::Link* except) const {
+    std::vector<TopicId> interested;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (TopicId id = 0; id < topics_.size(); ++id) {
+        const TopicState* entry = topics_[id].get();
+        if (!entry) {
+            continue;
+        }
+        bool wanted = !entry->subscribers.empty();
+        for (size_t i = 0; !wanted && i < entry->links.size(); ++i) {
+            wanted = entry->links[i].get() != except;
+        }
+        if (wanted) {
+            interested.push_back(id);
+        }
+    }
+    return interested;
+}
+
+size_t TopicManager::get_topic_count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return subscribed_topics_;
+}
+
+size_t TopicManager::get_subscriber_count(std::string_view topic) const {
     std::lock_guard<std::mutex> lock(mutex_);
-    auto it = subscriptions_.find(topic);
-    return it != subscriptions_.end() ? it->second.size() : 0;
+    const TopicState* entry = find_state(topic);
+    return entry ? entry->subscribers.size() : 0;
 }
 
 // ============================================================================
 // BrokerServer Implementation
 // ============================================================================
 
+void Session::close() {
+    std::error_code ignored;
+    socket_.shutdown(asio::socket_base::shutdown_both, ignored);
+}
+
+void Session::expire() {
+    if (log_enabled(LogLevel::Info)) {
+        log_info("Closing silent session " + get_client_id());
+    }
+    // Reset instead of a FIN a half-open peer would never acknowledge: the
+    // kernel drops the unsent data when the socket closes
+    struct linger reset = {1, 0};
+    ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    close();  // Fails the pending read and write; their handlers find the session gone
+    broker_.on_session_disconnect(shared_from_this());
+}
+
+void Session::set_listener(BrokerListener* listener) {
+    listener_ = listener;
+    quickack_ = listener && !listener->is_unix && listener->config.tcp_quickack;
+    if (listener) {
+        idle_timeout_ms_ = listener->config.idle_timeout_ms;
+        heartbeat_ms_ = listener->config.heartbeat_ms;
+    }
+}
+
+void Session::rearm_quickack() {
+    // The kernel drops back to delayed ACKs on its own, so ask again per read
+    int on = 1;
+    ::setsockopt(socket_.native_handle(), IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+}
+
+namespace {
+
+std::error_code set_tcp_option(int fd, int option, int value) {
+    if (::setsockopt(fd, IPPROTO_TCP, option, &value, sizeof(value)) != 0) {
+        return std::error_code(errno, std::system_category());
+    }
+    return {};
+}
+
+template <typename Endpoint>
+Endpoint to_endpoint(const asio::generic::stream_protocol::endpoint& endpoint) {
+    Endpoint result;
+    std::memcpy(result.data(), endpoint.data(), endpoint.size());
+    result.resize(endpoint.size());
+    return result;
+}
+
+uint16_t endpoint_port(const asio::generic::stream_protocol::endpoint& endpoint) {
+    if (endpoint.protocol().family() != AF_INET && endpoint.protocol().family() != AF_INET6) {
+        return 0;
+    }
+    return to_endpoint<asio::ip::tcp::endpoint>(endpoint).port();
+}
+
+// Whether a socket bound at `bound` serves a listener configured for
+// `wanted`; port 0 in `wanted` takes any port
+bool same_listen_address(const asio::generic::stream_protocol::endpoint& bound,
+                         const asio::generic::stream_protocol::endpoint& wanted) {
+    if (bound.protocol().family() != wanted.protocol().family()) {
+        return false;
+    }
+    if (wanted.protocol().family() == AF_UNIX) {
+        return to_endpoint<asio::local::stream_protocol::endpoint>(bound).path() ==
+               to_endpoint<asio::local::stream_protocol::endpoint>(wanted).path();
+    }
+    auto bound_tcp = to_endpoint<asio::ip::tcp::endpoint>(bound);
+    auto wanted_tcp = to_endpoint<asio::ip::tcp::endpoint>(wanted);
+    return bound_tcp.address() == wanted_tcp.address() &&
+           (wanted_tcp.port() == 0 || bound_tcp.port() == wanted_tcp.port());
+}
+
+// Remove a socket file left at path by a process that is gone; false when
+// something still accepts on it (or may: a full backlog refuses with
+// EAGAIN). Other files at path are left alone for bind() to fail on.
+bool remove_stale_socket(const std::string& path, std::string& error) {
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0 || !S_ISSOCK(info.st_mode)) {
+        return true;
+    }
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = std::string("socket: ") + std::strerror(errno);
+        return false;
+    }
+    int result = ::connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+    int connect_errno = errno;
+    ::close(fd);
+    if (result != 0 && connect_errno == ECONNREFUSED) {
+        ::unlink(path.c_str());
+        return true;
+    }
+    if (result != 0 && connect_errno == ENOENT) {
+        return true;  // Removed meanwhile
+    }
+    error = "address in use: " + path;
+    return false;
+}
+
+// Replies to a successor can wait this long for the other side
+constexpr int HANDOFF_TIMEOUT_MS = 10000;
+
+// Hand-off connection waiting for its HANDOFF line, read asynchronously so
+// a silent peer never holds up the io thread
+struct HandoffRequest {
+    explicit HandoffRequest(asio::local::stream_protocol::socket peer)
+        : socket(std::move(peer)), timer(socket.get_executor()) {}
+    
+    asio::local::stream_protocol::socket socket;
+    asio::streambuf buffer;
+    asio::steady_timer timer;
+};
+
+} // namespace
+
+BrokerServer::BrokerServer(asio::io_context& io_context)
+    : io_context_(io_context),
+      idle_epoch_ns_(latency_trace::now_ns()),
+      idle_timer_(io_context),
+      federation_(std::make_unique<federation::Federation>(*this, io_context)),
+      replication_(std::make_unique<replication::Replication>(*this, io_context)) {
+    topic_manager_.set_interest_listener([this](TopicId topic) { federation_->interest_changed(topic); });
+    topic_manager_.set_append_listener([this](const Message& msg) { replication_->appended(msg); });
+}
+
 BrokerServer::BrokerServer(asio::io_context& io_context, uint16_t port)
-    : acceptor_(io_context, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)) {
-    log_info("BrokerServer initialized on port " + std::to_string(port));
+    : BrokerServer(io_context) {
+    ListenerConfig config;
+    config.name = "tcp";
+    config.address = "0.0.0.0:" + std::to_string(port);
+    std::string error;
+    if (!add_listener(config, error)) {
+        throw std::runtime_error(error);
+    }
+}
+
+bool BrokerServer::add_listener(const ListenerConfig& config, std::string& error) {
+    ListenAddress address;
+    if (!ListenAddress::parse(config.address, address, error)) {
+        return false;
+    }
+    auto listener = std::make_unique<BrokerListener>(io_context_, config);
+    listener->is_unix = address.is_unix;
+    
+    std::error_code ec;
+    asio::generic::stream_protocol::endpoint endpoint;
+    if (address.is_unix) {
+        listener->unix_path = address.host;
+        endpoint = asio::local::stream_protocol::endpoint(address.host);
+    } else {
+        asio::ip::address ip = asio::ip::make_address(address.host, ec);
+        if (ec) {
+            error = "invalid listen address '" + address.host + "'";
+            return false;
+        }
+        endpoint = asio::ip::tcp::endpoint(ip, address.port);
+    }
+    
+    // Accepted sockets inherit the buffer sizes; the receive buffer has to
+    // be set before listen() so the advertised window scale matches it. A
+    // socket inherited from the previous broker is already bound.
+    BrokerListener::Acceptor& acceptor = listener->acceptor;
+    bool inherited = adopt_listener(config.name, endpoint, acceptor);
+    if (!inherited && address.is_unix && !remove_stale_socket(address.host, error)) {
+        return false;
+    }
+    if (!inherited) {
+        acceptor.open(endpoint.protocol(), ec);
+    }
+    if (!ec && !inherited && !address.is_unix) {
+        acceptor.set_option(asio::socket_base::reuse_address(true), ec);
+    }
+    if (!ec && config.send_buffer > 0) {
+        acceptor.set_option(asio::socket_base::send_buffer_size(config.send_buffer), ec);
+    }
+    if (!ec && config.receive_buffer > 0) {
+        acceptor.set_option(asio::socket_base::receive_buffer_size(config.receive_buffer), ec);
+    }
+    if (!ec && !address.is_unix && config.defer_accept > 0) {
+        // Connections are only reported once the client has sent data
+        ec = set_tcp_option(acceptor.native_handle(), TCP_DEFER_ACCEPT, config.defer_accept);
+    }
+    if (!ec && !inherited) {
+        acceptor.bind(endpoint, ec);
+    }
+    if (!ec) {
+        acceptor.listen(config.backlog, ec);  // Also resizes an inherited backlog
+    }
+    if (ec) {
+        error = "cannot listen on " + config.address + ": " + ec.message();
+        std::error_code ignored;
+        acceptor.close(ignored);
+        return false;
+    }
+    
+    if (config.accept_rate > 0) {
+        listener->tokens = config.accept_burst > 0 ? config.accept_burst : std::max(1.0, config.accept_rate);
+        listener->refilled = std::chrono::steady_clock::now();
+    }
+    if (address.is_unix && unix_path_.empty()) {
+        unix_path_ = address.host;
+    }
+    log_info("BrokerServer listening on " + config.address + " (" + config.name +
+             (inherited ? ", inherited)" : ")"));
+    listeners_.push_back(std::move(listener));
+    if (running_) {
+        accept_next(*listeners_.back());
+    }
+    return true;
+}
+
+bool BrokerServer::adopt_listener(const std::string& name, const asio::generic::stream_protocol::endpoint& endpoint,
+                                  BrokerListener::Acceptor& acceptor) {
+    auto found = inherited_.find(name);
+    if (found == inherited_.end()) {
+        return false;
+    }
+    int fd = found->second;
+    inherited_.erase(found);
+    std::error_code ec;
+    acceptor.assign(endpoint.protocol(), fd, ec);
+    if (ec) {
+        ::close(fd);
+        return false;
+    }
+    auto bound = acceptor.local_endpoint(ec);
+    if (ec || !same_listen_address(bound, endpoint)) {
+        // The address changed across the restart; the old socket's waiting
+        // connections are reset when it closes
+        log_warn("Listener " + name + " moved, not reusing the inherited socket");
+        acceptor.close(ec);
+        return false;
+    }
+    return true;
+}
+
+bool BrokerServer::listen_unix(const std::string& path) {
+    ListenerConfig config;
+    config.name = "unix";
+    config.address = std::string(transport::UNIX_PREFIX) + path;
+    std::string error;
+    if (!add_listener(config, error)) {
+        log_error("Cannot listen on Unix socket " + path + ": " + error);
+        return false;
+    }
+    return true;
+}
+
+uint16_t BrokerServer::get_port() const {
+    for (const auto& listener : listeners_) {
+        if (!listener->is_unix && listener->acceptor.is_open()) {
+            return endpoint_port(listener->acceptor.local_endpoint());
+        }
+    }
+    return 0;
+}
+
+uint16_t BrokerServer::get_port(const std::string& name) const {
+    for (const auto& listener : listeners_) {
+        if (listener->config.name == name && !listener->is_unix && listener->acceptor.is_open()) {
+            return endpoint_port(listener->acceptor.local_endpoint());
+        }
+    }
+    return 0;
+}
+
+bool BrokerServer::use_io_uring(std::string& error) {
+    if (!uring_) {
+        uring_ = UringEngine::create(io_context_, error);
+        if (!uring_) {
+            return false;
+        }
+        log_info(std::string("BrokerServer using io_uring (") +
+                 (uring_->fixed_sends() ? "registered-buffer sends" : "copied sends") + ")");
+    }
+    return true;
 }
 
 BrokerServer::~BrokerServer() {
     stop();
+    for (auto& entry : inherited_) {
+        ::close(entry.second);
+    }
+}
+
+bool BrokerServer::serve_handoff(const std::string& path, const std::string& snapshot_path,
+                                 std::function<void()> done, std::string& error) {
+    if (!remove_stale_socket(path, error)) {
+        return false;
+    }
+    auto acceptor = std::make_unique<asio::local::stream_protocol::acceptor>(io_context_);
+    asio::local::stream_protocol::endpoint endpoint(path);
+    std::error_code ec;
+    acceptor->open(endpoint.protocol(), ec);
+    // The socket file takes the socket's mode (less the umask) at bind, so
+    // there is no moment in which another user could connect
+    if (!ec && ::fchmod(acceptor->native_handle(), 0600) != 0) {
+        ec = std::error_code(errno, std::system_category());
+    }
+    if (!ec) {
+        acceptor->bind(endpoint, ec);
+    }
+    if (!ec) {
+        acceptor->listen(1, ec);
+    }
+    if (ec) {
+        error = "cannot listen on " + path + ": " + ec.message();
+        return false;
+    }
+    handoff_acceptor_ = std::move(acceptor);
+    handoff_path_ = path;
+    snapshot_path_ = snapshot_path;
+    handoff_done_ = std::move(done);
+    accept_handoff();
+    return true;
+}
+
+void BrokerServer::accept_handoff() {
+    handoff_acceptor_->async_accept(
+        [this](std::error_code ec, asio::local::stream_protocol::socket socket) {
+            if (ec) {
+                if (ec != asio::error::operation_aborted) {
+                    log_error("Hand-off accept failed: " + ec.message());
+                }
+                return;
+            }
+            // Listening sockets and topic data only go to processes of our
+            // own user; anyone else is turned away before a byte is read
+            struct ucred peer;
+            socklen_t peer_length = sizeof(peer);
+            if (getsockopt(socket.native_handle(), SOL_SOCKET, SO_PEERCRED, &peer, &peer_length) != 0 ||
+                (peer.uid != geteuid() && peer.uid != 0)) {
+                log_warn("Refusing hand-off connection from uid " + std::to_string(peer.uid));
+                handoff::Channel(socket.release()).send("ERROR permission denied");
+            } else {
+                read_handoff_request(std::move(socket));
+            }
+            if (!handed_off_ && handoff_acceptor_) {
+                accept_handoff();
+            }
+        });
+}
+
+void BrokerServer::read_handoff_request(asio::local::stream_protocol::socket socket) {
+    auto request = std::make_shared<HandoffRequest>(std::move(socket));
+    request->timer.expires_after(std::chrono::milliseconds(HANDOFF_TIMEOUT_MS));
+    request->timer.async_wait([request](std::error_code ec) {
+        if (!ec) {
+            std::error_code ignored;
+            request->socket.close(ignored);  // Fails the pending read
+        }
+    });
+    asio::async_read_until(
+        request->socket, request->buffer, '\n',
+        [this, request](std::error_code ec, size_t length) {
+            request->timer.cancel();
+            std::string line;
+            if (!ec) {
+                line.assign(asio::buffers_begin(request->buffer.data()),
+                            asio::buffers_begin(request->buffer.data()) + length - 1);
+            }
+            if (line != "HANDOFF") {
+                log_warn("Ignoring hand-off connection without a HANDOFF request");
+                return;
+            }
+            // Another successor got there first, or the broker stopped
+            if (handed_off_ || !handoff_acceptor_ || !handoff_acceptor_->is_open()) {
+                handoff::Channel(request->socket.release()).send("ERROR hand-off closed");
+                return;
+            }
+            hand_off(request->socket.release());
+        });
+}
+
+void BrokerServer::hand_off(int fd) {
+    handoff::Channel channel(fd);
+    
+    // This runs on the io thread, so nothing is published while the snapshot
+    // is taken. Until the listeners are passed on, a failure leaves this
+    // broker running as it was.
+    auto begin = std::chrono::steady_clock::now();
+    snapshot::Totals totals;
+    std::string error;
+    if (!topic_manager_.save_snapshot(snapshot_path_, totals, error)) {
+        log_error("Hand-off failed: " + error);
+        channel.send("ERROR " + error);
+        return;
+    }
+    for (auto& listener : listeners_) {
+        if (listener->acceptor.is_open()) {
+            channel.send("LISTENER " + listener->config.name, listener->acceptor.native_handle());
+        }
+    }
+    // From here the successor owns the sockets; stop() keeps their paths
+    handed_off_ = true;
+    for (auto& listener : listeners_) {
+        std::error_code ignored;
+        listener->throttle.cancel();
+        listener->acceptor.close(ignored);
+    }
+    topic_manager_.stop_tails();  // The successor recreates them
+    std::error_code ignored;
+    handoff_acceptor_->close(ignored);
+    ::unlink(handoff_path_.c_str());  // Before replying, so the successor can bind it
+    channel.send("SNAPSHOT " + snapshot_path_);
+    
+    log_info("Handed off to successor: " + std::to_string(totals.topics) + " topics, " +
+             std::to_string(totals.messages) + " messages in " +
+             std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - begin).count()) + " ms");
+    stop();
+    if (handoff_done_) {
+        handoff_done_();
+    }
+}
+
+bool BrokerServer::take_over(const std::string& path, snapshot::Totals& totals, std::string& error) {
+    totals = snapshot::Totals();
+    handoff::Channel channel = handoff::Channel::connect(path, error);
+    if (channel.fd() < 0) {
+        return false;
+    }
+    if (!channel.send("HANDOFF")) {
+        error = "cannot send hand-off request to " + path;
+        return false;
+    }
+    std::string line;
+    while (channel.receive(line, HANDOFF_TIMEOUT_MS)) {
+        if (line.compare(0, 9, "LISTENER ") == 0) {
+            int fd = channel.take_fd();
+            if (fd < 0) {
+                error = "hand-off sent listener " + line.substr(9) + " without its socket";
+                return false;
+            }
+            auto added = inherited_.emplace(line.substr(9), fd);
+            if (!added.second) {
+                ::close(added.first->second);
+                added.first->second = fd;
+            }
+        } else if (line.compare(0, 9, "SNAPSHOT ") == 0) {
+            // The listeners are ours now; a damaged snapshot only costs history
+            std::string snapshot_path = line.substr(9);
+            if (!topic_manager_.load_snapshot(snapshot_path, totals, error)) {
+                log_warn("Snapshot from previous broker: " + error);
+                error.clear();
+            }
+            std::remove(snapshot_path.c_str());
+            return true;
+        } else if (line.compare(0, 6, "ERROR ") == 0) {
+            error = "previous broker refused the hand-off: " + line.substr(6);
+            return false;
+        } else {
+            error = "unexpected hand-off reply '" + line + "'";
+            return false;
+        }
+    }
+    error = "no hand-off reply from " + path;
+    return false;
 }
 
 void BrokerServer::start() {
@@ -285,8 +2219,20 @@ void BrokerServer::start() {
     }
     
     running_ = true;
+    if (listeners_.empty()) {
+        log_warn("BrokerServer has no listeners");
+    }
+    for (auto& entry : inherited_) {
+        log_warn("No listener named " + entry.first + ", closing the inherited socket");
+        ::close(entry.second);
+    }
+    inherited_.clear();
     log_info("BrokerServer started, accepting connections...");
-    do_accept();
+    for (auto& listener : listeners_) {
+        accept_next(*listener);
+    }
+    federation_->start();
+    replication_->start();
 }
 
 void BrokerServer::stop() {
@@ -295,10 +2241,30 @@ void BrokerServer::stop() {
     }
     
     running_ = false;
+    federation_->stop();
+    replication_->stop();
+    idle_timer_.cancel();
+    
+    // Close acceptors
+    for (auto& listener : listeners_) {
+        std::error_code ignored;
+        listener->throttle.cancel();
+        listener->acceptor.close(ignored);
+        listener->connections = 0;  // Sessions are dropped below
+        if (listener->is_unix && !handed_off_) {
+            ::unlink(listener->unix_path.c_str());
+        }
+    }
+    
+    if (handoff_acceptor_ && handoff_acceptor_->is_open()) {
+        std::error_code ignored;
+        handoff_acceptor_->close(ignored);
+        ::unlink(handoff_path_.c_str());
+    }
     
-    // Close acceptor
-    if (acceptor_.is_open()) {
-        acceptor_.close();
+    // Sessions on io_uring end through their cancelled receives
+    if (uring_) {
+        uring_->shutdown();
     }
     
     // Close all sessions
@@ -310,49 +2276,285 @@ void BrokerServer::stop() {
     log_info("BrokerServer stopped");
 }
 
-void BrokerServer::do_accept() {
-    acceptor_.async_accept(
-        [this](std::error_code ec, asio::ip::tcp::socket socket) {
-            if (!ec) {
-                auto session = std::make_shared<Session>(std::move(socket), *this);
-                {
-                    std::lock_guard<std::mutex> lock(sessions_mutex_);
-                    sessions_.insert(session);
+void BrokerServer::accept_next(BrokerListener& listener) {
+    if (!running_) {
+        return;
+    }
+    double rate = listener.config.accept_rate;
+    if (rate > 0) {
+        // Connections over the rate wait in the kernel's backlog
+        auto now = std::chrono::steady_clock::now();
+        double burst = listener.config.accept_burst > 0 ? listener.config.accept_burst : std::max(1.0, rate);
+        listener.tokens = std::min(burst, listener.tokens +
+                                   rate * std::chrono::duration<double>(now - listener.refilled).count());
+        listener.refilled = now;
+        if (listener.tokens < 1) {
+            throttled_accepts_.fetch_add(1, std::memory_order_relaxed);
+            std::chrono::duration<double> wait((1 - listener.tokens) / rate);
+            listener.throttle.expires_after(std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait));
+            listener.throttle.async_wait([this, &listener](std::error_code ec) {
+                if (!ec) {
+                    accept_next(listener);
                 }
-                session->start();
-            } else {
-                log_error("Accept failed: " + ec.message());
+            });
+            return;
+        }
+        listener.tokens -= 1;
+    }
+    do_accept(listener);
+}
+
+void BrokerServer::do_accept(BrokerListener& listener) {
+    listener.acceptor.async_accept(
+        [this, &listener](std::error_code ec, Session::Socket socket) {
+            if (!ec) {
+                on_accept(listener, std::move(socket));
+            } else if (ec != asio::error::operation_aborted) {
+                log_error("Accept failed on " + listener.config.address + ": " + ec.message());
             }
             
             if (running_) {
-                do_accept();
+                accept_next(listener);
             }
         });
 }
 
-void BrokerServer::publish(const std::string& topic, const std::string& payload) {
-    topic_manager_.publish(topic, payload);
+void BrokerServer::on_accept(BrokerListener& listener, Session::Socket socket) {
+    const ListenerConfig& config = listener.config;
+    if (config.max_connections > 0 && listener.connections.load() >= config.max_connections) {
+        refused_connections_.fetch_add(1, std::memory_order_relaxed);
+        if (!listener.refusing) {
+            listener.refusing = true;
+            log_warn("Listener " + config.name + " is at max_connections (" +
+                     std::to_string(config.max_connections) + "), refusing new connections");
+        }
+        static const char reply[] = "ERROR:TOO_MANY_CONNECTIONS\n";
+        ssize_t ignored = ::send(socket.native_handle(), reply, sizeof(reply) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        (void)ignored;
+        return;  // Closing the socket
+    }
+    listener.refusing = false;
+    
+    if (!listener.is_unix) {
+        std::error_code ec;
+        if (config.tcp_nodelay) {
+            ec = set_tcp_option(socket.native_handle(), TCP_NODELAY, 1);
+        }
+        if (!ec && config.tcp_quickack) {
+            ec = set_tcp_option(socket.native_handle(), TCP_QUICKACK, 1);
+        }
+        if (ec) {
+            log_warn("Cannot tune connection on " + config.name + ": " + ec.message());
+        }
+    }
+    listener.connections.fetch_add(1);
+    add_session(std::move(socket), &listener);
+}
+
+std::shared_ptr<Session> BrokerServer::add_session(
+    Session::Socket socket, BrokerListener* listener,
+    const std::function<void(const std::shared_ptr<Session>&)>& prepare) {
+    // Session and control block in one pooled block (see session_pool.hpp)
+    auto session = std::allocate_shared<Session>(SessionAllocator<Session>(), std::move(socket), *this);
+    session->set_listener(listener);
+    if (prepare) {
+        prepare(session);
+    }
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        sessions_.insert(session);
+    }
+    session->start();
+    return session;
+}
+
+void BrokerServer::connect(const std::string& remote,
+                           std::function<void(std::error_code, Session::Socket)> handler) {
+    ListenAddress address;
+    std::string error;
+    if (!ListenAddress::parse(remote, address, error)) {
+        asio::post(io_context_, [handler = std::move(handler), this]() {
+            handler(asio::error::invalid_argument, Session::Socket(io_context_));
+        });
+        return;
+    }
+    auto socket = std::make_shared<Session::Socket>(io_context_);
+    auto on_connect = [socket, handler = std::move(handler)](std::error_code ec) {
+        if (!ec && socket->local_endpoint().protocol().family() != AF_UNIX) {
+            // Peers batch their own frames; Nagle would only add delay
+            int on = 1;
+            ::setsockopt(socket->native_handle(), IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        handler(ec, std::move(*socket));
+    };
+
+    if (address.is_unix) {
+        socket->async_connect(asio::local::stream_protocol::endpoint(address.host), std::move(on_connect));
+        return;
+    }
+    auto resolver = std::make_shared<asio::ip::tcp::resolver>(io_context_);
+    resolver->async_resolve(address.host, std::to_string(address.port),
+        [socket, resolver, on_connect = std::move(on_connect)](std::error_code ec,
+                                                               asio::ip::tcp::resolver::results_type results) mutable {
+            if (!ec && results.empty()) {
+                ec = asio::error::host_not_found;
+            }
+            if (ec) {
+                on_connect(ec);
+                return;
+            }
+            socket->async_connect(results.begin()->endpoint(), std::move(on_connect));
+        });
+}
+
+uint64_t BrokerServer::publish(std::string_view topic, const std::string& payload,
+                               const latency_trace::Stamps* trace, const federation::Origin* origin) {
+    return topic_manager_.publish(topic, payload, trace, origin);
 }
 
-void BrokerServer::subscribe(const std::string& topic, std::shared_ptr<Session> session) {
-    topic_manager_.subscribe(topic, session);
+bool BrokerServer::add_bridge(const BridgeConfig& config, std::string& error) {
+    return federation_->add_bridge(config, error);
 }
 
-void BrokerServer::unsubscribe(const std::string& topic, std::shared_ptr<Session> session) {
+bool BrokerServer::subscribe(std::string_view topic, std::shared_ptr<Session> session) {
+    return topic_manager_.subscribe(topic, session);
+}
+
+void BrokerServer::unsubscribe(std::string_view topic, std::shared_ptr<Session> session) {
     topic_manager_.unsubscribe(topic, session);
 }
 
 void BrokerServer::on_session_disconnect(std::shared_ptr<Session> session) {
+    // Expired sessions come back here through their failed read and write
+    if (session->closed_.exchange(true)) {
+        return;
+    }
+    
     // Remove from all subscriptions
     topic_manager_.unsubscribe_all(session);
+    if (session->get_bridge()) {
+        federation_->link_closed(session->get_bridge());
+    }
+    if (session->get_feed()) {
+        replication_->detach(session->get_feed());
+    }
+    if (session->is_upstream()) {
+        replication_->upstream_closed(session);
+    }
     
     // Remove from active sessions
+    bool removed;
     {
         std::lock_guard<std::mutex> lock(sessions_mutex_);
-        sessions_.erase(session);
+        removed = sessions_.erase(session) > 0;
+    }
+    if (removed && session->get_listener()) {
+        session->get_listener()->connections.fetch_sub(1);
     }
     
-    log_info("Session removed: " + session->get_client_id());
+    if (log_enabled(LogLevel::Info)) {
+        log_info("Session removed: " + session->get_client_id());
+    }
+}
+
+void BrokerServer::set_priorities(const PriorityConfig& config) {
+    topic_manager_.set_priorities(config.high, config.low);
+    lane_schedule_.strict = config.strict;
+    lane_schedule_.weights = config.weights;
+}
+
+void BrokerServer::watch(const std::shared_ptr<Session>& session, uint64_t deadline_ns) {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    uint64_t now_tick = (latency_trace::now_ns() - idle_epoch_ns_) / IDLE_TICK_NS;
+    if (idle_wheel_.size() == 0) {
+        idle_wheel_.advance(now_tick, [](std::weak_ptr<Session>&&) {});  // Catch up after a quiet spell
+    }
+    uint64_t tick = deadline_ns > idle_epoch_ns_ ? (deadline_ns - idle_epoch_ns_ + IDLE_TICK_NS - 1) / IDLE_TICK_NS : 0;
+    tick = std::max(tick, idle_wheel_.now() + 1);
+    if (session->watch_tick_ != 0 && session->watch_tick_ <= tick) {
+        return;  // Its entry comes up first and moves itself
+    }
+    // An entry left at a later tick finds watch_tick_ changed and is dropped
+    session->watch_tick_ = tick;
+    idle_wheel_.schedule(tick, session);
+    if (!idle_ticking_) {
+        idle_ticking_ = true;
+        asio::post(io_context_, [this]() { tick_idle(); });
+    }
+}
+
+void BrokerServer::tick_idle() {
+    if (!running_) {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        idle_ticking_ = false;
+        return;
+    }
+    idle_timer_.expires_after(std::chrono::nanoseconds(IDLE_TICK_NS));
+    idle_timer_.async_wait([this](std::error_code ec) {
+        uint64_t now = latency_trace::now_ns();
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            if (ec || !running_) {
+                idle_ticking_ = false;
+                return;
+            }
+            idle_wheel_.advance((now - idle_epoch_ns_) / IDLE_TICK_NS, [this](std::weak_ptr<Session>&& entry) {
+                std::shared_ptr<Session> session = entry.lock();
+                if (session && session->watch_tick_ == idle_wheel_.now()) {
+                    session->watch_tick_ = 0;
+                    idle_due_.push_back(std::move(session));
+                }
+            });
+        }
+        // Checks send and close, so they run outside the lock
+        for (const std::shared_ptr<Session>& session : idle_due_) {
+            if (uint64_t next = check_idle(*session, now)) {
+                watch(session, next);
+            }
+        }
+        idle_due_.clear();
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            if (idle_wheel_.size() == 0) {
+                idle_ticking_ = false;
+                return;
+            }
+        }
+        tick_idle();
+    });
+}
+
+uint64_t BrokerServer::check_idle(Session& session, uint64_t now_ns) {
+    if (session.closed_) {
+        return 0;
+    }
+    uint64_t heartbeat = uint64_t{session.heartbeat_ms_.load(std::memory_order_relaxed)} * 1000000;
+    uint64_t timeout = uint64_t{session.idle_timeout_ms_.load(std::memory_order_relaxed)} * 1000000;
+    if (timeout == 0) {
+        timeout = 3 * heartbeat;  // Three unanswered probes
+    }
+    if (timeout == 0) {
+        return 0;  // HEARTBEAT:OFF since it was scheduled
+    }
+    uint64_t heard = session.heard_ns_.load(std::memory_order_relaxed);
+    if (heard < now_ns && now_ns - heard >= timeout) {
+        idle_closed_.fetch_add(1, std::memory_order_relaxed);
+        session.expire();
+        return 0;
+    }
+    uint64_t next = heard + timeout;
+    if (heartbeat) {
+        // Only a peer that has been quiet for a whole interval is probed
+        uint64_t probe = std::max(heard, session.heartbeat_sent_ns_) + heartbeat;
+        if (probe <= now_ns) {
+            session.deliver("HEARTBEAT\n", Priority::High);
+            session.heartbeat_sent_ns_ = now_ns;
+            heartbeats_sent_.fetch_add(1, std::memory_order_relaxed);
+            probe = now_ns + heartbeat;
+        }
+        next = std::min(next, probe);
+    }
+    return next;
 }
 
 size_t BrokerServer::get_active_sessions() const {
@@ -4,120 +4,521 @@
 #include <asio.hpp>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <queue>
+#include <deque>
 #include <mutex>
 #include <functional>
+#include <atomic>
+#include <vector>
 #include "../include/message.hpp"
+#include "../include/latency_trace.hpp"
+#include "../include/lz_codec.hpp"
+#include "../include/timer_wheel.hpp"
+#include "../include/priority_lanes.hpp"
 #include "utils.hpp"
+#include "heavy_hitters.hpp"
+#include "topic_tail.hpp"
+#include "uring_engine.hpp"
+#include "session_pool.hpp"
+#include "broker_config.hpp"
+#include "snapshot.hpp"
+#include "federation.hpp"
+#include "replication.hpp"
 
 // Forward declarations
 class Session;
 class BrokerServer;
+class ShmRingSource;
+struct BrokerListener;
 
-// Connection session for each client
-class Session : public std::enable_shared_from_this<Session> {
+// Where a credit subscription (SUBSCRIBE:topic:credit=N) has read its
+// topic up to: the sequence of the next message to send
+struct CreditCursor {
+    TopicId topic;
+    uint64_t next;
+};
+
+// Connection session for each client (TCP or Unix domain socket). Socket
+// I/O goes through Asio, or through the broker's UringEngine when it has one.
+// Sessions are allocated from SessionPool; their Asio read and write
+// handlers live in per-session HandlerMemory, so steady-state socket I/O
+// does not touch the heap.
+class Session : public std::enable_shared_from_this<Session>, public UringEngine::Handler {
 public:
-    Session(asio::ip::tcp::socket socket, BrokerServer& broker);
+    using Socket = asio::generic::stream_protocol::socket;
+    
+    Session(Socket socket, BrokerServer& broker);
     ~Session();
     
     void start();
-    void deliver(const std::string& message);
-    std::string get_client_id() const { return client_id_; }
+    // Queue a line for the client in the lane of its priority; replies and
+    // credit batches go Normal, topic messages in their topic's class
+    void deliver(const std::string& message, Priority priority = Priority::Normal);
+    // "ip:port" or "unix#<n>", formatted on first call
+    const std::string& get_client_id() const;
+    
+    // Latency trace: session asked for TMESSAGE delivery via TRACE:ON
+    bool latency_trace_enabled() const { return latency_trace_; }
+    
+    // Handle one protocol line (without the trailing newline); public so
+    // benchmarks can drive the parser without a socket read per line
+    void process_message(const std::string& message);
+    
+    // Listener that accepted this session (null for sessions made elsewhere);
+    // set before start()
+    void set_listener(BrokerListener* listener);
+    BrokerListener* get_listener() const { return listener_; }
+    
+    // Bridge link this session carries (see federation.hpp), null for clients
+    void set_bridge(std::shared_ptr<federation::Link> bridge) { bridge_ = std::move(bridge); }
+    const std::shared_ptr<federation::Link>& get_bridge() const { return bridge_; }
+    
+    // Replication (see replication.hpp): the feed of a follower this
+    // session serves, or whether it is this broker's stream from its leader
+    const std::shared_ptr<replication::Feed>& get_feed() const { return feed_; }
+    void set_upstream() { upstream_ = true; }
+    bool is_upstream() const { return upstream_; }
+    
+    // Shut the connection down; the session ends through its read handler
+    void close();
+    
+    // A credit-subscribed topic has a new message; sends it if credit is left
+    void credit_ready();
     
 private:
+    friend class BrokerServer;
+    
     void do_read();
     void do_write();
-    void process_message(const std::string& message);
+    void on_write(const std::error_code& ec, size_t length);
+    void on_read_error(const std::error_code& ec);
+    void rearm_quickack();
+    void handle_line(const std::string& message);
+    bool is_batch_header(const std::string& line) const;
+    void read_batch(const std::string& header);
+    void unpack_batch(size_t raw_size, size_t compressed_size);
+    void acknowledge_publish(uint64_t sequence);
+    
+    // UringEngine::Handler
+    void on_receive(const char* data, size_t length) override;
+    void on_receive_end(const std::error_code& ec) override;
+    void on_send(const std::error_code& ec, size_t length) override;
     
-    asio::ip::tcp::socket socket_;
+    void handle_tracing_command(const std::string& command);
+    void handle_heartbeat(const std::string& message);
+    void start_heartbeats(uint32_t interval_ms);
+    bool subscribe_credit(const std::string& topic, uint64_t amount, bool bytes, std::string& error);
+    void drop_credit(std::string_view topic);
+    void pump_credit();
+    // Close a peer that went silent, without waiting for it to answer
+    void expire();
+    void handle_replication_command(const std::string& command);
+    // Unix-socket peer running as the broker's user or root
+    bool is_local_peer();
+    void attach_ring(const std::string& name);
+    void detach_ring();
+    void wait_ring();
+    void drain_ring();
+    long consume_ring(size_t max_lines);
+    bool send_with_fd(const std::string& reply, int fd);
+    
+    Socket socket_;
     BrokerServer& broker_;
-    std::string client_id_;
+    UringEngine* uring_;  // Null on the Asio (epoll) path
+    BrokerListener* listener_ = nullptr;
+    bool quickack_ = false;  // Listener asked for TCP_QUICKACK
+    Socket::endpoint_type peer_;
+    mutable std::string client_id_;
+    mutable std::once_flag client_id_once_;
+    std::string producer_key_;  // Heavy-hitter key, HeavyHitters::client_key()
+    uint32_t capture_id_;  // Connection id in traffic captures
+    std::atomic<bool> latency_trace_{false};
     
     asio::streambuf read_buffer_;
-    std::queue<std::string> write_queue_;
+    std::string read_line_;  // Line being handled; keeps its capacity
+    HandlerMemory read_handler_memory_;
+    HandlerMemory write_handler_memory_;
+    uint64_t read_ingress_ns_ = 0;  // Broker ingress stamp of the line being processed
+    uint64_t write_trace_begin_ns_ = 0;  // Sampled async_write start (tracing)
+    // Slab-backed copies (slab_alloc.hpp), one FIFO per priority class;
+    // do_write() picks the lane per the broker's LaneSchedule
+    PriorityLanes<Payload> write_lanes_;
     std::mutex write_mutex_;
+    
+    // Batch compression (COMPRESS:LZ). While compressing, one write carries
+    // every queued message, higher lanes first; they stay queued until it
+    // completes.
+    std::atomic<bool> compression_{false};
+    lz_codec::Adaptive compression_policy_;  // Owned by the write in progress
+    std::string write_batch_;
+    std::string write_frame_;
+    std::array<size_t, PRIORITY_COUNT> write_batch_counts_{};  // Messages per lane in the write
+    std::string read_batch_;
+    
+    // io_uring path: data arrives in chunks, so a ZBATCH block whose header
+    // was parsed waits in read_buffer_ until all of it is there
+    size_t pending_batch_raw_ = 0;
+    size_t pending_batch_compressed_ = 0;
+    bool batch_pending_ = false;
+    enum class BlockKind { Compressed, Bridge, Replication };
+    BlockKind block_kind_ = BlockKind::Compressed;  // ZBATCH, FBATCH or RBATCH
+    uint64_t replication_end_ = 0;  // <end> of the RBATCH being read
+    bool read_closed_ = false;
+    
+    // Shared-memory ring of a co-located producer (SHM:ATTACH). Lines read
+    // from it are handled like socket lines, minus the OK:PUBLISHED replies.
+    std::unique_ptr<ShmRingSource> shm_ring_;
+    bool ring_draining_ = false;
+    
+    std::shared_ptr<federation::Link> bridge_;
+    std::shared_ptr<replication::Feed> feed_;
+    bool upstream_ = false;
+    
+    // Liveness (see BrokerServer::watch). A session is checked on the
+    // broker's timer wheel while it has an idle timeout or heartbeats; the
+    // timeout is the listener's idle_timeout_ms, else three heartbeats.
+    std::atomic<uint64_t> heard_ns_{0};        // Last read from the peer
+    std::atomic<uint32_t> idle_timeout_ms_{0};
+    std::atomic<uint32_t> heartbeat_ms_{0};    // Probe a silent peer this often, 0 = off
+    uint64_t heartbeat_sent_ns_ = 0;           // Only the wheel's checks touch it
+    uint64_t watch_tick_ = 0;                  // Wheel tick of the live entry (broker's watch lock)
+    std::atomic<bool> closed_{false};          // Dropped by the broker; deliver() discards
+    
+    // Credit subscriptions: their messages stay in the topics' queues until
+    // the client grants credit (CREDIT:n), then go out in sequence order.
+    // Credit counts messages, or line bytes when granted as <n>B; the last
+    // message sent may take it below zero.
+    std::mutex credit_mutex_;
+    std::vector<CreditCursor> credit_topics_;
+    int64_t credit_ = 0;
+    bool credit_bytes_ = false;
+    std::atomic<bool> credit_open_{false};  // credit_ > 0, for credit_ready() without the lock
+    std::string credit_batch_;
 };
 
-// Topic subscription manager
+// Topic subscription manager. Topics are interned (see topic_table.hpp)
+// and their state is kept in a vector indexed by TopicId.
 class TopicManager {
 public:
-    // Subscribe a session to a topic
-    void subscribe(const std::string& topic, std::shared_ptr<Session> session);
+    // Subscribe a session to a topic; false, without interning the name,
+    // when the topic is new and the manager already has max_topics
+    bool subscribe(std::string_view topic, std::shared_ptr<Session> session);
     
     // Unsubscribe a session from a topic
-    void unsubscribe(const std::string& topic, std::shared_ptr<Session> session);
+    void unsubscribe(std::string_view topic, std::shared_ptr<Session> session);
     
     // Unsubscribe session from all topics
     void unsubscribe_all(std::shared_ptr<Session> session);
     
-    // Publish message to a topic
-    void publish(const std::string& topic, const std::string& payload);
+    // Credit subscriptions: session is told of new messages (credit_ready)
+    // instead of being sent them, and reads them with fill_credit(), which
+    // appends MESSAGE lines from the cursors' topics in sequence order while
+    // credit lasts (and out is under max_bytes), moving cursors and credit
+    // on. subscribe_credit() sets where a new cursor starts (false as for
+    // subscribe()); subscribe() turns a credit subscription back into a
+    // pushed one.
+    bool subscribe_credit(std::string_view topic, std::shared_ptr<Session> session, uint64_t& next);
+    size_t fill_credit(std::vector<CreditCursor>& cursors, int64_t& credit, bool bytes, size_t max_bytes,
+                       std::string& out);
+    
+    // Publish message to a topic (trace carries send/ingress stamps for
+    // traced publishes, origin is set for messages from a bridge); returns
+    // the message's sequence number
+    uint64_t publish(std::string_view topic, const std::string& payload,
+                     const latency_trace::Stamps* trace = nullptr,
+                     const federation::Origin* origin = nullptr);
     
     // Get all subscribers for a topic
-    std::vector<std::shared_ptr<Session>> get_subscribers(const std::string& topic);
+    std::vector<std::shared_ptr<Session>> get_subscribers(std::string_view topic);
     
     // Store message in topic queue
     void store_message(const Message& msg);
     
     // Consume message from topic
-    bool consume_message(const std::string& topic, Message& msg);
+    bool consume_message(std::string_view topic, Message& msg);
+    
+    // Topic names are interned for good (see topic_table.hpp), so topics a
+    // subscribe would add are refused past this many (published ones count
+    // too)
+    static constexpr size_t DEFAULT_MAX_TOPICS = 100000;
+    void set_max_topics(size_t max_topics) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_topics_ = max_topics;
+    }
     
     // Get topic statistics
     size_t get_topic_count() const;
-    size_t get_subscriber_count(const std::string& topic) const;
+    size_t get_subscriber_count(std::string_view topic) const;
+    
+    // Copy the topic's messages into a shared-memory tail for local readers
+    // (see topic_tail.hpp); returns the shared-memory name, empty on failure.
+    // At most MAX_TAILS topics have one at a time.
+    static constexpr size_t MAX_TAILS = 64;
+    std::string start_tail(const std::string& topic, std::string& error);
+    bool stop_tail(const std::string& topic);
+    void stop_tails();
+    
+    // Warm restart (see snapshot.hpp): write every topic's queued messages
+    // and tail flag to path, or add those of a snapshot to this manager.
+    // A damaged snapshot loads up to the damage and returns false.
+    bool save_snapshot(const std::string& path, snapshot::Totals& totals, std::string& error) const;
+    bool load_snapshot(const std::string& path, snapshot::Totals& totals, std::string& error);
+    
+    // Federation (see federation.hpp): the remote end of a link wants a
+    // topic's messages, or no longer does
+    void add_link_interest(std::string_view topic, std::shared_ptr<federation::Link> link);
+    void remove_link_interest(std::string_view topic, const federation::Link* link);
+    void remove_link(const federation::Link* link);
+    
+    // Whether this broker wants topic on a link: a local subscriber or
+    // another link (not `except`) wants it
+    bool has_interest(TopicId topic, const federation::Link* except) const;
+    std::vector<TopicId> interested_topics(const federation::Link* except) const;
+    
+    // Called, without the lock held, when has_interest() of a topic may
+    // have changed
+    void set_interest_listener(std::function<void(TopicId)> listener) { interest_listener_ = std::move(listener); }
+    
+    // Replication (see replication.hpp). apply() publishes a message with
+    // the sequence and timestamp the leader gave it. clear_messages() drops
+    // every queued message and restarts sequences at 0. at_next_sequence()
+    // runs fn with the next sequence under the lock, so nothing is added
+    // meanwhile. copy_messages() appends copies of the queued messages below
+    // `below`, by topic id and then sequence, from (topic, sequence) on; it
+    // stops after about max_bytes, moves (topic, sequence) past what it
+    // copied, and returns false once every topic is done.
+    void apply(std::string_view topic, const std::string& payload, uint64_t sequence,
+               std::chrono::system_clock::time_point timestamp);
+    uint64_t get_next_sequence() const;
+    void advance_sequence(uint64_t sequence);
+    void clear_messages();
+    void at_next_sequence(const std::function<void(uint64_t)>& fn) const;
+    bool copy_messages(TopicId& topic, uint64_t& sequence, uint64_t below, size_t max_bytes,
+                       std::vector<Message>& out) const;
+    
+    // Priority classes (see priority_lanes.hpp): topics matching a high or
+    // low pattern list (federation::parse_patterns) are delivered in that
+    // lane, every other topic Normal; high wins when both match
+    void set_priorities(const std::string& high, const std::string& low);
+    
+    // Called with the lock held for every message added, in sequence order
+    void set_append_listener(std::function<void(const Message&)> listener) { append_listener_ = std::move(listener); }
+    
+    // Lifetime message counters (published lines, subscriber deliveries)
+    uint64_t get_published_count() const { return published_count_.load(std::memory_order_relaxed); }
+    uint64_t get_delivered_count() const { return delivered_count_.load(std::memory_order_relaxed); }
     
 private:
-    // Map: topic -> set of subscribed sessions
-    std::unordered_map<std::string, std::unordered_set<std::shared_ptr<Session>>> subscriptions_;
+    struct TopicState {
+        std::unordered_set<std::shared_ptr<Session>> subscribers;
+        std::unordered_set<std::shared_ptr<Session>> credit_subscribers;  // Subset of subscribers
+        std::deque<Message> queue;
+        std::unique_ptr<TopicTail> tail;  // Shared-memory tail, written under mutex_
+        std::vector<std::shared_ptr<federation::Link>> links;  // Bridges whose far end wants it
+        Priority priority = Priority::Normal;
+    };
+    
+    uint64_t add_message(Message msg, std::string_view topic, const std::string& payload,
+                         const latency_trace::Stamps* trace, const federation::Origin* origin,
+                         bool assign_sequence);
+    
+    void notify_interest(TopicId topic) const {
+        if (interest_listener_) {
+            interest_listener_(topic);
+        }
+    }
     
-    // Map: topic -> message queue
-    std::unordered_map<std::string, std::queue<Message>> topic_queues_;
+    // Caller holds mutex_. state() creates the entry; find_state() returns
+    // null for topics this manager has not seen.
+    TopicState& state(TopicId id);
+    bool at_topic_limit(std::string_view topic) const;
+    TopicState* find_state(std::string_view topic);
+    const TopicState* find_state(std::string_view topic) const;
+    Priority classify(TopicId id) const;
+    bool open_tail(TopicState& entry, const std::string& topic, std::string& error);
+    
+    // Indexed by TopicId; ids are process-wide, so entries of topics only
+    // other brokers use stay null
+    std::vector<std::unique_ptr<TopicState>> topics_;
+    size_t subscribed_topics_ = 0;  // Entries with at least one subscriber
+    size_t tail_count_ = 0;         // Entries with a tail
+    size_t state_count_ = 0;        // Non-null entries
+    size_t max_topics_ = DEFAULT_MAX_TOPICS;
+    std::vector<std::string> high_patterns_;
+    std::vector<std::string> low_patterns_;
     
     mutable std::mutex mutex_;
     uint64_t sequence_counter_ = 0;
+    std::atomic<uint64_t> published_count_{0};
+    std::atomic<uint64_t> delivered_count_{0};
+    std::function<void(TopicId)> interest_listener_;  // Set before any session runs
+    std::function<void(const Message&)> append_listener_;  // Likewise
 };
 
 // Main broker server with Asio
 class BrokerServer {
 public:
+    // No listeners until add_listener()
+    explicit BrokerServer(asio::io_context& io_context);
+    // Default-tuned TCP listener on port (0 picks a free one); throws
+    // std::runtime_error when it cannot listen
     BrokerServer(asio::io_context& io_context, uint16_t port);
     ~BrokerServer();
     
+    // Accept connections as configured (see broker_config.hpp); false with
+    // the reason when the socket cannot be set up. For a Unix socket a stale
+    // socket file left by a previous run is replaced; one that still accepts
+    // connections fails the listener (address in use).
+    bool add_listener(const ListenerConfig& config, std::string& error);
+    
+    // Also accept connections on a Unix domain stream socket at path
+    bool listen_unix(const std::string& path);
+    
+    // Warm restart (see handoff.hpp). serve_handoff() waits for a successor
+    // on a Unix socket at path. When one takes over, topic data is saved to
+    // snapshot_path, the listening sockets are passed on, sessions are
+    // closed and done runs on the io thread.
+    bool serve_handoff(const std::string& path, const std::string& snapshot_path,
+                       std::function<void()> done, std::string& error);
+    bool handed_off() const { return handed_off_.load(); }
+    
+    // Take the listening sockets and topic data of a broker serving a
+    // hand-off at path. Call before add_listener(): a listener whose name
+    // and address match an inherited socket accepts on it.
+    bool take_over(const std::string& path, snapshot::Totals& totals, std::string& error);
+    
     // Start accepting connections
     void start();
     
     // Stop the broker
     void stop();
     
-    // Publish message to topic
-    void publish(const std::string& topic, const std::string& payload);
+    // Publish message to topic; returns its sequence number
+    uint64_t publish(std::string_view topic, const std::string& payload,
+                     const latency_trace::Stamps* trace = nullptr,
+                     const federation::Origin* origin = nullptr);
     
-    // Subscribe a session to a topic
-    void subscribe(const std::string& topic, std::shared_ptr<Session> session);
+    // Subscribe a session to a topic; false past the topic limit (see
+    // TopicManager::set_max_topics)
+    bool subscribe(std::string_view topic, std::shared_ptr<Session> session);
     
     // Unsubscribe session from topic
-    void unsubscribe(const std::string& topic, std::shared_ptr<Session> session);
+    void unsubscribe(std::string_view topic, std::shared_ptr<Session> session);
     
     // Handle session disconnect
     void on_session_disconnect(std::shared_ptr<Session> session);
     
+    // Check session on the timer wheel at deadline_ns (latency_trace::now_ns
+    // clock). One wheel and one steady_timer serve every session: a check
+    // that finds the peer heard from in the meantime just moves its entry.
+    void watch(const std::shared_ptr<Session>& session, uint64_t deadline_ns);
+    
     // Get broker statistics
     size_t get_active_sessions() const;
     size_t get_topic_count() const;
     
+    // Serve sessions accepted from now on with io_uring (call before
+    // start()); false with the reason when the kernel or build cannot
+    bool use_io_uring(std::string& error);
+    UringEngine* get_uring_engine() { return uring_.get(); }
+    
+    // Port of the first TCP listener (the bound one for port 0), 0 without one
+    uint16_t get_port() const;
+    // Bound port of a named TCP listener, 0 when there is none
+    uint16_t get_port(const std::string& listener) const;
+    
+    // Unix domain socket path, empty when not listening on one
+    const std::string& get_unix_path() const { return unix_path_; }
+    
+    // Sessions refused by max_connections, accepts delayed by accept_rate
+    uint64_t get_refused_connections() const { return refused_connections_.load(std::memory_order_relaxed); }
+    uint64_t get_throttled_accepts() const { return throttled_accepts_.load(std::memory_order_relaxed); }
+    // Sessions closed for silence, heartbeats sent to silent peers
+    uint64_t get_idle_closed() const { return idle_closed_.load(std::memory_order_relaxed); }
+    uint64_t get_heartbeats_sent() const { return heartbeats_sent_.load(std::memory_order_relaxed); }
+    
     TopicManager& get_topic_manager() { return topic_manager_; }
     
+    // Bridges to other brokers (see federation.hpp); dialled from start()
+    bool add_bridge(const BridgeConfig& config, std::string& error);
+    federation::Federation& get_federation() { return *federation_; }
+    
+    // Leader/follower replication (see replication.hpp); configure before start()
+    replication::Replication& get_replication() { return *replication_; }
+    
+    // Priority classes of topics and how sessions schedule their lanes (see
+    // PriorityConfig); call before start(), sessions keep the schedule they
+    // were created with
+    void set_priorities(const PriorityConfig& config);
+    const LaneSchedule& get_lane_schedule() const { return lane_schedule_; }
+    
+    // Streaming top-K of topics, publishing clients and services (TOP command)
+    HeavyHitters& get_heavy_hitters() { return heavy_hitters_; }
+    
 private:
-    void do_accept();
+    void accept_next(BrokerListener& listener);
+    void do_accept(BrokerListener& listener);
+    void on_accept(BrokerListener& listener, Session::Socket socket);
+    friend class federation::Federation;
+    friend class replication::Replication;
+    
+    // Serve a session on socket; prepare runs before it starts reading
+    std::shared_ptr<Session> add_session(Session::Socket socket, BrokerListener* listener = nullptr,
+                                         const std::function<void(const std::shared_ptr<Session>&)>& prepare = nullptr);
+    // Connect to another broker at remote (host:port or unix:/path); TCP
+    // connections get TCP_NODELAY
+    void connect(const std::string& remote, std::function<void(std::error_code, Session::Socket)> handler);
+    bool adopt_listener(const std::string& name, const asio::generic::stream_protocol::endpoint& endpoint,
+                        asio::basic_socket_acceptor<asio::generic::stream_protocol>& acceptor);
+    void accept_handoff();
+    void read_handoff_request(asio::local::stream_protocol::socket socket);
+    // Pass everything on to the successor on fd, which asked for it
+    void hand_off(int fd);
+    
+    // Idle checks (see watch)
+    void tick_idle();
+    // Expire session or probe it when due; when to check it next, 0 for never
+    uint64_t check_idle(Session& session, uint64_t now_ns);
     
-    asio::ip::tcp::acceptor acceptor_;
+    asio::io_context& io_context_;
+    std::vector<std::unique_ptr<BrokerListener>> listeners_;  // Added before start() or on the io thread
+    std::string unix_path_;
+    std::atomic<uint64_t> refused_connections_{0};
+    std::atomic<uint64_t> throttled_accepts_{0};
+    std::atomic<uint64_t> idle_closed_{0};
+    std::atomic<uint64_t> heartbeats_sent_{0};
+    LaneSchedule lane_schedule_;
+    
+    // Idle checks; idle_timer_ runs while the wheel has entries
+    static constexpr uint64_t IDLE_TICK_NS = 100'000'000;
+    TimerWheel<std::weak_ptr<Session>> idle_wheel_;
+    uint64_t idle_epoch_ns_;
+    std::mutex idle_mutex_;
+    asio::steady_timer idle_timer_;
+    bool idle_ticking_ = false;
+    std::vector<std::shared_ptr<Session>> idle_due_;  // Only tick_idle() touches it
+    
+    // Warm restart
+    std::unordered_map<std::string, int> inherited_;  // Sockets from take_over() by listener name
+    std::unique_ptr<asio::local::stream_protocol::acceptor> handoff_acceptor_;
+    std::string handoff_path_;
+    std::string snapshot_path_;
+    std::function<void()> handoff_done_;
+    std::atomic<bool> handed_off_{false};
     TopicManager topic_manager_;
+    HeavyHitters heavy_hitters_;
+    std::unique_ptr<federation::Federation> federation_;
+    std::unique_ptr<replication::Replication> replication_;
     
     std::unordered_set<std::shared_ptr<Session>> sessions_;
     mutable std::mutex sessions_mutex_;
     
     bool running_ = false;
+    
+    // Last, so it goes first: its pending operations hold sessions
+    std::unique_ptr<UringEngine> uring_;
 };
 
@@ -2,10 +2,17 @@
 #include <asio.hpp>
 #include "asio_server.hpp"
 #include "utils.hpp"
+#include "alloc_accounting.hpp"
+#include "capture.hpp"
+#include "broker_config.hpp"
+#include "../include/transport.hpp"
+#include <algorithm>
 #include <iostream>
 #include <csignal>
 #include <atomic>
 #include <thread>
+#include <sstream>
+#include <unistd.h>
 
 // Global flag for graceful shutdown
 std::atomic<bool> running(true);
@@ -21,10 +28,28 @@ void signal_handler(int signal) {
     }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     // Setup signal handlers for graceful shutdown
     std::signal(SIGINT, signal_handler);
     std::signal(SIGTERM, signal_handler);
+    apply_log_level_from_env();
+    
+    // Listeners come from --config/--listen; without them TCP 9092 plus the
+    // Unix socket (same-host clients connect via unix:<path>).
+    // NEUROPIPE_UNIX_SOCKET moves that socket; set it empty to turn it off.
+    BrokerConfig config;
+    const char* unix_env = std::getenv("NEUROPIPE_UNIX_SOCKET");
+    config.default_unix_path = unix_env ? unix_env : transport::DEFAULT_UNIX_PATH;
+    bool help = false;
+    std::string config_error;
+    if (!parse_broker_args(argc, argv, config, help, config_error)) {
+        std::cerr << "broker: " << config_error << "\n\n" << broker_usage();
+        return 2;
+    }
+    if (help) {
+        std::cout << broker_usage();
+        return 0;
+    }
     
     log_info("Starting NeuroPipe Broker (Asio Edition)...");
     
@@ -33,16 +58,135 @@ int main() {
         asio::io_context io_context;
         global_io_context = &io_context;
         
-        // Create broker server on port 9092
-        BrokerServer broker(io_context, 9092);
+        BrokerServer broker(io_context);
+        
+        // Warm restart: take the sockets and topic data of the running
+        // broker, or load what a stopped one left in the snapshot
+        snapshot::Totals restored;
+        std::string restore_error;
+        if (!config.takeover_path.empty()) {
+            auto begin = std::chrono::steady_clock::now();
+            if (!broker.take_over(config.takeover_path, restored, restore_error)) {
+                log_error("Takeover failed: " + restore_error);
+                return 1;
+            }
+            log_info("Took over from " + config.takeover_path + " in " +
+                     std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - begin).count()) + " ms: " +
+                     std::to_string(restored.topics) + " topics, " + std::to_string(restored.messages) + " messages");
+        } else if (!config.snapshot_path.empty() && access(config.snapshot_path.c_str(), F_OK) == 0) {
+            if (broker.get_topic_manager().load_snapshot(config.snapshot_path, restored, restore_error)) {
+                std::remove(config.snapshot_path.c_str());
+                log_info("Loaded snapshot " + config.snapshot_path + ": " + std::to_string(restored.topics) +
+                         " topics, " + std::to_string(restored.messages) + " messages");
+            } else {
+                log_warn("Snapshot: " + restore_error);
+            }
+        }
+        
+        for (const ListenerConfig& listener : config.listeners) {
+            std::string error;
+            if (!broker.add_listener(listener, error)) {
+                log_error("Listener " + listener.name + ": " + error);
+                return 1;
+            }
+        }
+        for (const BridgeConfig& bridge : config.bridges) {
+            std::string error;
+            if (!broker.add_bridge(bridge, error)) {
+                log_error("Bridge " + bridge.name + ": " + error);
+                return 1;
+            }
+        }
+        broker.get_replication().configure(config.replication);
+        broker.set_priorities(config.priorities);
+        
+        // NEUROPIPE_MAX_TOPICS caps the distinct topics subscribes may add
+        if (const char* max_topics = std::getenv("NEUROPIPE_MAX_TOPICS")) {
+            broker.get_topic_manager().set_max_topics(std::strtoull(max_topics, nullptr, 10));
+        }
+        
+        // NEUROPIPE_IO_ENGINE=uring serves sessions with io_uring; epoll
+        // (plain Asio) stays the default and the fallback
+        const char* engine_env = std::getenv("NEUROPIPE_IO_ENGINE");
+        if (engine_env && std::string(engine_env) == "uring") {
+            std::string error;
+            if (!broker.use_io_uring(error)) {
+                log_warn("io_uring engine unavailable (" + error + "), using epoll");
+            }
+        }
         broker.start();
         
+        if (!config.handoff_path.empty()) {
+            std::string snapshot_path = config.snapshot_path.empty() ? config.handoff_path + ".snapshot"
+                                                                     : config.snapshot_path;
+            std::string error;
+            auto handed_off = [&io_context]() {
+                running = false;
+                io_context.stop();
+            };
+            if (!broker.serve_handoff(config.handoff_path, snapshot_path, handed_off, error)) {
+                log_error("Warm restart: " + error);
+                return 1;
+            }
+        }
+        
+        // NEUROPIPE_TAIL_TOPICS=debug,errors publishes those topics to
+        // shared-memory tails for local readers (consumer_client --tail)
+        if (const char* tail_topics = std::getenv("NEUROPIPE_TAIL_TOPICS")) {
+            std::stringstream list(tail_topics);
+            std::string topic;
+            while (std::getline(list, topic, ',')) {
+                if (topic.empty()) {
+                    continue;
+                }
+                std::string error;
+                std::string name = broker.get_topic_manager().start_tail(topic, error);
+                if (name.empty()) {
+                    log_error("Cannot start tail of topic '" + topic + "': " + error);
+                } else {
+                    log_info("Topic tail of '" + topic + "' at /dev/shm" + name);
+                }
+            }
+        }
+        
+        // NEUROPIPE_CAPTURE=file records all inbound traffic from startup
+        if (const char* capture_path = std::getenv("NEUROPIPE_CAPTURE")) {
+            if (capture::start(capture_path)) {
+                log_info("Capturing inbound traffic to " + std::string(capture_path));
+            } else {
+                log_error("Cannot start traffic capture to " + std::string(capture_path));
+            }
+        }
+        
         std::cout << "\n==================================" << std::endl;
         std::cout << "=== NeuroPipe Broker Running ===" << std::endl;
         std::cout << "==================================" << std::endl;
-        std::cout << "Port:       9092" << std::endl;
-        std::cout << "Backend:    Standalone Asio" << std::endl;
-        std::cout << "Protocol:   TCP" << std::endl;
+        for (const ListenerConfig& listener : config.listeners) {
+            std::cout << "Listen:     " << listener.address << " (" << listener.name << ")" << std::endl;
+        }
+        for (const BridgeConfig& bridge : config.bridges) {
+            std::cout << "Bridge:     " << bridge.remote << " (" << bridge.name << ", " << bridge.topics << ")" << std::endl;
+        }
+        if (!config.replication.leader.empty()) {
+            std::cout << "Follow:     " << config.replication.leader << " (" << config.replication.name << ")" << std::endl;
+        }
+        if (config.replication.acks > 0) {
+            std::cout << "Acks:       " << config.replication.acks << " follower(s), "
+                      << config.replication.ack_timeout_ms << " ms timeout" << std::endl;
+        }
+        if (!config.priorities.high.empty() || !config.priorities.low.empty()) {
+            const PriorityConfig& priorities = config.priorities;
+            std::cout << "Priority:   high " << (priorities.high.empty() ? "-" : priorities.high)
+                      << ", low " << (priorities.low.empty() ? "-" : priorities.low) << ", "
+                      << (priorities.strict ? std::string("strict")
+                                            : "weighted " + std::to_string(priorities.weights[0]) + "/" +
+                                                  std::to_string(priorities.weights[1]) + "/" +
+                                                  std::to_string(priorities.weights[2]))
+                      << std::endl;
+        }
+        std::cout << "Backend:    Standalone Asio ("
+                  << (broker.get_uring_engine() ? "io_uring" : "epoll") << ")" << std::endl;
         std::cout << "Commands:   PUBLISH, SUBSCRIBE, UNSUBSCRIBE" << std::endl;
         std::cout << "==================================" << std::endl;
         std::cout << "Press Ctrl+C to stop\n" << std::endl;
@@ -53,22 +197,98 @@ int main() {
         });
         
         // Monitor thread - prints statistics periodically
+        TopicManager& topics = broker.get_topic_manager();
+        uint64_t last_published = topics.get_published_count();
+        uint64_t last_delivered = topics.get_delivered_count();
+        alloc_accounting::Snapshot last_allocs = alloc_accounting::snapshot();
+        auto next_stats = std::chrono::steady_clock::now() + std::chrono::seconds(10);
         while (running) {
-            std::this_thread::sleep_for(std::chrono::seconds(10));
-            if (running) {
+            // Short naps, so a hand-off or signal ends the loop promptly
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (running && std::chrono::steady_clock::now() >= next_stats) {
+                next_stats += std::chrono::seconds(10);
+                uint64_t published = topics.get_published_count();
+                uint64_t delivered = topics.get_delivered_count();
+                federation::Stats federation = broker.get_federation().stats();
                 log_info("Stats - Active Sessions: " + std::to_string(broker.get_active_sessions()) + 
-                        ", Topics: " + std::to_string(broker.get_topic_count()));
+                        ", Topics: " + std::to_string(broker.get_topic_count()) +
+                        ", Published: " + std::to_string(published - last_published) +
+                        ", Delivered: " + std::to_string(delivered - last_delivered) +
+                        ", Refused: " + std::to_string(broker.get_refused_connections()) +
+                        ", Throttled accepts: " + std::to_string(broker.get_throttled_accepts()));
+                if (broker.get_idle_closed() > 0 || broker.get_heartbeats_sent() > 0) {
+                    log_info("Liveness - Idle closed: " + std::to_string(broker.get_idle_closed()) +
+                             ", Heartbeats sent: " + std::to_string(broker.get_heartbeats_sent()));
+                }
+                if (alloc_accounting::ENABLED) {
+                    alloc_accounting::Snapshot allocs = alloc_accounting::snapshot();
+                    log_info(alloc_accounting::report(allocs - last_allocs, published - last_published,
+                                                      delivered - last_delivered));
+                    last_allocs = allocs;
+                }
+                if (!config.bridges.empty() || federation.links > 0) {
+                    log_info("Federation - Links: " + std::to_string(federation.links) +
+                             ", Forwarded: " + std::to_string(federation.forwarded) +
+                             ", Frames: " + std::to_string(federation.frames) +
+                             ", Received: " + std::to_string(federation.received) +
+                             ", Loops dropped: " + std::to_string(federation.loops_dropped));
+                }
+                replication::Stats replication = broker.get_replication().stats();
+                if (replication.following) {
+                    log_info("Replication - Following: " + replication.leader +
+                             (replication.connected ? "" : " (disconnected)") +
+                             ", Offset: " + std::to_string(replication.offset) +
+                             ", Applied: " + std::to_string(replication.applied) +
+                             ", Apply lag: " + std::to_string(replication.apply_lag_us) + " us");
+                }
+                if (!replication.followers.empty()) {
+                    uint64_t max_lag = 0;
+                    int64_t max_ack_latency = 0;
+                    for (const replication::FollowerStats& follower : replication.followers) {
+                        max_lag = std::max(max_lag, follower.lag);
+                        max_ack_latency = std::max(max_ack_latency, follower.ack_latency_us);
+                    }
+                    log_info("Replication - Followers: " + std::to_string(replication.followers.size()) +
+                             ", Max lag: " + std::to_string(max_lag) +
+                             ", Max ack latency: " + std::to_string(max_ack_latency) + " us" +
+                             ", Full copies: " + std::to_string(replication.full_copies) +
+                             ", Acks timed out: " + std::to_string(replication.acks_timed_out));
+                }
+                if (UringEngine* uring = broker.get_uring_engine()) {
+                    UringEngine::Stats stats = uring->stats();
+                    log_info("io_uring - Enter calls: " + std::to_string(stats.enter_calls) +
+                             ", SQEs: " + std::to_string(stats.submissions) +
+                             ", CQEs: " + std::to_string(stats.completions));
+                }
+                last_published = published;
+                last_delivered = delivered;
             }
         }
         
         log_info("Shutting down broker...");
         broker.stop();
+        long captured = capture::stop();
+        if (captured >= 0) {
+            log_info("Traffic capture closed (" + std::to_string(captured) + " records)");
+        }
         
         // Wait for io_context to finish
         if (io_thread.joinable()) {
             io_thread.join();
         }
         
+        // A broker that handed off has no data left to keep
+        if (!config.snapshot_path.empty() && !broker.handed_off()) {
+            snapshot::Totals saved;
+            std::string error;
+            if (broker.get_topic_manager().save_snapshot(config.snapshot_path, saved, error)) {
+                log_info("Saved snapshot " + config.snapshot_path + ": " + std::to_string(saved.topics) +
+                         " topics, " + std::to_string(saved.messages) + " messages");
+            } else {
+                log_error("Snapshot: " + error);
+            }
+        }
+        
         log_info("Broker stopped successfully");
         
     } catch (std::exception& e) {
@@ -0,0 +1,507 @@
+#include "broker_config.hpp"
+#include "../include/transport.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+
+namespace {
+
+std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool parse_bool(const std::string& value, bool& result) {
+    if (value == "true" || value == "on" || value == "yes" || value == "1") {
+        result = true;
+        return true;
+    }
+    if (value == "false" || value == "off" || value == "no" || value == "0") {
+        result = false;
+        return true;
+    }
+    return false;
+}
+
+bool parse_unsigned(const std::string& value, unsigned long long max, unsigned long long& result) {
+    if (value.empty() || value[0] == '-') {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    result = std::strtoull(value.c_str(), &end, 10);
+    return errno == 0 && *end == '\0' && result <= max;
+}
+
+template <typename T>
+bool parse_number(const std::string& value, T& result) {
+    unsigned long long parsed;
+    if (!parse_unsigned(value, static_cast<unsigned long long>(std::numeric_limits<T>::max()), parsed)) {
+        return false;
+    }
+    result = static_cast<T>(parsed);
+    return true;
+}
+
+} // namespace
+
+bool ListenerConfig::set(const std::string& key, const std::string& value, std::string& error) {
+    bool ok = true;
+    if (key == "address") {
+        ListenAddress parsed;
+        ok = ListenAddress::parse(value, parsed, error);
+        if (ok) {
+            address = value;
+        }
+        return ok;
+    } else if (key == "backlog") {
+        ok = parse_number(value, backlog) && backlog > 0;
+    } else if (key == "tcp_nodelay") {
+        ok = parse_bool(value, tcp_nodelay);
+    } else if (key == "tcp_quickack") {
+        ok = parse_bool(value, tcp_quickack);
+    } else if (key == "send_buffer") {
+        ok = parse_number(value, send_buffer);
+    } else if (key == "receive_buffer") {
+        ok = parse_number(value, receive_buffer);
+    } else if (key == "max_connections") {
+        ok = parse_number(value, max_connections);
+    } else if (key == "accept_rate") {
+        char* end = nullptr;
+        accept_rate = std::strtod(value.c_str(), &end);
+        ok = !value.empty() && *end == '\0' && accept_rate >= 0;
+    } else if (key == "accept_burst") {
+        ok = parse_number(value, accept_burst);
+    } else if (key == "defer_accept") {
+        ok = parse_number(value, defer_accept);
+    } else if (key == "replication") {
+        ok = parse_bool(value, replication);
+    } else if (key == "idle_timeout_ms") {
+        ok = parse_number(value, idle_timeout_ms);
+    } else if (key == "heartbeat_ms") {
+        ok = parse_number(value, heartbeat_ms);
+    } else {
+        error = "unknown listener setting '" + key + "'";
+        return false;
+    }
+    if (!ok) {
+        error = "invalid value '" + value + "' for " + key;
+    }
+    return ok;
+}
+
+bool BridgeConfig::set(const std::string& key, const std::string& value, std::string& error) {
+    bool ok = true;
+    if (key == "remote") {
+        ListenAddress parsed;
+        ok = ListenAddress::parse(value, parsed, error);
+        if (ok) {
+            remote = value;
+        }
+        return ok;
+    } else if (key == "topics") {
+        ok = !value.empty();
+        topics = value;
+    } else if (key == "batch_messages") {
+        ok = parse_number(value, batch_messages) && batch_messages > 0;
+    } else if (key == "batch_bytes") {
+        ok = parse_number(value, batch_bytes) && batch_bytes > 0;
+    } else if (key == "batch_delay_us") {
+        ok = parse_number(value, batch_delay_us);
+    } else {
+        error = "unknown bridge setting '" + key + "'";
+        return false;
+    }
+    if (!ok) {
+        error = "invalid value '" + value + "' for " + key;
+    }
+    return ok;
+}
+
+bool ReplicationConfig::set(const std::string& key, const std::string& value, std::string& error) {
+    bool ok = true;
+    if (key == "leader") {
+        ListenAddress address;
+        if (!value.empty() && !ListenAddress::parse(value, address, error)) {
+            return false;
+        }
+        leader = value;
+    } else if (key == "name") {
+        ok = !value.empty() && value.find(':') == std::string::npos;
+        name = value;
+    } else if (key == "acks") {
+        ok = parse_number(value, acks);
+    } else if (key == "ack_timeout_ms") {
+        ok = parse_number(value, ack_timeout_ms) && ack_timeout_ms > 0;
+    } else if (key == "log_bytes") {
+        ok = parse_number(value, log_bytes);
+    } else if (key == "batch_bytes") {
+        ok = parse_number(value, batch_bytes) && batch_bytes > 0;
+    } else if (key == "window_frames") {
+        ok = parse_number(value, window_frames) && window_frames > 0;
+    } else {
+        error = "unknown replication setting '" + key + "'";
+        return false;
+    }
+    if (!ok) {
+        error = "invalid value '" + value + "' for " + key;
+    }
+    return ok;
+}
+
+bool PriorityConfig::set(const std::string& key, const std::string& value, std::string& error) {
+    bool ok = true;
+    if (key == "high") {
+        high = value;
+    } else if (key == "low") {
+        low = value;
+    } else if (key == "scheduling") {
+        ok = value == "strict" || value == "weighted";
+        strict = value == "strict";
+    } else if (key == "weights") {
+        // high,normal,low; every lane needs at least one message per turn
+        std::array<uint32_t, 3> parsed;
+        size_t start = 0;
+        for (size_t i = 0; ok && i < parsed.size(); ++i) {
+            size_t comma = value.find(',', start);
+            bool last = i + 1 == parsed.size();
+            if ((comma == std::string::npos) != last) {
+                ok = false;
+                break;
+            }
+            ok = parse_number(trim(value.substr(start, last ? std::string::npos : comma - start)), parsed[i]) &&
+                 parsed[i] > 0;
+            start = comma + 1;
+        }
+        if (ok) {
+            weights = parsed;
+        }
+    } else {
+        error = "unknown priorities setting '" + key + "'";
+        return false;
+    }
+    if (!ok) {
+        error = "invalid value '" + value + "' for " + key;
+    }
+    return ok;
+}
+
+bool ListenAddress::parse(const std::string& address, ListenAddress& parsed, std::string& error) {
+    parsed = ListenAddress();
+    if (transport::is_unix_address(address)) {
+        parsed.is_unix = true;
+        parsed.host = transport::unix_path(address);
+        if (parsed.host.empty()) {
+            error = "empty socket path in '" + address + "'";
+            return false;
+        }
+        return true;
+    }
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || !parse_number(address.substr(colon + 1), parsed.port)) {
+        error = "listener address '" + address + "' needs host:port or unix:/path";
+        return false;
+    }
+    parsed.host = address.substr(0, colon);
+    if (parsed.host.size() >= 2 && parsed.host.front() == '[' && parsed.host.back() == ']') {
+        parsed.host = parsed.host.substr(1, parsed.host.size() - 2);
+    }
+    if (parsed.host.empty() || parsed.host == "*") {
+        parsed.host = "0.0.0.0";
+    }
+    return true;
+}
+
+ListenerConfig* BrokerConfig::find(const std::string& name) {
+    for (auto& listener : listeners) {
+        if (listener.name == name) {
+            return &listener;
+        }
+    }
+    return nullptr;
+}
+
+BridgeConfig* BrokerConfig::find_bridge(const std::string& name) {
+    for (auto& bridge : bridges) {
+        if (bridge.name == name) {
+            return &bridge;
+        }
+    }
+    return nullptr;
+}
+
+bool BrokerConfig::load(const std::string& path, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+    ListenerConfig* current = nullptr;
+    BridgeConfig* bridge = nullptr;
+    bool in_replication = false;
+    bool in_priorities = false;
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        std::string where = path + ":" + std::to_string(number) + ": ";
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        line = trim(line);
+        if (line.empty()) {
+            continue;
+        }
+        if (line == "[replication]" || line == "[priorities]") {
+            current = nullptr;
+            bridge = nullptr;
+            in_replication = line == "[replication]";
+            in_priorities = !in_replication;
+            continue;
+        }
+        if (line.front() == '[') {
+            // [listener NAME] or [bridge NAME]
+            bool is_listener = line.compare(1, 9, "listener ") == 0;
+            bool is_bridge = line.compare(1, 7, "bridge ") == 0;
+            if (line.back() != ']' || (!is_listener && !is_bridge)) {
+                error = where + "expected [listener NAME], [bridge NAME], [replication] or [priorities]";
+                return false;
+            }
+            size_t start = is_listener ? 10 : 8;
+            std::string name = trim(line.substr(start, line.size() - start - 1));
+            if (name.empty() || find(name) || find_bridge(name)) {
+                error = where + (name.empty() ? "section needs a name" : "duplicate name '" + name + "'");
+                return false;
+            }
+            current = nullptr;
+            bridge = nullptr;
+            in_replication = false;
+            in_priorities = false;
+            if (is_listener) {
+                listeners.push_back(ListenerConfig());
+                current = &listeners.back();
+                current->name = name;
+            } else {
+                bridges.push_back(BridgeConfig());
+                bridge = &bridges.back();
+                bridge->name = name;
+            }
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            error = where + "expected key = value";
+            return false;
+        }
+        if (!current && !bridge && !in_replication && !in_priorities) {
+            error = where + "setting outside a section";
+            return false;
+        }
+        std::string key = trim(line.substr(0, equals));
+        std::string value = trim(line.substr(equals + 1));
+        std::string setting_error;
+        bool ok = current        ? current->set(key, value, setting_error)
+                : bridge         ? bridge->set(key, value, setting_error)
+                : in_replication ? replication.set(key, value, setting_error)
+                                 : priorities.set(key, value, setting_error);
+        if (!ok) {
+            error = where + setting_error;
+            return false;
+        }
+    }
+    for (const auto& listener : listeners) {
+        if (listener.address.empty()) {
+            error = path + ": listener '" + listener.name + "' has no address";
+            return false;
+        }
+    }
+    for (const auto& entry : bridges) {
+        if (entry.remote.empty()) {
+            error = path + ": bridge '" + entry.name + "' has no remote";
+            return false;
+        }
+    }
+    return true;
+}
+
+void BrokerConfig::add_defaults() {
+    ListenerConfig tcp;
+    tcp.name = "tcp";
+    tcp.address = "0.0.0.0:" + std::to_string(DEFAULT_PORT);
+    listeners.push_back(tcp);
+    if (!default_unix_path.empty()) {
+        ListenerConfig local;
+        local.name = "unix";
+        local.address = std::string(transport::UNIX_PREFIX) + default_unix_path;
+        listeners.push_back(local);
+    }
+}
+
+bool parse_broker_args(int argc, char* argv[], BrokerConfig& config, bool& help, std::string& error) {
+    help = false;
+    std::string config_path;
+    std::vector<std::string> listens;
+    std::vector<std::string> bridges;
+    std::vector<std::string> overrides;
+    std::string port;
+    std::string follow;
+    std::string acks;
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--help" || option == "-h") {
+            help = true;
+            return true;
+        }
+        if (option != "--config" && option != "--listen" && option != "--port" && option != "--set" &&
+            option != "--snapshot" && option != "--handoff" && option != "--takeover" && option != "--bridge" &&
+            option != "--follow" && option != "--acks") {
+            error = "unknown option " + option;
+            return false;
+        }
+        if (i + 1 >= argc) {
+            error = option + " needs a value";
+            return false;
+        }
+        std::string value = argv[++i];
+        if (option == "--config") {
+            config_path = value;
+        } else if (option == "--listen") {
+            listens.push_back(value);
+        } else if (option == "--port") {
+            port = value;
+        } else if (option == "--bridge") {
+            bridges.push_back(value);
+        } else if (option == "--follow") {
+            follow = value;
+        } else if (option == "--acks") {
+            acks = value;
+        } else if (option == "--snapshot") {
+            config.snapshot_path = value;
+        } else if (option == "--handoff") {
+            config.handoff_path = value;
+        } else if (option == "--takeover") {
+            config.takeover_path = value;
+        } else {
+            overrides.push_back(value);
+        }
+    }
+
+    if (!config_path.empty() && !config.load(config_path, error)) {
+        return false;
+    }
+    for (const std::string& listen : listens) {
+        // [NAME=]ADDRESS; an address never contains '='
+        size_t equals = listen.find('=');
+        ListenerConfig listener;
+        listener.name = equals == std::string::npos ? "listen" + std::to_string(config.listeners.size())
+                                                    : listen.substr(0, equals);
+        if (config.find(listener.name)) {
+            error = "duplicate listener '" + listener.name + "'";
+            return false;
+        }
+        if (!listener.set("address", equals == std::string::npos ? listen : listen.substr(equals + 1), error)) {
+            return false;
+        }
+        config.listeners.push_back(listener);
+    }
+    for (const std::string& item : bridges) {
+        size_t equals = item.find('=');
+        BridgeConfig bridge;
+        bridge.name = equals == std::string::npos ? "bridge" + std::to_string(config.bridges.size())
+                                                  : item.substr(0, equals);
+        if (config.find(bridge.name) || config.find_bridge(bridge.name)) {
+            error = "duplicate name '" + bridge.name + "'";
+            return false;
+        }
+        if (!bridge.set("remote", equals == std::string::npos ? item : item.substr(equals + 1), error)) {
+            return false;
+        }
+        config.bridges.push_back(bridge);
+    }
+    if (config.listeners.empty()) {
+        config.add_defaults();
+    }
+    if ((!follow.empty() && !config.replication.set("leader", follow, error)) ||
+        (!acks.empty() && !config.replication.set("acks", acks, error))) {
+        return false;
+    }
+
+    if (!port.empty()) {
+        ListenerConfig* tcp = nullptr;
+        ListenAddress address;
+        for (auto& listener : config.listeners) {
+            if (ListenAddress::parse(listener.address, address, error) && !address.is_unix) {
+                tcp = &listener;
+                break;
+            }
+        }
+        uint16_t number;
+        if (!tcp || !parse_number(port, number)) {
+            error = tcp ? "invalid port " + port : "--port needs a TCP listener";
+            return false;
+        }
+        std::string host = address.host.find(':') != std::string::npos ? "[" + address.host + "]" : address.host;
+        tcp->address = host + ":" + port;
+    }
+
+    for (const std::string& item : overrides) {
+        // NAME.KEY=VALUE
+        size_t dot = item.find('.');
+        size_t equals = item.find('=');
+        if (dot == std::string::npos || equals == std::string::npos || equals < dot) {
+            error = "--set expects NAME.KEY=VALUE, got '" + item + "'";
+            return false;
+        }
+        std::string name = item.substr(0, dot);
+        std::string key = item.substr(dot + 1, equals - dot - 1);
+        std::string value = item.substr(equals + 1);
+        ListenerConfig* listener = config.find(name);
+        BridgeConfig* bridge = config.find_bridge(name);
+        if (!listener && !bridge) {
+            if (name != "replication" && name != "priorities") {
+                error = "--set: no listener or bridge named '" + name + "'";
+                return false;
+            }
+            if (name == "replication" ? !config.replication.set(key, value, error)
+                                      : !config.priorities.set(key, value, error)) {
+                return false;
+            }
+        } else if (listener ? !listener->set(key, value, error) : !bridge->set(key, value, error)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char* broker_usage() {
+    return "Usage: broker [--config FILE] [--listen [NAME=]ADDRESS]... [--port N] [--set NAME.KEY=VALUE]...\n"
+           "              [--bridge [NAME=]REMOTE]... [--follow LEADER] [--acks N]\n"
+           "              [--snapshot FILE] [--handoff SOCKET] [--takeover SOCKET]\n"
+           "\n"
+           "  --config FILE             listeners from a configuration file (see src/broker_config.hpp)\n"
+           "  --listen [NAME=]ADDRESS   add a listener: host:port, [v6]:port, *:port or unix:/path\n"
+           "  --port N                  port of the first TCP listener (default 9092)\n"
+           "  --bridge [NAME=]REMOTE    forward topics to and from the broker at REMOTE\n"
+           "  --follow LEADER           replicate the topic data of the broker at LEADER\n"
+           "  --acks N                  acknowledge publishes once N followers have them\n"
+           "  --set NAME.KEY=VALUE      override a listener or bridge setting, e.g. --set tcp.tcp_nodelay=true\n"
+           "  --snapshot FILE           save topic data to FILE at exit and load it at start\n"
+           "  --handoff SOCKET          wait on SOCKET for a successor to take over (warm restart)\n"
+           "  --takeover SOCKET         take listeners and topic data from the broker at SOCKET\n"
+           "\n"
+           "Listener settings: address, backlog, tcp_nodelay, tcp_quickack, send_buffer,\n"
+           "receive_buffer, max_connections, accept_rate, accept_burst, defer_accept,\n"
+           "replication (accept followers on this listener), idle_timeout_ms,\n"
+           "heartbeat_ms.\n"
+           "Bridge settings: remote, topics, batch_messages, batch_bytes, batch_delay_us.\n"
+           "Replication settings (--set replication.KEY=VALUE): leader, name, acks,\n"
+           "ack_timeout_ms, log_bytes, batch_bytes, window_frames.\n"
+           "Priority settings (--set priorities.KEY=VALUE): high, low (topic patterns),\n"
+           "scheduling (weighted or strict), weights (high,normal,low).\n"
+           "Without --config or --listen the broker listens on TCP 9092 and on the Unix\n"
+           "socket named by NEUROPIPE_UNIX_SOCKET (default /tmp/neuropipe.sock).\n";
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <string>
+#include <vector>
+
+/**
+ * Broker listeners: where the broker accepts connections and how each
+ * listening socket is tuned.
+ *
+ * Settings are per listener, so a latency-sensitive listener (TCP_NODELAY,
+ * TCP_QUICKACK, small buffers) and a bulk one (large buffers, rate-limited
+ * accepts) can serve the same broker. A configuration file holds one
+ * section per listener:
+ *
+ *   # neuropipe.conf
+ *   [listener apps]
+ *   address = 0.0.0.0:9092
+ *   tcp_nodelay = true
+ *   tcp_quickack = true
+ *
+ *   [listener bulk]
+ *   address = 0.0.0.0:9094
+ *   send_buffer = 4194304
+ *   max_connections = 200
+ *   accept_rate = 50        # connections per second
+ *   defer_accept = 5        # seconds
+ *   idle_timeout_ms = 30000 # drop half-open connections
+ *   heartbeat_ms = 10000    # clients must answer HEARTBEAT
+ *
+ *   [listener local]
+ *   address = unix:/tmp/neuropipe.sock
+ *
+ *   [listener peers]        # only followers use it, so keep it private
+ *   address = 10.0.0.5:9095
+ *   replication = true
+ *
+ *   [bridge central]        # see BridgeConfig
+ *   remote = central.example:9092
+ *
+ *   [replication]           # see ReplicationConfig
+ *   acks = 1
+ *
+ *   [priorities]            # see PriorityConfig
+ *   high = errors
+ *
+ * Command-line options override the file (see parse_broker_args).
+ */
+struct ListenerConfig {
+    std::string name;
+    std::string address;             // host:port, [v6]:port, *:port or unix:/path
+    int backlog = 4096;              // listen() backlog (the kernel caps it at somaxconn)
+    bool tcp_nodelay = false;        // Disable Nagle on accepted sockets
+    bool tcp_quickack = false;       // ACK at once; re-armed after every read
+    int send_buffer = 0;             // SO_SNDBUF bytes, 0 = kernel default
+    int receive_buffer = 0;          // SO_RCVBUF bytes, 0 = kernel default
+    size_t max_connections = 0;      // Open sessions from this listener, 0 = unlimited
+    double accept_rate = 0;          // Accepts per second, 0 = unlimited
+    int accept_burst = 0;            // Accepts allowed at once (default: one second's worth)
+    int defer_accept = 0;            // TCP_DEFER_ACCEPT seconds, 0 = off
+    bool replication = false;        // Serve replication followers (REPLICATE) here
+    int idle_timeout_ms = 0;         // Close sessions silent this long, 0 = never
+    int heartbeat_ms = 0;            // Probe silent sessions this often (HEARTBEAT), 0 = on request
+
+    // Set one option from its text form; false with the reason when the key
+    // or value is invalid
+    bool set(const std::string& key, const std::string& value, std::string& error);
+};
+
+// A link to another broker (see federation.hpp):
+//
+//   [bridge central]
+//   remote = central.example:9092
+//   topics = errors,metrics.*
+struct BridgeConfig {
+    std::string name;
+    std::string remote;              // host:port or unix:/path of the other broker
+    std::string topics = "*";        // Comma-separated: exact names, prefix* or *
+    size_t batch_messages = 256;     // Most messages per frame
+    size_t batch_bytes = 65536;      // Frame size that sends at once
+    int batch_delay_us = 1000;       // Longest a message waits for its frame
+    
+    bool set(const std::string& key, const std::string& value, std::string& error);
+};
+
+// Leader/follower replication (see replication.hpp):
+//
+//   [replication]
+//   leader = primary.example:9092   # follow this broker (empty: lead)
+//   acks = 1                        # followers that must have a publish before OK
+struct ReplicationConfig {
+    std::string leader;              // host:port or unix:/path to follow, empty for a leader
+    std::string name = "follower";   // How a follower shows up in its leader's stats
+    size_t acks = 0;                 // Followers a publish waits for, 0 = asynchronous
+    int ack_timeout_ms = 1000;       // Then ERROR:NOT_REPLICATED
+    size_t log_bytes = 64 << 20;     // Recent messages kept for followers to resume from
+    size_t batch_bytes = 256 << 10;  // Largest frame sent to a follower
+    size_t window_frames = 16;       // Frames in flight to a follower before it acknowledges
+    
+    bool set(const std::string& key, const std::string& value, std::string& error);
+};
+
+// Topic priority classes and how a session's outbound lanes share its
+// connection (see priority_lanes.hpp):
+//
+//   [priorities]
+//   high = errors,alerts.*          # patterns as in a bridge's topics
+//   low = debug,metrics.*           # everything else is normal
+//   scheduling = weighted           # or strict
+//   weights = 16,4,1                # messages per turn: high, normal, low
+struct PriorityConfig {
+    std::string high;
+    std::string low;
+    bool strict = false;
+    std::array<uint32_t, 3> weights = {16, 4, 1};
+    
+    bool set(const std::string& key, const std::string& value, std::string& error);
+};
+
+// A listener address taken apart
+struct ListenAddress {
+    bool is_unix = false;
+    std::string host;    // Socket path when is_unix
+    uint16_t port = 0;
+
+    static bool parse(const std::string& address, ListenAddress& parsed, std::string& error);
+};
+
+struct BrokerConfig {
+    static constexpr uint16_t DEFAULT_PORT = 9092;
+
+    std::vector<ListenerConfig> listeners;
+    std::vector<BridgeConfig> bridges;
+    ReplicationConfig replication;
+    PriorityConfig priorities;
+
+    // Socket of the default Unix listener; empty for none
+    std::string default_unix_path;
+    
+    // Warm restart (see handoff.hpp and snapshot.hpp)
+    std::string snapshot_path;   // Topic data saved at exit, loaded (and removed) at start
+    std::string handoff_path;    // Wait here for a successor to take over
+    std::string takeover_path;   // Take over from the broker waiting here
+
+    ListenerConfig* find(const std::string& name);
+    BridgeConfig* find_bridge(const std::string& name);
+
+    // Read a configuration file; its listeners and bridges are added to this
+    // config, [replication] and [priorities] sections replace those settings
+    bool load(const std::string& path, std::string& error);
+
+    // Listeners used when neither the file nor the command line names any:
+    // "tcp" on DEFAULT_PORT and "unix" on default_unix_path
+    void add_defaults();
+};
+
+/**
+ * Broker command line:
+ *
+ *   --config FILE             read listeners from FILE (before other options)
+ *   --listen [NAME=]ADDRESS   add a listener (repeatable)
+ *   --port N                  port of the first TCP listener
+ *   --bridge [NAME=]REMOTE    link to another broker (repeatable)
+ *   --follow LEADER           replicate the broker at LEADER (see replication.hpp)
+ *   --acks N                  publishes wait for N followers
+ *   --set NAME.KEY=VALUE      override one listener or bridge setting
+ *                             (NAME "replication" or "priorities" for those settings)
+ *   --snapshot FILE           keep topic data across restarts in FILE
+ *   --handoff SOCKET          let a successor take over through SOCKET
+ *   --takeover SOCKET         take over from the broker at SOCKET
+ *   --help
+ *
+ * Returns false with the reason on a bad option; help is set for --help.
+ */
+bool parse_broker_args(int argc, char* argv[], BrokerConfig& config, bool& help, std::string& error);
+
+// Usage text for --help and option errors
+const char* broker_usage();
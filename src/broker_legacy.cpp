@@ -18,6 +18,7 @@ int main() {
     // Setup signal handlers for graceful shutdown
     std::signal(SIGINT, signal_handler);
     std::signal(SIGTERM, signal_handler);
+    apply_log_level_from_env();
     
     log_info("Starting NeuroPipe Broker...");
     
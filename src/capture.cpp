@@ -0,0 +1,195 @@
+#include "capture.hpp"
+#include "../include/latency_trace.hpp"
+#include <cstring>
+#include <mutex>
+
+namespace capture {
+
+std::atomic<bool> g_active{false};
+
+namespace {
+
+const char MAGIC[8] = {'N', 'P', 'C', 'A', 'P', 1, 0, 0};
+
+struct Writer {
+    std::mutex mutex;
+    std::FILE* file = nullptr;
+    uint64_t last_ns = 0;
+    long records = 0;
+    uint64_t bytes = 0;
+    uint64_t max_bytes = 0;
+    bool full = false;  // Ended at max_bytes, not yet stopped
+};
+
+Writer& writer() {
+    static Writer instance;
+    return instance;
+}
+
+size_t put_varint(uint8_t* out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+    return n;
+}
+
+void put_u64(uint8_t* out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+} // namespace
+
+bool start(const std::string& path, uint64_t max_bytes) {
+    Writer& w = writer();
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (w.file) {
+        return false;
+    }
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+    uint64_t base_ns = latency_trace::now_ns();
+    uint8_t header[16];
+    std::memcpy(header, MAGIC, sizeof(MAGIC));
+    put_u64(header + 8, base_ns);
+    std::fwrite(header, 1, sizeof(header), file);
+
+    w.file = file;
+    w.last_ns = base_ns;
+    w.records = 0;
+    w.bytes = sizeof(header);
+    w.max_bytes = max_bytes;
+    w.full = false;
+    g_active.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+long stop() {
+    Writer& w = writer();
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (!w.file) {
+        if (!w.full) {
+            return -1;
+        }
+        w.full = false;
+        return w.records;
+    }
+    g_active.store(false, std::memory_order_relaxed);
+    std::fclose(w.file);
+    w.file = nullptr;
+    return w.records;
+}
+
+void record(Kind kind, uint32_t connection, uint64_t timestamp_ns, std::string_view frame) {
+    if (!active()) {
+        return;
+    }
+    Writer& w = writer();
+    std::lock_guard<std::mutex> lock(w.mutex);
+    if (!w.file) {
+        return;
+    }
+    // Stamps are taken before the lock, so threads can arrive slightly out of order
+    if (timestamp_ns < w.last_ns) {
+        timestamp_ns = w.last_ns;
+    }
+    uint8_t prefix[30];
+    size_t n = put_varint(prefix, timestamp_ns - w.last_ns);
+    n += put_varint(prefix + n, (static_cast<uint64_t>(connection) << 2) | static_cast<uint8_t>(kind));
+    if (kind == Kind::Frame) {
+        n += put_varint(prefix + n, frame.size());
+    }
+    uint64_t size = n + (kind == Kind::Frame ? frame.size() : 0);
+    if (w.bytes + size > w.max_bytes) {
+        // Full: the file ends with the last whole record
+        g_active.store(false, std::memory_order_relaxed);
+        std::fclose(w.file);
+        w.file = nullptr;
+        w.full = true;
+        return;
+    }
+    w.bytes += size;
+    std::fwrite(prefix, 1, n, w.file);
+    if (kind == Kind::Frame) {
+        std::fwrite(frame.data(), 1, frame.size(), w.file);
+    }
+    w.last_ns = timestamp_ns;
+    w.records++;
+}
+
+uint32_t next_connection_id() {
+    static std::atomic<uint32_t> counter{1};
+    return counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+Reader::Reader(const std::string& path) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return;
+    }
+    uint8_t header[16];
+    if (std::fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0) {
+        std::fclose(file);
+        return;
+    }
+    for (int i = 0; i < 8; ++i) {
+        base_ns_ |= static_cast<uint64_t>(header[8 + i]) << (8 * i);
+    }
+    last_ns_ = base_ns_;
+    file_ = file;
+}
+
+Reader::~Reader() {
+    if (file_) {
+        std::fclose(file_);
+    }
+}
+
+bool Reader::read_varint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = std::fgetc(file_);
+        if (c == EOF) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Reader::next(Record& record) {
+    uint64_t delta, tagged;
+    if (!file_ || !read_varint(delta) || !read_varint(tagged)) {
+        return false;
+    }
+    last_ns_ += delta;
+    record.timestamp_ns = last_ns_;
+    record.kind = static_cast<Kind>(tagged & 0x3);
+    record.connection = static_cast<uint32_t>(tagged >> 2);
+    record.frame.clear();
+    if (record.kind == Kind::Frame) {
+        uint64_t length;
+        if (!read_varint(length)) {
+            return false;
+        }
+        record.frame.resize(length);
+        if (length && std::fread(record.frame.data(), 1, length, file_) != length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace capture
@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+/**
+ * Wire-level capture of inbound broker traffic for later replay.
+ *
+ * While a capture is active every inbound line is appended to a compact
+ * binary file together with its arrival time (CLOCK_MONOTONIC) and the id
+ * of the connection it arrived on; connection open/close events are
+ * recorded too. When inactive, a capture point costs one relaxed atomic load.
+ * A capture ends by itself when its file would grow past max_bytes.
+ *
+ * File layout (integers little-endian, varints LEB128):
+ *   header:  "NPCAP\x01\0\0" then uint64 base timestamp (ns)
+ *   record:  varint delta_ns since the previous record
+ *            varint (connection << 2 | kind)
+ *            frames only: varint length, then the line without '\n'
+ *
+ * np_replay re-issues a capture against a broker.
+ */
+namespace capture {
+
+enum class Kind : uint8_t {
+    Open = 0,
+    Frame = 1,
+    Close = 2
+};
+
+extern std::atomic<bool> g_active;
+
+inline bool active() { return g_active.load(std::memory_order_relaxed); }
+
+constexpr uint64_t DEFAULT_MAX_BYTES = uint64_t{1} << 30;
+
+// Begin writing to path, at most max_bytes; false if a capture is already
+// running or the file cannot be created
+bool start(const std::string& path, uint64_t max_bytes = DEFAULT_MAX_BYTES);
+
+// Finish the capture; returns the number of records written (also for one
+// that reached its limit since), -1 if none was active
+long stop();
+
+// Append one record (no-op when inactive)
+void record(Kind kind, uint32_t connection, uint64_t timestamp_ns, std::string_view frame = {});
+
+// Process-unique id for a new connection
+uint32_t next_connection_id();
+
+struct Record {
+    Kind kind = Kind::Frame;
+    uint32_t connection = 0;
+    uint64_t timestamp_ns = 0;  // Absolute, same clock as the capturing broker
+    std::string frame;
+};
+
+// Sequential reader for capture files
+class Reader {
+public:
+    explicit Reader(const std::string& path);
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // False if the file is missing or not a capture
+    bool ok() const { return file_ != nullptr; }
+    uint64_t base_ns() const { return base_ns_; }
+
+    // False at end of file (or on a truncated record)
+    bool next(Record& record);
+
+private:
+    bool read_varint(uint64_t& value);
+
+    std::FILE* file_ = nullptr;
+    uint64_t base_ns_ = 0;
+    uint64_t last_ns_ = 0;
+};
+
+} // namespace capture
@@ -1,11 +1,21 @@
 #define ASIO_STANDALONE
 #include <asio.hpp>
+#include "stream_transport.hpp"
 #include <iostream>
 #include <string>
 #include <memory>
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/socket.h>
+#include "../include/latency_trace.hpp"
+#include "../include/lz_codec.hpp"
+#include "../include/topic_tail.hpp"
+#include "latency_histogram.hpp"
 
 class ConsumerClient {
 public:
@@ -13,42 +23,64 @@ public:
                    const std::string& host, 
                    const std::string& port)
         : socket_(io_context),
-          resolver_(io_context),
           host_(host),
           port_(port),
           running_(true) {
     }
     
+    // Ask the broker for TMESSAGE delivery and aggregate per-hop latency.
+    // With kernel_timestamps the socket also reports kernel receive times
+    // (SO_TIMESTAMPNS) so the kernel -> consumer hop can be split out.
+    void enable_latency_trace(bool kernel_timestamps) {
+        send_command("TRACE:ON\n", "OK:TRACE:ON");
+        latency_trace_ = true;
+        
+        if (kernel_timestamps) {
+            int on = 1;
+            if (setsockopt(socket_.native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0) {
+                kernel_timestamps_ = true;
+            } else {
+                std::cerr << "✗ Kernel timestamps unavailable: " << std::strerror(errno) << std::endl;
+            }
+        }
+    }
+    
+    // Ask the broker to send compressed batches (ZBATCH frames)
+    void enable_compression() {
+        if (send_command("COMPRESS:LZ\n", "OK:COMPRESS:LZ")) {
+            compression_ = true;
+            std::cout << "✓ Compression enabled (LZ)" << std::endl;
+        }
+    }
+    
+    // Ask the broker to probe this connection while it is quiet, so a
+    // consumer whose host died is dropped (probes are answered in
+    // start_listening)
+    void enable_heartbeats() {
+        if (send_command("HEARTBEAT:ON\n", "OK:HEARTBEAT:")) {
+            std::cout << "✓ Heartbeats enabled" << std::endl;
+        }
+    }
+    
     void connect() {
         try {
-            auto endpoints = resolver_.resolve(host_, port_);
-            asio::connect(socket_, endpoints);
-            std::cout << "✓ Connected to broker at " << host_ << ":" << port_ << std::endl;
+            connect_stream(socket_, host_, port_);
+            std::cout << "✓ Connected to broker at " << transport::describe(host_, port_) << std::endl;
         } catch (std::exception& e) {
             throw std::runtime_error("Connection failed: " + std::string(e.what()));
         }
     }
     
+    // Pull instead of push: the broker sends at most window messages ahead
+    // of what this consumer has printed (SUBSCRIBE:topic:credit=N)
+    void set_credit_window(uint64_t window) {
+        credit_window_ = window;
+    }
+    
     void subscribe(const std::string& topic) {
-        std::string command = "SUBSCRIBE:" + topic + "\n";
-        try {
-            asio::write(socket_, asio::buffer(command));
-            
-            // Read response
-            asio::streambuf response;
-            asio::read_until(socket_, response, '\n');
-            
-            std::istream response_stream(&response);
-            std::string response_line;
-            std::getline(response_stream, response_line);
-            
-            if (response_line.find("OK:SUBSCRIBED") == 0) {
-                std::cout << "✓ Subscribed to topic: " << topic << std::endl;
-            } else {
-                std::cout << "✗ Subscription failed: " << response_line << std::endl;
-            }
-        } catch (std::exception& e) {
-            std::cerr << "✗ Failed to subscribe: " << e.what() << std::endl;
+        std::string suffix = credit_window_ ? ":credit=" + std::to_string(credit_window_) : "";
+        if (send_command("SUBSCRIBE:" + topic + suffix + "\n", "OK:SUBSCRIBED")) {
+            std::cout << "✓ Subscribed to topic: " << topic << std::endl;
         }
     }
     
@@ -56,15 +88,12 @@ public:
         std::cout << "\n=== Listening for messages ===" << std::endl;
         std::cout << "Press Ctrl+C to stop\n" << std::endl;
         
-        asio::streambuf buffer;
         std::string line;
+        auto last_report = std::chrono::steady_clock::now();
         
         while (running_) {
             try {
-                asio::read_until(socket_, buffer, '\n');
-                
-                std::istream is(&buffer);
-                std::getline(is, line);
+                read_line(line);
                 
                 auto now = std::chrono::system_clock::now();
                 auto time = std::chrono::system_clock::to_time_t(now);
@@ -81,8 +110,23 @@ public:
                         std::cout << "[" << time_str << "] "
                                   << "📨 [" << topic << "] " << payload << std::endl;
                     }
+                    grant_credit();
+                } else if (line.find("TMESSAGE:") == 0) {
+                    latency_trace::Stamps stamps;
+                    std::string_view topic, payload;
+                    if (latency_trace::parse_message(line, stamps, topic, payload)) {
+                        record_latency(stamps);
+                        std::cout << "[" << time_str << "] "
+                                  << "📨 [" << topic << "] " << payload << std::endl;
+                    }
+                    if (std::chrono::steady_clock::now() - last_report > std::chrono::seconds(10)) {
+                        print_latency_report();
+                        last_report = std::chrono::steady_clock::now();
+                    }
                 } else if (line.find("OK:") == 0 || line.find("ERROR:") == 0) {
                     std::cout << "[" << time_str << "] ℹ️  " << line << std::endl;
+                } else if (line == "HEARTBEAT") {
+                    asio::write(socket_, asio::buffer("HEARTBEAT:ACK\n", 14));
                 } else if (line == "PONG") {
                     std::cout << "[" << time_str << "] 🏓 PONG received" << std::endl;
                 } else if (!line.empty()) {
@@ -110,26 +154,283 @@ public:
         std::cout << "Disconnected from broker" << std::endl;
     }
     
+    void print_latency_report() const {
+        if (!latency_trace_) {
+            return;
+        }
+        std::cerr << "\n=== Latency report (per hop) ===" << std::endl;
+        for (size_t i = 0; i < HOP_REPORT_COUNT; ++i) {
+            if (i == HOP_KERNEL_TO_APP && !kernel_timestamps_) {
+                continue;
+            }
+            std::cerr << "  " << std::left << std::setw(18) << HOP_NAMES[i]
+                      << hops_[i].summary() << std::endl;
+        }
+        std::cerr << "================================\n" << std::endl;
+    }
+    
 private:
-    asio::ip::tcp::socket socket_;
-    asio::ip::tcp::resolver resolver_;
+    enum HopReport {
+        HOP_APP_TO_BROKER,    // DebugLogger send -> broker ingress
+        HOP_BROKER_ROUTING,   // Broker ingress -> subscriber enqueue
+        HOP_SESSION_QUEUE,    // Subscriber enqueue -> socket write
+        HOP_WIRE_TO_APP,      // Socket write -> consumer read
+        HOP_KERNEL_TO_APP,    // Kernel receive -> consumer read (--kernel-ts)
+        HOP_END_TO_END,       // DebugLogger send -> consumer read
+        HOP_REPORT_COUNT
+    };
+    static constexpr const char* HOP_NAMES[HOP_REPORT_COUNT] = {
+        "app->broker", "broker routing", "session queue",
+        "wire->consumer", "kernel->consumer", "end-to-end"
+    };
+    
+    // Hand the credit of what was consumed back in half-window steps, so
+    // the next messages are already on the way
+    void grant_credit() {
+        if (credit_window_ == 0 || ++consumed_ < std::max<uint64_t>(1, credit_window_ / 2)) {
+            return;
+        }
+        asio::write(socket_, asio::buffer("CREDIT:" + std::to_string(consumed_) + "\n"));
+        consumed_ = 0;
+    }
+    
+    // Send a command and check the first response line starts with expected
+    bool send_command(const std::string& command, const std::string& expected) {
+        try {
+            asio::write(socket_, asio::buffer(command));
+            
+            // Read response
+            asio::streambuf response;
+            asio::read_until(socket_, response, '\n');
+            
+            std::istream response_stream(&response);
+            std::string response_line;
+            std::getline(response_stream, response_line);
+            
+            if (response_line.find(expected) == 0) {
+                return true;
+            }
+            std::cout << "✗ Command failed: " << response_line << std::endl;
+        } catch (std::exception& e) {
+            std::cerr << "✗ Command failed: " << e.what() << std::endl;
+        }
+        return false;
+    }
+    
+    static int64_t hop_delta(uint64_t from, uint64_t to) {
+        return static_cast<int64_t>(to - from);
+    }
+    
+    void record_latency(const latency_trace::Stamps& stamps) {
+        uint64_t received = latency_trace::now_ns();
+        const uint64_t* ns = stamps.ns;
+        int64_t deltas[HOP_REPORT_COUNT] = {
+            hop_delta(ns[latency_trace::HOP_SEND], ns[latency_trace::HOP_INGRESS]),
+            hop_delta(ns[latency_trace::HOP_INGRESS], ns[latency_trace::HOP_ENQUEUE]),
+            hop_delta(ns[latency_trace::HOP_ENQUEUE], ns[latency_trace::HOP_WRITE]),
+            hop_delta(ns[latency_trace::HOP_WRITE], received),
+            kernel_to_app_ns_,
+            hop_delta(ns[latency_trace::HOP_SEND], received)
+        };
+        // Measured once per recvmsg chunk: only its first traced line gets it
+        kernel_to_app_ns_ = -1;
+        for (size_t i = 0; i < HOP_REPORT_COUNT; ++i) {
+            // Negative deltas only happen across hosts with unrelated clocks
+            if (deltas[i] >= 0 && (i != HOP_KERNEL_TO_APP || kernel_timestamps_)) {
+                hops_[i].record(static_cast<uint64_t>(deltas[i]));
+            }
+        }
+    }
+    
+    // Next protocol line, unpacking ZBATCH frames on a compressed connection
+    void read_line(std::string& line) {
+        while (batch_pos_ >= batch_.size()) {
+            read_wire_line(line);
+            size_t raw_size, compressed_size;
+            if (!compression_ || !lz_codec::parse_batch_header(line, raw_size, compressed_size)) {
+                return;
+            }
+            std::string block;
+            read_exact(compressed_size, block);
+            batch_.clear();
+            batch_pos_ = 0;
+            if (!lz_codec::decompress(block, raw_size, batch_)) {
+                throw std::runtime_error("Corrupt compressed batch");
+            }
+        }
+        size_t newline = batch_.find('\n', batch_pos_);
+        if (newline == std::string::npos) {
+            newline = batch_.size();
+        }
+        line.assign(batch_, batch_pos_, newline - batch_pos_);
+        batch_pos_ = newline + 1;
+    }
+    
+    void read_wire_line(std::string& line) {
+        if (kernel_timestamps_) {
+            size_t newline;
+            while ((newline = pending_.find('\n')) == std::string::npos) {
+                receive_with_kernel_timestamp();
+            }
+            line.assign(pending_, 0, newline);
+            pending_.erase(0, newline + 1);
+        } else {
+            asio::read_until(socket_, buffer_, '\n');
+            std::istream is(&buffer_);
+            std::getline(is, line);
+        }
+    }
+    
+    void read_exact(size_t length, std::string& out) {
+        if (kernel_timestamps_) {
+            while (pending_.size() < length) {
+                receive_with_kernel_timestamp();
+            }
+            out.assign(pending_, 0, length);
+            pending_.erase(0, length);
+        } else {
+            if (buffer_.size() < length) {
+                asio::read(socket_, buffer_, asio::transfer_exactly(length - buffer_.size()));
+            }
+            out.assign(static_cast<const char*>(buffer_.data().data()), length);
+            buffer_.consume(length);
+        }
+    }
+    
+    // Read one chunk with recvmsg so the kernel receive timestamp of the
+    // chunk carrying a line's terminator is available (CLOCK_REALTIME).
+    void receive_with_kernel_timestamp() {
+        char data[16384];
+        char control[CMSG_SPACE(sizeof(struct timespec))];
+        struct iovec iov = {data, sizeof(data)};
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        
+        ssize_t n = recvmsg(socket_.native_handle(), &msg, 0);
+        if (n <= 0) {
+            throw std::runtime_error(n == 0 ? "End of file" : std::strerror(errno));
+        }
+        
+        kernel_to_app_ns_ = -1;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec kernel_ts;
+                std::memcpy(&kernel_ts, CMSG_DATA(cmsg), sizeof(kernel_ts));
+                struct timespec user_ts;
+                clock_gettime(CLOCK_REALTIME, &user_ts);
+                kernel_to_app_ns_ = (user_ts.tv_sec - kernel_ts.tv_sec) * 1000000000ll +
+                                    (user_ts.tv_nsec - kernel_ts.tv_nsec);
+            }
+        }
+        pending_.append(data, static_cast<size_t>(n));
+    }
+    
+
+    StreamSocket socket_;
     std::string host_;
     std::string port_;
     std::atomic<bool> running_;
+    
+    bool latency_trace_ = false;
+    bool kernel_timestamps_ = false;
+    bool compression_ = false;
+    uint64_t credit_window_ = 0;  // 0: messages are pushed
+    uint64_t consumed_ = 0;       // Messages not yet handed back as credit
+    int64_t kernel_to_app_ns_ = -1;
+    std::string pending_;
+    asio::streambuf buffer_;
+    std::string batch_;       // Decompressed ZBATCH lines not yet returned
+    size_t batch_pos_ = 0;
+    LatencyHistogram hops_[HOP_REPORT_COUNT];
 };
 
+std::atomic<bool> g_running(true);
+
+// Follow the broker's shared-memory tails of topics (TAIL:START or
+// NEUROPIPE_TAIL_TOPICS) instead of subscribing; same-host only
+int run_tail(const std::vector<std::string>& topics) {
+    std::vector<std::unique_ptr<topic_tail::Reader>> readers;
+    for (const auto& topic : topics) {
+        readers.push_back(std::make_unique<topic_tail::Reader>());
+        if (readers.back()->open(topic)) {
+            std::cout << "✓ Tailing topic: " << topic << std::endl;
+        } else {
+            std::cout << "… Waiting for the broker to tail topic: " << topic << std::endl;
+        }
+    }
+    std::cout << "\n=== Listening for messages ===" << std::endl;
+    std::cout << "Press Ctrl+C to stop\n" << std::endl;
+    
+    std::string payload;
+    auto last_check = std::chrono::steady_clock::now();
+    while (g_running) {
+        bool idle = true;
+        for (size_t i = 0; i < readers.size(); ++i) {
+            topic_tail::Reader& reader = *readers[i];
+            for (int n = 0; reader.is_open() && n < 256; ++n) {
+                topic_tail::Reader::Status status = reader.next(payload);
+                if (status == topic_tail::Reader::Status::Message) {
+                    idle = false;
+                    auto time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+                    char time_str[100];
+                    std::strftime(time_str, sizeof(time_str), "%H:%M:%S", std::localtime(&time));
+                    std::cout << "[" << time_str << "] "
+                              << "📨 [" << topics[i] << "] " << payload
+                              << (reader.truncated() ? " [truncated]" : "") << std::endl;
+                } else if (status == topic_tail::Reader::Status::Lapped) {
+                    std::cerr << "⚠️  [" << topics[i] << "] fell behind, " << reader.skipped()
+                              << " messages lost" << std::endl;
+                } else {
+                    break;
+                }
+            }
+        }
+        if (idle) {
+            // Tails get started late, stopped, or recreated by a restarted broker
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_check > std::chrono::seconds(1)) {
+                last_check = now;
+                for (size_t i = 0; i < readers.size(); ++i) {
+                    if (!readers[i]->is_open() || readers[i]->replaced()) {
+                        if (readers[i]->open(topics[i], true)) {
+                            std::cout << "✓ Tailing topic: " << topics[i] << std::endl;
+                        }
+                    }
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+    return 0;
+}
+
 void print_usage(const char* program_name) {
-    std::cout << "\nUsage: " << program_name << " [host] [port] [topic1] [topic2] ..." << std::endl;
+    std::cout << "\nUsage: " << program_name << " [--latency [--kernel-ts]] [--compress] [--heartbeat] [--credit N] [host] [port] [topic1] [topic2] ..." << std::endl;
+    std::cout << "       " << program_name << " --tail topic1 [topic2] ..." << std::endl;
+    std::cout << "\nOptions:" << std::endl;
+    std::cout << "  --latency     Request traced delivery and report per-hop latency percentiles" << std::endl;
+    std::cout << "  --kernel-ts   Also use kernel receive timestamps (SO_TIMESTAMPNS)" << std::endl;
+    std::cout << "  --compress    Receive messages in LZ-compressed batches" << std::endl;
+    std::cout << "  --heartbeat   Have the broker probe the connection while it is quiet" << std::endl;
+    std::cout << "  --credit N    Let the broker send at most N messages ahead of this consumer" << std::endl;
+    std::cout << "  --tail        Read the broker's shared-memory tails of the topics (same host," << std::endl;
+    std::cout << "                needs TAIL:START or NEUROPIPE_TAIL_TOPICS on the broker)" << std::endl;
     std::cout << "\nExamples:" << std::endl;
     std::cout << "  " << program_name << " 127.0.0.1 9092 sensor_data" << std::endl;
     std::cout << "  " << program_name << " localhost 9092 events logs alerts" << std::endl;
+    std::cout << "  " << program_name << " --latency localhost 9092 debug" << std::endl;
+    std::cout << "  " << program_name << " unix:/tmp/neuropipe.sock 0 debug" << std::endl;
+    std::cout << "  " << program_name << " --tail debug errors" << std::endl;
     std::cout << "\nDefaults:" << std::endl;
-    std::cout << "  host: 127.0.0.1" << std::endl;
-    std::cout << "  port: 9092" << std::endl;
+    std::cout << "  host: 127.0.0.1 (unix:/path connects to the broker's Unix socket)" << std::endl;
+    std::cout << "  port: 9092 (ignored for unix:)" << std::endl;
     std::cout << "  topics: (none - will prompt interactively)\n" << std::endl;
 }
 
-std::atomic<bool> g_running(true);
 ConsumerClient* g_client = nullptr;
 
 void signal_handler(int signal) {
@@ -146,34 +447,63 @@ int main(int argc, char* argv[]) {
     std::string host = "127.0.0.1";
     std::string port = "9092";
     std::vector<std::string> topics;
+    bool latency_trace = false;
+    bool kernel_timestamps = false;
+    bool compress = false;
+    bool heartbeat = false;
+    uint64_t credit = 0;
+    bool tail = false;
     
-    // Parse command line arguments
-    if (argc >= 2) {
-        if (std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h") {
+    // Parse command line arguments (flags first, then positional)
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
             print_usage(argv[0]);
             return 0;
+        } else if (arg == "--latency") {
+            latency_trace = true;
+        } else if (arg == "--kernel-ts") {
+            kernel_timestamps = true;
+        } else if (arg == "--compress") {
+            compress = true;
+        } else if (arg == "--heartbeat") {
+            heartbeat = true;
+        } else if (arg == "--credit" && i + 1 < argc) {
+            credit = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--tail") {
+            tail = true;
+        } else {
+            args.push_back(arg);
         }
-        host = argv[1];
     }
-    if (argc >= 3) {
-        port = argv[2];
+    if (args.size() >= 1) {
+        host = args[0];
+    }
+    if (args.size() >= 2) {
+        port = args[1];
     }
-    if (argc >= 4) {
-        for (int i = 3; i < argc; ++i) {
-            topics.push_back(argv[i]);
+    for (size_t i = 2; i < args.size(); ++i) {
+        topics.push_back(args[i]);
+    }
+    
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
+    if (tail) {
+        // No broker connection: every argument is a topic
+        if (args.empty()) {
+            print_usage(argv[0]);
+            return 1;
         }
+        return run_tail(args);
     }
     
     std::cout << "\n=========================================" << std::endl;
     std::cout << "=== NeuroPipe Consumer Client (Asio) ===" << std::endl;
     std::cout << "=========================================" << std::endl;
-    std::cout << "Target: " << host << ":" << port << std::endl;
+    std::cout << "Target: " << transport::describe(host, port) << std::endl;
     std::cout << "=========================================\n" << std::endl;
     
-    // Setup signal handlers
-    std::signal(SIGINT, signal_handler);
-    std::signal(SIGTERM, signal_handler);
-    
     try {
         asio::io_context io_context;
         ConsumerClient client(io_context, host, port);
@@ -206,6 +536,17 @@ int main(int argc, char* argv[]) {
             }
         }
         
+        if (heartbeat) {
+            client.enable_heartbeats();
+        }
+        client.set_credit_window(credit);
+        if (compress) {
+            client.enable_compression();
+        }
+        if (latency_trace) {
+            client.enable_latency_trace(kernel_timestamps);
+        }
+        
         // Subscribe to all topics
         std::cout << "\nSubscribing to topics..." << std::endl;
         for (const auto& topic : topics) {
@@ -215,6 +556,7 @@ int main(int argc, char* argv[]) {
         // Start listening for messages
         client.start_listening();
         
+        client.print_latency_report();
         client.disconnect();
         
     } catch (std::exception& e) {
@@ -0,0 +1,492 @@
+#include "federation.hpp"
+#include "asio_server.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+namespace federation {
+
+namespace {
+
+void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(static_cast<uint8_t>(value) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool get_varint(std::string_view& in, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(in.front());
+        in.remove_prefix(1);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool get_bytes(std::string_view& in, std::string_view& out) {
+    uint64_t length;
+    if (!get_varint(in, length) || length > in.size()) {
+        return false;
+    }
+    out = in.substr(0, length);
+    in.remove_prefix(length);
+    return true;
+}
+
+bool parse_size(std::string_view digits, size_t& value) {
+    value = 0;
+    if (digits.empty()) {
+        return false;
+    }
+    for (char c : digits) {
+        if (c < '0' || c > '9' || value > MAX_FRAME_BYTES) {
+            return false;
+        }
+        value = value * 10 + static_cast<size_t>(c - '0');
+    }
+    return value <= MAX_FRAME_BYTES;
+}
+
+constexpr std::string_view HELLO = "BRIDGE:HELLO:";
+constexpr std::string_view WELCOME = "OK:BRIDGE:";
+constexpr std::string_view INTEREST = "BRIDGE:INTEREST:";
+constexpr std::chrono::milliseconds MAX_BACKOFF{5000};
+
+} // namespace
+
+std::vector<std::string> parse_patterns(const std::string& list) {
+    std::vector<std::string> patterns;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string pattern = list.substr(begin, end - begin);
+        pattern.erase(0, pattern.find_first_not_of(' '));
+        pattern.erase(pattern.find_last_not_of(' ') + 1);
+        if (!pattern.empty()) {
+            patterns.push_back(pattern);
+        }
+        begin = end + 1;
+    }
+    return patterns;
+}
+
+bool matches(const std::vector<std::string>& patterns, std::string_view topic) {
+    for (const std::string& pattern : patterns) {
+        if (!pattern.empty() && pattern.back() == '*') {
+            if (topic.substr(0, pattern.size() - 1) == std::string_view(pattern).substr(0, pattern.size() - 1)) {
+                return true;
+            }
+        } else if (topic == pattern) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_frame_header(const std::string& line, size_t& count, size_t& bytes) {
+    if (line.compare(0, FRAME_PREFIX.size(), FRAME_PREFIX) != 0) {
+        return false;
+    }
+    std::string_view rest = std::string_view(line).substr(FRAME_PREFIX.size());
+    size_t colon = rest.find(':');
+    return colon != std::string_view::npos && parse_size(rest.substr(0, colon), count) &&
+           parse_size(rest.substr(colon + 1), bytes);
+}
+
+// ============================================================================
+// Link
+// ============================================================================
+
+Link::Link(Federation& federation, asio::io_context& io_context, const BridgeConfig& config, bool dialled)
+    : federation_(federation),
+      config_(config),
+      patterns_(parse_patterns(config.topics)),
+      dialled_(dialled),
+      flush_timer_(io_context) {}
+
+void Link::attach(std::shared_ptr<Session> session) {
+    session_ = session;
+}
+
+void Link::send(const std::string& line) {
+    if (auto session = session_.lock()) {
+        session->deliver(line);
+    }
+}
+
+void Link::forward(std::string_view topic, std::string_view payload, const Origin* origin) {
+    if (origin && (origin->via == this || origin->broker == remote_id())) {
+        return;  // Back where it came from
+    }
+    uint32_t hops = origin ? origin->hops + 1 : 1;
+    if (hops > MAX_HOPS) {
+        federation_.loops_dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    if (closed_ || !established()) {
+        return;
+    }
+    uint64_t broker = origin ? origin->broker : federation_.id();
+    char id[8];
+    for (int i = 0; i < 8; ++i) {
+        id[i] = static_cast<char>(broker >> (8 * i));
+    }
+    batch_.append(id, sizeof(id));
+    put_varint(batch_, hops);
+    put_varint(batch_, topic.size());
+    batch_.append(topic);
+    put_varint(batch_, payload.size());
+    batch_.append(payload);
+    ++batch_count_;
+    federation_.forwarded_.fetch_add(1, std::memory_order_relaxed);
+
+    if (batch_count_ >= config_.batch_messages || batch_.size() >= config_.batch_bytes ||
+        config_.batch_delay_us == 0) {
+        flush_locked();
+    } else if (!flush_armed_) {
+        flush_armed_ = true;
+        flush_timer_.expires_after(std::chrono::microseconds(config_.batch_delay_us));
+        std::weak_ptr<Link> weak = shared_from_this();
+        flush_timer_.async_wait([weak](std::error_code ec) {
+            auto self = weak.lock();
+            if (ec || !self) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(self->batch_mutex_);
+            self->flush_armed_ = false;
+            self->flush_locked();
+        });
+    }
+}
+
+void Link::flush_locked() {
+    if (batch_count_ == 0 || closed_) {
+        return;
+    }
+    std::string frame;
+    frame.reserve(FRAME_PREFIX.size() + 24 + batch_.size());
+    frame.append(FRAME_PREFIX)
+         .append(std::to_string(batch_count_))
+         .append(1, ':')
+         .append(std::to_string(batch_.size()))
+         .append(1, '\n')
+         .append(batch_);
+    batch_.clear();
+    batch_count_ = 0;
+    federation_.frames_.fetch_add(1, std::memory_order_relaxed);
+    send(frame);
+}
+
+bool Link::handle_frame(std::string_view block, size_t count) {
+    TopicManager& topics = federation_.broker_.get_topic_manager();
+    // A replication follower takes messages from its leader only (it still
+    // forwards them over its links)
+    bool following = federation_.broker_.get_replication().following();
+    std::string payload;
+    for (size_t i = 0; i < count; ++i) {
+        if (block.size() < 8) {
+            return false;
+        }
+        uint64_t broker = 0;
+        for (int b = 0; b < 8; ++b) {
+            broker |= static_cast<uint64_t>(static_cast<uint8_t>(block[b])) << (8 * b);
+        }
+        block.remove_prefix(8);
+        uint64_t hops;
+        std::string_view topic;
+        std::string_view body;
+        if (!get_varint(block, hops) || !get_bytes(block, topic) || !get_bytes(block, body) || topic.empty()) {
+            return false;
+        }
+        if (broker == federation_.id() || hops > MAX_HOPS) {
+            federation_.loops_dropped_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (following) {
+            continue;
+        }
+        Origin origin;
+        origin.broker = broker;
+        origin.hops = static_cast<uint32_t>(hops);
+        origin.via = this;
+        payload.assign(body);
+        topics.publish(topic, payload, nullptr, &origin);
+        federation_.received_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return block.empty();
+}
+
+void Link::handle_line(const std::string& line) {
+    if (line.compare(0, INTEREST.size(), INTEREST) == 0 && line.size() > INTEREST.size() + 1) {
+        char sign = line[INTEREST.size()];
+        std::string_view topic = std::string_view(line).substr(INTEREST.size() + 1);
+        if (!established() || !matches(patterns_, topic) || (sign != '+' && sign != '-')) {
+            return;
+        }
+        TopicManager& topics = federation_.broker_.get_topic_manager();
+        if (sign == '+') {
+            topics.add_link_interest(topic, shared_from_this());
+        } else {
+            topics.remove_link_interest(topic, this);
+        }
+    } else if (line.compare(0, WELCOME.size(), WELCOME) == 0 && dialled_ && !established()) {
+        uint64_t id = std::strtoull(line.c_str() + WELCOME.size(), nullptr, 10);
+        if (id != 0) {
+            welcome(id);
+        }
+    } else if (line.compare(0, 6, "ERROR:") == 0) {
+        federation_.refused(*this, line.substr(6));
+    }
+}
+
+void Link::welcome(uint64_t remote_id) {
+    remote_id_ = remote_id;
+    log_info("Bridge " + name() + " to " + config_.remote + " established");
+    federation_.established(shared_from_this());
+}
+
+void Link::refresh_interest(TopicId topic) {
+    std::lock_guard<std::mutex> lock(interest_mutex_);
+    if (closed_ || !established()) {
+        return;
+    }
+    bool wanted = federation_.broker_.get_topic_manager().has_interest(topic, this);
+    if (wanted == (advertised_.count(topic) > 0)) {
+        return;
+    }
+    if (wanted) {
+        advertised_.insert(topic);
+    } else {
+        advertised_.erase(topic);
+    }
+    send(std::string(INTEREST) + (wanted ? "+" : "-") + topics::name(topic) + "\n");
+}
+
+void Link::close() {
+    closed_ = true;
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    batch_.clear();
+    batch_count_ = 0;
+    flush_timer_.cancel();
+}
+
+// ============================================================================
+// Federation
+// ============================================================================
+
+Federation::Federation(BrokerServer& broker, asio::io_context& io_context)
+    : broker_(broker), io_context_(io_context) {
+    std::random_device random;
+    do {
+        id_ = (static_cast<uint64_t>(random()) << 32) | random();
+    } while (id_ == 0);
+}
+
+bool Federation::add_bridge(const BridgeConfig& config, std::string& error) {
+    ListenAddress address;
+    if (!ListenAddress::parse(config.remote, address, error)) {
+        return false;
+    }
+    if (parse_patterns(config.topics).empty()) {
+        error = "bridge " + config.name + " has no topic patterns";
+        return false;
+    }
+    bridges_.push_back(std::make_unique<Bridge>(io_context_, config));
+    if (running_) {
+        dial(*bridges_.back());
+    }
+    return true;
+}
+
+void Federation::start() {
+    running_ = true;
+    for (auto& bridge : bridges_) {
+        dial(*bridge);
+    }
+}
+
+void Federation::stop() {
+    running_ = false;
+    for (auto& bridge : bridges_) {
+        bridge->redial.cancel();
+    }
+    std::vector<std::shared_ptr<Link>> links;
+    {
+        std::lock_guard<std::mutex> lock(links_mutex_);
+        links.swap(links_);
+    }
+    for (auto& link : links) {
+        link->close();
+    }
+}
+
+void Federation::dial(Bridge& bridge) {
+    broker_.connect(bridge.config.remote, [this, &bridge](std::error_code ec, Session::Socket socket) {
+        if (!running_) {
+            return;
+        }
+        if (ec) {
+            if (!bridge.failing) {
+                bridge.failing = true;
+                log_warn("Bridge " + bridge.config.name + " cannot reach " + bridge.config.remote + ": " +
+                         ec.message() + " (retrying)");
+            }
+            redial_later(bridge);
+            return;
+        }
+        connected(bridge, std::move(socket));
+    });
+}
+
+void Federation::connected(Bridge& bridge, asio::generic::stream_protocol::socket socket) {
+    bridge.failing = false;
+    auto link = std::make_shared<Link>(*this, io_context_, bridge.config, true);
+    bridge.link = link;
+    broker_.add_session(std::move(socket), nullptr, [&link](const std::shared_ptr<Session>& session) {
+        link->attach(session);
+        session->set_bridge(link);
+    });
+    link->send(std::string(HELLO) + std::to_string(id_) + ":" + bridge.config.name + ":" +
+               bridge.config.topics + "\n");
+    link->send("HEARTBEAT:ON\n");  // A dead remote then ends the link and it is redialled
+}
+
+void Federation::redial_later(Bridge& bridge) {
+    if (!running_ || bridge.disabled) {
+        return;
+    }
+    bridge.redial.expires_after(bridge.backoff);
+    bridge.backoff = std::min(bridge.backoff * 2, MAX_BACKOFF);
+    bridge.redial.async_wait([this, &bridge](std::error_code ec) {
+        if (!ec && running_) {
+            dial(bridge);
+        }
+    });
+}
+
+std::shared_ptr<Link> Federation::accept(std::shared_ptr<Session> session, const std::string& hello) {
+    // BRIDGE:HELLO:<id>:<name>:<patterns>
+    size_t id_end = hello.find(':', HELLO.size());
+    size_t name_end = id_end == std::string::npos ? id_end : hello.find(':', id_end + 1);
+    uint64_t remote_id = std::strtoull(hello.c_str() + HELLO.size(), nullptr, 10);
+    if (name_end == std::string::npos || remote_id == 0) {
+        session->deliver("ERROR:INVALID_FORMAT\n");
+        return nullptr;
+    }
+    if (remote_id == id_) {
+        session->deliver("ERROR:BRIDGE_SELF\n");
+        return nullptr;
+    }
+    BridgeConfig config;
+    config.name = hello.substr(id_end + 1, name_end - id_end - 1) + "@" + session->get_client_id();
+    config.remote = session->get_client_id();
+    config.topics = hello.substr(name_end + 1);
+    if (parse_patterns(config.topics).empty()) {
+        session->deliver("ERROR:INVALID_FORMAT\n");
+        return nullptr;
+    }
+    auto link = std::make_shared<Link>(*this, io_context_, config, false);
+    link->attach(session);
+    link->remote_id_ = remote_id;
+    session->deliver(std::string(WELCOME) + std::to_string(id_) + "\n");
+    log_info("Bridge " + config.name + " accepted");
+    established(link);
+    return link;
+}
+
+void Federation::established(const std::shared_ptr<Link>& link) {
+    if (Bridge* bridge = find_bridge(*link)) {
+        bridge->backoff = std::chrono::milliseconds(100);
+    }
+    {
+        std::lock_guard<std::mutex> lock(links_mutex_);
+        links_.push_back(link);
+    }
+    // Everything this broker already wants goes over first
+    for (TopicId topic : broker_.get_topic_manager().interested_topics(link.get())) {
+        if (matches(link->patterns(), topics::name(topic))) {
+            link->refresh_interest(topic);
+        }
+    }
+}
+
+void Federation::refused(const Link& link, const std::string& reason) {
+    Bridge* bridge = find_bridge(link);
+    if (reason == "BRIDGE_SELF" && bridge) {
+        bridge->disabled = true;
+        log_error("Bridge " + link.name() + " leads back to this broker, disabled");
+    } else {
+        log_warn("Bridge " + link.name() + ": remote replied ERROR:" + reason);
+    }
+}
+
+Federation::Bridge* Federation::find_bridge(const Link& link) {
+    for (auto& bridge : bridges_) {
+        if (bridge->link.get() == &link) {
+            return bridge.get();
+        }
+    }
+    return nullptr;
+}
+
+void Federation::interest_changed(TopicId topic) {
+    std::vector<std::shared_ptr<Link>> links;
+    {
+        std::lock_guard<std::mutex> lock(links_mutex_);
+        links = links_;
+    }
+    const std::string& name = topics::name(topic);
+    for (auto& link : links) {
+        if (matches(link->patterns(), name)) {
+            link->refresh_interest(topic);
+        }
+    }
+}
+
+void Federation::link_closed(const std::shared_ptr<Link>& link) {
+    if (link->closed_.exchange(true)) {
+        return;
+    }
+    link->close();
+    {
+        std::lock_guard<std::mutex> lock(links_mutex_);
+        links_.erase(std::remove(links_.begin(), links_.end(), link), links_.end());
+    }
+    broker_.get_topic_manager().remove_link(link.get());
+
+    Bridge* bridge = find_bridge(*link);
+    if (link->established()) {
+        log_warn("Bridge " + link->name() + " closed");
+    }
+    if (bridge) {
+        bridge->link.reset();
+        redial_later(*bridge);
+    }
+}
+
+Stats Federation::stats() const {
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(links_mutex_);
+        stats.links = links_.size();
+    }
+    stats.forwarded = forwarded_.load(std::memory_order_relaxed);
+    stats.frames = frames_.load(std::memory_order_relaxed);
+    stats.received = received_.load(std::memory_order_relaxed);
+    stats.loops_dropped = loops_dropped_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+} // namespace federation
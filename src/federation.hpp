@@ -0,0 +1,197 @@
+#pragma once
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include "../include/topic_table.hpp"
+#include "broker_config.hpp"
+
+class BrokerServer;
+class Session;
+
+/**
+ * Broker federation: topics bridged between broker instances.
+ *
+ * A bridge ([bridge NAME] in the configuration, see broker_config.hpp) is a
+ * link this broker dials to another one. Both ends then behave the same:
+ * each tells the other which topics it wants, and forwards the messages of
+ * those topics over the link. A message crosses a link once, however many
+ * subscribers wait on the far side. Only topics matching the bridge's
+ * patterns are advertised or forwarded.
+ *
+ * A broker wants a topic on a link when it has a local subscriber or
+ * another link wants it. So interest flows down a fan-in tree. A dashboard
+ * on the central broker pulls a topic from every host, and a subscriber on
+ * one host pulls from the others through the centre.
+ *
+ * The link is an ordinary session carrying these lines:
+ *
+ *   dialler:  BRIDGE:HELLO:<broker id>:<bridge name>:<patterns>
+ *   accepter: OK:BRIDGE:<broker id>        (ERROR:BRIDGE_SELF to itself)
+ *   both:     BRIDGE:INTEREST:+<topic>     / BRIDGE:INTEREST:-<topic>
+ *   both:     FBATCH:<count>:<bytes>       followed by <bytes> of records:
+ *             uint64 origin broker id (little-endian), varint hops,
+ *             varint topic length, topic, varint payload length, payload
+ *
+ * Loops: a message keeps the id of the broker it was first published to. It
+ * never crosses a link towards that broker or back over the link it came in
+ * on. It is dropped when it reaches its origin or after MAX_HOPS links.
+ * Trees deliver every message exactly once. Redundant paths cannot loop
+ * forever, but they can deliver duplicates.
+ */
+namespace federation {
+
+constexpr std::string_view FRAME_PREFIX = "FBATCH:";
+constexpr size_t MAX_FRAME_BYTES = 4 << 20;
+constexpr uint32_t MAX_HOPS = 8;
+
+class Link;
+
+// Where a bridged message comes from (null for a local publish)
+struct Origin {
+    uint64_t broker = 0;        // Broker a client published it to
+    uint32_t hops = 0;          // Links crossed so far
+    const Link* via = nullptr;  // Link it arrived on
+};
+
+// Patterns: exact topic names, "prefix*" or "*"
+std::vector<std::string> parse_patterns(const std::string& list);
+bool matches(const std::vector<std::string>& patterns, std::string_view topic);
+
+// Parse an FBATCH header line; false if malformed or over the size limit
+bool parse_frame_header(const std::string& line, size_t& count, size_t& bytes);
+
+struct Stats {
+    size_t links = 0;           // Established
+    uint64_t forwarded = 0;     // Messages sent over links
+    uint64_t frames = 0;        // FBATCH frames sent
+    uint64_t received = 0;      // Messages published from links
+    uint64_t loops_dropped = 0; // Arrived back at their origin or ran out of hops
+};
+
+class Federation;
+
+// One bridge connection, at either end
+class Link : public std::enable_shared_from_this<Link> {
+public:
+    Link(Federation& federation, asio::io_context& io_context, const BridgeConfig& config, bool dialled);
+
+    const std::string& name() const { return config_.name; }
+    bool dialled() const { return dialled_; }
+    uint64_t remote_id() const { return remote_id_.load(std::memory_order_relaxed); }
+    bool established() const { return remote_id() != 0; }
+    const std::vector<std::string>& patterns() const { return patterns_; }
+
+    void attach(std::shared_ptr<Session> session);
+
+    // Queue a message the remote end asked for; sent in the next frame
+    void forward(std::string_view topic, std::string_view payload, const Origin* origin);
+
+    // A BRIDGE:/OK:BRIDGE/ERROR: line or FBATCH block from the remote end
+    void handle_line(const std::string& line);
+    bool handle_frame(std::string_view block, size_t count);
+
+    // Tell the remote end whether this broker now wants topic (only
+    // changes are sent)
+    void refresh_interest(TopicId topic);
+
+    // The session ended; drops queued messages
+    void close();
+    bool closed() const { return closed_.load(); }
+
+private:
+    friend class Federation;
+
+    void welcome(uint64_t remote_id);
+    void send(const std::string& line);
+    void flush_locked();
+
+    Federation& federation_;
+    BridgeConfig config_;
+    std::vector<std::string> patterns_;
+    bool dialled_;
+    std::atomic<uint64_t> remote_id_{0};
+    std::atomic<bool> closed_{false};
+    std::weak_ptr<Session> session_;
+
+    // Outgoing frame, filled by forward() on any thread
+    std::mutex batch_mutex_;
+    std::string batch_;
+    size_t batch_count_ = 0;
+    asio::steady_timer flush_timer_;
+    bool flush_armed_ = false;
+
+    std::mutex interest_mutex_;
+    std::unordered_set<TopicId> advertised_;  // Topics we told the remote end we want
+};
+
+// The broker's links and bridges
+class Federation {
+public:
+    Federation(BrokerServer& broker, asio::io_context& io_context);
+
+    // Random per process; carried by every message this broker originates
+    uint64_t id() const { return id_; }
+
+    // Dial a bridge once start() is called, and redial whenever it drops
+    bool add_bridge(const BridgeConfig& config, std::string& error);
+    void start();
+    void stop();
+
+    // BRIDGE:HELLO from a session; the link serving it, or null with the
+    // reply already sent
+    std::shared_ptr<Link> accept(std::shared_ptr<Session> session, const std::string& hello);
+
+    // Interest in topic may have changed (subscribers or link interest)
+    void interest_changed(TopicId topic);
+
+    // A link's session ended
+    void link_closed(const std::shared_ptr<Link>& link);
+
+    Stats stats() const;
+
+private:
+    friend class Link;
+
+    struct Bridge {
+        BridgeConfig config;
+        asio::steady_timer redial;
+        std::chrono::milliseconds backoff{100};
+        bool failing = false;   // Dial failures are logged once per outage
+        bool disabled = false;  // The remote end is this broker
+        std::shared_ptr<Link> link;
+
+        Bridge(asio::io_context& io_context, const BridgeConfig& bridge_config)
+            : config(bridge_config), redial(io_context) {}
+    };
+
+    void dial(Bridge& bridge);
+    void connected(Bridge& bridge, asio::generic::stream_protocol::socket socket);
+    void redial_later(Bridge& bridge);
+    void established(const std::shared_ptr<Link>& link);
+    void refused(const Link& link, const std::string& reason);
+    Bridge* find_bridge(const Link& link);
+
+    BrokerServer& broker_;
+    asio::io_context& io_context_;
+    uint64_t id_;
+    bool running_ = false;
+    std::vector<std::unique_ptr<Bridge>> bridges_;  // Changed before start() only
+
+    mutable std::mutex links_mutex_;
+    std::vector<std::shared_ptr<Link>> links_;  // Established
+
+    std::atomic<uint64_t> forwarded_{0};
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> received_{0};
+    std::atomic<uint64_t> loops_dropped_{0};
+};
+
+} // namespace federation
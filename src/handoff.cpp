@@ -0,0 +1,124 @@
+#include "handoff.hpp"
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace handoff {
+
+Channel::~Channel() {
+    for (int fd : fds_) {
+        ::close(fd);
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+Channel::Channel(Channel&& other) noexcept
+    : fd_(other.fd_), buffer_(std::move(other.buffer_)), fds_(std::move(other.fds_)) {
+    other.fd_ = -1;
+    other.fds_.clear();
+}
+
+Channel Channel::connect(const std::string& path, std::string& error) {
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        error = "hand-off socket path too long";
+        return Channel(-1);
+    }
+    std::memcpy(address.sun_path, path.data(), path.size());
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0) {
+        error = "cannot connect to " + path + ": " + std::strerror(errno);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return Channel(-1);
+    }
+    return Channel(fd);
+}
+
+bool Channel::send(const std::string& line, int fd) {
+    std::string data = line + "\n";
+    struct iovec iov = {data.data(), data.size()};
+    char control[CMSG_SPACE(sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    // A few short lines; the socket buffer takes them whole
+    return ::sendmsg(fd_, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+}
+
+bool Channel::receive(std::string& line, int timeout_ms) {
+    for (;;) {
+        size_t newline = buffer_.find('\n');
+        if (newline != std::string::npos) {
+            line.assign(buffer_, 0, newline);
+            buffer_.erase(0, newline + 1);
+            return true;
+        }
+        struct pollfd ready = {fd_, POLLIN, 0};
+        int polled = ::poll(&ready, 1, timeout_ms);
+        if (polled < 0 && errno == EINTR) {
+            continue;
+        }
+        if (polled <= 0) {
+            return false;
+        }
+
+        char data[4096];
+        struct iovec iov = {data, sizeof(data)};
+        char control[CMSG_SPACE(sizeof(int) * 16)];
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t received = ::recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < count; ++i) {
+                    int fd;
+                    std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                    fds_.push_back(fd);
+                }
+            }
+        }
+        buffer_.append(data, static_cast<size_t>(received));
+    }
+}
+
+int Channel::take_fd() {
+    if (fds_.empty()) {
+        return -1;
+    }
+    int fd = fds_.front();
+    fds_.pop_front();
+    return fd;
+}
+
+} // namespace handoff
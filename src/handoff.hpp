@@ -0,0 +1,63 @@
+#pragma once
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * Warm restart: a starting broker takes the listening sockets and topic
+ * data of the running one, so clients never see a refused connection and
+ * retained messages survive the deploy.
+ *
+ * The running broker (--handoff SOCKET) waits on a Unix socket. Its
+ * successor (--takeover SOCKET) connects, and they exchange lines:
+ *
+ *   successor:  HANDOFF
+ *   broker:     LISTENER <name>        one per listener, its socket attached
+ *                                      (SCM_RIGHTS); the broker stops accepting
+ *   broker:     SNAPSHOT <topics> <messages> <path>
+ *                                      topic data saved (see snapshot.hpp)
+ *           or  ERROR <reason>
+ *
+ * Connections that arrive in between wait in the shared listen backlog
+ * until the successor accepts them. The old broker then closes its
+ * sessions and exits; clients reconnect to the successor. Lines still in
+ * the sessions' write queues are dropped with them, not passed on: the
+ * topic data is, but subscribers miss what was queued for them.
+ *
+ * Only a peer of the broker's user (or root) gets past SO_PEERCRED, which
+ * is checked before anything is read; the socket is created mode 0600.
+ */
+namespace handoff {
+
+// One end of the hand-off socket
+class Channel {
+public:
+    explicit Channel(int fd) : fd_(fd) {}
+    ~Channel();
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    // Connect to a broker waiting at path; fd() is -1 and error set on failure
+    static Channel connect(const std::string& path, std::string& error);
+    Channel(Channel&& other) noexcept;
+
+    int fd() const { return fd_; }
+
+    // Send line (a '\n' is appended) with fd attached when fd >= 0
+    bool send(const std::string& line, int fd = -1);
+
+    // Next line without its '\n'; false on timeout, EOF or error
+    bool receive(std::string& line, int timeout_ms);
+
+    // Oldest descriptor received and not yet taken, -1 for none. One sent
+    // with a line has always arrived by the time receive() returns that line.
+    int take_fd();
+
+private:
+    int fd_;
+    std::string buffer_;
+    std::deque<int> fds_;  // Received, not yet claimed by a line
+};
+
+} // namespace handoff
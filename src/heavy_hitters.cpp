@@ -0,0 +1,281 @@
+#include "heavy_hitters.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// ============================================================================
+// DecayingSpaceSaving Implementation
+// ============================================================================
+
+DecayingSpaceSaving::DecayingSpaceSaving(size_t capacity)
+    : capacity_(capacity == 0 ? 1 : capacity) {
+    counters_.reserve(capacity_);
+    heap_.reserve(capacity_);
+    index_.reserve(capacity_);
+}
+
+void DecayingSpaceSaving::place(size_t position, size_t counter) {
+    heap_[position] = counter;
+    counters_[counter].heap_position = position;
+}
+
+void DecayingSpaceSaving::sift_up(size_t position) {
+    size_t counter = heap_[position];
+    double weight = counters_[counter].weight;
+    while (position > 0) {
+        size_t parent = (position - 1) / 2;
+        if (counters_[heap_[parent]].weight <= weight) {
+            break;
+        }
+        place(position, heap_[parent]);
+        position = parent;
+    }
+    place(position, counter);
+}
+
+void DecayingSpaceSaving::sift_down(size_t position) {
+    size_t counter = heap_[position];
+    double weight = counters_[counter].weight;
+    for (;;) {
+        size_t child = 2 * position + 1;
+        if (child >= heap_.size()) {
+            break;
+        }
+        if (child + 1 < heap_.size() && counters_[heap_[child + 1]].weight < counters_[heap_[child]].weight) {
+            ++child;
+        }
+        if (weight <= counters_[heap_[child]].weight) {
+            break;
+        }
+        place(position, heap_[child]);
+        position = child;
+    }
+    place(position, counter);
+}
+
+void DecayingSpaceSaving::add(std::string_view key, double scaled_weight) {
+    // Weights only grow, so an updated counter can only sink in the heap
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        Counter& counter = counters_[it->second];
+        counter.weight += scaled_weight;
+        sift_down(counter.heap_position);
+        return;
+    }
+
+    if (counters_.size() < capacity_) {
+        size_t index = counters_.size();
+        counters_.push_back({std::string(key), scaled_weight, 0.0, heap_.size()});
+        index_.emplace(counters_.back().key, index);
+        heap_.push_back(index);
+        sift_up(heap_.size() - 1);
+        return;
+    }
+
+    // Replace the lightest key; its weight becomes the newcomer's error bound.
+    // The counter's string and index node are reused for the new key.
+    size_t victim = heap_[0];
+    Counter& counter = counters_[victim];
+    auto node = index_.extract(counter.key);
+    counter.error = counter.weight;
+    counter.weight += scaled_weight;
+    counter.key.assign(key);
+    node.key() = counter.key;
+    index_.insert(std::move(node));
+    sift_down(0);
+}
+
+void DecayingSpaceSaving::rescale(double factor) {
+    for (auto& counter : counters_) {
+        counter.weight *= factor;
+        counter.error *= factor;
+    }
+}
+
+std::vector<DecayingSpaceSaving::Entry> DecayingSpaceSaving::top(size_t k, double current_scale) const {
+    std::vector<const Counter*> sorted;
+    sorted.reserve(counters_.size());
+    for (const auto& counter : counters_) {
+        sorted.push_back(&counter);
+    }
+    k = std::min(k, sorted.size());
+    std::partial_sort(sorted.begin(), sorted.begin() + k, sorted.end(),
+                      [](const Counter* a, const Counter* b) { return a->weight > b->weight; });
+
+    std::vector<Entry> result;
+    result.reserve(k);
+    for (size_t i = 0; i < k; ++i) {
+        result.push_back({sorted[i]->key, sorted[i]->weight / current_scale,
+                          sorted[i]->error / current_scale});
+    }
+    return result;
+}
+
+// ============================================================================
+// HeavyHitters Implementation
+// ============================================================================
+
+namespace {
+
+// Renormalize before e^x loses precision relative to fresh updates
+constexpr double MAX_DECAY_EXPONENT = 40.0;
+
+const char* const DIMENSION_NAMES[HeavyHitters::DIMENSION_COUNT] = {"topics", "clients", "services"};
+
+void write_json_string(std::ostream& out, std::string_view text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                << static_cast<int>(c) << std::dec << std::setfill(' ');
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+} // namespace
+
+HeavyHitters::HeavyHitters(size_t capacity, std::chrono::seconds window)
+    : capacity_(capacity),
+      tau_seconds_(static_cast<double>(std::max<int64_t>(window.count(), 1))),
+      landmark_(std::chrono::steady_clock::now()) {
+    sketches_.reserve(DIMENSION_COUNT * 2);
+    for (size_t i = 0; i < DIMENSION_COUNT * 2; ++i) {
+        sketches_.emplace_back(capacity);
+    }
+}
+
+std::string HeavyHitters::client_key(const void* address, size_t length, uint32_t connection_id) {
+    std::string key(1 + length + sizeof(connection_id), '\0');
+    std::memcpy(&key[1], address, length);
+    std::memcpy(&key[1 + length], &connection_id, sizeof(connection_id));
+    return key;
+}
+
+std::string HeavyHitters::client_label(std::string_view client) {
+    sockaddr_storage address;
+    uint32_t connection_id;
+    if (client.size() < 1 + sizeof(sa_family_t) + sizeof(connection_id) || client[0] != '\0' ||
+        client.size() - 1 - sizeof(connection_id) > sizeof(address)) {
+        return std::string(client);  // A name, not a client_key()
+    }
+    std::memset(&address, 0, sizeof(address));
+    std::memcpy(&address, client.data() + 1, client.size() - 1 - sizeof(connection_id));
+    std::memcpy(&connection_id, client.data() + client.size() - sizeof(connection_id), sizeof(connection_id));
+    // Built with append(): GCC 12 warns (-Wrestrict) on the operator+ chain
+    char text[INET6_ADDRSTRLEN];
+    std::string label;
+    if (address.ss_family == AF_INET) {
+        const auto* ipv4 = reinterpret_cast<const sockaddr_in*>(&address);
+        inet_ntop(AF_INET, &ipv4->sin_addr, text, sizeof(text));
+        label.reserve(INET_ADDRSTRLEN + 6);
+        label.append(text).append(1, ':').append(std::to_string(ntohs(ipv4->sin_port)));
+        return label;
+    }
+    if (address.ss_family == AF_INET6) {
+        const auto* ipv6 = reinterpret_cast<const sockaddr_in6*>(&address);
+        inet_ntop(AF_INET6, &ipv6->sin6_addr, text, sizeof(text));
+        label.reserve(INET6_ADDRSTRLEN + 8);
+        label.append(1, '[').append(text).append("]:").append(std::to_string(ntohs(ipv6->sin6_port)));
+        return label;
+    }
+    return "unix#" + std::to_string(connection_id);
+}
+
+double HeavyHitters::scale_at(std::chrono::steady_clock::time_point now) const {
+    double elapsed = std::chrono::duration<double>(now - landmark_).count();
+    return std::exp(elapsed / tau_seconds_);
+}
+
+std::string_view HeavyHitters::extract_service(std::string_view payload) {
+    // "[HH:MM:SS.mmm] [LEVEL] service: message"
+    if (payload.empty() || payload[0] != '[') {
+        return {};
+    }
+    size_t ts_end = payload.find("] [");
+    if (ts_end == std::string_view::npos) {
+        return {};
+    }
+    size_t level_end = payload.find("] ", ts_end + 3);
+    if (level_end == std::string_view::npos) {
+        return {};
+    }
+    size_t service_begin = level_end + 2;
+    size_t service_end = payload.find(": ", service_begin);
+    if (service_end == std::string_view::npos || service_end == service_begin) {
+        return {};
+    }
+    return payload.substr(service_begin, service_end - service_begin);
+}
+
+void HeavyHitters::record(std::string_view client, std::string_view topic, std::string_view payload) {
+    std::string_view service = extract_service(payload);
+    double bytes = static_cast<double>(topic.size() + payload.size());
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    double exponent = std::chrono::duration<double>(now - landmark_).count() / tau_seconds_;
+    if (exponent > MAX_DECAY_EXPONENT) {
+        double factor = std::exp(-exponent);
+        for (auto& sketch : sketches_) {
+            sketch.rescale(factor);
+        }
+        landmark_ = now;
+        exponent = 0.0;
+    }
+    double scale = std::exp(exponent);
+
+    std::string_view keys[DIMENSION_COUNT] = {topic, client, service};
+    for (size_t dim = 0; dim < DIMENSION_COUNT; ++dim) {
+        if (keys[dim].empty()) {
+            continue;
+        }
+        sketches_[dim * 2].add(keys[dim], scale);
+        sketches_[dim * 2 + 1].add(keys[dim], bytes * scale);
+    }
+}
+
+std::vector<DecayingSpaceSaving::Entry> HeavyHitters::top(Dimension dimension, bool by_bytes, size_t k) const {
+    std::vector<DecayingSpaceSaving::Entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries = sketches_[dimension * 2 + (by_bytes ? 1 : 0)].top(k, scale_at(std::chrono::steady_clock::now()));
+    }
+    if (dimension == CLIENTS) {
+        for (auto& entry : entries) {
+            entry.key = client_label(entry.key);
+        }
+    }
+    return entries;
+}
+
+std::string HeavyHitters::top_json(size_t k) const {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << "{\"window_s\":" << static_cast<int64_t>(tau_seconds_);
+    for (size_t dim = 0; dim < DIMENSION_COUNT; ++dim) {
+        out << ",\"" << DIMENSION_NAMES[dim] << "\":{";
+        for (int by_bytes = 0; by_bytes < 2; ++by_bytes) {
+            out << (by_bytes ? ",\"bytes\":[" : "\"messages\":[");
+            auto entries = top(static_cast<Dimension>(dim), by_bytes != 0, k);
+            for (size_t i = 0; i < entries.size(); ++i) {
+                out << (i ? "," : "") << "{\"key\":";
+                write_json_string(out, entries[i].key);
+                out << ",\"count\":" << entries[i].weight << ",\"error\":" << entries[i].error << '}';
+            }
+            out << ']';
+        }
+        out << '}';
+    }
+    out << '}';
+    return out.str();
+}
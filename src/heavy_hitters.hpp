@@ -0,0 +1,116 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Space-Saving heavy-hitter sketch with exponential time decay.
+ *
+ * Tracks at most `capacity` keys. A key that is not tracked replaces the
+ * current minimum and inherits its weight as overestimation error, so every
+ * key heavier than total/capacity is guaranteed to be present.
+ *
+ * Decay uses forward decay: an update at time t is stored with weight
+ * w * e^((t - landmark) / tau), and reads divide by e^((now - landmark) / tau).
+ * Relative order never changes as time passes, so nothing needs to be
+ * touched per tick; weights are renormalized when the exponent grows large.
+ *
+ * Counters sit in a min-heap by weight, so finding the minimum is O(1) and
+ * an update O(log capacity). (Stream-summary buckets only pay off for unit
+ * increments; decayed and byte weights make every counter's value unique.)
+ * An evicted counter keeps its key's storage and index node for the
+ * newcomer, so a full sketch adds without allocating unless a key outgrows
+ * the one it replaces.
+ */
+class DecayingSpaceSaving {
+public:
+    struct Entry {
+        std::string key;
+        double weight;  // Decayed weight as of the query time
+        double error;   // Upper bound of the overestimation
+    };
+
+    explicit DecayingSpaceSaving(size_t capacity);
+    
+    // The index views the counters' keys, so a sketch can move but not copy
+    DecayingSpaceSaving(const DecayingSpaceSaving&) = delete;
+    DecayingSpaceSaving& operator=(const DecayingSpaceSaving&) = delete;
+    DecayingSpaceSaving(DecayingSpaceSaving&&) = default;
+    DecayingSpaceSaving& operator=(DecayingSpaceSaving&&) = default;
+
+    // Add weight (already scaled by the caller's forward-decay factor)
+    void add(std::string_view key, double scaled_weight);
+
+    // Multiply every stored weight (renormalization)
+    void rescale(double factor);
+
+    // Top-k entries, heaviest first, divided by the current decay scale
+    std::vector<Entry> top(size_t k, double current_scale) const;
+
+    size_t size() const { return counters_.size(); }
+
+private:
+    struct Counter {
+        std::string key;
+        double weight;
+        double error;
+        size_t heap_position;
+    };
+
+    // Restore heap order after counter at position got lighter or heavier
+    void sift_up(size_t position);
+    void sift_down(size_t position);
+    void place(size_t position, size_t counter);
+
+    size_t capacity_;
+    std::vector<Counter> counters_;  // Reserved up front, never reallocated
+    std::vector<size_t> heap_;       // Counter indices, lightest first
+    std::unordered_map<std::string_view, size_t> index_;  // Views counters_[i].key
+};
+
+/**
+ * Heavy hitters over publishing traffic: topics, publishing clients and
+ * DebugLogger service names, each ranked by messages and by bytes.
+ * Bounded memory, constant cost per message (one short critical section).
+ */
+class HeavyHitters {
+public:
+    enum Dimension { TOPICS = 0, CLIENTS = 1, SERVICES = 2, DIMENSION_COUNT = 3 };
+
+    explicit HeavyHitters(size_t capacity = 64,
+                          std::chrono::seconds window = std::chrono::seconds(60));
+
+    // Account one published message; client is a name or a client_key()
+    void record(std::string_view client, std::string_view topic, std::string_view payload);
+    
+    // Key of a connected producer, built once per connection without
+    // formatting its address: a 0 byte, the raw sockaddr and the connection
+    // id (Unix socket peers are unnamed). Reports show it as "ip:port" or
+    // "unix#<id>", like Session::get_client_id().
+    static std::string client_key(const void* address, size_t length, uint32_t connection_id);
+    static std::string client_label(std::string_view client);
+
+    std::vector<DecayingSpaceSaving::Entry> top(Dimension dimension, bool by_bytes, size_t k) const;
+
+    // Single-line JSON report used by the TOP command
+    std::string top_json(size_t k) const;
+
+    size_t capacity() const { return capacity_; }
+
+    // Service name from a DebugLogger line "[ts] [LEVEL] service: message"
+    static std::string_view extract_service(std::string_view payload);
+
+private:
+    double scale_at(std::chrono::steady_clock::time_point now) const;
+
+    size_t capacity_;
+    double tau_seconds_;
+    std::chrono::steady_clock::time_point landmark_;
+    std::vector<DecayingSpaceSaving> sketches_;  // [dimension * 2 + by_bytes]
+    mutable std::mutex mutex_;
+};
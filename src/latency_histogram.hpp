@@ -0,0 +1,98 @@
+#pragma once
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <sstream>
+#include <iomanip>
+
+// Log-linear latency histogram (HDR-style) with constant memory.
+// Values below 32ns are exact; above that every power of two is split into
+// 16 sub-buckets, so reported percentiles are within ~6% of the true value.
+class LatencyHistogram {
+public:
+    static constexpr size_t SUB_BUCKETS = 16;
+    static constexpr size_t BUCKET_COUNT = 64 * SUB_BUCKETS;
+
+    void record(uint64_t value) {
+        buckets_[bucket_index(value)]++;
+        count_++;
+        sum_ += value;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            buckets_[i] += other.buckets_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    void reset() { *this = LatencyHistogram(); }
+
+    uint64_t count() const { return count_; }
+    uint64_t min() const { return count_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const { return count_ ? static_cast<double>(sum_) / count_ : 0.0; }
+
+    // Value at percentile p (0-100), clamped to the observed range
+    uint64_t percentile(double p) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(count_) + 0.5);
+        rank = std::clamp<uint64_t>(rank, 1, count_);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += buckets_[i];
+            if (seen >= rank) {
+                return std::clamp(bucket_value(i), min(), max_);
+            }
+        }
+        return max_;
+    }
+
+    // One-line summary, values converted from ns to microseconds
+    std::string summary() const {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1)
+            << "n=" << count_
+            << " p50=" << percentile(50) / 1000.0 << "us"
+            << " p99=" << percentile(99) / 1000.0 << "us"
+            << " p99.9=" << percentile(99.9) / 1000.0 << "us"
+            << " max=" << max_ / 1000.0 << "us";
+        return oss.str();
+    }
+
+private:
+    static size_t bucket_index(uint64_t value) {
+        if (value < 2 * SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(value));
+        unsigned shift = msb - 4;
+        return (msb - 3) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    // Midpoint of the bucket's value range
+    static uint64_t bucket_value(size_t index) {
+        if (index < 2 * SUB_BUCKETS) {
+            return index;
+        }
+        unsigned msb = static_cast<unsigned>(index / SUB_BUCKETS) + 3;
+        unsigned shift = msb - 4;
+        uint64_t low = (uint64_t(1) << msb) | (uint64_t(index % SUB_BUCKETS) << shift);
+        return low + ((uint64_t(1) << shift) >> 1);
+    }
+
+    std::array<uint64_t, BUCKET_COUNT> buckets_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+};
@@ -1,5 +1,6 @@
 #define ASIO_STANDALONE
 #include <asio.hpp>
+#include "stream_transport.hpp"
 #include <iostream>
 #include <string>
 #include <memory>
@@ -12,16 +13,14 @@ public:
                    const std::string& host, 
                    const std::string& port)
         : socket_(io_context),
-          resolver_(io_context),
           host_(host),
           port_(port) {
     }
     
     void connect() {
         try {
-            auto endpoints = resolver_.resolve(host_, port_);
-            asio::connect(socket_, endpoints);
-            std::cout << "✓ Connected to broker at " << host_ << ":" << port_ << std::endl;
+            connect_stream(socket_, host_, port_);
+            std::cout << "✓ Connected to broker at " << transport::describe(host_, port_) << std::endl;
         } catch (std::exception& e) {
             throw std::runtime_error("Connection failed: " + std::string(e.what()));
         }
@@ -77,8 +76,7 @@ public:
     }
     
 private:
-    asio::ip::tcp::socket socket_;
-    asio::ip::tcp::resolver resolver_;
+    StreamSocket socket_;
     std::string host_;
     std::string port_;
 };
@@ -108,7 +106,7 @@ int main(int argc, char* argv[]) {
     std::cout << "\n========================================" << std::endl;
     std::cout << "=== NeuroPipe Producer Client (Asio) ===" << std::endl;
     std::cout << "========================================" << std::endl;
-    std::cout << "Target: " << host << ":" << port << std::endl;
+    std::cout << "Target: " << transport::describe(host, port) << std::endl;
     std::cout << "========================================\n" << std::endl;
     
     try {
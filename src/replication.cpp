@@ -0,0 +1,724 @@
+#include "replication.hpp"
+#include "asio_server.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <charconv>
+#include <random>
+
+namespace replication {
+
+namespace {
+
+void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(static_cast<uint8_t>(value) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool get_varint(std::string_view& in, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(in.front());
+        in.remove_prefix(1);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool get_bytes(std::string_view& in, std::string_view& out) {
+    uint64_t length;
+    if (!get_varint(in, length) || length > in.size()) {
+        return false;
+    }
+    out = in.substr(0, length);
+    in.remove_prefix(length);
+    return true;
+}
+
+bool parse_u64(std::string_view digits, uint64_t& value) {
+    const char* end = digits.data() + digits.size();
+    auto result = std::from_chars(digits.data(), end, value);
+    return !digits.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+// Colon-separated fields after prefix
+std::vector<std::string_view> fields(const std::string& line, size_t prefix) {
+    std::vector<std::string_view> parts;
+    std::string_view rest = std::string_view(line).substr(prefix);
+    for (;;) {
+        size_t colon = rest.find(':');
+        parts.push_back(rest.substr(0, colon));
+        if (colon == std::string_view::npos) {
+            return parts;
+        }
+        rest.remove_prefix(colon + 1);
+    }
+}
+
+std::string frame(size_t count, const std::string& records, uint64_t end) {
+    std::string out;
+    out.reserve(FRAME_PREFIX.size() + 48 + records.size());
+    out.append(FRAME_PREFIX)
+       .append(std::to_string(count)).append(1, ':')
+       .append(std::to_string(records.size())).append(1, ':')
+       .append(std::to_string(end)).append(1, '\n')
+       .append(records);
+    return out;
+}
+
+uint64_t random_id() {
+    std::random_device random;
+    uint64_t id;
+    do {
+        id = (static_cast<uint64_t>(random()) << 32) | random();
+    } while (id == 0);
+    return id;
+}
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+constexpr std::string_view REPLICATE = "REPLICATE:";
+constexpr std::string_view RESUME = "OK:REPLICATE:";
+constexpr std::string_view RESET = "RRESET:";
+constexpr std::chrono::milliseconds MAX_BACKOFF{5000};
+
+} // namespace
+
+bool parse_frame_header(const std::string& line, size_t& count, size_t& bytes, uint64_t& end) {
+    if (line.compare(0, FRAME_PREFIX.size(), FRAME_PREFIX) != 0) {
+        return false;
+    }
+    std::vector<std::string_view> parts = fields(line, FRAME_PREFIX.size());
+    uint64_t parsed_count, parsed_bytes;
+    if (parts.size() != 3 || !parse_u64(parts[0], parsed_count) || !parse_u64(parts[1], parsed_bytes) ||
+        !parse_u64(parts[2], end) || parsed_bytes > MAX_FRAME_BYTES || parsed_count > parsed_bytes) {
+        return false;
+    }
+    count = static_cast<size_t>(parsed_count);
+    bytes = static_cast<size_t>(parsed_bytes);
+    return true;
+}
+
+bool parse_request(const std::string& line, uint64_t& history, uint64_t& offset, std::string& name) {
+    // REPLICATE:<history>:<offset>:<name>
+    if (line.compare(0, REPLICATE.size(), REPLICATE) != 0) {
+        return false;
+    }
+    std::vector<std::string_view> parts = fields(line, REPLICATE.size());
+    if (parts.size() != 3 || !parse_u64(parts[0], history) || !parse_u64(parts[1], offset) || parts[2].empty()) {
+        return false;
+    }
+    name = parts[2];
+    return true;
+}
+
+void encode(std::string& out, const Message& msg) {
+    put_varint(out, msg.sequence);
+    put_varint(out, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        msg.timestamp.time_since_epoch()).count()));
+    const std::string& topic = msg.topic_name();
+    put_varint(out, topic.size());
+    out.append(topic);
+    std::string_view payload = msg.payload.view();
+    put_varint(out, payload.size());
+    out.append(payload);
+}
+
+// ============================================================================
+// Log
+// ============================================================================
+
+void Log::set_max_bytes(size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_bytes_ = max_bytes;
+}
+
+void Log::reset(uint64_t offset) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.clear();
+    bytes_ = 0;
+    start_ = offset;
+}
+
+void Log::append(const Message& msg) {
+    std::string record;
+    encode(record, msg);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (msg.sequence != start_ + records_.size()) {
+        records_.clear();
+        bytes_ = 0;
+        start_ = msg.sequence;
+    }
+    bytes_ += record.size();
+    records_.push_back(std::move(record));
+    while (bytes_ > max_bytes_ && records_.size() > 1) {
+        bytes_ -= records_.front().size();
+        records_.pop_front();
+        ++start_;
+    }
+}
+
+uint64_t Log::head() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return start_ + records_.size();
+}
+
+bool Log::holds(uint64_t offset) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return offset >= start_ && offset <= start_ + records_.size();
+}
+
+bool Log::read(uint64_t offset, size_t max_bytes, std::string& records, size_t& count, uint64_t& end) const {
+    records.clear();
+    count = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (offset < start_ || offset > start_ + records_.size()) {
+        return false;
+    }
+    for (size_t i = offset - start_; i < records_.size(); ++i) {
+        if (count > 0 && records.size() + records_[i].size() > max_bytes) {
+            break;
+        }
+        records.append(records_[i]);
+        ++count;
+    }
+    end = offset + count;
+    return true;
+}
+
+// ============================================================================
+// Feed
+// ============================================================================
+
+Feed::Feed(Replication& replication, std::shared_ptr<Session> session, std::string name)
+    : replication_(replication), session_(session), name_(std::move(name)) {}
+
+bool Feed::send_frame(const std::string& frame) {
+    auto session = session_.lock();
+    if (!session) {
+        return false;
+    }
+    session->deliver(frame);
+    return true;
+}
+
+void Feed::pump() {
+    const ReplicationConfig& config = replication_.config_;
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Message> messages;
+    std::string records;
+    while (!closed_ && in_flight_.size() < config.window_frames) {
+        std::string next;
+        if (copying_) {
+            // Copies of one frame's messages under the topic lock, encoded
+            // outside it
+            messages.clear();
+            records.clear();
+            copying_ = replication_.broker_.get_topic_manager().copy_messages(
+                copy_topic_, copy_sequence_, copy_end_, config.batch_bytes, messages);
+            for (const Message& msg : messages) {
+                encode(records, msg);
+            }
+            next = frame(messages.size(), records, copying_ ? 0 : copy_end_);
+        } else {
+            size_t count;
+            uint64_t end;
+            if (!replication_.log_.read(sent_, config.batch_bytes, records, count, end)) {
+                // Frames already in flight would confuse a copy started on
+                // this stream; the follower reconnects and is copied afresh
+                log_warn("Follower " + name_ + " fell behind the replication log, disconnecting it");
+                closed_ = true;
+                if (auto session = session_.lock()) {
+                    session->close();
+                }
+                return;
+            }
+            if (count == 0) {
+                break;
+            }
+            next = frame(count, records, end);
+            sent_ = end;
+        }
+        in_flight_.push_back(std::chrono::steady_clock::now());
+        if (!send_frame(next)) {
+            closed_ = true;
+        }
+    }
+}
+
+void Feed::acknowledge(uint64_t end) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!in_flight_.empty()) {
+            ack_latency_us_ = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - in_flight_.front()).count();
+            in_flight_.pop_front();
+        }
+        if (end > acked_.load()) {
+            acked_ = end;
+        }
+    }
+    replication_.acknowledged();
+    pump();
+}
+
+// ============================================================================
+// Replication
+// ============================================================================
+
+Replication::Replication(BrokerServer& broker, asio::io_context& io_context)
+    : broker_(broker),
+      io_context_(io_context),
+      log_(config_.log_bytes),
+      history_(random_id()),
+      ack_timer_(io_context),
+      redial_(io_context) {}
+
+void Replication::configure(const ReplicationConfig& config) {
+    config_ = config;
+    log_.set_max_bytes(config.log_bytes);
+    leader_ = config.leader;
+    if (!leader_.empty()) {
+        following_ = true;
+        logging_ = true;  // Ready to lead after a promotion
+    }
+}
+
+void Replication::start() {
+    running_ = true;
+    if (following_) {
+        dial();
+    }
+}
+
+void Replication::stop() {
+    running_ = false;
+    redial_.cancel();
+    std::vector<std::shared_ptr<Feed>> feeds;
+    {
+        std::lock_guard<std::mutex> lock(feeds_mutex_);
+        feeds.swap(feeds_);
+        feed_count_ = 0;
+    }
+    for (auto& feed : feeds) {
+        std::lock_guard<std::mutex> lock(feed->mutex_);
+        feed->closed_ = true;
+    }
+    std::lock_guard<std::mutex> lock(waiters_mutex_);
+    waiters_.clear();  // Their sessions are closing too
+    ack_timer_.cancel();
+}
+
+bool Replication::follow(const std::string& leader, std::string& error) {
+    ListenAddress address;
+    if (!ListenAddress::parse(leader, address, error)) {
+        return false;
+    }
+    if (auto upstream = upstream_.lock()) {
+        upstream->close();
+    }
+    upstream_.reset();
+    redial_.cancel();
+    backoff_ = std::chrono::milliseconds(100);
+    failing_ = false;
+    connected_ = false;
+    {
+        std::lock_guard<std::mutex> lock(history_mutex_);
+        leader_ = leader;
+    }
+    logging_ = true;
+    following_ = true;
+    log_info("Following " + leader);
+    if (running_) {
+        dial();
+    }
+    return true;
+}
+
+bool Replication::promote(std::string& error) {
+    if (!following_) {
+        error = "not following";
+        return false;
+    }
+    if (copying_) {
+        error = "a full copy from the leader is in progress";
+        return false;
+    }
+    following_ = false;
+    connected_ = false;
+    redial_.cancel();
+    if (auto upstream = upstream_.lock()) {
+        upstream->close();
+    }
+    upstream_.reset();
+
+    uint64_t offset = broker_.get_topic_manager().get_next_sequence();
+    if (log_.head() != offset) {
+        log_.reset(offset);
+    }
+    {
+        std::lock_guard<std::mutex> lock(history_mutex_);
+        parent_history_ = history_;
+        fork_offset_ = offset;
+        history_ = random_id();
+    }
+    log_info("Promoted to leader at offset " + std::to_string(offset) + " (was following " + leader_ + ")");
+    return true;
+}
+
+uint64_t Replication::history() const {
+    std::lock_guard<std::mutex> lock(history_mutex_);
+    return history_;
+}
+
+std::shared_ptr<Feed> Replication::attach(std::shared_ptr<Session> session, const std::string& request) {
+    uint64_t history, offset;
+    std::string name;
+    if (!parse_request(request, history, offset, name)) {
+        session->deliver("ERROR:INVALID_FORMAT\n");
+        return nullptr;
+    }
+    auto feed = std::make_shared<Feed>(*this, session, name + "@" + session->get_client_id());
+    bool resume;
+    uint64_t current;
+    {
+        std::lock_guard<std::mutex> lock(history_mutex_);
+        current = history_;
+        resume = (history == history_ || (parent_history_ != 0 && history == parent_history_ &&
+                                          offset <= fork_offset_)) &&
+                 logging_ && !copying_ && log_.holds(offset);
+    }
+    if (resume) {
+        feed->sent_ = offset;
+        feed->acked_ = offset;
+        session->deliver(std::string(RESUME) + std::to_string(current) + ":" + std::to_string(offset) + "\n");
+        log_info("Follower " + feed->name() + " resumes from offset " + std::to_string(offset));
+    } else {
+        start_copy(*feed);
+    }
+    {
+        std::lock_guard<std::mutex> lock(feeds_mutex_);
+        feeds_.push_back(feed);
+        feed_count_ = feeds_.size();
+    }
+    feed->pump();
+    return feed;
+}
+
+void Replication::start_copy(Feed& feed) {
+    // The copy holds the messages below head; the log goes on from head,
+    // so nothing published meanwhile is missed
+    full_copies_.fetch_add(1, std::memory_order_relaxed);
+    uint64_t head = 0;
+    broker_.get_topic_manager().at_next_sequence([&](uint64_t next) {
+        head = next;
+        if (!logging_) {
+            log_.reset(next);
+            logging_ = true;
+        }
+    });
+
+    std::lock_guard<std::mutex> lock(feed.mutex_);
+    feed.copying_ = true;
+    feed.copy_topic_ = 0;
+    feed.copy_sequence_ = 0;
+    feed.copy_end_ = head;
+    feed.sent_ = head;
+    feed.acked_ = 0;
+    if (auto session = feed.session_.lock()) {
+        session->deliver(std::string(RESET) + std::to_string(history()) + ":" + std::to_string(head) + "\n");
+    }
+    log_info("Follower " + feed.name() + " gets a full copy up to offset " + std::to_string(head));
+}
+
+void Replication::detach(const std::shared_ptr<Feed>& feed) {
+    {
+        std::lock_guard<std::mutex> lock(feed->mutex_);
+        feed->closed_ = true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(feeds_mutex_);
+        feeds_.erase(std::remove(feeds_.begin(), feeds_.end(), feed), feeds_.end());
+        feed_count_ = feeds_.size();
+    }
+    log_info("Follower " + feed->name() + " left at offset " + std::to_string(feed->acked()));
+}
+
+void Replication::appended(const Message& msg) {
+    if (!logging_ || copying_) {
+        return;
+    }
+    log_.append(msg);
+    if (feed_count_ > 0) {
+        schedule_pump();
+    }
+}
+
+void Replication::schedule_pump() {
+    // Publishes until the post runs share the frames it sends
+    if (pump_scheduled_.exchange(true)) {
+        return;
+    }
+    asio::post(io_context_, [this]() {
+        pump_scheduled_ = false;
+        std::vector<std::shared_ptr<Feed>> feeds;
+        {
+            std::lock_guard<std::mutex> lock(feeds_mutex_);
+            feeds = feeds_;
+        }
+        for (auto& feed : feeds) {
+            feed->pump();
+        }
+    });
+}
+
+void Replication::when_replicated(uint64_t sequence, std::function<void(bool)> done) {
+    {
+        std::lock_guard<std::mutex> lock(waiters_mutex_);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.ack_timeout_ms);
+        waiters_.emplace(sequence + 1, Waiter{deadline, std::move(done)});
+        if (!ack_timer_armed_) {
+            ack_timer_armed_ = true;
+            ack_timer_.expires_at(deadline);
+            ack_timer_.async_wait([this](std::error_code ec) {
+                if (!ec) {
+                    expire_waiters();
+                }
+            });
+        }
+    }
+    acknowledged();
+}
+
+void Replication::acknowledged() {
+    if (config_.acks == 0) {
+        return;
+    }
+    // The offset at least `acks` followers have reached
+    std::vector<uint64_t> acked;
+    {
+        std::lock_guard<std::mutex> lock(feeds_mutex_);
+        for (const auto& feed : feeds_) {
+            acked.push_back(feed->acked());
+        }
+    }
+    if (acked.size() < config_.acks) {
+        return;
+    }
+    std::nth_element(acked.begin(), acked.begin() + (config_.acks - 1), acked.end(), std::greater<uint64_t>());
+    uint64_t quorum = acked[config_.acks - 1];
+
+    std::vector<Waiter> satisfied;
+    {
+        std::lock_guard<std::mutex> lock(waiters_mutex_);
+        auto end = waiters_.upper_bound(quorum);
+        for (auto it = waiters_.begin(); it != end; ++it) {
+            satisfied.push_back(std::move(it->second));
+        }
+        waiters_.erase(waiters_.begin(), end);
+    }
+    for (auto& waiter : satisfied) {
+        waiter.done(true);
+    }
+}
+
+void Replication::expire_waiters() {
+    std::vector<Waiter> expired;
+    {
+        std::lock_guard<std::mutex> lock(waiters_mutex_);
+        ack_timer_armed_ = false;
+        auto now = std::chrono::steady_clock::now();
+        auto next = std::chrono::steady_clock::time_point::max();
+        for (auto it = waiters_.begin(); it != waiters_.end();) {
+            if (it->second.deadline <= now) {
+                expired.push_back(std::move(it->second));
+                it = waiters_.erase(it);
+            } else {
+                next = std::min(next, it->second.deadline);
+                ++it;
+            }
+        }
+        if (!waiters_.empty() && running_) {
+            ack_timer_armed_ = true;
+            ack_timer_.expires_at(next);
+            ack_timer_.async_wait([this](std::error_code ec) {
+                if (!ec) {
+                    expire_waiters();
+                }
+            });
+        }
+    }
+    acks_timed_out_.fetch_add(expired.size(), std::memory_order_relaxed);
+    for (auto& waiter : expired) {
+        waiter.done(false);
+    }
+}
+
+void Replication::dial() {
+    std::string leader = leader_;
+    broker_.connect(leader, [this, leader](std::error_code ec, Session::Socket socket) {
+        if (!running_ || !following_ || leader != leader_) {
+            return;  // Stopped, promoted or pointed elsewhere meanwhile
+        }
+        if (ec) {
+            if (!failing_) {
+                failing_ = true;
+                log_warn("Cannot reach leader " + leader + ": " + ec.message() + " (retrying)");
+            }
+            redial_later();
+            return;
+        }
+        failing_ = false;
+        auto session = broker_.add_session(std::move(socket), nullptr,
+                                           [](const std::shared_ptr<Session>& upstream) { upstream->set_upstream(); });
+        upstream_ = session;
+        session->deliver(std::string(REPLICATE) + std::to_string(history()) + ":" +
+                         std::to_string(broker_.get_topic_manager().get_next_sequence()) + ":" + config_.name + "\n");
+        session->deliver("HEARTBEAT:ON\n");  // Notice a dead leader without waiting for TCP
+    });
+}
+
+void Replication::redial_later() {
+    if (!running_ || !following_) {
+        return;
+    }
+    redial_.expires_after(backoff_);
+    backoff_ = std::min(backoff_ * 2, MAX_BACKOFF);
+    redial_.async_wait([this](std::error_code ec) {
+        if (!ec && running_ && following_) {
+            dial();
+        }
+    });
+}
+
+void Replication::upstream_closed(const std::shared_ptr<Session>& session) {
+    if (upstream_.lock() != session) {
+        return;
+    }
+    upstream_.reset();
+    if (connected_.exchange(false)) {
+        log_warn("Lost leader " + leader_ + " at offset " +
+                 std::to_string(broker_.get_topic_manager().get_next_sequence()));
+    }
+    redial_later();
+}
+
+void Replication::handle_line(const std::string& line) {
+    if (line.compare(0, RESUME.size(), RESUME) == 0 || line.compare(0, RESET.size(), RESET) == 0) {
+        bool reset = line[0] == 'R';
+        std::vector<std::string_view> parts = fields(line, reset ? RESET.size() : RESUME.size());
+        uint64_t history, offset;
+        if (parts.size() != 2 || !parse_u64(parts[0], history) || !parse_u64(parts[1], offset)) {
+            log_warn("Malformed line from leader " + leader_ + ": " + line);
+            return;
+        }
+        connected_ = true;
+        backoff_ = std::chrono::milliseconds(100);
+        if (reset) {
+            // Until the copy is complete this broker has no history a
+            // reconnect could resume
+            {
+                std::lock_guard<std::mutex> lock(history_mutex_);
+                history_ = 0;
+                parent_history_ = 0;
+            }
+            copy_history_ = history;
+            copy_end_ = offset;
+            copying_ = true;
+            broker_.get_topic_manager().clear_messages();
+            log_info("Full copy from leader " + leader_ + " up to offset " + std::to_string(offset));
+        } else {
+            {
+                std::lock_guard<std::mutex> lock(history_mutex_);
+                history_ = history;
+                parent_history_ = 0;
+            }
+            if (log_.head() != offset) {
+                log_.reset(offset);
+            }
+            log_info("Following " + leader_ + " from offset " + std::to_string(offset));
+        }
+    } else if (line.compare(0, 6, "ERROR:") == 0) {
+        log_warn("Leader " + leader_ + " replied " + line);
+    }
+}
+
+bool Replication::handle_frame(std::string_view block, size_t count, uint64_t end) {
+    TopicManager& topics = broker_.get_topic_manager();
+    std::string payload;
+    uint64_t timestamp_ns = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t sequence;
+        std::string_view topic;
+        std::string_view body;
+        if (!get_varint(block, sequence) || !get_varint(block, timestamp_ns) || !get_bytes(block, topic) ||
+            !get_bytes(block, body) || topic.empty()) {
+            return false;
+        }
+        payload.assign(body);
+        topics.apply(topic, payload, sequence, std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(timestamp_ns))));
+    }
+    if (!block.empty()) {
+        return false;
+    }
+    if (end != 0) {
+        topics.advance_sequence(end);
+        if (copying_ && end >= copy_end_) {
+            // The copy is complete: this broker now holds the leader's
+            // history up to end
+            log_.reset(end);
+            {
+                std::lock_guard<std::mutex> lock(history_mutex_);
+                history_ = copy_history_;
+            }
+            copying_ = false;
+        }
+    }
+    applied_.fetch_add(count, std::memory_order_relaxed);
+    if (count > 0) {
+        apply_lag_us_ = (now_ns() - static_cast<int64_t>(timestamp_ns)) / 1000;
+    }
+    if (auto upstream = upstream_.lock()) {
+        upstream->deliver("RACK:" + std::to_string(end) + "\n");
+    }
+    return true;
+}
+
+Stats Replication::stats() const {
+    Stats stats;
+    stats.following = following_;
+    stats.history = history();
+    stats.offset = broker_.get_topic_manager().get_next_sequence();
+    {
+        std::lock_guard<std::mutex> lock(feeds_mutex_);
+        for (const auto& feed : feeds_) {
+            FollowerStats follower;
+            follower.name = feed->name();
+            follower.acked = feed->acked();
+            follower.lag = stats.offset > follower.acked ? stats.offset - follower.acked : 0;
+            follower.ack_latency_us = feed->ack_latency_us_.load(std::memory_order_relaxed);
+            stats.followers.push_back(follower);
+        }
+    }
+    stats.full_copies = full_copies_.load(std::memory_order_relaxed);
+    stats.acks_timed_out = acks_timed_out_.load(std::memory_order_relaxed);
+    if (stats.following) {
+        std::lock_guard<std::mutex> lock(history_mutex_);
+        stats.leader = leader_;
+        stats.connected = connected_;
+        stats.applied = applied_.load(std::memory_order_relaxed);
+        stats.apply_lag_us = apply_lag_us_.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+} // namespace replication
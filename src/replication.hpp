@@ -0,0 +1,274 @@
+#pragma once
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../include/message.hpp"
+#include "broker_config.hpp"
+
+class BrokerServer;
+class Session;
+
+/**
+ * Leader/follower replication of topic data.
+ *
+ * Offsets are message sequence numbers: a broker at offset N holds every
+ * message below N. A follower (--follow LEADER) connects to its leader like
+ * a client and asks for the messages from its offset on:
+ *
+ *   follower: REPLICATE:<history>:<offset>:<name>
+ *   leader:   OK:REPLICATE:<history>:<offset>   resume from that offset, or
+ *             RRESET:<history>:<offset>         a full copy up to offset follows
+ *   leader:   RBATCH:<count>:<bytes>:<end>      followed by <bytes> of records:
+ *             varint sequence, varint timestamp (ns since the epoch),
+ *             varint topic length, topic, varint payload length, payload
+ *   follower: RACK:<end>                        one per frame, once applied
+ *
+ * A frame takes the follower to offset <end> (0 inside a full copy). The
+ * leader keeps up to window_frames frames in flight to each follower, so
+ * the stream does not wait for acknowledgements.
+ *
+ * The leader keeps its most recent messages in a Log (log_bytes). A
+ * follower that reconnects resumes from its offset while the log still
+ * holds it. Otherwise it gets a full copy of every queued message, read a
+ * frame at a time as the window allows, so publishes wait for the topic
+ * lock no longer than one frame's worth of copying. A follower that falls
+ * out of the log mid-stream is disconnected; it reconnects and is copied.
+ *
+ * Only listeners with replication = true accept REPLICATE, and
+ * REPLICATION:PROMOTE and REPLICATION:FOLLOW come only from local peers
+ * (a Unix socket of the broker's own user), since either one can replace
+ * the broker's topic data or hand it out.
+ *
+ * A history id names the sequence of messages the offsets count. A promoted
+ * follower forks a new history from its leader's at its own offset. Other
+ * followers at or below that offset resume from it. Followers past it have
+ * messages the promoted one never got, so they are copied afresh.
+ *
+ * Acks: with acks = N a publish is answered OK:PUBLISHED once N followers
+ * have acknowledged it. After ack_timeout_ms it is answered
+ * ERROR:NOT_REPLICATED; the leader keeps the message either way. With
+ * acks = 0 replication is asynchronous.
+ *
+ * A follower refuses publishes (ERROR:FOLLOWER) but serves subscribers,
+ * which receive the replicated messages. REPLICATION:PROMOTE turns it into
+ * a leader; REPLICATION:FOLLOW:<leader> points a broker at a new leader.
+ */
+namespace replication {
+
+constexpr std::string_view FRAME_PREFIX = "RBATCH:";
+constexpr size_t MAX_FRAME_BYTES = 64 << 20;  // A frame holds at least one message
+
+// Parse an RBATCH header line; false if malformed or over the size limit
+bool parse_frame_header(const std::string& line, size_t& count, size_t& bytes, uint64_t& end);
+
+// Parse a follower's REPLICATE line
+bool parse_request(const std::string& line, uint64_t& history, uint64_t& offset, std::string& name);
+
+// One message in frame record form
+void encode(std::string& out, const Message& msg);
+
+// Recent messages in record form, with consecutive offsets
+class Log {
+public:
+    explicit Log(size_t max_bytes) : max_bytes_(max_bytes) {}
+    void set_max_bytes(size_t max_bytes);
+
+    // Start over, empty, at offset
+    void reset(uint64_t offset);
+
+    // A message whose sequence is not head() starts the log over at it
+    void append(const Message& msg);
+
+    uint64_t head() const;
+
+    // Whether a follower at offset can be served from the log
+    bool holds(uint64_t offset) const;
+
+    // Records from offset on, up to about max_bytes; false when the log no
+    // longer holds offset
+    bool read(uint64_t offset, size_t max_bytes, std::string& records, size_t& count, uint64_t& end) const;
+
+private:
+    mutable std::mutex mutex_;
+    size_t max_bytes_;
+    std::deque<std::string> records_;
+    size_t bytes_ = 0;
+    uint64_t start_ = 0;  // Offset of records_.front()
+};
+
+struct FollowerStats {
+    std::string name;
+    uint64_t acked = 0;          // Offset the follower has acknowledged
+    uint64_t lag = 0;            // Messages behind the leader
+    int64_t ack_latency_us = 0;  // Frame sent to acknowledged, latest frame
+};
+
+struct Stats {
+    bool following = false;
+    uint64_t history = 0;
+    uint64_t offset = 0;  // Next sequence
+
+    // Leader
+    std::vector<FollowerStats> followers;
+    uint64_t full_copies = 0;      // Followers that could not resume
+    uint64_t acks_timed_out = 0;   // Publishes answered ERROR:NOT_REPLICATED
+
+    // Follower
+    std::string leader;
+    bool connected = false;        // Streaming from the leader
+    uint64_t applied = 0;          // Messages applied from the leader
+    int64_t apply_lag_us = 0;      // Publish on the leader to applied here, latest frame
+};
+
+class Replication;
+
+// The leader's end of one follower's stream
+class Feed : public std::enable_shared_from_this<Feed> {
+public:
+    Feed(Replication& replication, std::shared_ptr<Session> session, std::string name);
+
+    const std::string& name() const { return name_; }
+    uint64_t acked() const { return acked_.load(std::memory_order_relaxed); }
+
+    // RACK:<end> from the follower
+    void acknowledge(uint64_t end);
+
+    // Send what the window allows
+    void pump();
+
+private:
+    friend class Replication;
+
+    bool send_frame(const std::string& frame);
+
+    Replication& replication_;
+    std::weak_ptr<Session> session_;
+    std::string name_;
+
+    std::mutex mutex_;
+    uint64_t sent_ = 0;  // Offset the frames sent so far take the follower to
+    
+    // Full copy in progress: messages below copy_end_, read from
+    // (copy_topic_, copy_sequence_) on
+    bool copying_ = false;
+    TopicId copy_topic_ = 0;
+    uint64_t copy_sequence_ = 0;
+    uint64_t copy_end_ = 0;
+    std::deque<std::chrono::steady_clock::time_point> in_flight_;  // Send times of unacknowledged frames
+    bool closed_ = false;
+
+    std::atomic<uint64_t> acked_{0};
+    std::atomic<int64_t> ack_latency_us_{0};
+};
+
+// The broker's role: a leader feeding followers, a follower of a leader,
+// or both (a follower can feed followers of its own)
+class Replication {
+public:
+    Replication(BrokerServer& broker, asio::io_context& io_context);
+
+    // Settings; before start()
+    void configure(const ReplicationConfig& config);
+    void start();
+    void stop();
+
+    // Follow leader (replacing any current one), or stop following and
+    // lead from the current topic data; false with the reason
+    bool follow(const std::string& leader, std::string& error);
+    bool promote(std::string& error);
+    bool following() const { return following_.load(); }
+    uint64_t history() const;
+
+    // Leader side: REPLICATE from a session; the feed serving it, or null
+    // with the reply already sent
+    std::shared_ptr<Feed> attach(std::shared_ptr<Session> session, const std::string& request);
+    void detach(const std::shared_ptr<Feed>& feed);
+
+    // Semi-synchronous acks: done(true) once the configured number of
+    // followers have acknowledged sequence, done(false) after the timeout
+    size_t required_acks() const { return config_.acks; }
+    void when_replicated(uint64_t sequence, std::function<void(bool)> done);
+
+    // Follower side: lines and frames from the leader's session
+    void handle_line(const std::string& line);
+    bool handle_frame(std::string_view block, size_t count, uint64_t end);
+    void upstream_closed(const std::shared_ptr<Session>& session);
+
+    // Every message the topic manager appends, in sequence order (called
+    // with its lock held)
+    void appended(const Message& msg);
+
+    Stats stats() const;
+
+private:
+    friend class Feed;
+
+    struct Waiter {
+        std::chrono::steady_clock::time_point deadline;
+        std::function<void(bool)> done;
+    };
+
+    void schedule_pump();
+    void start_copy(Feed& feed);
+    void acknowledged();
+    void expire_waiters();
+    void dial();
+    void redial_later();
+
+    BrokerServer& broker_;
+    asio::io_context& io_context_;
+    ReplicationConfig config_;
+    Log log_;
+    bool running_ = false;
+
+    // History: id, and the one it was forked from at fork_offset_ (also
+    // guards leader_)
+    mutable std::mutex history_mutex_;
+    uint64_t history_;
+    uint64_t parent_history_ = 0;
+    uint64_t fork_offset_ = 0;
+
+    // The log records only once there is a follower to serve, or when
+    // following (for a promotion); never during a full copy
+    std::atomic<bool> logging_{false};
+    std::atomic<bool> copying_{false};
+    uint64_t copy_end_ = 0;        // Offset the full copy being received ends at
+    uint64_t copy_history_ = 0;    // History adopted once it is complete
+
+    mutable std::mutex feeds_mutex_;
+    std::vector<std::shared_ptr<Feed>> feeds_;
+    std::atomic<size_t> feed_count_{0};
+    std::atomic<bool> pump_scheduled_{false};
+
+    std::mutex waiters_mutex_;
+    std::multimap<uint64_t, Waiter> waiters_;  // By the offset that satisfies them
+    asio::steady_timer ack_timer_;
+    bool ack_timer_armed_ = false;
+
+    // Follower
+    std::atomic<bool> following_{false};
+    std::string leader_;  // Changed on the io thread, under history_mutex_
+    std::weak_ptr<Session> upstream_;
+    asio::steady_timer redial_;
+    std::chrono::milliseconds backoff_{100};
+    bool failing_ = false;
+    std::atomic<bool> connected_{false};
+    std::atomic<uint64_t> applied_{0};
+    std::atomic<int64_t> apply_lag_us_{0};
+
+    std::atomic<uint64_t> full_copies_{0};
+    std::atomic<uint64_t> acks_timed_out_{0};
+};
+
+} // namespace replication
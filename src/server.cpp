@@ -154,7 +154,7 @@ Message BrokerServer::consume(const std::string& topic) {
     if (topics_.find(topic) != topics_.end() && !topics_[topic].empty()) {
         Message msg = topics_[topic].front();
         topics_[topic].pop();
-        log_info("Consumed message from topic '" + topic + "': " + msg.payload);
+        log_info("Consumed message from topic '" + topic + "': " + msg.payload.str());
         return msg;
     }
     
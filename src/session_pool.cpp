@@ -0,0 +1,40 @@
+#include "session_pool.hpp"
+
+SessionPool& SessionPool::instance() {
+    // Never destroyed, so late session destructors still find it
+    static SessionPool* pool = new SessionPool();
+    return *pool;
+}
+
+void* SessionPool::allocate(size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (block_size_ == 0) {
+            block_size_ = size;
+            free_.reserve(MAX_CACHED);
+        }
+        if (size == block_size_ && !free_.empty()) {
+            void* block = free_.back();
+            free_.pop_back();
+            reused_.fetch_add(1, std::memory_order_relaxed);
+            return block;
+        }
+    }
+    return ::operator new(size);
+}
+
+void SessionPool::deallocate(void* block, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size == block_size_ && free_.size() < MAX_CACHED) {
+            free_.push_back(block);
+            return;
+        }
+    }
+    ::operator delete(block);
+}
+
+size_t SessionPool::cached() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return free_.size();
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/**
+ * Memory recycling for client connections.
+ *
+ * SessionPool keeps the blocks of destroyed sessions on a free list. Each
+ * block holds the Session and its shared_ptr control block, allocated
+ * together through SessionAllocator and allocate_shared. A reconnect storm
+ * (every DebugLogger of a fleet coming back after a broker restart) then
+ * reuses those blocks instead of contending on the global allocator.
+ *
+ * HandlerMemory is a slot for the single read or write completion handler a
+ * session has in flight. Asio finds it through the handler's associated
+ * allocator (HandlerAllocator, see asio::bind_allocator), so initiating the
+ * next read or write reuses the memory the last one released. Unlike Asio's
+ * per-thread cache this holds when the handler completes on another thread.
+ */
+class SessionPool {
+public:
+    // Blocks kept for reuse at most; the rest go back to the allocator
+    static constexpr size_t MAX_CACHED = 4096;
+
+    // Lives for the whole process: sessions may outlive the broker that
+    // created them while their last handlers drain
+    static SessionPool& instance();
+
+    void* allocate(size_t size);
+    void deallocate(void* block, size_t size);
+
+    // Allocations served from the free list, and blocks on it now
+    uint64_t reused() const { return reused_.load(std::memory_order_relaxed); }
+    size_t cached() const;
+
+private:
+    SessionPool() = default;
+
+    mutable std::mutex mutex_;
+    size_t block_size_ = 0;      // Size of the first request; others bypass the pool
+    std::vector<void*> free_;
+    std::atomic<uint64_t> reused_{0};
+};
+
+template <typename T>
+class SessionAllocator {
+public:
+    using value_type = T;
+
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "pooled blocks use the default alignment");
+
+    SessionAllocator() noexcept = default;
+    template <typename U>
+    SessionAllocator(const SessionAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(SessionPool::instance().allocate(n * sizeof(T)));
+    }
+    void deallocate(T* block, size_t n) {
+        SessionPool::instance().deallocate(block, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const SessionAllocator<U>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const SessionAllocator<U>&) const noexcept { return false; }
+};
+
+class HandlerMemory {
+public:
+    // Fits Asio's read_until and write operations wrapping a session handler
+    static constexpr size_t SIZE = 512;
+
+    HandlerMemory() = default;
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+    void* allocate(size_t size) {
+        if (!in_use_ && size <= SIZE) {
+            in_use_ = true;
+            return storage_;
+        }
+        // Larger, or a second operation at once: not expected, but correct
+        overflows_.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(size);
+    }
+
+    void deallocate(void* block) {
+        if (block == storage_) {
+            in_use_ = false;
+        } else {
+            ::operator delete(block);
+        }
+    }
+
+    uint64_t overflows() const { return overflows_.load(std::memory_order_relaxed); }
+
+private:
+    alignas(std::max_align_t) unsigned char storage_[SIZE];
+    bool in_use_ = false;
+    std::atomic<uint64_t> overflows_{0};
+};
+
+template <typename T>
+class HandlerAllocator {
+public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemory& memory) noexcept : memory_(&memory) {}
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other) noexcept : memory_(other.memory_) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(memory_->allocate(n * sizeof(T))); }
+    void deallocate(T* block, size_t /*n*/) { memory_->deallocate(block); }
+
+    template <typename U>
+    bool operator==(const HandlerAllocator<U>& other) const noexcept { return memory_ == other.memory_; }
+    template <typename U>
+    bool operator!=(const HandlerAllocator<U>& other) const noexcept { return memory_ != other.memory_; }
+
+private:
+    template <typename>
+    friend class HandlerAllocator;
+
+    HandlerMemory* memory_;
+};
@@ -0,0 +1,79 @@
+#include "shm_transport.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Rings larger than this are refused rather than mapped
+constexpr size_t MAX_RING_MAPPING = shm_ring::DATA_OFFSET + (64u << 20);
+
+bool valid_ring_name(const std::string& name) {
+    if (name.size() <= shm_ring::NAME_PREFIX.size() || name.size() > 64 ||
+        name.compare(0, shm_ring::NAME_PREFIX.size(), shm_ring::NAME_PREFIX) != 0) {
+        return false;
+    }
+    return std::all_of(name.begin() + shm_ring::NAME_PREFIX.size(), name.end(),
+                       [](char c) { return (c >= '0' && c <= '9') || c == '_'; });
+}
+
+} // namespace
+
+std::unique_ptr<ShmRingSource> ShmRingSource::open(const asio::any_io_executor& executor,
+                                                   const std::string& name, std::string& error) {
+    if (!valid_ring_name(name)) {
+        error = "invalid ring name";
+        return nullptr;
+    }
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        error = std::strerror(errno);
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(shm_ring::DATA_OFFSET) ||
+        static_cast<size_t>(info.st_size) > MAX_RING_MAPPING) {
+        ::close(fd);
+        error = "bad ring size";
+        return nullptr;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        error = std::strerror(errno);
+        return nullptr;
+    }
+    int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        error = std::strerror(errno);
+        munmap(base, size);
+        return nullptr;
+    }
+    std::unique_ptr<ShmRingSource> source(new ShmRingSource(executor, base, size, event_fd));
+    if (!source->ring_.attach(base, size)) {
+        error = "not a ring";
+        return nullptr;
+    }
+    return source;
+}
+
+ShmRingSource::ShmRingSource(const asio::any_io_executor& executor, void* base, size_t size, int event_fd)
+    : base_(base), size_(size), wakeup_(executor, event_fd) {}
+
+ShmRingSource::~ShmRingSource() {
+    std::error_code ignored;
+    wakeup_.close(ignored);
+    munmap(base_, size_);
+}
+
+void ShmRingSource::clear_wakeup() {
+    uint64_t count;
+    while (::read(wakeup_.native_handle(), &count, sizeof(count)) > 0) {
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include <memory>
+#include <string>
+#include "../include/shm_ring.hpp"
+
+/**
+ * Broker end of a producer's shared-memory ring (see shm_ring.hpp): the
+ * mapped ring plus the eventfd the producer signals while the broker sleeps.
+ */
+class ShmRingSource {
+public:
+    // Map the ring called name; nullptr (and error set) if it is missing,
+    // not a ring or not a name a producer may hand us
+    static std::unique_ptr<ShmRingSource> open(const asio::any_io_executor& executor,
+                                               const std::string& name, std::string& error);
+    ~ShmRingSource();
+
+    ShmRingSource(const ShmRingSource&) = delete;
+    ShmRingSource& operator=(const ShmRingSource&) = delete;
+
+    shm_ring::Consumer& ring() { return ring_; }
+
+    // Sent to the producer, which writes to it to wake us up
+    int event_fd() { return wakeup_.native_handle(); }
+
+    // Wait until the producer signals; handler(std::error_code)
+    template <typename Handler>
+    void async_wait(Handler&& handler) {
+        wakeup_.async_wait(asio::posix::stream_descriptor::wait_read, std::forward<Handler>(handler));
+    }
+
+    // Reset the eventfd counter after a wake-up
+    void clear_wakeup();
+
+private:
+    ShmRingSource(const asio::any_io_executor& executor, void* base, size_t size, int event_fd);
+
+    void* base_;
+    size_t size_;
+    shm_ring::Consumer ring_;
+    asio::posix::stream_descriptor wakeup_;
+};
@@ -0,0 +1,172 @@
+#include "snapshot.hpp"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace snapshot {
+
+namespace {
+
+const char MAGIC[8] = {'N', 'P', 'S', 'N', 'A', 'P', 1, 0};
+
+// Refuse lengths no snapshot can hold rather than allocate for them
+constexpr uint64_t MAX_FIELD = 1ull << 32;
+
+} // namespace
+
+Writer::~Writer() {
+    if (file_) {
+        std::fclose(file_);
+        std::remove(temp_path_.c_str());
+    }
+}
+
+bool Writer::open(const std::string& path, uint64_t next_sequence, std::string& error) {
+    path_ = path;
+    temp_path_ = path + ".tmp";
+    file_ = std::fopen(temp_path_.c_str(), "wb");
+    if (!file_) {
+        error = "cannot create " + temp_path_ + ": " + std::strerror(errno);
+        return false;
+    }
+    std::setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+    std::fwrite(MAGIC, 1, sizeof(MAGIC), file_);
+    put_u64(next_sequence);
+    return true;
+}
+
+void Writer::topic(std::string_view name, uint64_t flags, uint64_t messages) {
+    put_varint(1);
+    put_varint(name.size());
+    std::fwrite(name.data(), 1, name.size(), file_);
+    put_varint(flags);
+    put_varint(messages);
+}
+
+void Writer::message(uint64_t sequence, int64_t timestamp_ns, std::string_view payload) {
+    put_varint(sequence);
+    put_u64(static_cast<uint64_t>(timestamp_ns));
+    put_varint(payload.size());
+    std::fwrite(payload.data(), 1, payload.size(), file_);
+}
+
+bool Writer::commit(std::string& error) {
+    put_varint(0);
+    bool ok = std::fflush(file_) == 0 && !std::ferror(file_) && fsync(fileno(file_)) == 0;
+    int saved_errno = errno;
+    ok = std::fclose(file_) == 0 && ok;
+    file_ = nullptr;
+    if (ok && std::rename(temp_path_.c_str(), path_.c_str()) != 0) {
+        saved_errno = errno;
+        ok = false;
+    }
+    if (!ok) {
+        error = "cannot write " + path_ + ": " + std::strerror(saved_errno);
+        std::remove(temp_path_.c_str());
+    }
+    return ok;
+}
+
+void Writer::put_varint(uint64_t value) {
+    uint8_t out[10];
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+    std::fwrite(out, 1, n, file_);
+}
+
+void Writer::put_u64(uint64_t value) {
+    uint8_t out[8];
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+    std::fwrite(out, 1, sizeof(out), file_);
+}
+
+Reader::~Reader() {
+    if (file_) {
+        std::fclose(file_);
+    }
+}
+
+bool Reader::open(const std::string& path, std::string& error) {
+    file_ = std::fopen(path.c_str(), "rb");
+    if (!file_) {
+        error = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    std::setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+    char magic[sizeof(MAGIC)];
+    if (std::fread(magic, 1, sizeof(magic), file_) != sizeof(magic) ||
+        std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || !get_u64(next_sequence_)) {
+        error = path + " is not a broker snapshot";
+        std::fclose(file_);
+        file_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool Reader::next_topic(std::string& name, uint64_t& flags, uint64_t& messages) {
+    uint64_t marker;
+    if (!file_ || complete_ || !get_varint(marker)) {
+        return false;
+    }
+    if (marker == 0) {
+        complete_ = true;
+        return false;
+    }
+    uint64_t length;
+    return marker == 1 && get_varint(length) && get_bytes(name, length) &&
+           get_varint(flags) && get_varint(messages);
+}
+
+bool Reader::next_message(uint64_t& sequence, int64_t& timestamp_ns, std::string& payload) {
+    uint64_t timestamp;
+    uint64_t length;
+    if (!get_varint(sequence) || !get_u64(timestamp) || !get_varint(length) || !get_bytes(payload, length)) {
+        return false;
+    }
+    timestamp_ns = static_cast<int64_t>(timestamp);
+    return true;
+}
+
+bool Reader::get_varint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = std::getc(file_);
+        if (byte == EOF) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Reader::get_u64(uint64_t& value) {
+    uint8_t in[8];
+    if (std::fread(in, 1, sizeof(in), file_) != sizeof(in)) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return true;
+}
+
+bool Reader::get_bytes(std::string& out, uint64_t length) {
+    if (length > MAX_FIELD) {
+        return false;
+    }
+    out.resize(length);
+    return std::fread(out.data(), 1, length, file_) == length;
+}
+
+} // namespace snapshot
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+/**
+ * Binary snapshot of the topic data a broker retains, so a restarted
+ * broker starts with the queues of the one it replaces.
+ *
+ * File layout (integers little-endian, varints LEB128):
+ *   header:  "NPSNAP\x01\0" then uint64 next sequence number
+ *   topic:   varint 1, varint name length, name, varint flags,
+ *            varint message count, then that many messages
+ *   message: varint sequence, uint64 timestamp (ns since the epoch),
+ *            varint payload length, payload
+ *   end:     varint 0
+ *
+ * Writer fills <path>.tmp and renames it on commit(), so a reader never
+ * sees half a snapshot. TopicManager::save_snapshot/load_snapshot use it.
+ */
+namespace snapshot {
+
+constexpr uint64_t FLAG_TAIL = 1;  // Topic had a shared-memory tail
+
+struct Totals {
+    size_t topics = 0;
+    size_t messages = 0;
+};
+
+class Writer {
+public:
+    Writer() = default;
+    ~Writer();  // Removes the temporary file unless committed
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    bool open(const std::string& path, uint64_t next_sequence, std::string& error);
+
+    // A topic header followed by exactly `messages` message() calls
+    void topic(std::string_view name, uint64_t flags, uint64_t messages);
+    void message(uint64_t sequence, int64_t timestamp_ns, std::string_view payload);
+
+    // Flush and move the file into place; false with the reason on a write error
+    bool commit(std::string& error);
+
+private:
+    void put_varint(uint64_t value);
+    void put_u64(uint64_t value);
+
+    std::FILE* file_ = nullptr;
+    std::string path_;
+    std::string temp_path_;
+};
+
+class Reader {
+public:
+    Reader() = default;
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // False with the reason when the file is missing or not a snapshot
+    bool open(const std::string& path, std::string& error);
+    uint64_t next_sequence() const { return next_sequence_; }
+
+    // Next topic header; false at the end marker or on a damaged file
+    bool next_topic(std::string& name, uint64_t& flags, uint64_t& messages);
+    bool next_message(uint64_t& sequence, int64_t& timestamp_ns, std::string& payload);
+
+    // The end marker was read: everything before it is intact
+    bool complete() const { return complete_; }
+
+private:
+    bool get_varint(uint64_t& value);
+    bool get_u64(uint64_t& value);
+    bool get_bytes(std::string& out, uint64_t length);
+
+    std::FILE* file_ = nullptr;
+    uint64_t next_sequence_ = 0;
+    bool complete_ = false;
+};
+
+} // namespace snapshot
@@ -0,0 +1,25 @@
+#pragma once
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include <string>
+#include "../include/transport.hpp"
+
+// A connected stream socket of either transport (TCP or Unix domain)
+using StreamSocket = asio::generic::stream_protocol::socket;
+
+// Connect to host:port over TCP, or to a "unix:/path" address over its
+// Unix domain socket. TCP connections get TCP_NODELAY.
+inline void connect_stream(StreamSocket& socket, const std::string& host, const std::string& port) {
+    if (transport::is_unix_address(host)) {
+        asio::local::stream_protocol::socket unix_socket(socket.get_executor());
+        unix_socket.connect(asio::local::stream_protocol::endpoint(transport::unix_path(host)));
+        socket = std::move(unix_socket);
+        return;
+    }
+    asio::ip::tcp::resolver resolver(socket.get_executor());
+    asio::ip::tcp::socket tcp_socket(socket.get_executor());
+    asio::connect(tcp_socket, resolver.resolve(host, port));
+    tcp_socket.set_option(asio::ip::tcp::no_delay(true));
+    socket = std::move(tcp_socket);
+}
@@ -0,0 +1,48 @@
+#include "topic_tail.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+std::unique_ptr<TopicTail> TopicTail::create(const std::string& topic, std::string& error) {
+    std::string name = topic_tail::shm_name(topic);
+    if (name.empty()) {
+        error = "topic name cannot be used for a tail";
+        return nullptr;
+    }
+    
+    // A ring left by an earlier broker may still be mapped by readers; they
+    // keep it and notice the new one through Reader::replaced()
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        error = std::strerror(errno);
+        return nullptr;
+    }
+    size_t size = topic_tail::mapping_size(topic_tail::DEFAULT_SLOT_COUNT, topic_tail::DEFAULT_SLOT_SIZE);
+    void* base = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int saved_errno = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+        error = std::strerror(saved_errno);
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+    return std::unique_ptr<TopicTail>(new TopicTail(std::move(name), base, size));
+}
+
+TopicTail::TopicTail(std::string name, void* base, size_t size)
+    : name_(std::move(name)),
+      base_(base),
+      size_(size),
+      writer_(base, topic_tail::DEFAULT_SLOT_COUNT, topic_tail::DEFAULT_SLOT_SIZE) {}
+
+TopicTail::~TopicTail() {
+    writer_.close();
+    shm_unlink(name_.c_str());
+    munmap(base_, size_);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include "../include/topic_tail.hpp"
+
+/**
+ * Broker end of a topic tail (see topic_tail.hpp): owns the shared-memory
+ * object readers map, and unlinks it when the tail is stopped.
+ */
+class TopicTail {
+public:
+    // Create (or replace) the tail of topic; nullptr and error set on failure
+    static std::unique_ptr<TopicTail> create(const std::string& topic, std::string& error);
+    ~TopicTail();
+
+    TopicTail(const TopicTail&) = delete;
+    TopicTail& operator=(const TopicTail&) = delete;
+
+    // Caller serialises appends (TopicManager holds its lock)
+    void append(std::string_view payload) { writer_.append(payload); }
+
+    const std::string& name() const { return name_; }
+
+private:
+    TopicTail(std::string name, void* base, size_t size);
+
+    std::string name_;
+    void* base_;
+    size_t size_;
+    topic_tail::Writer writer_;
+};
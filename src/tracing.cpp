@@ -0,0 +1,191 @@
+#include "tracing.hpp"
+#include "../include/latency_trace.hpp"
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace tracing {
+
+std::atomic<bool> g_enabled{false};
+
+namespace {
+
+struct SpanEvent {
+    const char* name;
+    const char* arg_name;
+    int64_t arg_value;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+};
+
+// Per-thread ring. Only the owning thread writes; the mutex is uncontended
+// except while a dump copies the ring out.
+struct ThreadBuffer {
+    std::mutex mutex;
+    std::vector<SpanEvent> ring;
+    uint64_t written = 0;
+    long tid = 0;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    std::atomic<uint32_t> sample_every{1};
+    std::atomic<size_t> ring_capacity{65536};
+    std::atomic<uint64_t> generation{0};
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+thread_local std::shared_ptr<ThreadBuffer> t_buffer;
+thread_local uint64_t t_buffer_generation = 0;
+thread_local uint32_t t_active_depth = 0;
+thread_local uint32_t t_root_counter = 0;
+
+ThreadBuffer& thread_buffer() {
+    Registry& reg = registry();
+    uint64_t generation = reg.generation.load(std::memory_order_acquire);
+    if (!t_buffer || t_buffer_generation != generation) {
+        // First span on this thread since start(): register a fresh ring
+        auto buffer = std::make_shared<ThreadBuffer>();
+        buffer->ring.resize(reg.ring_capacity.load());
+        buffer->tid = static_cast<long>(syscall(SYS_gettid));
+        {
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            reg.buffers.push_back(buffer);
+        }
+        t_buffer = std::move(buffer);
+        t_buffer_generation = generation;
+    }
+    return *t_buffer;
+}
+
+void write_json_string(std::ostream& out, const char* text) {
+    out << '"';
+    for (const char* p = text; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            out << '\\';
+        }
+        out << *p;
+    }
+    out << '"';
+}
+
+// Trace-event timestamps are microseconds; keep full ns precision
+void write_micros(std::ostream& out, uint64_t ns) {
+    out << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000 << std::setfill(' ');
+}
+
+} // namespace
+
+void start(uint32_t sample_every, size_t ring_capacity) {
+    Registry& reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.buffers.clear();
+        reg.sample_every = sample_every == 0 ? 1 : sample_every;
+        reg.ring_capacity = ring_capacity == 0 ? 1 : ring_capacity;
+        reg.generation.fetch_add(1, std::memory_order_release);
+    }
+    g_enabled.store(true, std::memory_order_release);
+}
+
+void stop() {
+    g_enabled.store(false, std::memory_order_release);
+}
+
+bool sample_root() {
+    uint32_t every = registry().sample_every.load(std::memory_order_relaxed);
+    return (t_root_counter++ % every) == 0;
+}
+
+void record(const char* name, uint64_t begin_ns, uint64_t end_ns,
+            const char* arg_name, int64_t arg_value) {
+    ThreadBuffer& buffer = thread_buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.ring[buffer.written % buffer.ring.size()] = {name, arg_name, arg_value, begin_ns, end_ns};
+    buffer.written++;
+}
+
+long dump_chrome_json(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        return -1;
+    }
+
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        buffers = registry().buffers;
+    }
+
+    long pid = static_cast<long>(getpid());
+    long spans = 0;
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    for (auto& buffer : buffers) {
+        std::vector<SpanEvent> events;
+        {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            size_t capacity = buffer->ring.size();
+            uint64_t begin = buffer->written > capacity ? buffer->written - capacity : 0;
+            for (uint64_t i = begin; i < buffer->written; ++i) {
+                events.push_back(buffer->ring[i % capacity]);
+            }
+        }
+
+        out << (first ? "" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << buffer->tid
+            << ",\"args\":{\"name\":\"broker-" << buffer->tid << "\"}}";
+        first = false;
+
+        for (const auto& event : events) {
+            out << ",\n{\"name\":";
+            write_json_string(out, event.name);
+            out << ",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << buffer->tid
+                << ",\"ts\":";
+            write_micros(out, event.begin_ns);
+            out << ",\"dur\":";
+            write_micros(out, event.end_ns - event.begin_ns);
+            if (event.arg_name) {
+                out << ",\"args\":{";
+                write_json_string(out, event.arg_name);
+                out << ':' << event.arg_value << '}';
+            }
+            out << '}';
+            spans++;
+        }
+    }
+    out << "\n]}\n";
+    return out ? spans : -1;
+}
+
+Scope::Scope(const char* name, bool root) : name_(name) {
+    if (!enabled()) {
+        return;
+    }
+    if (t_active_depth == 0 && (!root || !sample_root())) {
+        // Outside a sampled root span: nothing to attach to
+        return;
+    }
+    active_ = true;
+    t_active_depth++;
+    begin_ns_ = latency_trace::now_ns();
+}
+
+Scope::~Scope() {
+    if (!active_) {
+        return;
+    }
+    t_active_depth--;
+    record(name_, begin_ns_, latency_trace::now_ns(), arg_name_, arg_value_);
+}
+
+} // namespace tracing
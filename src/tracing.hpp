@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Low-overhead span tracing for broker internals.
+ *
+ * Each thread records completed spans into its own fixed-size ring buffer
+ * (oldest spans are overwritten). Tracing is off by default; when off a span
+ * costs one relaxed atomic load. Sampling is decided by root spans: with
+ * sample_every = N only every Nth root span on a thread (and everything
+ * nested inside it) is recorded.
+ *
+ * The buffers are dumped as Chrome trace-event JSON, loadable in Perfetto
+ * (ui.perfetto.dev) or chrome://tracing.
+ *
+ * Usage:
+ *   TRACE_ROOT_SCOPE("Session::on_read");
+ *   TRACE_SCOPE("TopicManager::publish");
+ */
+namespace tracing {
+
+extern std::atomic<bool> g_enabled;
+
+inline bool enabled() { return g_enabled.load(std::memory_order_relaxed); }
+
+// Start recording; ring_capacity is the number of spans kept per thread
+void start(uint32_t sample_every = 1, size_t ring_capacity = 65536);
+void stop();
+
+// Write every thread's buffer as Chrome trace-event JSON.
+// Returns the number of spans written, or -1 if the file cannot be opened.
+long dump_chrome_json(const std::string& path);
+
+// Record a span with explicit bounds (for spans that cross handlers)
+void record(const char* name, uint64_t begin_ns, uint64_t end_ns,
+            const char* arg_name = nullptr, int64_t arg_value = 0);
+
+// Sampling decision for a new root span on this thread
+bool sample_root();
+
+class Scope {
+public:
+    explicit Scope(const char* name, bool root = false);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    // Attach one numeric argument (shown in the Perfetto details pane)
+    void set_arg(const char* name, int64_t value) {
+        arg_name_ = name;
+        arg_value_ = value;
+    }
+
+    bool active() const { return active_; }
+
+private:
+    const char* name_;
+    const char* arg_name_ = nullptr;
+    int64_t arg_value_ = 0;
+    uint64_t begin_ns_ = 0;
+    bool active_ = false;
+};
+
+} // namespace tracing
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) tracing::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_ROOT_SCOPE(name) tracing::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name, true)
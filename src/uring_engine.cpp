@@ -0,0 +1,675 @@
+#include "uring_engine.hpp"
+#include "utils.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>) && !defined(NEUROPIPE_NO_IO_URING)
+#include <linux/io_uring.h>
+#endif
+
+// Multishot receive, provided buffer rings, fixed-buffer sends and
+// cancel-any all arrived by Linux 6.0; older headers build without the engine
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ASYNC_CANCEL_ANY) && defined(IORING_RECVSEND_FIXED_BUF)
+#define NEUROPIPE_HAVE_IO_URING 1
+#endif
+
+struct UringEngine::Op {
+    enum Kind { Receive, Send };
+
+    Op(Kind kind, int fd, std::shared_ptr<Handler> handler)
+        : kind(kind), fd(fd), handler(std::move(handler)) {}
+
+    Kind kind;
+    int fd;
+    std::shared_ptr<Handler> handler;
+    // Send: data points into a registered buffer (buffer >= 0) or into heap
+    int buffer = -1;
+    std::string heap;
+    const char* data = nullptr;
+    size_t length = 0;
+    size_t sent = 0;
+};
+
+#ifdef NEUROPIPE_HAVE_IO_URING
+
+namespace {
+
+constexpr uint16_t BUFFER_GROUP = 0;
+
+int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+void* map_ring(int fd, size_t size, off_t offset) {
+    return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+}
+
+std::atomic_ref<uint32_t> ring_word(uint32_t* word) {
+    return std::atomic_ref<uint32_t>(*word);
+}
+
+} // namespace
+
+UringEngine::UringEngine(asio::io_context& io_context)
+    : io_context_(io_context), ring_wait_(io_context) {}
+
+std::unique_ptr<UringEngine> UringEngine::create(asio::io_context& io_context, std::string& error) {
+    std::unique_ptr<UringEngine> engine(new UringEngine(io_context));
+    if (!engine->setup(error)) {
+        return nullptr;
+    }
+    engine->fixed_sends_ = engine->probe_fixed_send();
+    engine->arm_wait();
+    return engine;
+}
+
+bool UringEngine::setup(std::string& error) {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    params.cq_entries = CQ_ENTRIES;
+    ring_fd_ = io_uring_setup(SQ_ENTRIES, &params);
+    if (ring_fd_ < 0) {
+        error = std::string("io_uring_setup: ") + std::strerror(errno);
+        return false;
+    }
+    // Owned by the descriptor from here on, which closes it
+    ring_wait_.assign(ring_fd_);
+    if (!(params.features & IORING_FEAT_NODROP)) {
+        error = "kernel may drop completions (no IORING_FEAT_NODROP)";
+        return false;
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = map_ring(ring_fd_, sq_ring_size_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        sq_ring_ = nullptr;
+        error = std::string("mmap SQ ring: ") + std::strerror(errno);
+        return false;
+    }
+    if (single_mmap) {
+        cq_ring_ = sq_ring_;
+    } else {
+        cq_ring_ = map_ring(ring_fd_, cq_ring_size_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            cq_ring_ = nullptr;
+            error = std::string("mmap CQ ring: ") + std::strerror(errno);
+            return false;
+        }
+    }
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = map_ring(ring_fd_, sqes_size_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = nullptr;
+        error = std::string("mmap SQEs: ") + std::strerror(errno);
+        return false;
+    }
+
+    auto* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    sq_array_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    sq_mask_ = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    auto* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    cqes_ = cq + params.cq_off.cqes;
+
+    // Provided receive buffers: the kernel picks one per multishot completion
+    buffer_ring_size_ = RECV_BUFFERS * sizeof(struct io_uring_buf);
+    buffer_ring_ = mmap(nullptr, buffer_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    recv_buffers_ = static_cast<char*>(mmap(nullptr, RECV_BUFFERS * RECV_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    send_buffers_ = static_cast<char*>(mmap(nullptr, SEND_BUFFERS * SEND_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (buffer_ring_ == MAP_FAILED || recv_buffers_ == MAP_FAILED || send_buffers_ == MAP_FAILED) {
+        buffer_ring_ = buffer_ring_ == MAP_FAILED ? nullptr : buffer_ring_;
+        recv_buffers_ = recv_buffers_ == MAP_FAILED ? nullptr : recv_buffers_;
+        send_buffers_ = send_buffers_ == MAP_FAILED ? nullptr : send_buffers_;
+        error = "cannot allocate I/O buffers";
+        return false;
+    }
+    // The whole pool is on the ring before the kernel first looks at it
+    for (uint16_t id = 0; id < RECV_BUFFERS; ++id) {
+        recycle_buffer(id);
+    }
+    struct io_uring_buf_reg registration;
+    std::memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<uint64_t>(buffer_ring_);
+    registration.ring_entries = RECV_BUFFERS;
+    registration.bgid = BUFFER_GROUP;
+    if (io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &registration, 1) < 0 ||
+        !probe_buffer_ring()) {
+        // Some kernels accept the ring but never select from it; fall back
+        // to a classic buffer group, refilled by a PROVIDE_BUFFERS SQE per
+        // recycled buffer
+        io_uring_register(ring_fd_, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+        ring_buffers_ = false;
+        if (!provide_buffers()) {
+            error = std::string("provided buffers: ") + std::strerror(errno);
+            return false;
+        }
+    }
+
+    std::vector<struct iovec> iovecs(SEND_BUFFERS);
+    for (unsigned i = 0; i < SEND_BUFFERS; ++i) {
+        iovecs[i].iov_base = send_buffers_ + i * SEND_BUFFER_SIZE;
+        iovecs[i].iov_len = SEND_BUFFER_SIZE;
+        free_send_buffers_.push_back(static_cast<uint16_t>(SEND_BUFFERS - 1 - i));
+    }
+    if (io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, iovecs.data(), SEND_BUFFERS) < 0) {
+        error = std::string("registered buffers: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void UringEngine::push_sqe() {
+    ring_word(sq_tail_).store(ring_word(sq_tail_).load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    unsubmitted_++;
+}
+
+// Setup only: submit the SQE just pushed (user_data 0) and take its result
+int32_t UringEngine::run_sqe(uint32_t& flags) {
+    submit_locked(true);
+    uint32_t head = ring_word(cq_head_).load(std::memory_order_relaxed);
+    if (head == ring_word(cq_tail_).load(std::memory_order_acquire)) {
+        return -EIO;
+    }
+    auto* cqe = static_cast<struct io_uring_cqe*>(cqes_) + (head & cq_mask_);
+    int32_t result = cqe->res;
+    flags = cqe->flags;
+    ring_word(cq_head_).store(head + 1, std::memory_order_release);
+    return result;
+}
+
+bool UringEngine::probe_buffer_ring() {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+        return false;
+    }
+    int32_t result = -EIO;
+    uint32_t flags = 0;
+    if (write(pair[1], "x", 1) == 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto* sqe = static_cast<struct io_uring_sqe*>(next_sqe());
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = pair[0];
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        push_sqe();
+        result = run_sqe(flags);
+    }
+    close(pair[0]);
+    close(pair[1]);
+    if (result != 1 || !(flags & IORING_CQE_F_BUFFER)) {
+        return false;
+    }
+    recycle_buffer(static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT));
+    return true;
+}
+
+bool UringEngine::provide_buffers() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* sqe = static_cast<struct io_uring_sqe*>(next_sqe());
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = RECV_BUFFERS;  // Buffer count
+    sqe->addr = reinterpret_cast<uint64_t>(recv_buffers_);
+    sqe->len = static_cast<uint32_t>(RECV_BUFFER_SIZE);
+    sqe->off = 0;            // First buffer id
+    sqe->buf_group = BUFFER_GROUP;
+    push_sqe();
+    uint32_t flags = 0;
+    int32_t result = run_sqe(flags);
+    if (result < 0) {
+        errno = -result;
+        return false;
+    }
+    return true;
+}
+
+// Plain sends from registered buffers are newer than the rest (Linux 6.10);
+// without them the same buffers are sent as ordinary memory
+bool UringEngine::probe_fixed_send() {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+        return false;
+    }
+    int32_t result;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto* sqe = static_cast<struct io_uring_sqe*>(next_sqe());
+        send_buffers_[0] = 'x';
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = pair[0];
+        sqe->addr = reinterpret_cast<uint64_t>(send_buffers_);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+        sqe->buf_index = 0;
+        push_sqe();
+        uint32_t flags = 0;
+        result = run_sqe(flags);
+    }
+    close(pair[0]);
+    close(pair[1]);
+    return result == 1;
+}
+
+UringEngine::~UringEngine() {
+    // The kernel may still be writing into our buffers until every
+    // operation has completed, so cancel and wait before unmapping
+    if (ring_fd_ >= 0 && sqes_) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        closing_ = true;
+        // Never reached the kernel, so no completion will come for them
+        for (Op* op : pending_ops_) {
+            ops_.erase(op);
+            delete op;
+        }
+        pending_ops_.clear();
+        if (!ops_.empty()) {
+            if (auto* sqe = static_cast<struct io_uring_sqe*>(next_sqe())) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+                sqe->user_data = 0;
+                push_sqe();
+            }
+            submit_locked();
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (!ops_.empty() && std::chrono::steady_clock::now() < deadline) {
+            struct pollfd pfd = {ring_fd_, POLLIN, 0};
+            lock.unlock();
+            poll(&pfd, 1, 50);
+            lock.lock();
+            uint32_t head = ring_word(cq_head_).load(std::memory_order_relaxed);
+            uint32_t tail = ring_word(cq_tail_).load(std::memory_order_acquire);
+            for (; head != tail; ++head) {
+                auto* cqe = static_cast<struct io_uring_cqe*>(cqes_) + (head & cq_mask_);
+                auto* op = reinterpret_cast<Op*>(cqe->user_data);
+                if (op && (op->kind == Op::Send || !(cqe->flags & IORING_CQE_F_MORE))) {
+                    ops_.erase(op);
+                    delete op;
+                }
+            }
+            ring_word(cq_head_).store(head, std::memory_order_release);
+        }
+    }
+    std::error_code ignored;
+    ring_wait_.close(ignored);
+    for (Op* op : ops_) {
+        delete op;
+    }
+    if (sqes_) {
+        munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ && cq_ring_ != sq_ring_) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_) {
+        munmap(sq_ring_, sq_ring_size_);
+    }
+    if (buffer_ring_) {
+        munmap(buffer_ring_, buffer_ring_size_);
+    }
+    if (recv_buffers_) {
+        munmap(recv_buffers_, RECV_BUFFERS * RECV_BUFFER_SIZE);
+    }
+    if (send_buffers_) {
+        munmap(send_buffers_, SEND_BUFFERS * SEND_BUFFER_SIZE);
+    }
+}
+
+void* UringEngine::next_sqe() {
+    uint32_t tail = ring_word(sq_tail_).load(std::memory_order_relaxed);
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        uint32_t head = ring_word(sq_head_).load(std::memory_order_acquire);
+        if (tail - head < sq_entries_) {
+            uint32_t index = tail & sq_mask_;
+            auto* sqe = static_cast<struct io_uring_sqe*>(sqes_) + index;
+            std::memset(sqe, 0, sizeof(*sqe));
+            sq_array_[index] = index;
+            return sqe;
+        }
+        // Full: hand what we have to the kernel to make room
+        submit_locked();
+    }
+    return nullptr;
+}
+
+void UringEngine::submit_locked(bool wait_for_one) {
+    while (unsubmitted_ > 0 || wait_for_one) {
+        int submitted = io_uring_enter(ring_fd_, unsubmitted_, wait_for_one ? 1 : 0,
+                                       wait_for_one ? IORING_ENTER_GETEVENTS : 0);
+        enter_calls_.fetch_add(1, std::memory_order_relaxed);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EBUSY/EAGAIN: completions must be reaped first; retried after the next reap
+            log_warn(std::string("io_uring_enter: ") + std::strerror(errno));
+            return;
+        }
+        submissions_.fetch_add(static_cast<uint64_t>(submitted), std::memory_order_relaxed);
+        unsubmitted_ -= static_cast<uint32_t>(submitted);
+        wait_for_one = false;
+    }
+}
+
+void UringEngine::schedule_flush() {
+    // Completion handling submits once at its end; otherwise batch whatever
+    // this turn of the event loop queues into one io_uring_enter
+    if (reaping_ || flush_posted_) {
+        return;
+    }
+    flush_posted_ = true;
+    asio::post(io_context_, [this]() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flush_posted_ = false;
+        submit_locked();
+    });
+}
+
+void UringEngine::queue_receive(Op* op) {
+    auto* sqe = static_cast<struct io_uring_sqe*>(next_sqe());
+    if (!sqe) {
+        pending_ops_.push_back(op);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = op->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = reinterpret_cast<uint64_t>(op);
+    push_sqe();
+    schedule_flush();
+}
+
+void UringEngine::queue_send(Op* op) {
+    auto* sqe = static_cast<struct io_uring_sqe*>(next_sqe());
+    if (!sqe) {
+        pending_ops_.push_back(op);
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = op->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(op->data + op->sent);
+    sqe->len = static_cast<uint32_t>(op->length - op->sent);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    if (op->buffer >= 0 && fixed_sends_) {
+        sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+        sqe->buf_index = static_cast<uint16_t>(op->buffer);
+    }
+    sqe->user_data = reinterpret_cast<uint64_t>(op);
+    push_sqe();
+    schedule_flush();
+}
+
+void UringEngine::start_receive(int fd, std::shared_ptr<Handler> handler) {
+    auto* op = new Op(Op::Receive, fd, std::move(handler));
+    std::lock_guard<std::mutex> lock(mutex_);
+    ops_.insert(op);
+    queue_receive(op);
+}
+
+void UringEngine::send(int fd, std::string_view data, std::shared_ptr<Handler> handler) {
+    auto* op = new Op(Op::Send, fd, std::move(handler));
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closing_) {
+        delete op;
+        return;
+    }
+    if (data.size() <= SEND_BUFFER_SIZE && !free_send_buffers_.empty()) {
+        op->buffer = free_send_buffers_.back();
+        free_send_buffers_.pop_back();
+        char* buffer = send_buffers_ + static_cast<size_t>(op->buffer) * SEND_BUFFER_SIZE;
+        std::memcpy(buffer, data.data(), data.size());
+        op->data = buffer;
+    } else {
+        op->heap.assign(data);
+        op->data = op->heap.data();
+    }
+    op->length = data.size();
+    ops_.insert(op);
+    queue_send(op);
+}
+
+void UringEngine::shutdown() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closing_) {
+        return;
+    }
+    closing_ = true;
+    if (auto* sqe = static_cast<struct io_uring_sqe*>(next_sqe())) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        sqe->user_data = 0;
+        push_sqe();
+    }
+    submit_locked();
+}
+
+bool UringEngine::completions_pending() const {
+    return ring_word(cq_head_).load(std::memory_order_relaxed) !=
+           ring_word(cq_tail_).load(std::memory_order_acquire);
+}
+
+void UringEngine::arm_wait() {
+    ring_wait_.async_wait(asio::posix::stream_descriptor::wait_read, [this](std::error_code ec) {
+        if (ec) {
+            return;
+        }
+        reap();
+        arm_wait();
+    });
+    // A completion posted before the wait was queued raised no new event
+    if (completions_pending()) {
+        asio::post(io_context_, [this]() { reap(); });
+    }
+}
+
+void UringEngine::reap() {
+    std::lock_guard<std::mutex> reap_lock(reap_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reaping_ = true;
+    }
+    while (true) {
+        uint32_t head = ring_word(cq_head_).load(std::memory_order_relaxed);
+        if (head == ring_word(cq_tail_).load(std::memory_order_acquire)) {
+            break;
+        }
+        auto* cqe = static_cast<struct io_uring_cqe*>(cqes_) + (head & cq_mask_);
+        uint64_t user_data = cqe->user_data;
+        int32_t result = cqe->res;
+        uint32_t flags = cqe->flags;
+        ring_word(cq_head_).store(head + 1, std::memory_order_release);
+        completions_.fetch_add(1, std::memory_order_relaxed);
+        if (user_data) {
+            complete(reinterpret_cast<Op*>(user_data), result, flags);
+        }
+    }
+    // Operations that found the SQ full go in now that the kernel has room;
+    // after shutdown they end as cancelled instead
+    std::vector<Op*> aborted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        submit_locked();
+        if (closing_) {
+            aborted.swap(pending_ops_);
+        } else {
+            requeue_pending();
+        }
+        reaping_ = false;
+    }
+    for (Op* op : aborted) {
+        complete(op, -ECANCELED, 0);
+    }
+}
+
+void UringEngine::requeue_pending() {
+    std::vector<uint16_t> buffers;
+    buffers.swap(pending_buffers_);
+    for (uint16_t id : buffers) {
+        queue_provide_buffer(id);
+    }
+    std::vector<Op*> ops;
+    ops.swap(pending_ops_);
+    for (Op* op : ops) {
+        if (op->kind == Op::Receive) {
+            queue_receive(op);
+        } else {
+            queue_send(op);
+        }
+    }
+    submit_locked();
+}
+
+void UringEngine::complete(Op* op, int32_t result, uint32_t flags) {
+    if (op->kind == Op::Receive) {
+        if (flags & IORING_CQE_F_BUFFER) {
+            uint16_t id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            if (result > 0) {
+                op->handler->on_receive(recv_buffers_ + static_cast<size_t>(id) * RECV_BUFFER_SIZE,
+                                        static_cast<size_t>(result));
+            }
+            recycle_buffer(id);
+        }
+        if (flags & IORING_CQE_F_MORE) {
+            return;
+        }
+        {
+            // Multishot also ends when the buffers ran out for a moment
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!closing_ && (result > 0 || result == -ENOBUFS)) {
+                queue_receive(op);
+                return;
+            }
+        }
+        std::error_code ec = result == 0 ? asio::error::eof
+                           : result == -ECANCELED ? asio::error::operation_aborted
+                           : std::error_code(-result, asio::error::get_system_category());
+        std::shared_ptr<Handler> handler = op->handler;
+        release(op);
+        handler->on_receive_end(ec);
+        return;
+    }
+
+    if (result > 0) {
+        op->sent += static_cast<size_t>(result);
+        if (op->sent < op->length) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!closing_) {
+                queue_send(op);
+                return;
+            }
+        }
+    }
+    std::error_code ec;
+    if (result < 0) {
+        ec = result == -ECANCELED ? asio::error::operation_aborted
+                                  : std::error_code(-result, asio::error::get_system_category());
+    } else if (op->sent < op->length) {
+        ec = result == 0 ? asio::error::connection_reset : asio::error::operation_aborted;
+    }
+    size_t length = ec ? op->sent : op->length;
+    std::shared_ptr<Handler> handler = op->handler;
+    release(op);  // Frees the send buffer before the handler sends again
+    handler->on_send(ec, length);
+}
+
+void UringEngine::queue_provide_buffer(uint16_t id) {
+    auto* sqe = static_cast<struct io_uring_sqe*>(next_sqe());
+    if (!sqe) {
+        pending_buffers_.push_back(id);
+        return;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = reinterpret_cast<uint64_t>(recv_buffers_ + static_cast<size_t>(id) * RECV_BUFFER_SIZE);
+    sqe->len = static_cast<uint32_t>(RECV_BUFFER_SIZE);
+    sqe->off = id;
+    sqe->buf_group = BUFFER_GROUP;
+    push_sqe();
+    schedule_flush();
+}
+
+void UringEngine::recycle_buffer(uint16_t id) {
+    if (!ring_buffers_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_provide_buffer(id);
+        return;
+    }
+    char* address = recv_buffers_ + static_cast<size_t>(id) * RECV_BUFFER_SIZE;
+    auto* ring = static_cast<struct io_uring_buf_ring*>(buffer_ring_);
+    struct io_uring_buf* buffer = &ring->bufs[buffer_tail_ & (RECV_BUFFERS - 1)];
+    buffer->addr = reinterpret_cast<uint64_t>(address);
+    buffer->len = static_cast<uint32_t>(RECV_BUFFER_SIZE);
+    buffer->bid = id;
+    buffer_tail_++;
+    std::atomic_ref<uint16_t>(ring->tail).store(buffer_tail_, std::memory_order_release);
+}
+
+void UringEngine::release(Op* op) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ops_.erase(op);
+        if (op->buffer >= 0) {
+            free_send_buffers_.push_back(static_cast<uint16_t>(op->buffer));
+        }
+    }
+    delete op;
+}
+
+UringEngine::Stats UringEngine::stats() const {
+    Stats stats;
+    stats.enter_calls = enter_calls_.load(std::memory_order_relaxed);
+    stats.submissions = submissions_.load(std::memory_order_relaxed);
+    stats.completions = completions_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+#else // !NEUROPIPE_HAVE_IO_URING
+
+UringEngine::UringEngine(asio::io_context& io_context)
+    : io_context_(io_context), ring_wait_(io_context) {}
+
+UringEngine::~UringEngine() = default;
+
+std::unique_ptr<UringEngine> UringEngine::create(asio::io_context&, std::string& error) {
+    error = "built without io_uring support";
+    return nullptr;
+}
+
+void UringEngine::start_receive(int, std::shared_ptr<Handler>) {}
+void UringEngine::send(int, std::string_view, std::shared_ptr<Handler>) {}
+void UringEngine::shutdown() {}
+UringEngine::Stats UringEngine::stats() const { return Stats(); }
+
+#endif // NEUROPIPE_HAVE_IO_URING
@@ -0,0 +1,148 @@
+#pragma once
+
+#define ASIO_STANDALONE
+#include <asio.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * io_uring I/O engine for broker sessions (NEUROPIPE_IO_ENGINE=uring).
+ *
+ * Each connection gets one multishot receive that stays armed for its
+ * lifetime. It picks its buffers from a ring of provided buffers (or, on
+ * kernels where that ring does not work, a classic provided-buffer group
+ * refilled with PROVIDE_BUFFERS). Sends are
+ * copied into registered buffers (fixed-buffer sends where the kernel has
+ * them). Submissions made while completions are handled go to the kernel
+ * in one io_uring_enter. Completions are noticed through Asio: the ring fd
+ * is waited on like any other descriptor, so timers, acceptors and the
+ * remaining sockets keep running on the epoll reactor.
+ *
+ * Built from the kernel ABI alone (no liburing). create() returns nullptr
+ * when the kernel or the build lacks what the engine needs; callers stay
+ * on epoll then.
+ */
+class UringEngine {
+public:
+    // Completions of one connection. The engine holds a reference while the
+    // connection has operations in flight.
+    class Handler {
+    public:
+        virtual ~Handler() = default;
+        virtual void on_receive(const char* data, size_t length) = 0;
+        // Receiving stopped for good: asio::error::eof, operation_aborted or an error
+        virtual void on_receive_end(const std::error_code& ec) = 0;
+        // A send finished; length is the whole request unless ec is set
+        virtual void on_send(const std::error_code& ec, size_t length) = 0;
+    };
+
+    static std::unique_ptr<UringEngine> create(asio::io_context& io_context, std::string& error);
+    ~UringEngine();
+
+    UringEngine(const UringEngine&) = delete;
+    UringEngine& operator=(const UringEngine&) = delete;
+
+    void start_receive(int fd, std::shared_ptr<Handler> handler);
+
+    // Send all of data (copied); callers keep one send per connection in flight
+    void send(int fd, std::string_view data, std::shared_ptr<Handler> handler);
+
+    // Cancel every operation; handlers see operation_aborted
+    void shutdown();
+
+    // Whether sends use registered buffers directly (IORING_RECVSEND_FIXED_BUF)
+    bool fixed_sends() const { return fixed_sends_; }
+
+    struct Stats {
+        uint64_t enter_calls = 0;   // io_uring_enter system calls
+        uint64_t submissions = 0;   // SQEs submitted
+        uint64_t completions = 0;   // CQEs handled
+    };
+    Stats stats() const;
+
+    static constexpr unsigned SQ_ENTRIES = 256;
+    static constexpr unsigned CQ_ENTRIES = 4096;
+    static constexpr unsigned RECV_BUFFERS = 512;          // Power of two
+    static constexpr size_t RECV_BUFFER_SIZE = 4096;
+    static constexpr unsigned SEND_BUFFERS = 64;
+    static constexpr size_t SEND_BUFFER_SIZE = 64 * 1024;
+
+private:
+    struct Op;
+
+    explicit UringEngine(asio::io_context& io_context);
+    bool setup(std::string& error);
+    bool probe_buffer_ring();
+    bool provide_buffers();
+    bool probe_fixed_send();
+
+    // Caller holds mutex_
+    void* next_sqe();
+    void push_sqe();
+    int32_t run_sqe(uint32_t& flags);
+    void submit_locked(bool wait_for_one = false);
+    void queue_receive(Op* op);
+    void queue_send(Op* op);
+    void queue_provide_buffer(uint16_t id);
+    void requeue_pending();
+    void schedule_flush();
+
+    void arm_wait();
+    bool completions_pending() const;
+    void reap();
+    void complete(Op* op, int32_t result, uint32_t flags);
+    void recycle_buffer(uint16_t id);
+    void release(Op* op);
+
+    asio::io_context& io_context_;
+    int ring_fd_ = -1;
+    asio::posix::stream_descriptor ring_wait_;
+
+    // Mappings shared with the kernel
+    void* sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    size_t cq_ring_size_ = 0;
+    void* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    uint32_t* sq_head_ = nullptr;
+    uint32_t* sq_tail_ = nullptr;
+    uint32_t* sq_array_ = nullptr;
+    uint32_t sq_mask_ = 0;
+    uint32_t sq_entries_ = 0;
+    uint32_t* cq_head_ = nullptr;
+    uint32_t* cq_tail_ = nullptr;
+    uint32_t cq_mask_ = 0;
+    void* cqes_ = nullptr;
+
+    void* buffer_ring_ = nullptr;      // Provided receive buffers (descriptor ring)
+    size_t buffer_ring_size_ = 0;
+    char* recv_buffers_ = nullptr;
+    uint16_t buffer_tail_ = 0;         // Reaping thread only
+    bool ring_buffers_ = true;         // Else IORING_OP_PROVIDE_BUFFERS per recycle
+    char* send_buffers_ = nullptr;     // Registered with the ring
+    bool fixed_sends_ = false;
+
+    std::mutex mutex_;                 // SQ, free send buffers, ops_
+    std::mutex reap_mutex_;            // One thread handles completions at a time
+    std::vector<uint16_t> free_send_buffers_;
+    std::unordered_set<Op*> ops_;
+    // Queued while the SQ was full; reap() submits them once it has drained the CQ
+    std::vector<Op*> pending_ops_;
+    std::vector<uint16_t> pending_buffers_;
+    uint32_t unsubmitted_ = 0;
+    bool reaping_ = false;
+    bool flush_posted_ = false;
+    bool closing_ = false;
+
+    std::atomic<uint64_t> enter_calls_{0};
+    std::atomic<uint64_t> submissions_{0};
+    std::atomic<uint64_t> completions_{0};
+};
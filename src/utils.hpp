@@ -7,6 +7,8 @@
 #include <chrono>
 #include <iomanip>
 #include <sstream>
+#include <atomic>
+#include <cstdlib>
 
 // Thread-safe queue for message buffering
 template<typename T>
@@ -78,19 +80,59 @@ inline std::string get_timestamp() {
     return ss.str();
 }
 
+// Log levels, lowest first. Messages below the current level are dropped.
+enum class LogLevel { Debug = 0, Info = 1, Warn = 2, Error = 3, Off = 4 };
+
+inline std::atomic<LogLevel>& log_level_storage() {
+    static std::atomic<LogLevel> level{LogLevel::Debug};
+    return level;
+}
+
+inline void set_log_level(LogLevel level) {
+    log_level_storage().store(level, std::memory_order_relaxed);
+}
+
+// Parse "debug", "info", "warn", "error" or "off"
+inline bool parse_log_level(const std::string& name, LogLevel& level) {
+    if (name == "debug") level = LogLevel::Debug;
+    else if (name == "info") level = LogLevel::Info;
+    else if (name == "warn") level = LogLevel::Warn;
+    else if (name == "error") level = LogLevel::Error;
+    else if (name == "off") level = LogLevel::Off;
+    else return false;
+    return true;
+}
+
+// Apply NEUROPIPE_LOG_LEVEL from the environment, if set and valid
+inline void apply_log_level_from_env() {
+    LogLevel level;
+    if (const char* env = std::getenv("NEUROPIPE_LOG_LEVEL"); env && parse_log_level(env, level)) {
+        set_log_level(level);
+    }
+}
+
+// Per-message call sites check this before building the log string
+inline bool log_enabled(LogLevel level) {
+    return level >= log_level_storage().load(std::memory_order_relaxed);
+}
+
 // Simple logger functions
 inline void log_info(const std::string& msg) {
+    if (!log_enabled(LogLevel::Info)) return;
     std::cout << "[" << get_timestamp() << "] [INFO] " << msg << std::endl;
 }
 
 inline void log_error(const std::string& msg) {
+    if (!log_enabled(LogLevel::Error)) return;
     std::cerr << "[" << get_timestamp() << "] [ERROR] " << msg << std::endl;
 }
 
 inline void log_debug(const std::string& msg) {
+    if (!log_enabled(LogLevel::Debug)) return;
     std::cout << "[" << get_timestamp() << "] [DEBUG] " << msg << std::endl;
 }
 
 inline void log_warn(const std::string& msg) {
+    if (!log_enabled(LogLevel::Warn)) return;
     std::cout << "[" << get_timestamp() << "] [WARN] " << msg << std::endl;
 }
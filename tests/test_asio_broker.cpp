@@ -2,11 +2,34 @@
 #include <asio.hpp>
 #include "../src/asio_server.hpp"
 #include "../src/utils.hpp"
+#include "../src/alloc_accounting.hpp"
+#include "../src/capture.hpp"
+#include "../include/lz_codec.hpp"
+#include "../include/shm_ring.hpp"
+#include "../include/topic_tail.hpp"
+#include "../include/timer_wheel.hpp"
+#include "../include/priority_lanes.hpp"
+#include "../lib/debug_logger.hpp"
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <cassert>
 #include <atomic>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <tuple>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <csignal>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/mman.h>
 
 // Simple test framework
 int tests_passed = 0;
@@ -48,13 +71,27 @@ public:
         asio::write(socket_, asio::buffer(message));
     }
     
-    std::string receive_line() {
-        asio::streambuf buffer;
-        asio::read_until(socket_, buffer, '\n');
-        std::istream is(&buffer);
-        std::string line;
-        std::getline(is, line);
-        return line;
+    // One line, keeping whatever arrived after it for the next call; throws
+    // when none arrives within timeout_ms
+    std::string receive_line(int timeout_ms = 5000) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (true) {
+            const char* data = static_cast<const char*>(buffer_.data().data());
+            const char* newline = static_cast<const char*>(std::memchr(data, '\n', buffer_.size()));
+            if (newline) {
+                std::string line(data, newline - data);
+                buffer_.consume(line.size() + 1);
+                return line;
+            }
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            pollfd ready{socket_.native_handle(), POLLIN, 0};
+            if (remaining <= 0 || ::poll(&ready, 1, static_cast<int>(remaining)) <= 0) {
+                throw std::runtime_error("No line within " + std::to_string(timeout_ms) + " ms");
+            }
+            size_t received = socket_.read_some(buffer_.prepare(64 * 1024));
+            buffer_.commit(received);
+        }
     }
     
     void close() {
@@ -63,16 +100,67 @@ public:
         }
     }
     
+    asio::ip::tcp::socket& socket() { return socket_; }
+    
 private:
     asio::ip::tcp::socket socket_;
     asio::ip::tcp::resolver resolver_;
+    asio::streambuf buffer_;
 };
 
+size_t count_open_fds() {
+    size_t count = 0;
+    if (DIR* dir = opendir("/proc/self/fd")) {
+        while (readdir(dir)) {
+            ++count;
+        }
+        closedir(dir);
+    }
+    return count;
+}
+
 // Global broker for tests
 std::unique_ptr<BrokerServer> g_broker;
 std::unique_ptr<asio::io_context> g_io_context;
 std::unique_ptr<std::thread> g_io_thread;
 
+// The global broker's Unix socket, listened on at first use
+std::string local_socket_path() {
+    std::string path = g_broker->get_unix_path();
+    if (path.empty()) {
+        path = "/tmp/neuropipe_test_" + std::to_string(getpid()) + ".sock";
+        if (!g_broker->listen_unix(path)) {
+            throw std::runtime_error("Broker cannot listen on " + path);
+        }
+    }
+    return path;
+}
+
+// Session on the global broker's Unix socket: a local peer, allowed the
+// commands TCP sessions are refused
+class LocalClient {
+public:
+    explicit LocalClient(asio::io_context& io_context) : socket_(io_context) {
+        socket_.connect(asio::local::stream_protocol::endpoint(local_socket_path()));
+    }
+    
+    // Send line, return the reply line
+    std::string command(const std::string& line) {
+        asio::write(socket_, asio::buffer(line + "\n"));
+        asio::read_until(socket_, buffer_, '\n');
+        std::istream is(&buffer_);
+        std::string reply;
+        std::getline(is, reply);
+        return reply;
+    }
+    
+    void close() { socket_.close(); }
+    
+private:
+    asio::local::stream_protocol::socket socket_;
+    asio::streambuf buffer_;
+};
+
 void setup_broker() {
     g_io_context = std::make_unique<asio::io_context>();
     g_broker = std::make_unique<BrokerServer>(*g_io_context, 9093); // Use different port for testing
@@ -231,9 +319,92 @@ TEST(test_unsubscribe) {
     std::string response2 = client.receive_line();
     ASSERT(response2.find("OK:UNSUBSCRIBED") == 0, "Unsubscribe failed");
     
+    // Names are never freed, so past the topic limit a subscribe to a new
+    // one is refused without interning it; known topics still work
+    g_broker->get_topic_manager().set_max_topics(0);
+    client.send("SUBSCRIBE:temp_topic\n");
+    ASSERT(client.receive_line() == "OK:SUBSCRIBED:temp_topic", "Known topic at the limit");
+    client.send("SUBSCRIBE:temp_topic_new\n");
+    std::string refused = client.receive_line();
+    client.send("SUBSCRIBE:temp_topic_new:credit=5\n");
+    std::string refused_credit = client.receive_line();
+    g_broker->get_topic_manager().set_max_topics(TopicManager::DEFAULT_MAX_TOPICS);
+    ASSERT(refused == "ERROR:TOO_MANY_TOPICS", "New topic past the limit: " + refused);
+    ASSERT(refused_credit == "ERROR:TOO_MANY_TOPICS", "New credit topic past the limit: " + refused_credit);
+    ASSERT(topics::find("temp_topic_new") == TopicTable::NONE, "Refused topic interned");
+    
     client.close();
 }
 
+TEST(test_credit_subscription) {
+    asio::io_context io_context;
+    TestClient publisher(io_context, "127.0.0.1", 9093);
+    TestClient subscriber(io_context, "127.0.0.1", 9093);
+    auto publish = [&](const std::string& topic, const std::string& payload) {
+        publisher.send("PUBLISH:" + topic + ":" + payload + "\n");
+        ASSERT(publisher.receive_line() == "OK:PUBLISHED", "Publish " + payload);
+    };
+    auto nothing_more = [](TestClient& client) {
+        try {
+            client.receive_line(200);
+        } catch (const std::system_error&) {
+            throw;
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    
+    // Two messages of credit: the rest waits in the topic until granted
+    subscriber.send("SUBSCRIBE:credit_test:credit=2\n");
+    ASSERT(subscriber.receive_line() == "OK:SUBSCRIBED:credit_test", "Credit subscribe");
+    for (int i = 0; i < 5; ++i) {
+        publish("credit_test", "m" + std::to_string(i));
+    }
+    ASSERT(subscriber.receive_line() == "MESSAGE:credit_test:m0", "First message");
+    ASSERT(subscriber.receive_line() == "MESSAGE:credit_test:m1", "Second message");
+    ASSERT(nothing_more(subscriber), "Sent past the credit");
+    subscriber.send("CREDIT:2\n");
+    ASSERT(subscriber.receive_line() == "MESSAGE:credit_test:m2", "Granted message");
+    ASSERT(subscriber.receive_line() == "MESSAGE:credit_test:m3", "Granted message");
+    ASSERT(nothing_more(subscriber), "Sent past the grant");
+    subscriber.send("CREDIT:10\n");
+    ASSERT(subscriber.receive_line() == "MESSAGE:credit_test:m4", "Last queued message");
+    publish("credit_test", "m5");
+    ASSERT(subscriber.receive_line() == "MESSAGE:credit_test:m5", "Credit left sends at once");
+    subscriber.send("CREDIT:10B\n");
+    ASSERT(subscriber.receive_line() == "ERROR:CREDIT_UNIT", "One unit per session");
+    subscriber.send("CREDIT:x\n");
+    ASSERT(subscriber.receive_line() == "ERROR:INVALID_FORMAT", "Bad credit");
+    
+    // A plain SUBSCRIBE turns it back into pushed delivery
+    subscriber.send("SUBSCRIBE:credit_test\n");
+    ASSERT(subscriber.receive_line() == "OK:SUBSCRIBED:credit_test", "Plain subscribe");
+    publish("credit_test", "m6");
+    ASSERT(subscriber.receive_line() == "MESSAGE:credit_test:m6", "Pushed again");
+    
+    // Byte credit: "MESSAGE:credit_bytes:xxxxxxxxxx\n" is 32 bytes, and the
+    // message that crosses the limit still goes out
+    TestClient bytes(io_context, "127.0.0.1", 9093);
+    bytes.send("SUBSCRIBE:credit_bytes:credit=30B\n");
+    ASSERT(bytes.receive_line() == "OK:SUBSCRIBED:credit_bytes", "Byte credit subscribe");
+    for (int i = 0; i < 3; ++i) {
+        publish("credit_bytes", std::string(9, 'x') + std::to_string(i));
+    }
+    ASSERT(bytes.receive_line() == "MESSAGE:credit_bytes:xxxxxxxxx0", "First message within 30 bytes");
+    ASSERT(nothing_more(bytes), "Byte credit overrun");
+    bytes.send("CREDIT:2B\n");  // Only pays back the overdraft
+    ASSERT(nothing_more(bytes), "Overdraft not paid back");
+    bytes.send("CREDIT:40B\n");
+    ASSERT(bytes.receive_line() == "MESSAGE:credit_bytes:xxxxxxxxx1", "Second message");
+    ASSERT(bytes.receive_line() == "MESSAGE:credit_bytes:xxxxxxxxx2", "Third message");
+    
+    ASSERT(g_broker->get_topic_manager().get_subscriber_count("credit_bytes") == 1, "Credit subscriber counted");
+    bytes.send("UNSUBSCRIBE:credit_bytes\n");
+    ASSERT(bytes.receive_line() == "OK:UNSUBSCRIBED:credit_bytes", "Unsubscribe");
+    ASSERT(g_broker->get_topic_manager().get_subscriber_count("credit_bytes") == 0, "Credit subscriber removed");
+}
+
 TEST(test_multiple_topics) {
     asio::io_context io_context;
     TestClient publisher(io_context, "127.0.0.1", 9093);
@@ -299,10 +470,1729 @@ TEST(test_session_disconnect) {
     ASSERT(g_broker != nullptr, "Broker should still be running after client disconnect");
 }
 
+TEST(test_latency_trace_delivery) {
+    asio::io_context io_context;
+    TestClient publisher(io_context, "127.0.0.1", 9093);
+    TestClient traced(io_context, "127.0.0.1", 9093);
+    TestClient plain(io_context, "127.0.0.1", 9093);
+    
+    traced.send("TRACE:ON\n");
+    ASSERT(traced.receive_line() == "OK:TRACE:ON", "TRACE:ON not acknowledged");
+    traced.send("SUBSCRIBE:trace_topic\n");
+    traced.receive_line();
+    plain.send("SUBSCRIBE:trace_topic\n");
+    plain.receive_line();
+    
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    
+    uint64_t send_ns = latency_trace::now_ns();
+    publisher.send("TPUBLISH:" + latency_trace::format_stamp(send_ns) + ":trace_topic:a:b\n");
+    ASSERT(publisher.receive_line() == "OK:PUBLISHED", "Traced publish failed");
+    
+    // Untraced sessions still get the plain line
+    std::string plain_line = plain.receive_line();
+    ASSERT(plain_line == "MESSAGE:trace_topic:a:b", "Unexpected plain delivery: " + plain_line);
+    
+    std::string line = traced.receive_line();
+    latency_trace::Stamps stamps;
+    std::string_view topic, payload;
+    ASSERT(latency_trace::parse_message(line, stamps, topic, payload), "Malformed TMESSAGE: " + line);
+    ASSERT(topic == "trace_topic" && payload == "a:b", "Wrong topic/payload: " + line);
+    ASSERT(stamps.ns[latency_trace::HOP_SEND] == send_ns, "Send stamp not preserved");
+    for (size_t hop = 1; hop < latency_trace::HOP_COUNT; ++hop) {
+        ASSERT(stamps.ns[hop] >= stamps.ns[hop - 1], "Stamps not monotonic: " + line);
+    }
+    
+    publisher.send("TPUBLISH:zz:trace_topic:x\n");
+    ASSERT(publisher.receive_line() == "ERROR:INVALID_FORMAT", "Bad stamp should be rejected");
+    
+    publisher.close();
+    traced.close();
+    plain.close();
+}
+
+TEST(test_span_tracing_dump) {
+    asio::io_context io_context;
+    TestClient client(io_context, "127.0.0.1", 9093);
+    TestClient subscriber(io_context, "127.0.0.1", 9093);
+    
+    client.send("TRACING:START\n");
+    ASSERT(client.receive_line() == "ERROR:PERMISSION_DENIED", "TCP session must not start tracing");
+    client.send("TRACING:DUMP\n");
+    ASSERT(client.receive_line() == "ERROR:PERMISSION_DENIED", "TCP session must not dump traces");
+    LocalClient local(io_context);
+    ASSERT(local.command("TRACING:START") == "OK:TRACING:STARTED", "Tracing did not start");
+    
+    subscriber.send("SUBSCRIBE:traced_spans\n");
+    subscriber.receive_line();
+    for (int i = 0; i < 5; ++i) {
+        client.send("PUBLISH:traced_spans:payload\n");
+        ASSERT(client.receive_line() == "OK:PUBLISHED", "Publish failed");
+        subscriber.receive_line();
+    }
+    
+    ASSERT(local.command("TRACING:STOP") == "OK:TRACING:STOPPED", "Tracing did not stop");
+    std::string response = local.command("TRACING:DUMP");
+    ASSERT(response.find("OK:TRACING:DUMPED:") == 0, "Dump failed: " + response);
+    local.close();
+    
+    std::string path = response.substr(18);
+    std::ifstream in(path);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    std::remove(path.c_str());
+    
+    std::string json = contents.str();
+    ASSERT(json.find("\"traceEvents\"") != std::string::npos, "Missing traceEvents");
+    ASSERT(json.find("TopicManager::publish") != std::string::npos, "Missing publish spans");
+    ASSERT(json.find("TopicManager::fanout") != std::string::npos, "Missing fan-out spans");
+    ASSERT(json.find("Session::write_inflight") != std::string::npos, "Missing write spans");
+    
+    client.close();
+    subscriber.close();
+}
+
+TEST(test_alloc_accounting) {
+    if (!alloc_accounting::ENABLED) {
+        std::cout << "  (skipped: built without NEUROPIPE_ALLOC_ACCOUNTING)" << std::endl;
+        return;
+    }
+    
+    asio::io_context io_context;
+    TestClient publisher(io_context, "127.0.0.1", 9093);
+    TestClient subscriber(io_context, "127.0.0.1", 9093);
+    subscriber.send("SUBSCRIBE:alloc_topic\n");
+    subscriber.receive_line();
+    
+    TopicManager& topics = g_broker->get_topic_manager();
+    uint64_t published_before = topics.get_published_count();
+    uint64_t delivered_before = topics.get_delivered_count();
+    alloc_accounting::Snapshot before = alloc_accounting::snapshot();
+    
+    for (int i = 0; i < 20; ++i) {
+        publisher.send("PUBLISH:alloc_topic:payload\n");
+        publisher.receive_line();
+        subscriber.receive_line();
+    }
+    
+    alloc_accounting::Snapshot delta = alloc_accounting::snapshot() - before;
+    uint64_t published = topics.get_published_count() - published_before;
+    uint64_t delivered = topics.get_delivered_count() - delivered_before;
+    ASSERT(published == 20 && delivered == 20, "Message counters out of step");
+    ASSERT(alloc_accounting::allocations_per_published(delta, published) > 0,
+           "Expected tagged ingest allocations");
+    ASSERT(alloc_accounting::allocations_per_delivered(delta, delivered) > 0,
+           "Expected tagged fan-out allocations");
+    std::cout << "  " << alloc_accounting::report(delta, published, delivered) << std::endl;
+    
+    publisher.close();
+    subscriber.close();
+}
+
+TEST(test_heavy_hitter_sketch) {
+    HeavyHitters hitters(4);
+    for (int i = 0; i < 100; ++i) {
+        hitters.record("client_a", "noisy", "[10:00:00.000] [INFO] order_service: hello");
+        hitters.record("client_b", "topic_" + std::to_string(i), "x");
+    }
+    
+    auto topics = hitters.top(HeavyHitters::TOPICS, false, 1);
+    ASSERT(topics.size() == 1 && topics[0].key == "noisy", "Noisy topic should lead");
+    ASSERT(topics[0].weight > 90 && topics[0].weight <= 100.5, "Unexpected decayed count");
+    
+    auto services = hitters.top(HeavyHitters::SERVICES, true, 1);
+    ASSERT(services.size() == 1 && services[0].key == "order_service", "Service not extracted");
+    
+    auto clients = hitters.top(HeavyHitters::CLIENTS, false, 10);
+    ASSERT(clients.size() == 2, "Expected two publishing clients");
+    
+    // Evictions keep the heaviest keys and rank them in order
+    DecayingSpaceSaving sketch(8);
+    for (int round = 0; round < 200; ++round) {
+        sketch.add("heavy", 10.0);
+        sketch.add("medium", 5.0);
+        sketch.add("light_" + std::to_string(round), 1.0);
+        sketch.add("a much longer transient key than fits inline " + std::to_string(round), 1.0);
+    }
+    auto ranked = sketch.top(8, 1.0);
+    ASSERT(sketch.size() == 8 && ranked.size() == 8, "Sketch should stay at capacity");
+    ASSERT(ranked[0].key == "heavy" && ranked[0].weight == 2000.0 && ranked[0].error == 0.0, "Heaviest key");
+    ASSERT(ranked[1].key == "medium" && ranked[1].weight == 1000.0, "Second heaviest key");
+    for (size_t i = 1; i < ranked.size(); ++i) {
+        ASSERT(ranked[i - 1].weight >= ranked[i].weight, "Top entries out of order");
+    }
+    
+    // Producer keys are raw addresses, labelled only in reports
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(5555);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    std::string key = HeavyHitters::client_key(&address, sizeof(address), 3);
+    ASSERT(HeavyHitters::client_label(key) == "127.0.0.1:5555", "IPv4 label: " + HeavyHitters::client_label(key));
+    sockaddr_un local{};
+    local.sun_family = AF_UNIX;
+    ASSERT(HeavyHitters::client_label(HeavyHitters::client_key(&local, sizeof(sa_family_t), 7)) == "unix#7",
+           "Unix label");
+    HeavyHitters keyed(4);
+    keyed.record(key, "t", "x");
+    auto labelled = keyed.top(HeavyHitters::CLIENTS, false, 1);
+    ASSERT(labelled.size() == 1 && labelled[0].key == "127.0.0.1:5555", "Client reported by label");
+}
+
+TEST(test_top_command) {
+    asio::io_context io_context;
+    TestClient client(io_context, "127.0.0.1", 9093);
+    
+    for (int i = 0; i < 3; ++i) {
+        client.send("PUBLISH:flood_topic:[10:00:00.000] [ERROR] flood_service: boom\n");
+        client.receive_line();
+    }
+    
+    client.send("TOP:3\n");
+    std::string response = client.receive_line();
+    ASSERT(response.find("OK:TOP:{") == 0, "Expected TOP JSON, got: " + response);
+    ASSERT(response.find("\"key\":\"flood_topic\"") != std::string::npos, "Topic missing from TOP");
+    ASSERT(response.find("\"key\":\"flood_service\"") != std::string::npos, "Service missing from TOP");
+    std::string client_id = "127.0.0.1:" + std::to_string(client.socket().local_endpoint().port());
+    ASSERT(response.find("\"key\":\"" + client_id + "\"") != std::string::npos, "Client missing from TOP");
+    
+    client.send("TOP:abc\n");
+    ASSERT(client.receive_line() == "ERROR:INVALID_FORMAT", "Bad TOP argument should be rejected");
+    
+    client.close();
+}
+
 // ============================================================================
 // Main Test Runner
 // ============================================================================
 
+TEST(test_traffic_capture) {
+    asio::io_context io_context;
+    TestClient client(io_context, "127.0.0.1", 9093);
+    
+    // Captures hold every client's traffic, so only local peers run them
+    client.send("CAPTURE:START\n");
+    ASSERT(client.receive_line() == "ERROR:PERMISSION_DENIED", "TCP session must not start captures");
+    LocalClient local(io_context);
+    std::string response = local.command("CAPTURE:START");
+    ASSERT(response.find("OK:CAPTURE:STARTED:") == 0, "Capture did not start: " + response);
+    std::string path = response.substr(19);
+    
+    client.send("PUBLISH:captured:first\n");
+    ASSERT(client.receive_line() == "OK:PUBLISHED", "Publish failed");
+    {
+        TestClient other(io_context, "127.0.0.1", 9093);
+        other.send("PUBLISH:captured:second\n");
+        ASSERT(other.receive_line() == "OK:PUBLISHED", "Publish failed");
+        other.close();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));  // Let the close be recorded
+    
+    client.send("CAPTURE:STOP\n");
+    ASSERT(client.receive_line() == "ERROR:PERMISSION_DENIED", "TCP session must not stop captures");
+    response = local.command("CAPTURE:STOP");
+    ASSERT(response.find("OK:CAPTURE:STOPPED:") == 0, "Capture did not stop: " + response);
+    
+    std::vector<capture::Record> records;
+    {
+        capture::Reader reader(path);
+        ASSERT(reader.ok(), "Capture file unreadable");
+        capture::Record record;
+        while (reader.next(record)) {
+            records.push_back(record);
+        }
+    }
+    std::remove(path.c_str());
+    
+    ASSERT(records.size() >= 5, "Expected open/frames/close records, got " + std::to_string(records.size()));
+    ASSERT(records[0].kind == capture::Kind::Frame && records[0].frame == "PUBLISH:captured:first",
+           "First record should be the first publish");
+    uint32_t other_id = 0;
+    bool saw_open = false, saw_second = false, saw_close = false;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const capture::Record& r = records[i];
+        ASSERT(i == 0 || r.timestamp_ns >= records[i - 1].timestamp_ns, "Timestamps must not go backwards");
+        if (r.kind == capture::Kind::Open) {
+            saw_open = true;
+            other_id = r.connection;
+        } else if (r.kind == capture::Kind::Frame && r.frame == "PUBLISH:captured:second") {
+            saw_second = true;
+            ASSERT(r.connection == other_id && r.connection != records[0].connection,
+                   "Second publish should carry the second connection's id");
+        } else if (r.kind == capture::Kind::Close && r.connection == other_id) {
+            saw_close = true;
+        }
+    }
+    ASSERT(saw_open && saw_second && saw_close, "Missing open, frame or close of the second connection");
+    ASSERT(records.back().frame == "CAPTURE:STOP", "Capture should end with its stop command");
+    
+    local.close();
+    client.close();
+    
+    // A capture ends at its size limit, keeping whole records
+    ASSERT(capture::start(path, 200), "Capture with a limit");
+    for (int i = 0; i < 50; ++i) {
+        capture::record(capture::Kind::Frame, 1, latency_trace::now_ns(), "PUBLISH:limited:0123456789");
+    }
+    ASSERT(!capture::active(), "Capture should end at its limit");
+    long kept = capture::stop();
+    ASSERT(kept > 0 && kept < 50, "Records kept under the limit: " + std::to_string(kept));
+    struct stat info;
+    ASSERT(stat(path.c_str(), &info) == 0 && info.st_size <= 200, "Capture file over its limit");
+    {
+        capture::Reader reader(path);
+        capture::Record record;
+        long read = 0;
+        while (reader.next(record)) {
+            ++read;
+        }
+        ASSERT(read == kept, "Limited capture should end with a whole record");
+    }
+    std::remove(path.c_str());
+    ASSERT(capture::stop() == -1, "Nothing left to stop");
+}
+
+TEST(test_lz_codec) {
+    std::string logs;
+    for (int i = 0; i < 200; ++i) {
+        logs += "PUBLISH:debug:[12:00:0" + std::to_string(i % 10) + ".123] [INFO] order_service: "
+                "Processed order " + std::to_string(1000 + i) + "\n";
+    }
+    std::string noise;
+    uint32_t state = 12345;
+    for (int i = 0; i < 5000; ++i) {
+        state = state * 1103515245 + 12345;
+        noise.push_back(static_cast<char>(state >> 16));
+    }
+    
+    for (const std::string& input : {logs, noise, std::string(), std::string("abc"),
+                                     std::string(70000, 'x')}) {
+        std::string block;
+        lz_codec::compress(input, block);
+        ASSERT(block.size() <= lz_codec::compress_bound(input.size()), "Block exceeds compress_bound");
+        std::string output;
+        ASSERT(lz_codec::decompress(block, input.size(), output), "Round trip failed to decode");
+        ASSERT(output == input, "Round trip changed the data");
+        if (!block.empty()) {
+            std::string truncated;
+            ASSERT(!lz_codec::decompress(std::string_view(block).substr(0, block.size() - 1),
+                                         input.size(), truncated) || input.empty(),
+                   "Truncated block should not decode");
+        }
+    }
+    
+    std::string frame;
+    lz_codec::encode_batch(logs, frame);
+    ASSERT(frame.size() * 4 < logs.size(), "Log lines should compress at least 4x, got " +
+           std::to_string(frame.size()) + " from " + std::to_string(logs.size()));
+    size_t raw_size, compressed_size;
+    ASSERT(lz_codec::parse_batch_header(frame.substr(0, frame.find('\n')), raw_size, compressed_size),
+           "Frame header should parse");
+    ASSERT(raw_size == logs.size() && compressed_size == frame.size() - frame.find('\n') - 1,
+           "Frame header sizes mismatch");
+    ASSERT(!lz_codec::parse_batch_header("ZBATCH:99999999999:1", raw_size, compressed_size),
+           "Oversized batch must be refused");
+    
+    // Adaptive: small batches stay plain, incompressible data backs off
+    lz_codec::Adaptive policy;
+    ASSERT(!policy.should_compress(policy.min_batch_bytes - 1), "Small batch should go plain");
+    ASSERT(policy.should_compress(noise.size()), "First large batch should be tried");
+    policy.observe(noise.size(), noise.size() + 10, 1000);
+    ASSERT(!policy.should_compress(noise.size()) && policy.backing_off(),
+           "Incompressible data should back off");
+    lz_codec::Adaptive good;
+    good.observe(logs.size(), frame.size(), 1000);
+    ASSERT(good.should_compress(logs.size()), "Compressible data should stay compressed");
+}
+
+TEST(test_compressed_batches) {
+    asio::io_context io_context;
+    TestClient publisher(io_context, "127.0.0.1", 9093);
+    TestClient subscriber(io_context, "127.0.0.1", 9093);
+    
+    publisher.send("COMPRESS:BROTLI\n");
+    ASSERT(publisher.receive_line() == "ERROR:UNSUPPORTED_CODEC", "Unknown codec should be refused");
+    publisher.send("COMPRESS:LZ\n");
+    ASSERT(publisher.receive_line() == "OK:COMPRESS:LZ", "Compression negotiation failed");
+    subscriber.send("COMPRESS:LZ\n");
+    ASSERT(subscriber.receive_line() == "OK:COMPRESS:LZ", "Compression negotiation failed");
+    subscriber.send("SUBSCRIBE:zbatch\n");
+    
+    // Read the subscriber's stream the way consumer_client does: plain lines
+    // and ZBATCH frames may be mixed
+    asio::streambuf buffer;
+    std::vector<std::string> lines;
+    size_t frames = 0;
+    auto read_line = [&]() {
+        asio::read_until(subscriber.socket(), buffer, '\n');
+        std::istream is(&buffer);
+        std::string line;
+        std::getline(is, line);
+        size_t raw_size, compressed_size;
+        if (!lz_codec::parse_batch_header(line, raw_size, compressed_size)) {
+            lines.push_back(line);
+            return;
+        }
+        frames++;
+        if (buffer.size() < compressed_size) {
+            asio::read(subscriber.socket(), buffer, asio::transfer_exactly(compressed_size - buffer.size()));
+        }
+        std::string batch;
+        ASSERT(lz_codec::decompress(std::string_view(static_cast<const char*>(buffer.data().data()),
+                                                     compressed_size), raw_size, batch),
+               "Broker sent a corrupt batch");
+        buffer.consume(compressed_size);
+        std::istringstream batch_lines(batch);
+        while (std::getline(batch_lines, line)) {
+            lines.push_back(line);
+        }
+    };
+    read_line();
+    ASSERT(lines.back() == "OK:SUBSCRIBED:zbatch", "Subscribe failed: " + lines.back());
+    lines.clear();
+    
+    // One compressed frame of publishes from the producer side
+    const int count = 300;
+    std::string batch;
+    for (int i = 0; i < count; ++i) {
+        batch += "PUBLISH:zbatch:[12:00:00.000] [INFO] order_service: Processed order " +
+                 std::to_string(i) + "\n";
+    }
+    std::string frame;
+    lz_codec::encode_batch(batch, frame);
+    publisher.send(frame);
+    
+    while (lines.size() < static_cast<size_t>(count)) {
+        read_line();
+    }
+    for (int i = 0; i < count; ++i) {
+        std::string expected = "MESSAGE:zbatch:[12:00:00.000] [INFO] order_service: Processed order " +
+                               std::to_string(i);
+        ASSERT(lines[i] == expected, "Unexpected delivery " + std::to_string(i) + ": " + lines[i]);
+    }
+    std::cout << "  " << count << " messages arrived in " << frames << " compressed frames" << std::endl;
+    
+    // A bad frame header closes the connection after an error reply
+    TestClient bad(io_context, "127.0.0.1", 9093);
+    bad.send("COMPRESS:LZ\n");
+    ASSERT(bad.receive_line() == "OK:COMPRESS:LZ", "Compression negotiation failed");
+    bad.send("ZBATCH:10:x\n");
+    ASSERT(bad.receive_line() == "ERROR:INVALID_BATCH", "Bad frame should be reported");
+    
+    bad.close();
+    publisher.close();
+    subscriber.close();
+}
+
+TEST(test_unix_socket_transport) {
+    std::string path = local_socket_path();
+    ASSERT(g_broker->get_unix_path() == path, "Unix path not reported");
+    
+    asio::io_context io_context;
+    asio::local::stream_protocol::socket subscriber(io_context);
+    subscriber.connect(asio::local::stream_protocol::endpoint(path));
+    asio::streambuf buffer;
+    auto receive_line = [&]() {
+        asio::read_until(subscriber, buffer, '\n');
+        std::istream is(&buffer);
+        std::string line;
+        std::getline(is, line);
+        return line;
+    };
+    
+    asio::write(subscriber, asio::buffer(std::string("PING\n")));
+    ASSERT(receive_line() == "PONG", "PING over the Unix socket failed");
+    asio::write(subscriber, asio::buffer(std::string("SUBSCRIBE:uds_topic\n")));
+    ASSERT(receive_line() == "OK:SUBSCRIBED:uds_topic", "Subscribe over the Unix socket failed");
+    
+    // Sessions of both transports share topics
+    TestClient publisher(io_context, "127.0.0.1", 9093);
+    publisher.send("PUBLISH:uds_topic:over tcp\n");
+    ASSERT(publisher.receive_line() == "OK:PUBLISHED", "Publish failed");
+    ASSERT(receive_line() == "MESSAGE:uds_topic:over tcp", "Unix subscriber missed the TCP publish");
+    
+    asio::write(subscriber, asio::buffer(std::string("TOP:20\n")));
+    std::string top = receive_line();
+    ASSERT(top.find("OK:TOP:") == 0, "TOP failed: " + top);
+    
+    // A second broker must not take over a live socket...
+    BrokerServer second(io_context);
+    ListenerConfig config;
+    config.name = "unix";
+    config.address = "unix:" + path;
+    std::string error;
+    ASSERT(!second.add_listener(config, error), "Took over a live socket");
+    ASSERT(error.find("address in use") != std::string::npos, "Unexpected error: " + error);
+    asio::write(subscriber, asio::buffer(std::string("PING\n")));
+    ASSERT(receive_line() == "PONG", "Live socket disturbed");
+    
+    // ...but replaces one nobody accepts on any more
+    std::string stale = path + ".stale";
+    {
+        asio::local::stream_protocol::acceptor left(io_context, asio::local::stream_protocol::endpoint(stale));
+    }
+    config.address = "unix:" + stale;
+    ASSERT(second.add_listener(config, error), "Stale socket not replaced: " + error);
+    second.stop();
+    ::unlink(stale.c_str());
+    
+    subscriber.close();
+    publisher.close();
+}
+
+TEST(test_shm_ring) {
+    const uint32_t capacity = 1024;
+    std::vector<uint64_t> memory(shm_ring::mapping_size(capacity) / sizeof(uint64_t));
+    shm_ring::init(memory.data(), capacity);
+    shm_ring::Producer producer(memory.data());
+    shm_ring::Consumer consumer;
+    ASSERT(consumer.attach(memory.data(), memory.size() * sizeof(uint64_t)), "Attach failed");
+    
+    std::vector<std::string> seen;
+    auto collect = [&](std::string_view line) { seen.emplace_back(line); };
+    bool wake;
+    
+    // Laps the buffer several times, so records wrap behind padding
+    int next = 0;
+    for (int round = 0; round < 20; ++round) {
+        int written = 0;
+        while (producer.write("PUBLISH:ring:message " + std::to_string(next + written), wake)) {
+            written++;
+        }
+        ASSERT(written > 0, "Nothing fits into an empty ring");
+        seen.clear();
+        ASSERT(consumer.drain(collect, 10000) == written, "Drain count mismatch");
+        for (int i = 0; i < written; ++i) {
+            ASSERT(seen[i] == "PUBLISH:ring:message " + std::to_string(next + i), "Record out of order");
+        }
+        next += written;
+    }
+    ASSERT(producer.dropped() == 20, "Full ring should count one drop per round");
+    
+    // Only a sleeping broker is woken, and only once
+    ASSERT(consumer.prepare_wait(), "Empty ring should allow waiting");
+    producer.write("a", wake);
+    ASSERT(wake, "Writer should wake a waiting consumer");
+    producer.write("b", wake);
+    ASSERT(!wake, "Second writer should not wake again");
+    ASSERT(!consumer.prepare_wait(), "Pending records must be drained before waiting");
+    seen.clear();
+    ASSERT(consumer.drain(collect, 1) == 1 && seen.back() == "a", "Bounded drain failed");
+    ASSERT(consumer.drain(collect, 10) == 1 && seen.back() == "b", "Drain after bound failed");
+    
+    // A record whose writer died before committing holds back what follows
+    auto* header = reinterpret_cast<shm_ring::Header*>(memory.data());
+    uint64_t stuck = header->reserve.load();
+    header->reserve.fetch_add(shm_ring::record_size(5));
+    producer.write("after", wake);
+    ASSERT(consumer.drain(collect, 10) == 0, "Drain went past an uncommitted record");
+    
+    // A broken length is reported instead of read past the buffer
+    auto* data = reinterpret_cast<uint8_t*>(memory.data()) + shm_ring::DATA_OFFSET;
+    uint32_t bad = shm_ring::COMMITTED | (capacity * 2);
+    std::memcpy(data + (stuck & (capacity - 1)), &bad, sizeof(bad));
+    ASSERT(consumer.drain(collect, 10) == -1, "Corrupt record not detected");
+}
+
+TEST(test_shared_memory_producer) {
+    asio::io_context io_context;
+    TestClient tcp(io_context, "127.0.0.1", 9093);
+    tcp.send("SHM:ATTACH:/neuropipe_ring_1_0\n");
+    ASSERT(tcp.receive_line() == "ERROR:SHM_REQUIRES_UNIX_SOCKET", "TCP session must not attach rings");
+    tcp.close();
+    
+    std::string path = g_broker->get_unix_path();
+    if (path.empty()) {
+        path = "/tmp/neuropipe_test_" + std::to_string(getpid()) + ".sock";
+        ASSERT(g_broker->listen_unix(path), "Broker should listen on " + path);
+    }
+    
+    TestClient subscriber(io_context, "127.0.0.1", 9093);
+    subscriber.send("SUBSCRIBE:shm_topic\n");
+    ASSERT(subscriber.receive_line() == "OK:SUBSCRIBED:shm_topic", "Subscribe failed");
+    
+    const int count = 5000;
+    {
+        DebugLogger logger("shm_test", "unix:" + path);
+        logger.set_shared_memory(true);
+        ASSERT(logger.shared_memory(), "Shared-memory ring not attached");
+        for (int i = 0; i < count; ++i) {
+            logger.publish("shm_topic", "message " + std::to_string(i));
+            if (i % 500 == 499) {
+                // Keep well inside the ring; a full ring drops
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+        // Detaching drains the ring before the broker answers anything else
+        logger.set_shared_memory(false);
+        ASSERT(!logger.shared_memory(), "Ring still attached");
+        logger.publish("shm_topic", "over the socket");
+        
+        // Rings given up are unmapped and their eventfds closed, on both ends
+        size_t open_fds = count_open_fds();
+        for (int i = 0; i < 20; ++i) {
+            logger.set_shared_memory(true);
+            ASSERT(logger.shared_memory(), "Ring not attached again");
+            logger.set_shared_memory(false);
+        }
+        for (int i = 0; i < 100 && count_open_fds() > open_fds; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ASSERT(count_open_fds() <= open_fds, "Reattaching leaks descriptors: " + std::to_string(count_open_fds()) +
+                                                 " open, " + std::to_string(open_fds) + " before");
+    }
+    
+    asio::streambuf buffer;
+    for (int i = 0; i < count; ++i) {
+        asio::read_until(subscriber.socket(), buffer, '\n');
+        std::istream is(&buffer);
+        std::string line;
+        std::getline(is, line);
+        ASSERT(line == "MESSAGE:shm_topic:message " + std::to_string(i), "Unexpected ring delivery: " + line);
+    }
+    asio::read_until(subscriber.socket(), buffer, '\n');
+    std::istream is(&buffer);
+    std::string line;
+    std::getline(is, line);
+    ASSERT(line == "MESSAGE:shm_topic:over the socket", "Socket publish after detach out of order: " + line);
+    subscriber.close();
+    
+    // Only publishes are taken from a ring: a command in it (SHM:DETACH
+    // would drain the ring again from inside the drain) detaches it as corrupt
+    const uint32_t capacity = 4096;
+    std::string name = std::string(shm_ring::NAME_PREFIX) + std::to_string(getpid()) + "_900";
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    ASSERT(fd >= 0 && ftruncate(fd, static_cast<off_t>(shm_ring::mapping_size(capacity))) == 0, "Ring file");
+    void* base = mmap(nullptr, shm_ring::mapping_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    ASSERT(base != MAP_FAILED, "Ring mapping");
+    shm_ring::init(base, capacity);
+    shm_ring::Producer producer(base);
+    bool wake;
+    ASSERT(producer.write("SHM:DETACH", wake) && producer.write("PUBLISH:shm_topic:after", wake), "Ring writes");
+    LocalClient local(io_context);
+    std::string reply = local.command("SHM:ATTACH:" + name);
+    shm_unlink(name.c_str());
+    ASSERT(reply == "OK:SHM:ATTACHED", "Attach: " + reply);
+    std::string detached;
+    for (int i = 0; i < 100; ++i) {
+        detached = local.command("SHM:DETACH");
+        if (detached == "ERROR:SHM_NOT_ATTACHED") {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT(detached == "ERROR:SHM_NOT_ATTACHED", "Ring with a command should be dropped: " + detached);
+    ASSERT(local.command("PING") == "PONG", "Broker should survive a command in the ring");
+    munmap(base, shm_ring::mapping_size(capacity));
+    local.close();
+}
+
+TEST(test_topic_tail_ring) {
+    const uint32_t slots = 8;
+    const uint32_t slot_size = 64;
+    std::vector<uint64_t> memory(topic_tail::mapping_size(slots, slot_size) / sizeof(uint64_t));
+    topic_tail::Writer writer(memory.data(), slots, slot_size);
+    const size_t size = memory.size() * sizeof(uint64_t);
+    
+    topic_tail::Reader reader;
+    ASSERT(reader.attach(memory.data(), size), "Attach failed");
+    std::string payload;
+    ASSERT(reader.next(payload) == topic_tail::Reader::Status::Empty, "New tail should be empty");
+    
+    writer.append("first");
+    writer.append(std::string(100, 'x'));
+    ASSERT(reader.next(payload) == topic_tail::Reader::Status::Message && payload == "first", "First message");
+    ASSERT(reader.next(payload) == topic_tail::Reader::Status::Message, "Long message");
+    ASSERT(reader.truncated() && payload.size() == slot_size - topic_tail::SLOT_HEADER, "Long message not truncated");
+    
+    // Twenty more than fit: the reader is lapped, skips ahead and counts the loss
+    for (int i = 0; i < 20; ++i) {
+        writer.append("m" + std::to_string(i));
+    }
+    ASSERT(reader.next(payload) == topic_tail::Reader::Status::Lapped, "Overrun not detected");
+    ASSERT(reader.skipped() == 16, "Lapped reader should resume half a ring behind");
+    for (int i = 16; i < 20; ++i) {
+        ASSERT(reader.next(payload) == topic_tail::Reader::Status::Message && payload == "m" + std::to_string(i),
+               "Unexpected message after resync: " + payload);
+    }
+    ASSERT(reader.next(payload) == topic_tail::Reader::Status::Empty, "Reader should have caught up");
+    
+    // Readers are independent: a new one can start with the oldest message kept
+    topic_tail::Reader oldest;
+    ASSERT(oldest.attach(memory.data(), size, true), "Attach failed");
+    ASSERT(oldest.next(payload) == topic_tail::Reader::Status::Message && payload == "m13", "Oldest message");
+    
+    writer.close();
+    ASSERT(reader.next(payload) == topic_tail::Reader::Status::Closed, "Close not seen");
+}
+
+TEST(test_topic_tail_command) {
+    asio::io_context io_context;
+    TestClient client(io_context, "127.0.0.1", 9093);
+    std::string topic = "tail_test_" + std::to_string(getpid());
+    
+    // Tails are for readers on this host, so only local peers start them
+    client.send("TAIL:START:" + topic + "\n");
+    ASSERT(client.receive_line() == "ERROR:PERMISSION_DENIED", "TCP session must not start tails");
+    
+    LocalClient local(io_context);
+    ASSERT(local.command("TAIL:START:bad/topic") == "ERROR:TAIL_START_FAILED", "Topic names with '/' must be refused");
+    std::string reply = local.command("TAIL:START:" + topic);
+    ASSERT(reply == "OK:TAIL:STARTED:" + topic_tail::shm_name(topic), "TAIL:START failed: " + reply);
+    
+    topic_tail::Reader reader;
+    ASSERT(reader.open(topic), "Reader cannot map the tail");
+    for (int i = 0; i < 10; ++i) {
+        client.send("PUBLISH:" + topic + ":tailed " + std::to_string(i) + "\n");
+        ASSERT(client.receive_line() == "OK:PUBLISHED", "Publish failed");
+    }
+    std::string payload;
+    for (int i = 0; i < 10; ++i) {
+        ASSERT(reader.next(payload) == topic_tail::Reader::Status::Message, "Tail missed a message");
+        ASSERT(payload == "tailed " + std::to_string(i), "Unexpected tail message: " + payload);
+    }
+    ASSERT(reader.next(payload) == topic_tail::Reader::Status::Empty, "Tail has extra messages");
+    
+    client.send("TAIL:STOP:" + topic + "\n");
+    ASSERT(client.receive_line() == "ERROR:PERMISSION_DENIED", "TCP session must not stop tails");
+    ASSERT(local.command("TAIL:STOP:" + topic) == "OK:TAIL:STOPPED:" + topic, "TAIL:STOP failed");
+    ASSERT(reader.next(payload) == topic_tail::Reader::Status::Closed, "Reader should see the tail close");
+    ASSERT(local.command("TAIL:STOP:" + topic) == "ERROR:TAIL_NOT_ACTIVE", "Second TAIL:STOP should fail");
+    local.close();
+    client.close();
+    
+    // Each tail maps a ring, so a broker keeps at most MAX_TAILS of them
+    TopicManager manager;
+    std::string error;
+    for (size_t i = 0; i < TopicManager::MAX_TAILS; ++i) {
+        ASSERT(!manager.start_tail(topic + "_" + std::to_string(i), error).empty(), "Tail " + std::to_string(i) + ": " + error);
+    }
+    ASSERT(manager.start_tail(topic + "_over", error).empty(), "Tail over the limit started");
+    ASSERT(manager.stop_tail(topic + "_0"), "Stop a tail");
+    ASSERT(!manager.start_tail(topic + "_over", error).empty(), "Stopped tail should free its place: " + error);
+    manager.stop_tails();
+}
+
+TEST(test_io_uring_engine) {
+    // A second broker with io_uring sessions, on its own io_context so it can
+    // be torn down (after its thread stops) within the test
+    asio::io_context broker_context;
+    auto broker = std::make_unique<BrokerServer>(broker_context, 0);
+    std::string error;
+    if (!broker->use_io_uring(error)) {
+        std::cout << "  io_uring unavailable here (" << error << "), skipped" << std::endl;
+        return;
+    }
+    broker->start();
+    std::thread broker_thread([&broker_context]() { broker_context.run(); });
+    uint16_t port = broker->get_port();
+    auto stop_broker = [&]() {
+        broker->stop();
+        broker_context.stop();
+        broker_thread.join();
+        broker.reset();
+    };
+    
+    asio::io_context io_context;
+    try {
+        TestClient publisher(io_context, "127.0.0.1", port);
+        TestClient subscriber(io_context, "127.0.0.1", port);
+        subscriber.send("SUBSCRIBE:uring\n");
+        ASSERT(subscriber.receive_line() == "OK:SUBSCRIBED:uring", "Subscribe failed");
+        
+        // Many lines per write: receives carry several lines and split others
+        const int count = 2000;
+        std::string burst;
+        for (int i = 0; i < count; ++i) {
+            burst += "PUBLISH:uring:message " + std::to_string(i) + "\n";
+        }
+        publisher.send(burst);
+        asio::streambuf buffer;
+        std::istream is(&buffer);
+        std::string line;
+        for (int i = 0; i < count; ++i) {
+            asio::read_until(subscriber.socket(), buffer, '\n');
+            std::getline(is, line);
+            ASSERT(line == "MESSAGE:uring:message " + std::to_string(i), "Unexpected delivery: " + line);
+        }
+        // Replies are batched per send as well, so read them from one buffer
+        asio::streambuf replies;
+        std::istream reply_stream(&replies);
+        for (int i = 0; i < count; ++i) {
+            asio::read_until(publisher.socket(), replies, '\n');
+            std::getline(reply_stream, line);
+            ASSERT(line == "OK:PUBLISHED", "Publish not acknowledged: " + line);
+        }
+        
+        // Larger than a receive buffer and than a registered send buffer
+        std::string large(100 * 1024, 'x');
+        publisher.send("PUBLISH:uring:" + large + "\n");
+        asio::read_until(publisher.socket(), replies, '\n');
+        std::getline(reply_stream, line);
+        ASSERT(line == "OK:PUBLISHED", "Large publish failed");
+        asio::read_until(subscriber.socket(), buffer, '\n');
+        std::getline(is, line);
+        ASSERT(line == "MESSAGE:uring:" + large, "Large message corrupted");
+        
+        // Compressed batches arrive in pieces too
+        publisher.send("COMPRESS:LZ\n");
+        ASSERT(publisher.receive_line() == "OK:COMPRESS:LZ", "Compression negotiation failed");
+        std::string batch;
+        for (int i = 0; i < 200; ++i) {
+            batch += "PUBLISH:uring:zipped " + std::to_string(i) + "\n";
+        }
+        std::string frame;
+        lz_codec::encode_batch(batch, frame);
+        publisher.send(frame);
+        for (int i = 0; i < 200; ++i) {
+            asio::read_until(subscriber.socket(), buffer, '\n');
+            std::getline(is, line);
+            ASSERT(line == "MESSAGE:uring:zipped " + std::to_string(i), "Unexpected delivery: " + line);
+        }
+        
+        ASSERT(broker->get_active_sessions() == 2, "Broker should have 2 sessions");
+        publisher.close();
+        subscriber.close();
+    } catch (...) {
+        stop_broker();
+        throw;
+    }
+    for (int i = 0; i < 50 && broker->get_active_sessions() > 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    size_t sessions = broker->get_active_sessions();
+    UringEngine::Stats stats = broker->get_uring_engine()->stats();
+    stop_broker();
+    ASSERT(sessions == 0, "Closed connections should end their sessions");
+    
+    std::cout << "  " << stats.completions << " completions, " << stats.submissions << " submissions in "
+              << stats.enter_calls << " io_uring_enter calls" << std::endl;
+    ASSERT(stats.enter_calls < stats.completions, "Submissions should be batched");
+}
+
+TEST(test_session_pool) {
+    // One handler slot: reused once released, heap for a second at once
+    HandlerMemory memory;
+    HandlerAllocator<char> allocator(memory);
+    char* first = allocator.allocate(128);
+    char* second = allocator.allocate(128);
+    ASSERT(first != second, "Second live handler needs its own block");
+    ASSERT(memory.overflows() == 1, "Second live handler should overflow");
+    allocator.deallocate(second, 128);
+    allocator.deallocate(first, 128);
+    ASSERT(allocator.allocate(128) == first, "Released slot should be reused");
+    allocator.deallocate(first, 128);
+    char* large = allocator.allocate(HandlerMemory::SIZE + 1);
+    ASSERT(large != first, "Oversized handler goes to the heap");
+    allocator.deallocate(large, HandlerMemory::SIZE + 1);
+    
+    // A reconnect takes the block a closed session left in the pool
+    SessionPool& pool = SessionPool::instance();
+    asio::io_context io_context;
+    {
+        TestClient client(io_context, "127.0.0.1", 9093);
+        client.send("PING\n");
+        ASSERT(client.receive_line() == "PONG", "Expected PONG");
+        client.close();
+    }
+    for (int i = 0; i < 50 && pool.cached() == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT(pool.cached() > 0, "Closed session should return its block");
+    uint64_t reused_before = pool.reused();
+    
+    TestClient client(io_context, "127.0.0.1", 9093);
+    client.send("PING\n");
+    ASSERT(client.receive_line() == "PONG", "Expected PONG after reconnect");
+    ASSERT(pool.reused() > reused_before, "Reconnect should reuse a pooled session");
+    client.close();
+}
+
+TEST(test_broker_config) {
+    const std::string path = "/tmp/neuropipe_test_" + std::to_string(getpid()) + ".conf";
+    {
+        std::ofstream file(path);
+        file << "# test listeners\n"
+             << "[listener apps]\n"
+             << "address = 127.0.0.1:9200\n"
+             << "tcp_nodelay = true   # latency first\n"
+             << "\n"
+             << "[listener bulk]\n"
+             << "address = [::1]:9201\n"
+             << "send_buffer = 4194304\n"
+             << "accept_rate = 50\n"
+             << "\n"
+             << "[bridge central]\n"
+             << "remote = central.example:9092\n"
+             << "topics = logs.*, alerts\n"
+             << "\n"
+             << "[replication]\n"
+             << "leader = 10.0.0.1:9092\n"
+             << "name = standby\n";
+    }
+    const char* args[] = {"broker", "--config", path.c_str(), "--listen", "local=unix:/tmp/np_test.sock",
+                          "--port", "9300", "--set", "bulk.max_connections=10",
+                          "--bridge", "edge=unix:/tmp/np_edge.sock", "--set", "central.batch_delay_us=0",
+                          "--acks", "1", "--set", "replication.ack_timeout_ms=250"};
+    BrokerConfig config;
+    bool help = false;
+    std::string error;
+    bool parsed = parse_broker_args(17, const_cast<char**>(args), config, help, error);
+    std::remove(path.c_str());
+    ASSERT(parsed, "Config should parse: " + error);
+    ASSERT(config.listeners.size() == 3, "Expected three listeners");
+    ASSERT(config.find("apps")->address == "127.0.0.1:9300" && config.find("apps")->tcp_nodelay,
+           "--port should move the first TCP listener");
+    ListenerConfig* bulk = config.find("bulk");
+    ASSERT(bulk->send_buffer == 4194304 && bulk->accept_rate == 50 && bulk->max_connections == 10,
+           "Bulk listener settings");
+    ListenAddress address;
+    ASSERT(ListenAddress::parse(bulk->address, address, error) && address.host == "::1" && address.port == 9201,
+           "IPv6 address");
+    ASSERT(ListenAddress::parse(config.find("local")->address, address, error) && address.is_unix,
+           "Unix listener");
+    ASSERT(config.bridges.size() == 2 && config.find_bridge("central")->topics == "logs.*, alerts" &&
+           config.find_bridge("central")->batch_delay_us == 0 && config.find_bridge("edge")->topics == "*",
+           "Bridges");
+    std::vector<std::string> patterns = federation::parse_patterns(config.find_bridge("central")->topics);
+    ASSERT(federation::matches(patterns, "logs.app") && federation::matches(patterns, "alerts") &&
+           !federation::matches(patterns, "alerts.disk"), "Bridge topic patterns");
+    ASSERT(config.replication.leader == "10.0.0.1:9092" && config.replication.name == "standby" &&
+           config.replication.acks == 1 && config.replication.ack_timeout_ms == 250, "Replication settings");
+    
+    ListenerConfig listener;
+    ASSERT(!listener.set("tcp_nodelay", "maybe", error), "Bad boolean accepted");
+    ASSERT(!listener.set("backlog", "-1", error), "Negative backlog accepted");
+    ASSERT(!listener.set("no_such_key", "1", error), "Unknown key accepted");
+    ASSERT(!listener.set("address", "localhost", error), "Address without port accepted");
+    ReplicationConfig replication;
+    ASSERT(!replication.set("window_frames", "0", error), "Empty replication window accepted");
+    
+    // No listeners named: TCP on the default port plus the Unix socket
+    const char* none[] = {"broker"};
+    BrokerConfig defaults;
+    defaults.default_unix_path = "/tmp/np_default.sock";
+    ASSERT(parse_broker_args(1, const_cast<char**>(none), defaults, help, error) &&
+           defaults.listeners.size() == 2 && defaults.listeners[0].address == "0.0.0.0:9092",
+           "Default listeners");
+}
+
+TEST(test_listener_limits) {
+    asio::io_context broker_context;
+    auto broker = std::make_unique<BrokerServer>(broker_context);
+    std::string error;
+    ListenerConfig capped;
+    capped.name = "capped";
+    capped.address = "127.0.0.1:0";
+    capped.tcp_nodelay = true;
+    capped.tcp_quickack = true;
+    capped.max_connections = 1;
+    ListenerConfig slow;
+    slow.name = "slow";
+    slow.address = "127.0.0.1:0";
+    slow.receive_buffer = 256 * 1024;
+    slow.accept_rate = 5;
+    slow.accept_burst = 1;
+    ASSERT(broker->add_listener(capped, error), "Capped listener: " + error);
+    ASSERT(broker->add_listener(slow, error), "Slow listener: " + error);
+    broker->start();
+    std::thread broker_thread([&broker_context]() { broker_context.run(); });
+    auto stop_broker = [&]() {
+        broker->stop();
+        broker_context.stop();
+        broker_thread.join();
+        broker.reset();
+    };
+    
+    asio::io_context io_context;
+    try {
+        uint16_t capped_port = broker->get_port("capped");
+        uint16_t slow_port = broker->get_port("slow");
+        ASSERT(capped_port != 0 && slow_port != 0 && capped_port != slow_port, "Listener ports");
+        {
+            TestClient first(io_context, "127.0.0.1", capped_port);
+            first.send("PING\n");
+            ASSERT(first.receive_line() == "PONG", "First connection should be served");
+            TestClient second(io_context, "127.0.0.1", capped_port);
+            ASSERT(second.receive_line() == "ERROR:TOO_MANY_CONNECTIONS", "Second connection should be refused");
+            ASSERT(broker->get_refused_connections() == 1, "Refusal not counted");
+        }
+        // The slot frees up once the first session is gone
+        std::string reply;
+        for (int i = 0; i < 50 && reply != "PONG"; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            TestClient again(io_context, "127.0.0.1", capped_port);
+            again.send("PING\n");
+            reply = again.receive_line();
+        }
+        ASSERT(reply == "PONG", "Closed session should release its slot");
+        
+        // 5 accepts/s with a burst of 1: the third connection waits ~400ms
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < 3; ++i) {
+            TestClient client(io_context, "127.0.0.1", slow_port);
+            client.send("PING\n");
+            ASSERT(client.receive_line() == "PONG", "Throttled connection should be served");
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        ASSERT(elapsed >= 0.3, "Accepts were not rate limited (" + std::to_string(elapsed) + "s)");
+        ASSERT(broker->get_throttled_accepts() >= 2, "Throttled accepts not counted");
+    } catch (...) {
+        stop_broker();
+        throw;
+    }
+    stop_broker();
+}
+
+TEST(test_topic_snapshot) {
+    const std::string path = "/tmp/neuropipe_test_" + std::to_string(getpid()) + ".snapshot";
+    const std::string large(3000, 'z');
+    TopicManager before;
+    before.publish("snap.logs", "first");
+    before.publish("snap.logs", large);
+    before.publish("snap.metrics", "cpu=42");
+    std::string error;
+    snapshot::Totals saved;
+    ASSERT(before.save_snapshot(path, saved, error), "Snapshot should save: " + error);
+    ASSERT(saved.topics == 2 && saved.messages == 3, "Saved totals");
+    
+    TopicManager after;
+    snapshot::Totals loaded;
+    ASSERT(after.load_snapshot(path, loaded, error), "Snapshot should load: " + error);
+    ASSERT(loaded.topics == 2 && loaded.messages == 3, "Loaded totals");
+    Message msg("", "");
+    ASSERT(after.consume_message("snap.logs", msg) && msg.payload == "first" && msg.sequence == 0, "First message");
+    ASSERT(after.consume_message("snap.logs", msg) && msg.payload == large, "Large message");
+    ASSERT(!after.consume_message("snap.logs", msg), "Only two messages on snap.logs");
+    ASSERT(after.consume_message("snap.metrics", msg) && msg.payload == "cpu=42", "Second topic");
+    // Sequence numbers carry on where the old broker stopped
+    after.publish("snap.metrics", "cpu=7");
+    ASSERT(after.consume_message("snap.metrics", msg) && msg.sequence == 3, "Sequence continues");
+    
+    // A cut-off snapshot loads what precedes the damage and says so
+    ASSERT(truncate(path.c_str(), 40) == 0, "truncate");
+    TopicManager damaged;
+    ASSERT(!damaged.load_snapshot(path, loaded, error), "Truncated snapshot accepted");
+    std::remove(path.c_str());
+    ASSERT(!damaged.load_snapshot(path, loaded, error), "Missing snapshot accepted");
+}
+
+TEST(test_warm_restart) {
+    const std::string handoff_path = "/tmp/neuropipe_test_" + std::to_string(getpid()) + ".handoff";
+    const std::string snapshot_path = handoff_path + ".snapshot";
+    ListenerConfig tcp;
+    tcp.name = "tcp";
+    tcp.address = "127.0.0.1:0";
+    
+    asio::io_context old_context;
+    auto old_broker = std::make_unique<BrokerServer>(old_context);
+    std::string error;
+    ASSERT(old_broker->add_listener(tcp, error), "Old listener: " + error);
+    old_broker->start();
+    std::atomic<bool> handed_off{false};
+    ASSERT(old_broker->serve_handoff(handoff_path, snapshot_path, [&] { handed_off = true; }, error),
+           "Hand-off socket: " + error);
+    std::thread old_thread([&old_context]() { old_context.run(); });
+    
+    asio::io_context new_context;
+    auto new_broker = std::make_unique<BrokerServer>(new_context);
+    std::thread new_thread;
+    auto stop_brokers = [&]() {
+        old_broker->stop();
+        old_context.stop();
+        old_thread.join();
+        new_broker->stop();
+        new_context.stop();
+        if (new_thread.joinable()) {
+            new_thread.join();
+        }
+    };
+    
+    asio::io_context io_context;
+    try {
+        struct stat mode;
+        ASSERT(stat(handoff_path.c_str(), &mode) == 0 && (mode.st_mode & 0777) == 0600,
+               "Hand-off socket should be private to the broker's user");
+        
+        // A connection that never sends HANDOFF does not hold up the broker
+        // or a real successor
+        asio::local::stream_protocol::socket silent(io_context);
+        silent.connect(asio::local::stream_protocol::endpoint(handoff_path));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        
+        uint16_t port = old_broker->get_port();
+        TestClient publisher(io_context, "127.0.0.1", port);
+        for (int i = 0; i < 5; ++i) {
+            publisher.send("PUBLISH:restart.logs:line " + std::to_string(i) + "\n");
+            ASSERT(publisher.receive_line(1000) == "OK:PUBLISHED", "Publish before restart");
+        }
+        
+        snapshot::Totals totals;
+        ASSERT(new_broker->take_over(handoff_path, totals, error), "Takeover: " + error);
+        ASSERT(totals.messages == 5, "Snapshot should carry the queued messages");
+        for (int i = 0; i < 50 && !handed_off; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ASSERT(handed_off && old_broker->handed_off(), "Old broker should report the hand-off");
+        
+        // A client connecting during the hand-off waits in the shared backlog
+        TestClient early(io_context, "127.0.0.1", port);
+        early.send("PING\n");
+        ASSERT(new_broker->add_listener(tcp, error), "Inherited listener: " + error);
+        ASSERT(new_broker->get_port() == port, "Successor should accept on the same port");
+        new_broker->start();
+        new_thread = std::thread([&new_context]() { new_context.run(); });
+        ASSERT(early.receive_line() == "PONG", "Waiting client served by the successor");
+        
+        Message msg("", "");
+        ASSERT(new_broker->get_topic_manager().consume_message("restart.logs", msg) && msg.payload == "line 0",
+               "Queued messages survive the restart");
+        struct stat info;
+        ASSERT(stat(snapshot_path.c_str(), &info) != 0, "Successor removes the snapshot it loaded");
+        ASSERT(!new_broker->take_over(handoff_path, totals, error), "Hand-off socket should be gone");
+    } catch (...) {
+        stop_brokers();
+        throw;
+    }
+    stop_brokers();
+}
+
+TEST(test_federation) {
+    // Two hosts bridged to a central broker, then a ring of three
+    asio::io_context context;
+    std::vector<std::unique_ptr<BrokerServer>> brokers;
+    auto make_broker = [&]() -> BrokerServer& {
+        brokers.push_back(std::make_unique<BrokerServer>(context));
+        ListenerConfig tcp;
+        tcp.name = "tcp";
+        tcp.address = "127.0.0.1:0";
+        std::string error;
+        if (!brokers.back()->add_listener(tcp, error)) {
+            throw std::runtime_error("Listener: " + error);
+        }
+        return *brokers.back();
+    };
+    auto bridge_to = [](BrokerServer& from, BrokerServer& to, const std::string& name, const std::string& topics) {
+        BridgeConfig bridge;
+        bridge.name = name;
+        bridge.remote = "127.0.0.1:" + std::to_string(to.get_port());
+        bridge.topics = topics;
+        std::string error;
+        if (!from.add_bridge(bridge, error)) {
+            throw std::runtime_error("Bridge: " + error);
+        }
+    };
+    auto wait_for = [](auto condition) {
+        for (int i = 0; i < 300 && !condition(); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return condition();
+    };
+    auto wants = [](BrokerServer& broker, const std::string& topic) {
+        return broker.get_topic_manager().has_interest(topics::find(topic), nullptr);
+    };
+    
+    BrokerServer& central = make_broker();
+    BrokerServer& host1 = make_broker();
+    BrokerServer& host2 = make_broker();
+    bridge_to(host1, central, "central", "logs.*");
+    bridge_to(host2, central, "central", "logs.*");
+    BrokerServer& ring_a = make_broker();
+    BrokerServer& ring_b = make_broker();
+    BrokerServer& ring_c = make_broker();
+    bridge_to(ring_a, ring_b, "next", "*");
+    bridge_to(ring_b, ring_c, "next", "*");
+    bridge_to(ring_c, ring_a, "next", "*");
+    for (auto& broker : brokers) {
+        broker->start();
+    }
+    std::thread io_thread([&context]() { context.run(); });
+    auto stop_brokers = [&]() {
+        for (auto& broker : brokers) {
+            broker->stop();
+        }
+        context.stop();
+        io_thread.join();
+    };
+    
+    asio::io_context io_context;
+    try {
+        ASSERT(wait_for([&] { return central.get_federation().stats().links == 2; }), "Hosts should link up");
+        
+        // A dashboard on the central broker pulls the topic from both hosts
+        TestClient dashboard(io_context, "127.0.0.1", central.get_port());
+        dashboard.send("SUBSCRIBE:logs.app\n");
+        ASSERT(dashboard.receive_line().find("OK:SUBSCRIBED") == 0, "Dashboard subscribe");
+        ASSERT(wait_for([&] { return wants(host1, "logs.app") && wants(host2, "logs.app"); }),
+               "Interest should reach both hosts");
+        TestClient publisher(io_context, "127.0.0.1", host1.get_port());
+        publisher.send("PUBLISH:logs.app:first\n");
+        ASSERT(publisher.receive_line() == "OK:PUBLISHED", "Publish on host 1");
+        publisher.send("PUBLISH:logs.app:second\n");
+        ASSERT(publisher.receive_line() == "OK:PUBLISHED", "Publish on host 1");
+        ASSERT(dashboard.receive_line() == "MESSAGE:logs.app:first", "Bridged message");
+        ASSERT(dashboard.receive_line() == "MESSAGE:logs.app:second", "Bridged message delivered once");
+        
+        // A subscriber on host 2 gets host 1's messages through the centre
+        TestClient remote(io_context, "127.0.0.1", host2.get_port());
+        remote.send("SUBSCRIBE:logs.app\n");
+        ASSERT(remote.receive_line().find("OK:SUBSCRIBED") == 0, "Host 2 subscribe");
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));  // INTEREST reaches the centre
+        publisher.send("PUBLISH:logs.app:across\n");
+        ASSERT(publisher.receive_line() == "OK:PUBLISHED", "Publish on host 1");
+        ASSERT(remote.receive_line() == "MESSAGE:logs.app:across", "Host to host through the centre");
+        ASSERT(dashboard.receive_line() == "MESSAGE:logs.app:across", "Dashboard still served");
+        
+        // Nothing crosses a link without interest or outside the patterns
+        uint64_t forwarded = host1.get_federation().stats().forwarded;
+        dashboard.send("SUBSCRIBE:metrics.cpu\n");
+        ASSERT(dashboard.receive_line().find("OK:SUBSCRIBED") == 0, "Dashboard subscribe");
+        publisher.send("PUBLISH:logs.idle:nobody\n");
+        ASSERT(publisher.receive_line() == "OK:PUBLISHED", "Publish on host 1");
+        publisher.send("PUBLISH:metrics.cpu:42\n");
+        ASSERT(publisher.receive_line() == "OK:PUBLISHED", "Publish on host 1");
+        ASSERT(host1.get_federation().stats().forwarded == forwarded, "Unwanted topics should stay local");
+        ASSERT(!wants(host1, "metrics.cpu"), "Interest outside the patterns should not be advertised");
+        
+        // A ring never brings a message back to where it was published
+        TestClient listener(io_context, "127.0.0.1", ring_b.get_port());
+        listener.send("SUBSCRIBE:ring\n");
+        ASSERT(listener.receive_line().find("OK:SUBSCRIBED") == 0, "Ring subscribe");
+        ASSERT(wait_for([&] { return wants(ring_a, "ring") && wants(ring_c, "ring"); }), "Ring interest");
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        uint64_t published_a = ring_a.get_topic_manager().get_published_count();
+        uint64_t published_b = ring_b.get_topic_manager().get_published_count();
+        TestClient ring_publisher(io_context, "127.0.0.1", ring_a.get_port());
+        ring_publisher.send("PUBLISH:ring:once\n");
+        ASSERT(ring_publisher.receive_line() == "OK:PUBLISHED", "Publish on the ring");
+        ASSERT(listener.receive_line() == "MESSAGE:ring:once", "Ring delivery");
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        ASSERT(ring_a.get_topic_manager().get_published_count() == published_a + 1,
+               "Message should not return to its origin");
+        ASSERT(ring_b.get_topic_manager().get_published_count() <= published_b + 2,
+               "Redundant paths should stay bounded");
+    } catch (...) {
+        stop_brokers();
+        throw;
+    }
+    stop_brokers();
+}
+
+TEST(test_replication) {
+    // A leader with two followers; then a follower is promoted and the other
+    // one follows it
+    uint64_t history, offset;
+    std::string name;
+    ASSERT(replication::parse_request("REPLICATE:18446744073709551615:42:f1", history, offset, name) &&
+           history == 18446744073709551615ull && offset == 42 && name == "f1",
+           "History ids use all 64 bits");
+    ASSERT(!replication::parse_request("REPLICATE:18446744073709551616:0:f1", history, offset, name),
+           "Overflowing history accepted");
+    
+    asio::io_context context;
+    std::vector<std::unique_ptr<BrokerServer>> brokers;
+    auto make_broker = [&](const ReplicationConfig& replication) -> BrokerServer& {
+        brokers.push_back(std::make_unique<BrokerServer>(context));
+        ListenerConfig tcp;
+        tcp.name = "tcp";
+        tcp.address = "127.0.0.1:0";
+        tcp.replication = replication.acks < 2;  // Not on the broker left without followers
+        std::string error;
+        if (!brokers.back()->add_listener(tcp, error)) {
+            throw std::runtime_error("Listener: " + error);
+        }
+        brokers.back()->get_replication().configure(replication);
+        return *brokers.back();
+    };
+    auto address = [](BrokerServer& broker) { return "127.0.0.1:" + std::to_string(broker.get_port()); };
+    auto wait_for = [](auto condition) {
+        for (int i = 0; i < 300 && !condition(); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return condition();
+    };
+    using Entry = std::tuple<uint64_t, std::string, std::string>;
+    auto contents = [](BrokerServer& broker) {
+        std::vector<Entry> entries;
+        TopicManager& topics = broker.get_topic_manager();
+        uint64_t next = topics.get_next_sequence();
+        std::vector<Message> messages;
+        TopicId topic = 0;
+        uint64_t sequence = 0;
+        while (topics.copy_messages(topic, sequence, next, 64, messages)) {
+        }
+        for (const Message& msg : messages) {
+            entries.emplace_back(msg.sequence, msg.topic_name(), msg.payload.str());
+        }
+        std::sort(entries.begin(), entries.end());
+        entries.emplace_back(next, "", "");
+        return entries;
+    };
+    
+    ReplicationConfig leader_config;
+    leader_config.batch_bytes = 16;  // A message or two per frame, full copies included
+    leader_config.acks = 1;
+    leader_config.ack_timeout_ms = 2000;
+    BrokerServer& leader = make_broker(leader_config);
+    ReplicationConfig follower_config;
+    follower_config.name = "f1";
+    follower_config.leader = address(leader);
+    BrokerServer& f1 = make_broker(follower_config);
+    ReplicationConfig lagging_config;
+    lagging_config.name = "f2";
+    BrokerServer& f2 = make_broker(lagging_config);
+    ReplicationConfig strict_config;
+    strict_config.acks = 2;
+    strict_config.ack_timeout_ms = 100;
+    BrokerServer& strict = make_broker(strict_config);
+    
+    // Messages from before any follower reach them in the full copy
+    leader.publish("orders", "early-1");
+    leader.publish("audit", "early-2");
+    for (auto& broker : brokers) {
+        broker->start();
+    }
+    std::thread io_thread([&context]() { context.run(); });
+    auto stop_brokers = [&]() {
+        for (auto& broker : brokers) {
+            broker->stop();
+        }
+        context.stop();
+        io_thread.join();
+    };
+    
+    asio::io_context io_context;
+    try {
+        ASSERT(wait_for([&] { return leader.get_replication().stats().followers.size() == 1; }),
+               "Follower should attach");
+        ASSERT(wait_for([&] { return f1.get_topic_manager().get_next_sequence() == 2; }), "Full copy applied");
+        
+        // Semi-synchronous publish; the follower's subscribers get it
+        TestClient subscriber(io_context, "127.0.0.1", f1.get_port());
+        subscriber.send("SUBSCRIBE:orders\n");
+        ASSERT(subscriber.receive_line().find("OK:SUBSCRIBED") == 0, "Subscribe on the follower");
+        TestClient publisher(io_context, "127.0.0.1", leader.get_port());
+        for (int i = 0; i < 5; ++i) {
+            publisher.send("PUBLISH:orders:order-" + std::to_string(i) + "\n");
+        }
+        for (int i = 0; i < 5; ++i) {
+            ASSERT(publisher.receive_line() == "OK:PUBLISHED", "Publish acknowledged by the follower");
+            ASSERT(subscriber.receive_line() == "MESSAGE:orders:order-" + std::to_string(i), "Replicated message");
+        }
+        ASSERT(f1.get_replication().stats().applied >= 5, "Follower applied count");
+        
+        TestClient refused(io_context, "127.0.0.1", f1.get_port());
+        refused.send("PUBLISH:orders:sideways\n");
+        ASSERT(refused.receive_line() == "ERROR:FOLLOWER", "Followers refuse publishes");
+        refused.send("REPLICATION:STATUS\n");
+        ASSERT(refused.receive_line().find("OK:REPLICATION:{\"role\":\"follower\"") == 0, "Status command");
+        
+        // A late follower gets a full copy and ends up identical
+        std::string error;
+        ASSERT(f2.get_replication().follow(address(leader), error), "Follow: " + error);
+        ASSERT(wait_for([&] { return contents(f2) == contents(leader); }), "Full copy should match the leader");
+        ASSERT(contents(f1) == contents(leader), "Streamed follower should match the leader");
+        
+        // Not enough followers: the publish is kept but not acknowledged
+        TestClient strict_publisher(io_context, "127.0.0.1", strict.get_port());
+        strict_publisher.send("PUBLISH:orders:alone\n");
+        ASSERT(strict_publisher.receive_line() == "ERROR:NOT_REPLICATED", "Acks should time out");
+        ASSERT(strict.get_replication().stats().acks_timed_out == 1, "Timed out ack counted");
+        strict_publisher.send("REPLICATE:0:0:intruder\n");
+        ASSERT(strict_publisher.receive_line() == "ERROR:REPLICATION_NOT_ALLOWED",
+               "Listeners without replication = true refuse followers");
+        
+        // Failover: f1 takes over and f2 resumes from it without a copy
+        uint64_t copies = f1.get_replication().stats().full_copies;
+        TestClient admin(io_context, "127.0.0.1", f1.get_port());
+        admin.send("REPLICATION:PROMOTE\n");
+        ASSERT(admin.receive_line() == "ERROR:PERMISSION_DENIED", "Promotion is for local peers only");
+        admin.send("REPLICATION:FOLLOW:127.0.0.1:1\n");
+        ASSERT(admin.receive_line() == "ERROR:PERMISSION_DENIED", "Following is for local peers only");
+        ASSERT(f1.get_replication().promote(error), "Promote: " + error);
+        ASSERT(f2.get_replication().follow(address(f1), error), "Follow: " + error);
+        ASSERT(wait_for([&] { return f1.get_replication().stats().followers.size() == 1; }),
+               "Follower should attach to the promoted broker");
+        ASSERT(f1.get_replication().stats().full_copies == copies, "Follower should resume, not copy");
+        TestClient new_publisher(io_context, "127.0.0.1", f1.get_port());
+        new_publisher.send("PUBLISH:orders:after-failover\n");
+        ASSERT(new_publisher.receive_line() == "OK:PUBLISHED", "Publish on the promoted broker");
+        ASSERT(subscriber.receive_line() == "MESSAGE:orders:after-failover", "Local delivery after promotion");
+        ASSERT(wait_for([&] { return contents(f2) == contents(f1); }), "Follower should track the new leader");
+    } catch (...) {
+        stop_brokers();
+        throw;
+    }
+    stop_brokers();
+}
+
+TEST(test_replication_processes) {
+#ifndef NEUROPIPE_BROKER_PATH
+    std::cout << "  (skipped: built without the broker binary's path)" << std::endl;
+#else
+    // Three broker processes: a leader and two followers. The leader is
+    // killed, one follower is promoted and the other follows it.
+    struct Process {
+        pid_t pid = -1;
+        ~Process() { stop(SIGTERM); }
+        void stop(int signal) {
+            if (pid > 0) {
+                ::kill(pid, signal);
+                ::waitpid(pid, nullptr, 0);
+                pid = -1;
+            }
+        }
+    };
+    auto spawn = [](Process& process, std::vector<std::string> args) {
+        args.insert(args.begin(), NEUROPIPE_BROKER_PATH);
+        process.pid = ::fork();
+        ASSERT(process.pid >= 0, "fork failed");
+        if (process.pid == 0) {
+            int null = ::open("/dev/null", O_WRONLY);
+            ::dup2(null, STDOUT_FILENO);
+            ::dup2(null, STDERR_FILENO);
+            std::vector<char*> argv;
+            for (auto& arg : args) {
+                argv.push_back(arg.data());
+            }
+            argv.push_back(nullptr);
+            ::execv(argv[0], argv.data());
+            ::_exit(127);
+        }
+    };
+    auto free_port = []() -> uint16_t {
+        asio::io_context io;
+        asio::ip::tcp::acceptor probe(io, asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+        return probe.local_endpoint().port();
+    };
+    // One request over a broker's Unix admin socket
+    auto admin = [](const std::string& path, const std::string& line) {
+        asio::io_context io;
+        asio::local::stream_protocol::socket socket(io);
+        socket.connect(asio::local::stream_protocol::endpoint(path));
+        asio::write(socket, asio::buffer(line + "\n"));
+        pollfd ready{socket.native_handle(), POLLIN, 0};
+        if (::poll(&ready, 1, 5000) <= 0) {
+            throw std::runtime_error("No reply to " + line);
+        }
+        asio::streambuf buffer;
+        asio::read_until(socket, buffer, '\n');
+        std::istream is(&buffer);
+        std::string reply;
+        std::getline(is, reply);
+        return reply;
+    };
+    auto status_field = [&](const std::string& path, const std::string& field) {
+        std::string status = admin(path, "REPLICATION:STATUS");
+        size_t at = status.find("\"" + field + "\":");
+        return at == std::string::npos ? std::string() : status.substr(at + field.size() + 3,
+                                                                       status.find_first_of(",}", at) - at - field.size() - 3);
+    };
+    auto wait_for = [](auto condition) {
+        for (int i = 0; i < 500; ++i) {
+            try {
+                if (condition()) {
+                    return true;
+                }
+            } catch (const std::exception&) {
+                // Not up yet
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    };
+    
+    std::string base = "/tmp/neuropipe_rep_" + std::to_string(getpid());
+    std::string leader_admin = base + "_leader.sock";
+    std::string f1_admin = base + "_f1.sock";
+    std::string f2_admin = base + "_f2.sock";
+    uint16_t leader_port = free_port();
+    uint16_t f1_port = free_port();
+    uint16_t f2_port = free_port();
+    std::string leader_address = "127.0.0.1:" + std::to_string(leader_port);
+    std::string f1_address = "127.0.0.1:" + std::to_string(f1_port);
+    Process leader, f1, f2;
+    spawn(leader, {"--listen", "tcp=" + leader_address, "--set", "tcp.replication=true",
+                   "--listen", "admin=unix:" + leader_admin, "--acks", "1",
+                   "--set", "replication.ack_timeout_ms=500"});
+    spawn(f1, {"--listen", "tcp=" + f1_address, "--set", "tcp.replication=true",
+               "--listen", "admin=unix:" + f1_admin, "--follow", leader_address, "--set", "replication.name=f1"});
+    spawn(f2, {"--listen", "tcp=127.0.0.1:" + std::to_string(f2_port),
+               "--listen", "admin=unix:" + f2_admin, "--follow", leader_address, "--set", "replication.name=f2"});
+    
+    asio::io_context io_context;
+    std::unique_ptr<TestClient> publisher;
+    std::unique_ptr<TestClient> subscriber;
+    ASSERT(wait_for([&] {
+        publisher = std::make_unique<TestClient>(io_context, "127.0.0.1", leader_port);
+        subscriber = std::make_unique<TestClient>(io_context, "127.0.0.1", f2_port);
+        return true;
+    }), "Brokers should start");
+    subscriber->send("SUBSCRIBE:jobs\n");
+    ASSERT(subscriber->receive_line().find("OK:SUBSCRIBED") == 0, "Subscribe on a follower");
+    
+    ASSERT(wait_for([&] {
+        return status_field(f1_admin, "connected") == "true" && status_field(f2_admin, "connected") == "true";
+    }), "Followers should connect");
+    
+    // Acknowledged once a follower has it
+    publisher->send("PUBLISH:jobs:first\n");
+    ASSERT(publisher->receive_line() == "OK:PUBLISHED", "A follower should acknowledge the publish");
+    ASSERT(subscriber->receive_line() == "MESSAGE:jobs:first", "Replicated to the other follower");
+    std::string offset = status_field(leader_admin, "offset");
+    ASSERT(wait_for([&] {
+        return status_field(f1_admin, "offset") == offset && status_field(f2_admin, "offset") == offset;
+    }), "Followers should catch up");
+    
+    // Failover
+    leader.stop(SIGKILL);
+    ASSERT(admin(f1_admin, "REPLICATION:PROMOTE").find("OK:PROMOTED:" + offset) == 0, "Promote f1");
+    ASSERT(admin(f2_admin, "REPLICATION:FOLLOW:" + f1_address) == "OK:FOLLOWING", "Point f2 at f1");
+    TestClient new_publisher(io_context, "127.0.0.1", f1_port);
+    new_publisher.send("PUBLISH:jobs:second\n");
+    ASSERT(new_publisher.receive_line() == "OK:PUBLISHED", "Publish on the promoted broker");
+    ASSERT(subscriber->receive_line() == "MESSAGE:jobs:second", "Replicated from the new leader");
+    ASSERT(status_field(f1_admin, "full_copies") == "0", "f2 should resume from its offset");
+    ASSERT(status_field(f2_admin, "leader") == "\"" + f1_address + "\"", "f2 follows f1");
+#endif
+}
+
+TEST(test_idle_sessions) {
+    // The wheel fires every entry at its own tick, across level boundaries
+    TimerWheel<int> wheel;
+    std::vector<uint64_t> due = {1, 255, 256, 257, 300, 65535, 65536, 70000, (1u << 24) + 5};
+    for (size_t i = 0; i < due.size(); ++i) {
+        wheel.schedule(due[i], static_cast<int>(i));
+    }
+    std::vector<uint64_t> fired(due.size(), 0);
+    for (uint64_t tick = 0; tick <= (1u << 24) + 10; tick += 7) {
+        wheel.advance(tick, [&](int index) { fired[index] = wheel.now(); });
+    }
+    for (size_t i = 0; i < due.size(); ++i) {
+        ASSERT(fired[i] == due[i], "Wheel entry " + std::to_string(i) + " fired at " + std::to_string(fired[i]));
+    }
+    ASSERT(wheel.size() == 0, "Wheel should be empty");
+    uint64_t overdue = wheel.now();
+    wheel.schedule(overdue - 5, 0);
+    uint64_t fired_at = 0;
+    wheel.advance(overdue + 1000, [&](int) { fired_at = wheel.now(); });
+    ASSERT(fired_at == overdue + 1, "Overdue entry should fire on the next tick");
+    
+    asio::io_context broker_context;
+    auto broker = std::make_unique<BrokerServer>(broker_context);
+    std::string error;
+    ListenerConfig idle;
+    idle.name = "idle";
+    idle.address = "127.0.0.1:0";
+    idle.idle_timeout_ms = 300;
+    ListenerConfig beat;
+    beat.name = "beat";
+    beat.address = "127.0.0.1:0";
+    beat.heartbeat_ms = 100;
+    ASSERT(broker->add_listener(idle, error), "Idle listener: " + error);
+    ASSERT(broker->add_listener(beat, error), "Heartbeat listener: " + error);
+    broker->start();
+    std::thread broker_thread([&broker_context]() { broker_context.run(); });
+    auto stop_broker = [&]() {
+        broker->stop();
+        broker_context.stop();
+        broker_thread.join();
+        broker.reset();
+    };
+    
+    asio::io_context io_context;
+    try {
+        uint16_t idle_port = broker->get_port("idle");
+        uint16_t beat_port = broker->get_port("beat");
+        
+        // A silent subscriber is dropped with its subscription and the
+        // messages queued for it; a chatty one stays
+        TestClient silent(io_context, "127.0.0.1", idle_port);
+        int small = 4096;
+        ::setsockopt(silent.socket().native_handle(), SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+        silent.send("SUBSCRIBE:idle_test\n");
+        ASSERT(silent.receive_line() == "OK:SUBSCRIBED:idle_test", "Subscribe");
+        TestClient chatty(io_context, "127.0.0.1", idle_port);
+        std::string payload(1024, 'x');
+        for (int i = 0; i < 2000; ++i) {
+            broker->publish("idle_test", payload);
+        }
+        auto begin = std::chrono::steady_clock::now();
+        while (broker->get_idle_closed() == 0 &&
+               std::chrono::steady_clock::now() - begin < std::chrono::seconds(3)) {
+            chatty.send("PING\n");
+            ASSERT(chatty.receive_line() == "PONG", "Chatty session should be served");
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+        ASSERT(broker->get_idle_closed() == 1, "Silent session not closed");
+        ASSERT(waited.count() >= 200, "Closed too early (" + std::to_string(waited.count()) + " ms)");
+        ASSERT(broker->get_topic_manager().get_subscriber_count("idle_test") == 0, "Subscription should be gone");
+        ASSERT(broker->get_active_sessions() == 1, "Only the chatty session should remain");
+        chatty.send("PING\n");
+        ASSERT(chatty.receive_line() == "PONG", "Chatty session should survive");
+        chatty.send("HEARTBEAT:ON\n");
+        ASSERT(chatty.receive_line() == "OK:HEARTBEAT:100", "Heartbeat interval from idle_timeout_ms");
+        chatty.close();
+        
+        // Heartbeat listener: answered probes keep a quiet session alive,
+        // unanswered ones end it after three intervals
+        TestClient answering(io_context, "127.0.0.1", beat_port);
+        TestClient mute(io_context, "127.0.0.1", beat_port);
+        answering.send("HEARTBEAT:OFF\n");
+        ASSERT(answering.receive_line() == "ERROR:HEARTBEAT_REQUIRED", "Listener heartbeats cannot be turned off");
+        bool mute_closed = false;
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(1500);
+        while (std::chrono::steady_clock::now() < until) {
+            try {
+                if (answering.receive_line(20) == "HEARTBEAT") {
+                    answering.send("HEARTBEAT:ACK\n");
+                }
+            } catch (const std::system_error&) {
+                ASSERT(false, "Answering session should stay");
+            } catch (const std::runtime_error&) {
+                // Nothing yet
+            }
+            try {
+                if (!mute_closed) {
+                    mute.receive_line(20);
+                }
+            } catch (const std::system_error&) {
+                mute_closed = true;  // EOF or reset
+            } catch (const std::runtime_error&) {
+            }
+        }
+        ASSERT(mute_closed, "Mute session should be closed");
+        ASSERT(broker->get_idle_closed() == 2, "Mute session not counted");
+        ASSERT(broker->get_heartbeats_sent() >= 3, "Heartbeats not counted");
+        answering.send("HEARTBEAT\n");
+        ASSERT(answering.receive_line() == "HEARTBEAT:ACK", "Broker answers probes");
+    } catch (...) {
+        stop_broker();
+        throw;
+    }
+    stop_broker();
+}
+
+TEST(test_priority_lanes) {
+    // Strict: always the highest non-empty lane
+    LaneSchedule strict;
+    strict.strict = true;
+    PriorityLanes<int> lanes(strict);
+    lanes.push(Priority::Low, 1);
+    lanes.push(Priority::Normal, 2);
+    lanes.push(Priority::High, 3);
+    std::vector<int> order;
+    while (!lanes.empty()) {
+        size_t lane = lanes.pick();
+        order.push_back(lanes.lane(lane).front());
+        lanes.pop(lane, 1);
+    }
+    ASSERT((order == std::vector<int>{3, 2, 1}), "Strict lanes drain highest first");
+    
+    // Weighted 2/1/1: turns go High, High, Normal, Low while all have work
+    LaneSchedule weighted;
+    weighted.weights = {2, 1, 1};
+    PriorityLanes<char> shared(weighted);
+    for (int i = 0; i < 4; ++i) {
+        shared.push(Priority::High, 'h');
+        shared.push(Priority::Normal, 'n');
+        shared.push(Priority::Low, 'l');
+    }
+    std::string picked;
+    while (!shared.empty()) {
+        size_t lane = shared.pick();
+        picked += shared.lane(lane).front();
+        shared.pop(lane, 1);
+    }
+    ASSERT(picked == "hhnlhhnlnlnl", "Weighted turns: " + picked);
+    
+    const std::string path = "/tmp/neuropipe_priorities_" + std::to_string(getpid()) + ".conf";
+    {
+        std::ofstream file(path);
+        file << "[priorities]\n"
+             << "high = alerts.*, heartbeat\n"
+             << "low = logs.*\n"
+             << "weights = 8, 2, 1\n";
+    }
+    const char* args[] = {"broker", "--config", path.c_str(), "--set", "priorities.scheduling=strict"};
+    BrokerConfig config;
+    bool help = false;
+    std::string error;
+    bool parsed = parse_broker_args(5, const_cast<char**>(args), config, help, error);
+    std::remove(path.c_str());
+    ASSERT(parsed, "Priorities should parse: " + error);
+    ASSERT(config.priorities.high == "alerts.*, heartbeat" && config.priorities.low == "logs.*" &&
+           config.priorities.strict && (config.priorities.weights == std::array<uint32_t, 3>{8, 2, 1}),
+           "Priority settings");
+    PriorityConfig priorities;
+    ASSERT(!priorities.set("weights", "8,2", error), "Two weights accepted");
+    ASSERT(!priorities.set("weights", "8,2,1,1", error), "Four weights accepted");
+    ASSERT(!priorities.set("weights", "8,0,1", error), "Zero weight accepted");
+    ASSERT(!priorities.set("scheduling", "fifo", error), "Unknown scheduling accepted");
+    
+    // A reader behind a backlog of bulk messages gets an urgent one long
+    // before the backlog ends; each lane keeps its own order
+    asio::io_context broker_context;
+    auto broker = std::make_unique<BrokerServer>(broker_context);
+    PriorityConfig classes;
+    classes.high = "urgent";
+    classes.low = "bulk";
+    broker->set_priorities(classes);
+    ListenerConfig listener;
+    listener.name = "lanes";
+    listener.address = "127.0.0.1:0";
+    listener.send_buffer = 16384;
+    ASSERT(broker->add_listener(listener, error), "Listener: " + error);
+    broker->start();
+    std::thread broker_thread([&broker_context]() { broker_context.run(); });
+    auto stop_broker = [&]() {
+        broker->stop();
+        broker_context.stop();
+        broker_thread.join();
+        broker.reset();
+    };
+    
+    asio::io_context io_context;
+    try {
+        TestClient reader(io_context, "127.0.0.1", broker->get_port("lanes"));
+        int small = 4096;
+        ::setsockopt(reader.socket().native_handle(), SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+        reader.send("SUBSCRIBE:bulk\n");
+        ASSERT(reader.receive_line() == "OK:SUBSCRIBED:bulk", "Subscribe bulk");
+        reader.send("SUBSCRIBE:urgent\n");
+        ASSERT(reader.receive_line() == "OK:SUBSCRIBED:urgent", "Subscribe urgent");
+        
+        const int backlog = 5000;
+        std::string filler(1024, 'b');
+        for (int i = 0; i < backlog; ++i) {
+            broker->publish("bulk", std::to_string(i) + ":" + filler);
+        }
+        broker->publish("urgent", "now");
+        
+        int urgent_at = -1;
+        int next_bulk = 0;
+        for (int i = 0; i <= backlog; ++i) {
+            std::string line = reader.receive_line();
+            if (line == "MESSAGE:urgent:now") {
+                urgent_at = i;
+                continue;
+            }
+            ASSERT(line.compare(0, 13, "MESSAGE:bulk:") == 0, "Unexpected line: " + line.substr(0, 40));
+            ASSERT(std::stoi(line.substr(13)) == next_bulk, "Bulk out of order at " + std::to_string(i));
+            ++next_bulk;
+        }
+        ASSERT(next_bulk == backlog, "Every bulk message delivered");
+        ASSERT(urgent_at >= 0 && urgent_at < 1000,
+               "Urgent message waited behind " + std::to_string(urgent_at) + " bulk messages");
+    } catch (...) {
+        stop_broker();
+        throw;
+    }
+    stop_broker();
+}
+
 int main() {
     std::cout << "=========================================" << std::endl;
     std::cout << "=== NeuroPipe Asio Broker Test Suite ===" << std::endl;
@@ -322,9 +2212,34 @@ int main() {
         run_test_publish_and_receive();
         run_test_multiple_subscribers();
         run_test_unsubscribe();
+        run_test_credit_subscription();
         run_test_multiple_topics();
         run_test_invalid_command();
         run_test_session_disconnect();
+        run_test_latency_trace_delivery();
+        run_test_span_tracing_dump();
+        run_test_alloc_accounting();
+        run_test_heavy_hitter_sketch();
+        run_test_top_command();
+        run_test_traffic_capture();
+        run_test_lz_codec();
+        run_test_compressed_batches();
+        run_test_unix_socket_transport();
+        run_test_shm_ring();
+        run_test_shared_memory_producer();
+        run_test_topic_tail_ring();
+        run_test_topic_tail_command();
+        run_test_io_uring_engine();
+        run_test_session_pool();
+        run_test_broker_config();
+        run_test_listener_limits();
+        run_test_topic_snapshot();
+        run_test_warm_restart();
+        run_test_federation();
+        run_test_replication();
+        run_test_replication_processes();
+        run_test_idle_sessions();
+        run_test_priority_lanes();
         
         std::cout << "\n[TEARDOWN] Stopping test broker..." << std::endl;
         teardown_broker();
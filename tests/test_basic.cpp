@@ -1,15 +1,21 @@
 #include "../include/message.hpp"
+#include "../include/slab_alloc.hpp"
+#include "../include/latency_trace.hpp"
 #include "../src/utils.hpp"
+#include "../src/latency_histogram.hpp"
 #include <cassert>
 #include <iostream>
 #include <thread>
 #include <functional>
+#include <algorithm>
+#include <vector>
 
 void test_message_creation() {
     std::cout << "Testing Message creation..." << std::endl;
     
     Message msg("orders", "hello");
-    assert(msg.topic == "orders");
+    assert(msg.topic_name() == "orders");
+    assert(msg.topic == topics::find("orders"));
     assert(msg.payload == "hello");
     assert(msg.sequence == 0);
     
@@ -96,6 +102,122 @@ void test_logging() {
     std::cout << "✓ Logging test passed" << std::endl;
 }
 
+void test_latency_histogram() {
+    std::cout << "Testing LatencyHistogram..." << std::endl;
+    
+    LatencyHistogram hist;
+    for (uint64_t v = 1; v <= 10000; ++v) {
+        hist.record(v * 1000);
+    }
+    assert(hist.count() == 10000);
+    assert(hist.max() == 10000000);
+    
+    // Log-linear buckets keep percentiles within ~6%
+    [[maybe_unused]] uint64_t p50 = hist.percentile(50);
+    [[maybe_unused]] uint64_t p99 = hist.percentile(99);
+    assert(p50 > 4700000 && p50 < 5300000);
+    assert(p99 > 9300000 && p99 <= 10000000);
+    assert(hist.percentile(100) == hist.max());
+    
+    std::cout << "✓ LatencyHistogram test passed" << std::endl;
+}
+
+void test_latency_stamps() {
+    std::cout << "Testing latency trace stamps..." << std::endl;
+    
+    latency_trace::Stamps stamps;
+    stamps.ns[latency_trace::HOP_SEND] = 0x1234abcd;
+    stamps.ns[latency_trace::HOP_INGRESS] = 0x1234abce;
+    std::string line = latency_trace::format_message(stamps, "debug", "x:y");
+    latency_trace::stamp_message(line, latency_trace::HOP_WRITE, 42);
+    line.pop_back();  // newline
+    
+    latency_trace::Stamps parsed;
+    std::string_view topic, payload;
+    assert(latency_trace::parse_message(line, parsed, topic, payload));
+    assert(parsed.ns[latency_trace::HOP_SEND] == 0x1234abcd);
+    assert(parsed.ns[latency_trace::HOP_INGRESS] == 0x1234abce);
+    assert(parsed.ns[latency_trace::HOP_ENQUEUE] == 0);
+    assert(parsed.ns[latency_trace::HOP_WRITE] == 42);
+    assert(topic == "debug" && payload == "x:y");
+    
+    std::cout << "✓ Latency stamp test passed" << std::endl;
+}
+
+void test_topic_table() {
+    std::cout << "Testing topic interning..." << std::endl;
+    
+    TopicTable table;
+    assert(table.find("orders") == TopicTable::NONE);
+    [[maybe_unused]] TopicId orders = table.intern("orders");
+    assert(orders == 0);
+    assert(table.intern(std::string("orders")) == orders);
+    assert(table.find(std::string_view("orders:x").substr(0, 6)) == orders);
+    
+    // Enough names to grow the table several times; ids stay dense and stable
+    for (int i = 0; i < 1000; ++i) {
+        assert(table.intern("topic_" + std::to_string(i)) == static_cast<TopicId>(i + 1));
+    }
+    assert(table.size() == 1001);
+    assert(table.find("orders") == orders && table.name(orders) == "orders");
+    for (int i = 0; i < 1000; ++i) {
+        [[maybe_unused]] TopicId id = table.find("topic_" + std::to_string(i));
+        assert(id == static_cast<TopicId>(i + 1) && table.name(id) == "topic_" + std::to_string(i));
+    }
+    assert(table.find("topic_1000") == TopicTable::NONE);
+    
+    std::cout << "✓ Topic table test passed" << std::endl;
+}
+
+void test_slab_allocator() {
+    std::cout << "Testing slab allocator..." << std::endl;
+    
+    Payload metric("cpu=0.93");
+    assert(metric.is_inline() && metric == "cpu=0.93");
+    std::string line(200, 'x');
+    Payload body(line);
+    assert(!body.is_inline() && body == line);
+    Payload copy(body);
+    assert(copy == line && copy.data() != body.data());
+    Payload moved(std::move(copy));
+    assert(moved == line && copy.empty());
+    moved = metric;
+    assert(moved == "cpu=0.93");
+    
+    // A freed block is the next one of its class
+    size_t capacity = 0;
+    void* first = slab::allocate(150, capacity);
+    assert(capacity == 160);
+    slab::deallocate(first, capacity);
+    assert(slab::allocate(145, capacity) == first);
+    slab::deallocate(first, capacity);
+    
+    // Blocks freed on another thread go back to the owner in batches
+    [[maybe_unused]] slab::Stats before = slab::stats();
+    std::vector<void*> blocks;
+    for (int i = 0; i < 100; ++i) {
+        blocks.push_back(slab::allocate(300, capacity));
+    }
+    std::thread([&] {
+        for (void* block : blocks) {
+            slab::deallocate(block, capacity);
+        }
+    }).join();
+    [[maybe_unused]] slab::Stats after = slab::stats();
+    assert(after.remote_frees - before.remote_frees == 100);
+    assert(after.remote_batches - before.remote_batches == 4);  // 3 full, 1 at thread exit
+    std::sort(blocks.begin(), blocks.end());
+    for (int i = 0; i < 100; ++i) {
+        [[maybe_unused]] void* block = slab::allocate(300, capacity);
+        assert(std::binary_search(blocks.begin(), blocks.end(), block));
+    }
+    for (void* block : blocks) {
+        slab::deallocate(block, capacity);
+    }
+    
+    std::cout << "✓ Slab allocator test passed" << std::endl;
+}
+
 int main() {
     std::cout << "\n=== Running NeuroPipe Basic Tests ===" << std::endl;
     std::cout << std::endl;
@@ -105,6 +227,10 @@ int main() {
         test_thread_safe_queue();
         test_thread_safe_queue_threading();
         test_logging();
+        test_latency_histogram();
+        test_latency_stamps();
+        test_topic_table();
+        test_slab_allocator();
         
         std::cout << std::endl;
         std::cout << "=== All tests passed! ===" << std::endl;